@@ -0,0 +1,110 @@
+#include "arena.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+
+
+typedef
+struct {
+    uint8_t *base;
+    size_t  size;
+} arena_t;
+
+
+
+static __thread arena_t thread_arena = { .base = NULL, .size = 0 };
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+
+
+static void
+unmap_arena(arena_t *arena)
+{
+    if (NULL != arena->base) {
+        munmap(arena->base, arena->size);
+    }
+
+    arena->base = NULL;
+    arena->size = 0;
+}
+
+
+/* Thread-exit destructor; the key's value is only used as a "this thread has an arena" marker. */
+static void
+arena_destructor(void *value)
+{
+    (void)value;
+    unmap_arena(&thread_arena);
+}
+
+
+static void
+create_arena_key(void)
+{
+    pthread_key_create(&arena_key, arena_destructor);
+}
+
+
+static uint8_t *
+map_huge(size_t size)
+{
+    void *mapping = MAP_FAILED;
+    uint8_t *aligned = NULL;
+    uintptr_t slop = 0;
+
+#ifdef MAP_HUGETLB
+    /* Explicit huge pages only work if the administrator reserved some, so this often fails. */
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (MAP_FAILED != mapping) return (uint8_t *)mapping;
+#endif
+
+    /* Transparent huge pages need a 2 MiB-aligned range, so over-map and trim the ends. */
+    mapping = mmap(NULL, size + VBA_ARENA_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == mapping) return NULL;
+
+    aligned = (uint8_t *)(((uintptr_t)mapping + VBA_ARENA_HUGE_PAGE_SIZE - 1) & ~((uintptr_t)VBA_ARENA_HUGE_PAGE_SIZE - 1));
+    slop = (uintptr_t)aligned - (uintptr_t)mapping;
+
+    if (slop > 0) munmap(mapping, slop);
+    munmap(aligned + size, VBA_ARENA_HUGE_PAGE_SIZE - slop);
+
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+    return aligned;
+}
+
+
+
+void *
+arena__acquire(size_t bytes)
+{
+    size_t size = 0;
+
+    if (0 == bytes) return NULL;
+    if (bytes <= thread_arena.size) return thread_arena.base;
+
+    pthread_once(&arena_key_once, create_arena_key);
+    pthread_setspecific(arena_key, (void *)&thread_arena);
+
+    unmap_arena(&thread_arena);
+
+    size = (bytes + VBA_ARENA_HUGE_PAGE_SIZE - 1) & ~((size_t)VBA_ARENA_HUGE_PAGE_SIZE - 1);
+
+    thread_arena.base = map_huge(size);
+    if (NULL == thread_arena.base) return NULL;
+
+    thread_arena.size = size;
+    return thread_arena.base;
+}
+
+
+void
+arena__release(void)
+{
+    unmap_arena(&thread_arena);
+}
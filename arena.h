@@ -0,0 +1,34 @@
+#ifndef LIB_VBA_ARENA_H
+#define LIB_VBA_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+#define VBA_ARENA_HUGE_PAGE_SIZE    (2 * 1024 * 1024)
+
+
+
+/**
+ * Get at least `bytes` of scratch memory from the calling thread's arena.
+ *
+ * The arena is a single mapping backed by huge pages where the system allows it (MAP_HUGETLB
+ *   first, then transparent huge pages). It is only ever grown, never shrunk, so repeated KDF
+ *   runs with the same parameters reuse the same already-faulted pages. Memory from a previous
+ *   call is invalidated by the next call on the same thread.
+ */
+void *
+arena__acquire(
+    size_t          bytes
+);
+
+/**
+ * Unmap the calling thread's arena now rather than at thread exit.
+ */
+void
+arena__release(void);
+
+
+
+#endif   /* LIB_VBA_ARENA_H */
@@ -0,0 +1,254 @@
+#include "argon2_lanes.h"
+
+#include "vba.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LANES_CPU_RELAX()   _mm_pause()
+#else
+#define LANES_CPU_RELAX()   sched_yield()
+#endif
+
+
+
+/*
+ * How long a thread spins before it sleeps in the kernel. A slice of a small, cheap Argon2 run
+ *   takes microseconds, so sleeping at every barrier would cost more than the work between them.
+ */
+#define LANES_SPIN_LIMIT    (1 << 14)
+
+/**
+ * A sense-reversing barrier: the last thread to arrive resets `arrived` and moves `phase` on,
+ *   which releases everyone spinning (or sleeping) on the phase they arrived in.
+ */
+typedef
+struct {
+    uint32_t    arrived;
+    uint32_t    phase;      /* Futex word. */
+    uint32_t    sleepers;
+} __attribute__((aligned(64))) lanes_barrier_t;
+
+/*
+ * The crew. Everything here but the futex words is only changed by whoever holds `is_busy`, which
+ *   is the caller being served (or `argon2_lanes__set_helpers`); helpers only read it once a new
+ *   `generation` is posted.
+ */
+static uint32_t is_busy = 0;
+static bool is_started = false;
+static bool is_stopping = false;
+static size_t wanted_helpers = SIZE_MAX;   /* SIZE_MAX until set: one fewer than the core count. */
+static size_t helper_count = 0;
+static pthread_t helpers[ARGON2_LANES_MAX_HELPERS];
+
+static argon2d_state_t job;
+static uint32_t participants = 0;
+static uint32_t start_generation = 0;
+static size_t picked_up = 0;   /* Helpers which have read the posted job; it is not reused before. */
+
+static uint32_t generation __attribute__((aligned(64))) = 0;   /* Futex word; moves on per job. */
+static uint32_t idle_sleepers = 0;
+
+static lanes_barrier_t barrier;
+
+
+
+static void
+futex_wait(uint32_t *word,
+           uint32_t expected)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+
+static void
+futex_wake(uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+
+/*
+ * Wait until `*word` is no longer `seen`. The sleeper count and the word are both touched with
+ *   sequentially consistent operations, so either the waiter sees the new value or the thread
+ *   which changed it sees the sleeper and wakes it.
+ */
+static void
+wait_for_change(uint32_t *word,
+                uint32_t *sleepers,
+                uint32_t seen)
+{
+    for (int spin = 0; spin < LANES_SPIN_LIMIT; ++spin) {
+        if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != seen) return;
+        LANES_CPU_RELAX();
+    }
+
+    __atomic_add_fetch(sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(word, __ATOMIC_SEQ_CST) == seen) futex_wait(word, seen);
+    __atomic_sub_fetch(sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+
+static void
+barrier_wait(uint32_t count)
+{
+    uint32_t phase = __atomic_load_n(&(barrier.phase), __ATOMIC_ACQUIRE);
+
+    if (__atomic_add_fetch(&(barrier.arrived), 1, __ATOMIC_ACQ_REL) == count) {
+        /* Nobody can arrive for the next phase before this one moves on. */
+        __atomic_store_n(&(barrier.arrived), 0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&(barrier.phase), 1, __ATOMIC_SEQ_CST);
+        if (0 != __atomic_load_n(&(barrier.sleepers), __ATOMIC_SEQ_CST)) futex_wake(&(barrier.phase));
+        return;
+    }
+
+    wait_for_change(&(barrier.phase), &(barrier.sleepers), phase);
+}
+
+
+/* Lanes `first_lane`, `first_lane + stride`, ... of every remaining slice, one barrier per slice. */
+static void
+fill_lanes(argon2d_state_t *state,
+           uint32_t first_lane,
+           uint32_t stride)
+{
+    do {
+        for (uint32_t lane = first_lane; lane < state->lanes; lane += stride) {
+            argon2d__fill_lane_segment(state, lane);
+        }
+        barrier_wait(stride);
+    } while (0 == argon2d__next_slice(state));
+}
+
+
+static void *
+helper_main(void *argument)
+{
+    uint32_t index = (uint32_t)(uintptr_t)argument;   /* The caller is participant 0. */
+    uint32_t seen = start_generation;
+    uint32_t count = 0;
+    argon2d_state_t state;
+
+    while (true) {
+        wait_for_change(&generation, &idle_sleepers, seen);
+        seen = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+
+        if (true == is_stopping) break;
+
+        /* Each participant steps through the slices on its own copy of the position. */
+        count = participants;
+        if (index < count) state = job;
+        __atomic_add_fetch(&picked_up, 1, __ATOMIC_RELEASE);
+
+        if (index < count) fill_lanes(&state, index, count);   /* Else fewer lanes than helpers. */
+    }
+
+    return NULL;
+}
+
+
+/* These are only called while holding `is_busy`. */
+static void
+wait_for_pickup(void)
+{
+    /* Helpers left out of the last job may not have looked at it yet. */
+    while (__atomic_load_n(&picked_up, __ATOMIC_ACQUIRE) < helper_count) sched_yield();
+    __atomic_store_n(&picked_up, 0, __ATOMIC_RELAXED);
+}
+
+
+static void
+start_crew(void)
+{
+    long online_cores = 0;
+    size_t count = wanted_helpers;
+
+    if (SIZE_MAX == count) {
+        online_cores = sysconf(_SC_NPROCESSORS_ONLN);
+        count = (online_cores > 1) ? (size_t)(online_cores - 1) : 0;
+    }
+    count = MIN(count, (size_t)ARGON2_LANES_MAX_HELPERS);
+
+    is_started = true;
+    helper_count = 0;
+    start_generation = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (0 != pthread_create(&(helpers[i]), NULL, helper_main, (void *)(uintptr_t)(i + 1))) break;
+        ++helper_count;
+    }
+
+    __atomic_store_n(&picked_up, helper_count, __ATOMIC_RELAXED);   /* Nothing posted yet. */
+}
+
+
+static void
+stop_crew(void)
+{
+    if (false == is_started) return;
+
+    wait_for_pickup();
+    is_stopping = true;
+    __atomic_add_fetch(&generation, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&generation);
+
+    for (size_t i = 0; i < helper_count; ++i) pthread_join(helpers[i], NULL);
+
+    is_stopping = false;
+    is_started = false;
+    helper_count = 0;
+}
+
+
+
+void
+argon2_lanes__fill(argon2d_state_t *state)
+{
+    if (NULL == state || state->pass >= state->passes) return;
+
+    /* A slice which is already partly filled (a resumed job), or a single lane: no crew needed. */
+    if (state->lanes < 2 || 0 != state->lane) goto Label__fill_Serial;
+
+    if (0 != __atomic_exchange_n(&is_busy, 1, __ATOMIC_ACQUIRE)) goto Label__fill_Serial;
+
+    if (false == is_started) start_crew();
+    if (0 == helper_count) {
+        __atomic_store_n(&is_busy, 0, __ATOMIC_RELEASE);
+        goto Label__fill_Serial;
+    }
+
+    /* Post the job; the generation bump publishes it to the helpers. */
+    wait_for_pickup();
+    job = *state;
+    participants = (uint32_t)MIN((size_t)state->lanes, helper_count + 1);
+    __atomic_add_fetch(&generation, 1, __ATOMIC_SEQ_CST);
+    if (0 != __atomic_load_n(&idle_sleepers, __ATOMIC_SEQ_CST)) futex_wake(&generation);
+
+    /* Past the last barrier every lane is filled; the helpers only touch their own copies after it. */
+    fill_lanes(state, 0, participants);
+
+    __atomic_store_n(&is_busy, 0, __ATOMIC_RELEASE);
+    return;
+
+Label__fill_Serial:
+    argon2d__fill_segments(state, SIZE_MAX);
+}
+
+
+void
+argon2_lanes__set_helpers(size_t count)
+{
+    while (0 != __atomic_exchange_n(&is_busy, 1, __ATOMIC_ACQUIRE)) sched_yield();
+
+    stop_crew();
+    wanted_helpers = MIN(count, (size_t)ARGON2_LANES_MAX_HELPERS);
+
+    __atomic_store_n(&is_busy, 0, __ATOMIC_RELEASE);
+}
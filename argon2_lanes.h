@@ -0,0 +1,40 @@
+#ifndef LIB_VBA_ARGON2_LANES_H
+#define LIB_VBA_ARGON2_LANES_H
+
+#include "argon2d.h"
+
+#include <stddef.h>
+
+
+
+#define ARGON2_LANES_MAX_HELPERS    7   /* Parallelism is clamped to 8 lanes, and the caller fills one. */
+
+
+
+/**
+ * Fill every remaining segment of an Argon2d computation. With more than one lane, the lanes are
+ *   shared out between the calling thread and a process-wide crew of persistent helper threads,
+ *   which meet at a spinning barrier after each slice instead of being spawned and joined per
+ *   pass. The crew serves one computation at a time: a caller which finds it busy (or which runs
+ *   on a single core) fills its lanes on its own thread. The crew is started on first use.
+ *
+ * On return, `state` is ready for `argon2d__finish`.
+ */
+void
+argon2_lanes__fill(
+    argon2d_state_t             *state
+);
+
+/**
+ * Set the size of the helper crew, stopping the current one (after any computation it is serving).
+ *   The new crew starts on the next `argon2_lanes__fill`. The default is one helper fewer than the
+ *   online core count, and 0 turns the crew off. Capped at ARGON2_LANES_MAX_HELPERS.
+ */
+void
+argon2_lanes__set_helpers(
+    size_t                      helper_count
+);
+
+
+
+#endif   /* LIB_VBA_ARGON2_LANES_H */
@@ -0,0 +1,529 @@
+#include "argon2d.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+
+
+#define BLAKE2B_BLOCK_LENGTH    128
+#define BLAKE2B_OUT_LENGTH      64
+#define ARGON2D_PREHASH_LENGTH  (BLAKE2B_OUT_LENGTH + 8)   /* H0 plus the block and lane indices. */
+
+typedef
+struct {
+    uint64_t    h[8];
+    uint64_t    t;
+    uint8_t     buffer[BLAKE2B_BLOCK_LENGTH];
+    size_t      buffer_length;
+    size_t      out_length;
+} blake2b_state_t;
+
+static const uint64_t blake2b_iv[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static const uint8_t blake2b_sigma[12][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+};
+
+
+
+static inline uint64_t
+rotr64(uint64_t x, int k)
+{
+    return (x >> k) | (x << (64 - k));
+}
+
+
+static inline uint64_t
+load_le64(const uint8_t *input)
+{
+    uint64_t value = 0;
+
+    for (int i = 7; i >= 0; --i) value = (value << 8) | input[i];
+    return value;
+}
+
+
+static inline void
+store_le64(uint8_t *output,
+           uint64_t value)
+{
+    for (int i = 0; i < 8; ++i) output[i] = (uint8_t)(value >> (8 * i));
+}
+
+
+static inline void
+store_le32(uint8_t *output,
+           uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) output[i] = (uint8_t)(value >> (8 * i));
+}
+
+
+#define BLAKE2B_G(a, b, c, d, x, y)             \
+    do {                                        \
+        a = a + b + (x);                        \
+        d = rotr64(d ^ a, 32);                  \
+        c = c + d;                              \
+        b = rotr64(b ^ c, 24);                  \
+        a = a + b + (y);                        \
+        d = rotr64(d ^ a, 16);                  \
+        c = c + d;                              \
+        b = rotr64(b ^ c, 63);                  \
+    } while (0)
+
+
+static void
+blake2b_compress(blake2b_state_t *state,
+                 const uint8_t block[BLAKE2B_BLOCK_LENGTH],
+                 bool is_last)
+{
+    uint64_t m[16];
+    uint64_t v[16];
+
+    for (int i = 0; i < 16; ++i) m[i] = load_le64(block + 8 * i);
+    for (int i = 0; i < 8; ++i) {
+        v[i] = state->h[i];
+        v[i + 8] = blake2b_iv[i];
+    }
+
+    v[12] ^= state->t;
+    if (is_last) v[14] = ~v[14];
+
+    for (int r = 0; r < 12; ++r) {
+        const uint8_t *s = blake2b_sigma[r];
+
+        BLAKE2B_G(v[0], v[4], v[ 8], v[12], m[s[ 0]], m[s[ 1]]);
+        BLAKE2B_G(v[1], v[5], v[ 9], v[13], m[s[ 2]], m[s[ 3]]);
+        BLAKE2B_G(v[2], v[6], v[10], v[14], m[s[ 4]], m[s[ 5]]);
+        BLAKE2B_G(v[3], v[7], v[11], v[15], m[s[ 6]], m[s[ 7]]);
+        BLAKE2B_G(v[0], v[5], v[10], v[15], m[s[ 8]], m[s[ 9]]);
+        BLAKE2B_G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        BLAKE2B_G(v[2], v[7], v[ 8], v[13], m[s[12]], m[s[13]]);
+        BLAKE2B_G(v[3], v[4], v[ 9], v[14], m[s[14]], m[s[15]]);
+    }
+
+    for (int i = 0; i < 8; ++i) state->h[i] ^= v[i] ^ v[i + 8];
+}
+
+
+static void
+blake2b_begin(blake2b_state_t *state,
+              size_t out_length)
+{
+    memcpy(state->h, blake2b_iv, sizeof(state->h));
+    state->h[0] ^= 0x01010000ULL ^ (uint64_t)out_length;   /* Unkeyed, fanout 1, depth 1. */
+    state->t = 0;
+    state->buffer_length = 0;
+    state->out_length = out_length;
+}
+
+
+static void
+blake2b_update(blake2b_state_t *state,
+               const uint8_t *input,
+               size_t length)
+{
+    /* The last block is only compressed in `blake2b_finish`, so always keep one buffered. */
+    while (length > 0) {
+        size_t chunk = 0;
+
+        if (BLAKE2B_BLOCK_LENGTH == state->buffer_length) {
+            state->t += BLAKE2B_BLOCK_LENGTH;
+            blake2b_compress(state, state->buffer, false);
+            state->buffer_length = 0;
+        }
+
+        chunk = BLAKE2B_BLOCK_LENGTH - state->buffer_length;
+        if (chunk > length) chunk = length;
+
+        memcpy(state->buffer + state->buffer_length, input, chunk);
+        state->buffer_length += chunk;
+        input += chunk;
+        length -= chunk;
+    }
+}
+
+
+static void
+blake2b_finish(blake2b_state_t *state,
+               uint8_t *output)
+{
+    uint8_t digest[BLAKE2B_OUT_LENGTH];
+
+    state->t += state->buffer_length;
+    memset(state->buffer + state->buffer_length, 0x00, BLAKE2B_BLOCK_LENGTH - state->buffer_length);
+    blake2b_compress(state, state->buffer, true);
+
+    for (int i = 0; i < 8; ++i) store_le64(digest + 8 * i, state->h[i]);
+    memcpy(output, digest, state->out_length);
+}
+
+
+/* H' from the Argon2 spec: BLAKE2b stretched to any output length. */
+static void
+blake2b_long(uint8_t *output,
+             uint32_t output_length,
+             const uint8_t *input,
+             size_t input_length)
+{
+    blake2b_state_t state;
+    uint8_t length_le[4];
+    uint8_t buffer[BLAKE2B_OUT_LENGTH];
+    uint32_t remaining = output_length;
+
+    store_le32(length_le, output_length);
+
+    if (output_length <= BLAKE2B_OUT_LENGTH) {
+        blake2b_begin(&state, output_length);
+        blake2b_update(&state, length_le, sizeof(length_le));
+        blake2b_update(&state, input, input_length);
+        blake2b_finish(&state, output);
+        return;
+    }
+
+    blake2b_begin(&state, BLAKE2B_OUT_LENGTH);
+    blake2b_update(&state, length_le, sizeof(length_le));
+    blake2b_update(&state, input, input_length);
+    blake2b_finish(&state, buffer);
+
+    memcpy(output, buffer, BLAKE2B_OUT_LENGTH / 2);
+    output += BLAKE2B_OUT_LENGTH / 2;
+    remaining -= BLAKE2B_OUT_LENGTH / 2;
+
+    while (remaining > BLAKE2B_OUT_LENGTH) {
+        blake2b_begin(&state, BLAKE2B_OUT_LENGTH);
+        blake2b_update(&state, buffer, BLAKE2B_OUT_LENGTH);
+        blake2b_finish(&state, buffer);
+
+        memcpy(output, buffer, BLAKE2B_OUT_LENGTH / 2);
+        output += BLAKE2B_OUT_LENGTH / 2;
+        remaining -= BLAKE2B_OUT_LENGTH / 2;
+    }
+
+    blake2b_begin(&state, remaining);
+    blake2b_update(&state, buffer, BLAKE2B_OUT_LENGTH);
+    blake2b_finish(&state, output);
+}
+
+
+static inline uint64_t
+blamka(uint64_t x,
+       uint64_t y)
+{
+    return x + y + 2 * (uint64_t)(uint32_t)x * (uint32_t)y;
+}
+
+
+#define BLAMKA_G(a, b, c, d)                    \
+    do {                                        \
+        a = blamka(a, b);                       \
+        d = rotr64(d ^ a, 32);                  \
+        c = blamka(c, d);                       \
+        b = rotr64(b ^ c, 24);                  \
+        a = blamka(a, b);                       \
+        d = rotr64(d ^ a, 16);                  \
+        c = blamka(c, d);                       \
+        b = rotr64(b ^ c, 63);                  \
+    } while (0)
+
+#define BLAMKA_ROUND(v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15)  \
+    do {                                        \
+        BLAMKA_G(v0, v4, v8, v12);              \
+        BLAMKA_G(v1, v5, v9, v13);              \
+        BLAMKA_G(v2, v6, v10, v14);             \
+        BLAMKA_G(v3, v7, v11, v15);             \
+        BLAMKA_G(v0, v5, v10, v15);             \
+        BLAMKA_G(v1, v6, v11, v12);             \
+        BLAMKA_G(v2, v7, v8, v13);              \
+        BLAMKA_G(v3, v4, v9, v14);              \
+    } while (0)
+
+
+/* The compression function G: next = P(prev ^ ref) ^ prev ^ ref, also XORed with next after pass 0. */
+static void
+fill_block(const argon2d_block_t *prev,
+           const argon2d_block_t *ref,
+           argon2d_block_t *next,
+           bool with_xor)
+{
+    argon2d_block_t R;
+    argon2d_block_t Q;
+    uint64_t *v = Q.v;
+
+    for (int i = 0; i < ARGON2D_QWORDS_IN_BLOCK; ++i) R.v[i] = ref->v[i] ^ prev->v[i];
+    memcpy(&Q, &R, sizeof(Q));
+
+    for (int i = 0; i < 8; ++i) {
+        BLAMKA_ROUND(v[16 * i],      v[16 * i + 1],  v[16 * i + 2],  v[16 * i + 3],
+                     v[16 * i + 4],  v[16 * i + 5],  v[16 * i + 6],  v[16 * i + 7],
+                     v[16 * i + 8],  v[16 * i + 9],  v[16 * i + 10], v[16 * i + 11],
+                     v[16 * i + 12], v[16 * i + 13], v[16 * i + 14], v[16 * i + 15]);
+    }
+
+    for (int i = 0; i < 8; ++i) {
+        BLAMKA_ROUND(v[2 * i],       v[2 * i + 1],   v[2 * i + 16],  v[2 * i + 17],
+                     v[2 * i + 32],  v[2 * i + 33],  v[2 * i + 48],  v[2 * i + 49],
+                     v[2 * i + 64],  v[2 * i + 65],  v[2 * i + 80],  v[2 * i + 81],
+                     v[2 * i + 96],  v[2 * i + 97],  v[2 * i + 112], v[2 * i + 113]);
+    }
+
+    if (with_xor) {
+        for (int i = 0; i < ARGON2D_QWORDS_IN_BLOCK; ++i) next->v[i] ^= Q.v[i] ^ R.v[i];
+    } else {
+        for (int i = 0; i < ARGON2D_QWORDS_IN_BLOCK; ++i) next->v[i] = Q.v[i] ^ R.v[i];
+    }
+}
+
+
+/* Map the pseudo-random value J1 onto a block of the reference set (spec section 3.4). */
+static uint32_t
+reference_index(const argon2d_state_t *state,
+                uint32_t index,
+                uint32_t pseudo_random,
+                bool same_lane)
+{
+    uint32_t reference_area_size = 0;
+    uint32_t start_position = 0;
+    uint64_t relative_position = pseudo_random;
+
+    if (0 == state->pass) {
+        if (0 == state->slice) {
+            reference_area_size = index - 1;
+        } else if (same_lane) {
+            reference_area_size = state->slice * state->segment_length + index - 1;
+        } else {
+            reference_area_size = state->slice * state->segment_length + ((0 == index) ? -1 : 0);
+        }
+    } else {
+        if (same_lane) {
+            reference_area_size = state->lane_length - state->segment_length + index - 1;
+        } else {
+            reference_area_size = state->lane_length - state->segment_length + ((0 == index) ? -1 : 0);
+        }
+
+        if (state->slice != ARGON2D_SYNC_POINTS - 1) start_position = (state->slice + 1) * state->segment_length;
+    }
+
+    relative_position = (relative_position * relative_position) >> 32;
+    relative_position = reference_area_size - 1 - ((reference_area_size * relative_position) >> 32);
+
+    return (uint32_t)((start_position + relative_position) % state->lane_length);
+}
+
+
+static void
+fill_segment(const argon2d_state_t *state,
+             uint32_t lane)
+{
+    uint32_t start_index = (0 == state->pass && 0 == state->slice) ? 2 : 0;
+    uint32_t current_offset = lane * state->lane_length + state->slice * state->segment_length + start_index;
+    uint32_t previous_offset = (0 == current_offset % state->lane_length)
+                               ? current_offset + state->lane_length - 1
+                               : current_offset - 1;
+
+    for (uint32_t i = start_index; i < state->segment_length; ++i, ++current_offset, ++previous_offset) {
+        uint64_t pseudo_random = 0;
+        uint32_t reference_lane = 0;
+        uint32_t reference = 0;
+
+        /* The first block of a lane follows the lane's last one. */
+        if (1 == current_offset % state->lane_length) previous_offset = current_offset - 1;
+
+        /* Argon2d: the reference comes from the previous block's contents. */
+        pseudo_random = state->memory[previous_offset].v[0];
+        reference_lane = (uint32_t)((pseudo_random >> 32) % state->lanes);
+        if (0 == state->pass && 0 == state->slice) reference_lane = lane;
+
+        reference = reference_index(state, i, (uint32_t)pseudo_random, reference_lane == lane);
+
+        fill_block(&(state->memory[previous_offset]),
+                   &(state->memory[(size_t)state->lane_length * reference_lane + reference]),
+                   &(state->memory[current_offset]),
+                   0 != state->pass);
+    }
+}
+
+
+
+size_t
+argon2d__memory_blocks(uint32_t m_cost,
+                       uint32_t lanes)
+{
+    uint64_t blocks = m_cost;
+
+    if (0 == lanes) return 0;
+
+    if (blocks < 2 * ARGON2D_SYNC_POINTS * (uint64_t)lanes) blocks = 2 * ARGON2D_SYNC_POINTS * (uint64_t)lanes;
+
+    return (size_t)((blocks / (ARGON2D_SYNC_POINTS * (uint64_t)lanes)) * (ARGON2D_SYNC_POINTS * (uint64_t)lanes));
+}
+
+
+int
+argon2d__begin_keyed(argon2d_state_t *state,
+                     argon2d_block_t *memory,
+                     const uint8_t *password,
+                     size_t password_length,
+                     const uint8_t *salt,
+                     size_t salt_length,
+                     const uint8_t *secret,
+                     size_t secret_length,
+                     const uint8_t *associated_data,
+                     size_t associated_data_length,
+                     uint32_t t_cost,
+                     uint32_t m_cost,
+                     uint32_t lanes,
+                     uint32_t output_length)
+{
+    blake2b_state_t hash;
+    uint8_t prehash[ARGON2D_PREHASH_LENGTH] = {0};
+    uint8_t block_bytes[ARGON2D_BLOCK_SIZE];
+    uint8_t word[4];
+    size_t memory_blocks = argon2d__memory_blocks(m_cost, lanes);
+
+    if (NULL == state || NULL == memory || 0 == memory_blocks || 0 == t_cost || output_length < 4) return -1;
+    if ((NULL == secret && secret_length > 0) || (NULL == associated_data && associated_data_length > 0)) return -1;
+
+    state->memory = memory;
+    state->passes = t_cost;
+    state->lanes = lanes;
+    state->lane_length = (uint32_t)(memory_blocks / lanes);
+    state->segment_length = state->lane_length / ARGON2D_SYNC_POINTS;
+    state->pass = 0;
+    state->slice = 0;
+    state->lane = 0;
+
+    /* H0 over every parameter and input, each length-prefixed. */
+    blake2b_begin(&hash, BLAKE2B_OUT_LENGTH);
+
+    store_le32(word, lanes);                    blake2b_update(&hash, word, sizeof(word));
+    store_le32(word, output_length);            blake2b_update(&hash, word, sizeof(word));
+    store_le32(word, m_cost);                   blake2b_update(&hash, word, sizeof(word));
+    store_le32(word, t_cost);                   blake2b_update(&hash, word, sizeof(word));
+    store_le32(word, ARGON2D_VERSION);          blake2b_update(&hash, word, sizeof(word));
+    store_le32(word, 0);                        blake2b_update(&hash, word, sizeof(word));   /* Type d. */
+    store_le32(word, (uint32_t)password_length); blake2b_update(&hash, word, sizeof(word));
+    blake2b_update(&hash, password, password_length);
+    store_le32(word, (uint32_t)salt_length);    blake2b_update(&hash, word, sizeof(word));
+    blake2b_update(&hash, salt, salt_length);
+    store_le32(word, (uint32_t)secret_length);  blake2b_update(&hash, word, sizeof(word));
+    if (secret_length > 0) blake2b_update(&hash, secret, secret_length);
+    store_le32(word, (uint32_t)associated_data_length); blake2b_update(&hash, word, sizeof(word));
+    if (associated_data_length > 0) blake2b_update(&hash, associated_data, associated_data_length);
+
+    blake2b_finish(&hash, prehash);
+
+    /* B[l][0] = H'(H0 || 0 || l) and B[l][1] = H'(H0 || 1 || l). */
+    for (uint32_t l = 0; l < lanes; ++l) {
+        for (uint32_t b = 0; b < 2; ++b) {
+            argon2d_block_t *block = &(memory[(size_t)l * state->lane_length + b]);
+
+            store_le32(prehash + BLAKE2B_OUT_LENGTH, b);
+            store_le32(prehash + BLAKE2B_OUT_LENGTH + 4, l);
+            blake2b_long(block_bytes, ARGON2D_BLOCK_SIZE, prehash, sizeof(prehash));
+
+            for (int i = 0; i < ARGON2D_QWORDS_IN_BLOCK; ++i) block->v[i] = load_le64(block_bytes + 8 * i);
+        }
+    }
+
+    return 0;
+}
+
+
+int
+argon2d__begin(argon2d_state_t *state,
+               argon2d_block_t *memory,
+               const uint8_t *password,
+               size_t password_length,
+               const uint8_t *salt,
+               size_t salt_length,
+               uint32_t t_cost,
+               uint32_t m_cost,
+               uint32_t lanes,
+               uint32_t output_length)
+{
+    return argon2d__begin_keyed(state, memory, password, password_length, salt, salt_length,
+                                NULL, 0, NULL, 0, t_cost, m_cost, lanes, output_length);
+}
+
+
+int
+argon2d__fill_segments(argon2d_state_t *state,
+                       size_t max_segments)
+{
+    if (state->pass >= state->passes) return 1;
+    if (0 == max_segments) max_segments = 1;
+
+    /*
+     * Lanes only ever reference other lanes' finished slices, so running the segments of a slice
+     *   one after another gives exactly what libargon2's threads give.
+     */
+    do {
+        fill_segment(state, state->lane);
+
+        if (++(state->lane) < state->lanes) continue;
+        state->lane = 0;
+
+        if (1 == argon2d__next_slice(state)) return 1;
+    } while (--max_segments > 0);
+
+    return 0;
+}
+
+
+void
+argon2d__fill_lane_segment(const argon2d_state_t *state,
+                           uint32_t lane)
+{
+    if (state->pass >= state->passes || lane >= state->lanes) return;
+
+    fill_segment(state, lane);
+}
+
+
+int
+argon2d__next_slice(argon2d_state_t *state)
+{
+    if (state->pass >= state->passes) return 1;
+
+    if (++(state->slice) < ARGON2D_SYNC_POINTS) return 0;
+    state->slice = 0;
+
+    return (++(state->pass) >= state->passes) ? 1 : 0;
+}
+
+
+void
+argon2d__finish(const argon2d_state_t *state,
+                uint8_t *output,
+                uint32_t output_length)
+{
+    argon2d_block_t final_block;
+    uint8_t block_bytes[ARGON2D_BLOCK_SIZE];
+    size_t last = state->lane_length - 1;
+
+    /* XOR the last block of every lane, then stretch it to the tag. */
+    memcpy(&final_block, &(state->memory[last]), sizeof(final_block));
+    for (uint32_t l = 1; l < state->lanes; ++l) {
+        last += state->lane_length;
+        for (int i = 0; i < ARGON2D_QWORDS_IN_BLOCK; ++i) final_block.v[i] ^= state->memory[last].v[i];
+    }
+
+    for (int i = 0; i < ARGON2D_QWORDS_IN_BLOCK; ++i) store_le64(block_bytes + 8 * i, final_block.v[i]);
+
+    blake2b_long(output, output_length, block_bytes, sizeof(block_bytes));
+}
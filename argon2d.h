@@ -0,0 +1,132 @@
+#ifndef LIB_VBA_ARGON2D_H
+#define LIB_VBA_ARGON2D_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+#define ARGON2D_BLOCK_SIZE          1024
+#define ARGON2D_QWORDS_IN_BLOCK     (ARGON2D_BLOCK_SIZE / 8)
+#define ARGON2D_SYNC_POINTS         4
+#define ARGON2D_VERSION             0x13
+
+
+
+typedef
+struct {
+    uint64_t    v[ARGON2D_QWORDS_IN_BLOCK];
+} argon2d_block_t;
+
+/**
+ * An Argon2d (v1.3) computation which can be stopped after any segment and picked up again.
+ *   libargon2 only exports the one-shot API, so this is a small in-tree core with the same
+ *   output as `argon2_ctx(..., Argon2_d)`.
+ */
+typedef
+struct {
+    argon2d_block_t *memory;
+    uint32_t        passes;
+    uint32_t        lanes;
+    uint32_t        lane_length;      /* In blocks. */
+    uint32_t        segment_length;   /* In blocks. */
+    uint32_t        pass;             /* The next segment to fill... */
+    uint32_t        slice;
+    uint32_t        lane;
+} argon2d_state_t;
+
+
+
+/**
+ * The amount of blocks `argon2d__begin` needs for a MemorySize (in KiB) and lane count,
+ *   rounded the same way libargon2 rounds it. Returns 0 for an invalid lane count.
+ */
+size_t
+argon2d__memory_blocks(
+    uint32_t                    m_cost,
+    uint32_t                    lanes
+);
+
+/**
+ * Hash the inputs and fill the first two blocks of every lane. `memory` must hold
+ *   `argon2d__memory_blocks(m_cost, lanes)` blocks and stays owned by the caller.
+ */
+int
+argon2d__begin(
+    argon2d_state_t             *state,
+    argon2d_block_t             *memory,
+    const uint8_t               *password,
+    size_t                      password_length,
+    const uint8_t               *salt,
+    size_t                      salt_length,
+    uint32_t                    t_cost,
+    uint32_t                    m_cost,
+    uint32_t                    lanes,
+    uint32_t                    output_length
+);
+
+/**
+ * `argon2d__begin` with a secret key and associated data mixed into H0 (RFC 9106, section 3.2).
+ *   The library itself uses neither; this is what the RFC's test vector needs.
+ */
+int
+argon2d__begin_keyed(
+    argon2d_state_t             *state,
+    argon2d_block_t             *memory,
+    const uint8_t               *password,
+    size_t                      password_length,
+    const uint8_t               *salt,
+    size_t                      salt_length,
+    const uint8_t               *secret,
+    size_t                      secret_length,
+    const uint8_t               *associated_data,
+    size_t                      associated_data_length,
+    uint32_t                    t_cost,
+    uint32_t                    m_cost,
+    uint32_t                    lanes,
+    uint32_t                    output_length
+);
+
+/**
+ * Fill at most `max_segments` more segments (at least one). Returns 1 once every pass is done.
+ */
+int
+argon2d__fill_segments(
+    argon2d_state_t             *state,
+    size_t                      max_segments
+);
+
+/**
+ * Fill one lane's segment of the current slice, leaving the position as it is. The segments of
+ *   one slice only read other lanes' finished slices, so different threads may fill different
+ *   lanes of the same slice at once, each with its own copy of the state.
+ */
+void
+argon2d__fill_lane_segment(
+    const argon2d_state_t       *state,
+    uint32_t                    lane
+);
+
+/**
+ * Move on to the next slice once every lane's segment of the current one has been filled.
+ *   Returns 1 once every pass is done.
+ */
+int
+argon2d__next_slice(
+    argon2d_state_t             *state
+);
+
+/**
+ * Produce the tag once `argon2d__fill_segments` has returned 1. `output_length` must match the
+ *   one passed to `argon2d__begin`.
+ */
+void
+argon2d__finish(
+    const argon2d_state_t       *state,
+    uint8_t                     *output,
+    uint32_t                    output_length
+);
+
+
+
+#endif   /* LIB_VBA_ARGON2D_H */
@@ -0,0 +1,327 @@
+#include "vba.h"
+
+#include "generator.h"
+#include "metrics.h"
+#include "ndopt.h"
+#include "pool.h"
+#include "sha256_mb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+#define BENCH_DEFAULT_RUNS          15
+#define BENCH_MAX_RUNS              1000
+#define BENCH_BATCH_SIZE            16
+#define BENCH_SCHEMA_VERSION        1
+
+/**
+ * One point in the sweep. `parameter` is the voucher's algorithm value: the ITERATIONS_FACTOR,
+ *   (raw Parallelism byte << 24 | MemorySize) for Argon2, or the SCALING_FACTOR.
+ */
+typedef
+struct {
+    vba_kdf_t   kdf;
+    uint32_t    parameter;
+    uint16_t    work_factor;
+} bench_case_t;
+
+typedef
+enum {
+    BENCH_OP_GENERATE,
+    BENCH_OP_VERIFY,
+    BENCH_OP_VERIFY_BATCH
+} bench_operation_t;
+
+typedef
+struct {
+    uint64_t    min_ns;
+    uint64_t    median_ns;
+    uint64_t    p99_ns;
+    double      mean_ns;
+    double      ops_per_second;
+    uint32_t    runs;
+} bench_stats_t;
+
+
+
+static const bench_case_t BENCH_CASES[] = {
+    { VBA_ALGO_PBKDF2,  1,                          0x0100 },
+    { VBA_ALGO_PBKDF2,  1,                          0x1000 },
+    { VBA_ALGO_PBKDF2,  16,                         0x0400 },
+    { VBA_ALGO_PBKDF2,  64,                         0x1000 },
+    { VBA_ALGO_ARGON2,  (0x10 << 24) | 1024,        0x0001 },
+    { VBA_ALGO_ARGON2,  (0x10 << 24) | 1024,        0x0301 },
+    { VBA_ALGO_ARGON2,  (0x10 << 24) | 16384,       0x0001 },
+    { VBA_ALGO_ARGON2,  (0x40 << 24) | 16384,       0x0001 },
+    { VBA_ALGO_ARGON2,  (0x10 << 24) | 60000,       0x0001 },
+    { VBA_ALGO_SCRYPT,  0,                          ((24 * 6) << 8) | 0x01 },
+    { VBA_ALGO_SCRYPT,  3,                          ((24 * 6) << 8) | 0x08 },
+    { VBA_ALGO_SCRYPT,  3,                          ((24 * 10) << 8) | 0x08 },
+    { VBA_ALGO_SCRYPT,  5,                          ((24 * 8) << 8) | 0x08 },
+};
+
+static const char *BENCH_KDF_NAMES[] = { "pbkdf2", "argon2", "scrypt" };
+static const char *BENCH_OPERATION_NAMES[] = { "generate", "verify", "verify_batch" };
+
+/* Everything about the benchmark device is fixed, so each run derives exactly the same addresses. */
+static const subnet_t BENCH_SUBNET = {
+    .prefix = {0xFE, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+    .length = 8
+};
+
+static const uint8_t BENCH_LINK_LAYER_ID[] = {0xAB, 0xCD, 0xEF, 0x11, 0x22, 0x33};
+
+
+
+static int
+compare_u64(const void *a,
+            const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/* Build the case's voucher with a seed that depends only on the case index. */
+static int
+create_case_voucher(const bench_case_t *bench_case,
+                    size_t case_index,
+                    pseudo_net_dev_t *device)
+{
+    uint8_t raw_ndopt[VBA_LINK_VOUCHER_MIN_LENGTH];
+    uint8_t seed[VBA_SEED_LENGTH];
+    nd_link_voucher_option_t *voucher = NULL;
+    int status = 0;
+
+    for (int i = 0; i < VBA_SEED_LENGTH; ++i) seed[i] = (uint8_t)((case_index * 31) + (i * 7) + 1);
+
+    status = ndopt__encode_link_voucher(raw_ndopt,
+                                        sizeof(raw_ndopt),
+                                        bench_case->kdf,
+                                        bench_case->parameter,
+                                        (uint32_t)(0xBE00 | (uint8_t)case_index),
+                                        seed);
+    if (0 != status) return status;
+
+    status = ndopt__process_link_voucher((void *)raw_ndopt, device, &voucher);
+    device->active_voucher = voucher;
+
+    return status;
+}
+
+
+static void
+summarize(uint64_t *samples,
+          uint32_t runs,
+          uint32_t operations_per_run,
+          bench_stats_t *stats)
+{
+    double total = 0.0;
+
+    qsort(samples, runs, sizeof(uint64_t), compare_u64);
+
+    for (uint32_t i = 0; i < runs; ++i) total += (double)samples[i];
+
+    stats->runs = runs;
+    stats->min_ns = samples[0];
+    stats->median_ns = samples[runs / 2];
+    /* Nearest-rank percentile; with few runs this is simply the slowest one. */
+    stats->p99_ns = samples[MIN(runs - 1, ((runs * 99) + 99) / 100 - 1)];
+    stats->mean_ns = total / runs;
+    stats->ops_per_second = (stats->mean_ns > 0.0) ? ((1e9 * operations_per_run) / stats->mean_ns) : 0.0;
+}
+
+
+/* Time one operation `runs` times after a warm-up. Returns 0 on success. */
+static int
+run_operation(pseudo_net_dev_t *device,
+              vba_pool_t *pool,
+              bench_operation_t operation,
+              uint16_t work_factor,
+              uint32_t runs,
+              bench_stats_t *stats)
+{
+    vba_neighbor_t neighbors[BENCH_BATCH_SIZE];
+    int results[BENCH_BATCH_SIZE];
+    uint64_t *samples = NULL;
+    vba_t *address = NULL;
+    uint64_t begin = 0;
+    int status = 0;
+
+    samples = (uint64_t *)calloc(runs, sizeof(uint64_t));
+    if (NULL == samples) return -3;
+
+    /* The address under test is generated once; every verification checks the same binding. */
+    status = vba__generate(device, 0, work_factor, &address);
+    if (0 != status) goto Label__run_operation_Exit;
+
+    for (size_t i = 0; i < BENCH_BATCH_SIZE; ++i) {
+        memcpy(&(neighbors[i].address), address, sizeof(vba_t));
+        memcpy(&(neighbors[i].link_layer_id), &(device->link_layer_id), sizeof(llid_t));
+    }
+
+    /* One untimed pass (i == -1) to fault in KDF memory and warm the caches. */
+    for (int64_t i = -1; i < (int64_t)runs; ++i) {
+        vba_t *new_vba = NULL;
+
+        begin = metrics__now_ns();
+        switch (operation) {
+            case BENCH_OP_GENERATE:
+                status = vba__generate(device, 0, work_factor, &new_vba);
+                free(new_vba);
+                break;
+            case BENCH_OP_VERIFY:
+                status = vba__verify(device, address, &(neighbors[0].link_layer_id));
+                break;
+            case BENCH_OP_VERIFY_BATCH:
+                status = vba__verify_batch(device, pool, neighbors, BENCH_BATCH_SIZE, results);
+                for (size_t j = 0; 0 == status && j < BENCH_BATCH_SIZE; ++j) status = results[j];
+                break;
+        }
+        if (i >= 0) samples[i] = metrics__now_ns() - begin;
+
+        if (0 != status) goto Label__run_operation_Exit;
+    }
+
+    summarize(samples, runs, (BENCH_OP_VERIFY_BATCH == operation) ? BENCH_BATCH_SIZE : 1, stats);
+
+Label__run_operation_Exit:
+    free(address);
+    free(samples);
+    return status;
+}
+
+
+
+int
+main(int argc,
+     char **argv)
+{
+    static const size_t case_count = sizeof(BENCH_CASES) / sizeof(bench_case_t);
+
+    pseudo_net_dev_t device = {};
+    subnet_t subnet = {0};
+    vba_pool_t *pool = NULL;
+    bench_stats_t stats = {0};
+    const bench_case_t *bench_case = NULL;
+    const char *output_path = NULL;
+    const char *filter = NULL;
+    FILE *output = stdout;
+    uint32_t runs = BENCH_DEFAULT_RUNS;
+    bool is_first = true;
+    int status = 0;
+
+    /*
+     * Usage: vba-bench [--runs <n>] [--kdf pbkdf2|argon2|scrypt] [--output <file.json>]
+     *   Progress goes to stderr; the JSON report goes to stdout unless an output file is given.
+     */
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "--runs") && (i + 1) < argc) {
+            runs = (uint32_t)strtoul(argv[++i], NULL, 10);
+            runs = MAX(1, MIN(BENCH_MAX_RUNS, runs));
+        } else if (0 == strcmp(argv[i], "--kdf") && (i + 1) < argc) {
+            filter = argv[++i];
+        } else if (0 == strcmp(argv[i], "--output") && (i + 1) < argc) {
+            output_path = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--runs <n>] [--kdf pbkdf2|argon2|scrypt] [--output <file.json>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* Only the prefix noise draws from the PRNG, and a full /64 subnet takes none. */
+    Xoshiro128p__init();
+
+    memcpy(&subnet, &BENCH_SUBNET, sizeof(subnet_t));
+    device.iem = VBA_IEM_AGV;
+    device.subnet_prefixes = &subnet;
+    device.subnet_prefixes_count = 1;
+    device.link_layer_id.length = sizeof(BENCH_LINK_LAYER_ID);
+    memcpy(device.link_layer_id.id, BENCH_LINK_LAYER_ID, sizeof(BENCH_LINK_LAYER_ID));
+
+    pool = pool__create(0);
+    if (NULL == pool) return 3;
+
+    if (NULL != output_path) {
+        output = fopen(output_path, "w");
+        if (NULL == output) {
+            fprintf(stderr, "Cannot open '%s' for writing.\n", output_path);
+            pool__destroy(pool);
+            return 2;
+        }
+    }
+
+    fprintf(output, "{\n");
+    fprintf(output, "  \"schema\": %d,\n", BENCH_SCHEMA_VERSION);
+    fprintf(output, "  \"runs\": %u,\n", runs);
+    fprintf(output, "  \"threads\": %lu,\n", pool__thread_count(pool));
+    fprintf(output, "  \"sha256_lanes\": %lu,\n", pbkdf2_sha256_mb__lanes());
+    fprintf(output, "  \"batch_size\": %d,\n", BENCH_BATCH_SIZE);
+    fprintf(output, "  \"results\": [\n");
+
+    for (size_t i = 0; i < case_count; ++i) {
+        bench_case = &(BENCH_CASES[i]);
+        if (NULL != filter && 0 != strcmp(filter, BENCH_KDF_NAMES[bench_case->kdf])) continue;
+
+        status = create_case_voucher(bench_case, i, &device);
+        if (0 != status) break;
+
+        for (int operation = BENCH_OP_GENERATE; operation <= BENCH_OP_VERIFY_BATCH; ++operation) {
+            fprintf(stderr,
+                    "%-7s parameter=0x%08X work_factor=0x%04X %-13s ",
+                    BENCH_KDF_NAMES[bench_case->kdf],
+                    bench_case->parameter,
+                    bench_case->work_factor,
+                    BENCH_OPERATION_NAMES[operation]);
+
+            status = run_operation(&device, pool, (bench_operation_t)operation, bench_case->work_factor, runs, &stats);
+            if (0 != status) {
+                fprintf(stderr, "FAILED (%d)\n", status);
+                break;
+            }
+
+            fprintf(stderr,
+                    "min %10.3f ms  median %10.3f ms  p99 %10.3f ms  %10.2f ops/s\n",
+                    stats.min_ns / 1e6,
+                    stats.median_ns / 1e6,
+                    stats.p99_ns / 1e6,
+                    stats.ops_per_second);
+
+            /* One object per line, with a fixed key order, so reports diff cleanly between builds. */
+            fprintf(output,
+                    "%s    {\"kdf\": \"%s\", \"parameter\": %u, \"work_factor\": %u, \"operation\": \"%s\", "
+                    "\"runs\": %u, \"min_ns\": %lu, \"median_ns\": %lu, \"p99_ns\": %lu, \"mean_ns\": %.0f, "
+                    "\"ops_per_sec\": %.3f}",
+                    is_first ? "" : ",\n",
+                    BENCH_KDF_NAMES[bench_case->kdf],
+                    bench_case->parameter,
+                    bench_case->work_factor,
+                    BENCH_OPERATION_NAMES[operation],
+                    stats.runs,
+                    stats.min_ns,
+                    stats.median_ns,
+                    stats.p99_ns,
+                    stats.mean_ns,
+                    stats.ops_per_second);
+            is_first = false;
+        }
+
+        free(device.active_voucher->algorithm_spec);
+        free(device.active_voucher);
+        device.active_voucher = NULL;
+
+        if (0 != status) break;
+    }
+
+    fprintf(output, "\n  ]\n}\n");
+
+    if (stdout != output) fclose(output);
+    pool__destroy(pool);
+
+    return (0 == status) ? 0 : 1;
+}
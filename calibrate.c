@@ -0,0 +1,301 @@
+#include "calibrate.h"
+
+#include "metrics.h"
+#include "ndopt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/* Runs of one probe are repeated until at least this much time has been measured. */
+#define CALIBRATION_MIN_SAMPLE_NS   (5 * 1000 * 1000)
+#define CALIBRATION_MAX_REPEATS     16
+
+/**
+ * One measurement point. `parameter` is the voucher's algorithm value: the ITERATIONS_FACTOR,
+ *   (raw Parallelism byte << 24 | MemorySize) for Argon2, or the SCALING_FACTOR.
+ */
+typedef
+struct {
+    vba_kdf_t   kdf;
+    uint32_t    parameter;
+    uint16_t    work_factor;
+} calibration_probe_t;
+
+/* Per KDF, from cheapest to most expensive. Probing stops early once the time budget runs out. */
+static const calibration_probe_t CALIBRATION_PROBES[] = {
+    { VBA_ALGO_PBKDF2, 1,                           0x0400 },
+    { VBA_ALGO_PBKDF2, 1,                           0x1000 },
+    { VBA_ALGO_PBKDF2, 1,                           0x4000 },
+    { VBA_ALGO_PBKDF2, 16,                          0x4000 },
+    { VBA_ALGO_PBKDF2, 64,                          0x8000 },
+    { VBA_ALGO_ARGON2, (0x10 << 24) | 1024,         0x0001 },
+    { VBA_ALGO_ARGON2, (0x10 << 24) | 1024,         0x0301 },
+    { VBA_ALGO_ARGON2, (0x10 << 24) | 8192,         0x0001 },
+    { VBA_ALGO_ARGON2, (0x10 << 24) | 8192,         0x0301 },
+    { VBA_ALGO_ARGON2, (0x10 << 24) | 60000,        0x0001 },
+    { VBA_ALGO_SCRYPT, 3,                           ((24 * 4) << 8) | 0x08 },
+    { VBA_ALGO_SCRYPT, 3,                           ((24 * 6) << 8) | 0x08 },
+    { VBA_ALGO_SCRYPT, 3,                           ((24 * 8) << 8) | 0x08 },
+    { VBA_ALGO_SCRYPT, 3,                           ((24 * 10) << 8) | 0x08 },
+};
+
+static const char *CALIBRATION_KDF_NAMES[] = { "pbkdf2", "argon2", "scrypt" };
+
+
+
+static int
+kdf_index(uint16_t algorithm_type)
+{
+    switch (algorithm_type) {
+        case VBA_PBKDF2_TYPE:   return VBA_ALGO_PBKDF2;
+        case VBA_ARGON2_TYPE:   return VBA_ALGO_ARGON2;
+        case VBA_SCRYPT_TYPE:   return VBA_ALGO_SCRYPT;
+        default:                return -1;
+    }
+}
+
+
+/* Build a throwaway voucher for a probe by going through the same parser real vouchers do. */
+static int
+create_probe_voucher(const calibration_probe_t *probe,
+                     pseudo_net_dev_t *device)
+{
+    uint8_t raw_ndopt[VBA_LINK_VOUCHER_MIN_LENGTH];
+    uint8_t seed[VBA_SEED_LENGTH];
+    nd_link_voucher_option_t *voucher = NULL;
+    int status = 0;
+
+    memset(seed, 0x5A, VBA_SEED_LENGTH);
+    status = ndopt__encode_link_voucher(raw_ndopt, sizeof(raw_ndopt), probe->kdf, probe->parameter, 0, seed);
+    if (0 != status) return status;
+
+    status = ndopt__process_link_voucher((void *)raw_ndopt, device, &voucher);
+    device->active_voucher = voucher;
+
+    return status;
+}
+
+
+/* Average wall time of one generation, in nanoseconds. Returns 0 on failure. */
+static uint64_t
+measure_probe(pseudo_net_dev_t *device,
+              uint16_t work_factor)
+{
+    vba_t *new_vba = NULL;
+    uint64_t begin = 0;
+    uint64_t elapsed = 0;
+    uint32_t runs = 0;
+
+    /* One untimed run faults in the KDF's scratch memory. */
+    if (0 != vba__generate(device, 0, work_factor, &new_vba)) return 0;
+    free(new_vba);
+
+    while (elapsed < CALIBRATION_MIN_SAMPLE_NS && runs < CALIBRATION_MAX_REPEATS) {
+        new_vba = NULL;
+
+        begin = metrics__now_ns();
+        if (0 != vba__generate(device, 0, work_factor, &new_vba)) return 0;
+        elapsed += metrics__now_ns() - begin;
+
+        free(new_vba);
+        runs++;
+    }
+
+    return MAX(1, elapsed / runs);
+}
+
+
+/* Least-squares fit of ns = fixed + slope * units, with neither term allowed to go negative. */
+static void
+fit_model(vba_kdf_model_t *model,
+          const double *units,
+          const double *ns,
+          uint32_t count)
+{
+    double sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0;
+    double denominator = 0.0;
+
+    memset(model, 0x00, sizeof(vba_kdf_model_t));
+    if (0 == count) return;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        sum_x += units[i];
+        sum_y += ns[i];
+        sum_xx += units[i] * units[i];
+        sum_xy += units[i] * ns[i];
+    }
+
+    denominator = (count * sum_xx) - (sum_x * sum_x);
+
+    if (count > 1 && denominator > 0.0) {
+        model->ns_per_unit = ((count * sum_xy) - (sum_x * sum_y)) / denominator;
+        model->fixed_ns = (sum_y - (model->ns_per_unit * sum_x)) / count;
+    }
+
+    /* A single point (or a degenerate fit) just scales through the origin. */
+    if (model->ns_per_unit <= 0.0 || model->fixed_ns < 0.0) {
+        model->ns_per_unit = sum_y / MAX(1.0, sum_x);
+        model->fixed_ns = 0.0;
+    }
+
+    model->samples = count;
+}
+
+
+
+int
+calibrate__run(vba_calibration_t *calibration,
+               uint32_t budget_ms)
+{
+    static const size_t probe_count = sizeof(CALIBRATION_PROBES) / sizeof(calibration_probe_t);
+
+    subnet_t subnet = { .prefix = {0xFE, 0x80}, .length = 8 };
+    pseudo_net_dev_t device = {};
+    const calibration_probe_t *probe = NULL;
+    vba_kdf_cost_t cost = {0};
+    double units[sizeof(CALIBRATION_PROBES) / sizeof(calibration_probe_t)];
+    double ns[sizeof(CALIBRATION_PROBES) / sizeof(calibration_probe_t)];
+    uint64_t share_ns = 0;
+    uint64_t started = 0;
+    uint64_t sample = 0;
+    uint32_t count = 0;
+    int status = 0;
+
+    if (NULL == calibration) return -1;
+
+    memset(calibration, 0x00, sizeof(vba_calibration_t));
+
+    device.iem = VBA_IEM_AGV;
+    device.link_layer_id.length = 6;
+    memset(device.link_layer_id.id, 0x11, 6);
+    device.subnet_prefixes = &subnet;
+    device.subnet_prefixes_count = 1;
+
+    share_ns = ((uint64_t)MAX(1, budget_ms) * 1000000ULL) / 3;
+
+    for (int kdf = VBA_ALGO_PBKDF2; kdf <= VBA_ALGO_SCRYPT; ++kdf) {
+        count = 0;
+        started = metrics__now_ns();
+
+        for (size_t i = 0; i < probe_count; ++i) {
+            probe = &(CALIBRATION_PROBES[i]);
+            if (kdf != (int)probe->kdf) continue;
+
+            /* Two points are needed for a fit; past that, respect the budget. */
+            if (count >= 2 && (metrics__now_ns() - started) >= share_ns) break;
+
+            status = create_probe_voucher(probe, &device);
+            if (0 != status) return -2;
+
+            vba__estimate_cost(device.active_voucher, probe->work_factor, &cost);
+            sample = measure_probe(&device, probe->work_factor);
+
+            free(device.active_voucher->algorithm_spec);
+            free(device.active_voucher);
+            device.active_voucher = NULL;
+
+            if (0 == sample) return -3;   /* The KDF itself failed. */
+
+            units[count] = (double)cost.cpu_units;
+            ns[count] = (double)sample;
+            count++;
+        }
+
+        fit_model(&(calibration->kdf[kdf]), units, ns, count);
+    }
+
+    return 0;
+}
+
+
+double
+calibrate__predict_ns(const vba_calibration_t *calibration,
+                      const nd_link_voucher_option_t *voucher,
+                      uint16_t work_factor)
+{
+    const vba_kdf_model_t *model = NULL;
+    vba_kdf_cost_t cost = {0};
+    int kdf = 0;
+
+    if (NULL == calibration || NULL == voucher || NULL == voucher->algorithm_spec) return -1.0;
+
+    kdf = kdf_index(voucher->algorithm_spec->type);
+    if (kdf < 0) return -1.0;
+
+    model = &(calibration->kdf[kdf]);
+    if (0 == model->samples) return -1.0;
+
+    if (0 != vba__estimate_cost(voucher, work_factor, &cost)) return -1.0;
+
+    return model->fixed_ns + (model->ns_per_unit * (double)cost.cpu_units);
+}
+
+
+int
+calibrate__save(const vba_calibration_t *calibration,
+                const char *path)
+{
+    FILE *file = NULL;
+
+    if (NULL == calibration || NULL == path) return -1;
+
+    file = fopen(path, "w");
+    if (NULL == file) return -2;
+
+    fprintf(file, "%s %d\n", VBA_CALIBRATION_FILE_MAGIC, VBA_CALIBRATION_FILE_VERSION);
+    for (int kdf = VBA_ALGO_PBKDF2; kdf <= VBA_ALGO_SCRYPT; ++kdf) {
+        fprintf(file,
+                "%s %.9g %.9g %u\n",
+                CALIBRATION_KDF_NAMES[kdf],
+                calibration->kdf[kdf].ns_per_unit,
+                calibration->kdf[kdf].fixed_ns,
+                calibration->kdf[kdf].samples);
+    }
+
+    if (0 != fclose(file)) return -3;
+    return 0;
+}
+
+
+int
+calibrate__load(vba_calibration_t *calibration,
+                const char *path)
+{
+    FILE *file = NULL;
+    char magic[32] = {0};
+    char name[16] = {0};
+    int version = 0;
+    vba_kdf_model_t model = {0};
+    int status = 0;
+
+    if (NULL == calibration || NULL == path) return -1;
+
+    file = fopen(path, "r");
+    if (NULL == file) return -2;
+
+    memset(calibration, 0x00, sizeof(vba_calibration_t));
+
+    if (
+        2 != fscanf(file, "%31s %d", magic, &version)
+        || 0 != strcmp(magic, VBA_CALIBRATION_FILE_MAGIC)
+        || VBA_CALIBRATION_FILE_VERSION != version
+    ) {
+        status = -3;   /* Not a calibration file, or one from another version. */
+        goto Label__load_Close;
+    }
+
+    while (4 == fscanf(file, "%15s %lf %lf %u", name, &(model.ns_per_unit), &(model.fixed_ns), &(model.samples))) {
+        for (int kdf = VBA_ALGO_PBKDF2; kdf <= VBA_ALGO_SCRYPT; ++kdf) {
+            if (0 == strcmp(name, CALIBRATION_KDF_NAMES[kdf])) {
+                memcpy(&(calibration->kdf[kdf]), &model, sizeof(vba_kdf_model_t));
+            }
+        }
+    }
+
+Label__load_Close:
+    fclose(file);
+    return status;
+}
@@ -0,0 +1,72 @@
+#ifndef LIB_VBA_CALIBRATE_H
+#define LIB_VBA_CALIBRATE_H
+
+#include "vba.h"
+
+
+
+#define VBA_CALIBRATION_FILE_MAGIC      "vba-kdf-calibration"
+#define VBA_CALIBRATION_FILE_VERSION    1
+
+
+
+/**
+ * Fitted latency of one KDF on this host: ns = fixed_ns + ns_per_unit * cpu_units, where
+ *   `cpu_units` comes from `vba__estimate_cost`. A model with no samples is uncalibrated.
+ */
+typedef
+struct {
+    double      ns_per_unit;
+    double      fixed_ns;
+    uint32_t    samples;
+} vba_kdf_model_t;
+
+struct vba_calibration {
+    vba_kdf_model_t kdf[3];   /* Indexed by vba_kdf_t. */
+};
+
+
+
+/**
+ * Measure every KDF on this host and fit its cost model. Each KDF is probed with cheap,
+ *   then progressively more expensive work factors until its share of `budget_ms` is spent.
+ *   The PRNG must already be initialized.
+ */
+int
+calibrate__run(
+    vba_calibration_t           *calibration,
+    uint32_t                    budget_ms
+);
+
+/**
+ * Predict the wall time in nanoseconds of one KDF run. Returns a negative value when the
+ *   voucher's KDF has not been calibrated.
+ */
+double
+calibrate__predict_ns(
+    const vba_calibration_t         *calibration,
+    const nd_link_voucher_option_t  *voucher,
+    uint16_t                        work_factor
+);
+
+/**
+ * Write a calibration out as a small text file.
+ */
+int
+calibrate__save(
+    const vba_calibration_t     *calibration,
+    const char                  *path
+);
+
+/**
+ * Read back a calibration written by `calibrate__save`.
+ */
+int
+calibrate__load(
+    vba_calibration_t           *calibration,
+    const char                  *path
+);
+
+
+
+#endif   /* LIB_VBA_CALIBRATE_H */
@@ -0,0 +1,1755 @@
+#include "vba.h"
+#include "metrics.h"
+
+#include "ncache.h"
+#include "ndopt.h"
+#include "negfilter.h"
+#include "pool.h"
+#include "ratelimit.h"
+#include "reservoir.h"
+#include "registry.h"
+#include "rotation.h"
+#include "scheduler.h"
+#include "sha256_mb.h"
+#include "trace.h"
+#include "vba.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+#define CHECK_VERIFIERS             3
+#define CHECK_ROTATIONS             24
+#define CHECK_NCACHE_CAPACITY       1024
+#define CHECK_IDLE_RUNS             3
+#define CHECK_RESERVOIR_CAPACITY    2
+#define CHECK_WAIT_MS               30000
+
+#define CHECK_BATCH_NEIGHBORS       7
+
+#define CHECK_SCHEDULER_PENDING     4
+#define CHECK_SCHEDULER_HOLD_MS     20
+
+/* One set of 4 buckets; 1000 units a second refills 10 in the 10 ms a check sleeps. */
+#define CHECK_RATELIMIT_CAPACITY    4
+#define CHECK_RATELIMIT_RATE        1000
+#define CHECK_RATELIMIT_SLEEP_MS    10
+
+/* Through a device, the LLID earns one verification's cost every 50 ms. */
+#define CHECK_RATELIMIT_RUNS_PER_SECOND     20
+#define CHECK_RATELIMIT_REFILL_MS           200
+
+/* Cheap vouchers: the checks exercise the call paths, not the KDFs. */
+#define CHECK_PBKDF2_PARAMETER      1
+#define CHECK_ARGON2_PARAMETER      ((0x10 << 24) | 64)          /* One lane of 64 blocks. */
+#define CHECK_SCRYPT_PARAMETER      3
+#define CHECK_WORK_FACTOR           0x0100
+#define CHECK_ARGON2_WORK_FACTOR    0x0101                       /* Two passes. */
+#define CHECK_SCRYPT_WORK_FACTOR    (((24 * 4) << 8) | 0x01)     /* N = 128, r = 1, p = 1. */
+#define CHECK_TRACED_WORK_FACTOR    0x0123                       /* Used by no other check. */
+
+/* Slices per resumable verification, at the least. */
+#define CHECK_RESUME_MIN_SLICES     4
+
+#define CHECK_FAIL(name, ...) \
+    do { \
+        printf("  FAIL  %s: ", (name)); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        return 1; \
+    } while (0)
+
+/**
+ * Verifiers racing a rotation. Each one checks the latest committed address against the device
+ *   while the rotation keeps replacing the voucher underneath.
+ */
+typedef
+struct {
+    pseudo_net_dev_t    *device;
+    pthread_mutex_t     lock;
+    ipv6_addr_t         address;   /* Generated under the last committed voucher. */
+    bool                is_done;
+} check_rotation_t;
+
+/**
+ * Holds a pool worker until the check opens it, so that work can be queued up behind it.
+ */
+typedef
+struct {
+    pthread_mutex_t     lock;
+    pthread_cond_t      opened;
+    bool                is_open;
+} check_gate_t;
+
+/**
+ * The order in which a single pool worker ran the tasks of a check: 'N' for a regular task and
+ *   'I' for a run of the idle task.
+ */
+typedef
+struct {
+    vba_pool_t          *pool;
+    char                order[16];
+    size_t              count;
+    size_t              idle_runs;
+} check_order_t;
+
+typedef
+struct {
+    vba_reservoir_t     *reservoir;
+    size_t              available;
+} check_probe_t;
+
+/**
+ * What a scheduler's callbacks saw: the work factors in the order they finished, and how many
+ *   expensive verifications were ever in their callbacks at once.
+ */
+typedef
+struct {
+    pthread_mutex_t     lock;
+    const nd_link_voucher_option_t *voucher;
+    uint16_t            order[16];
+    size_t              count;
+    uint16_t            expensive_work_factor;   /* At or above this, a request is expensive. */
+    size_t              expensive_running;
+    size_t              expensive_running_max;
+} check_schedule_t;
+
+/**
+ * Completions of asynchronous verifications, one slot per neighbor.
+ */
+typedef
+struct {
+    pthread_mutex_t     lock;
+    size_t              completed;
+    int                 statuses[2];
+    size_t              callbacks[2];
+} check_async_t;
+
+typedef
+struct {
+    check_async_t       *async;
+    size_t              index;
+} check_async_slot_t;
+
+/**
+ * One KDF, as the checks which run the same calls under every KDF see it.
+ */
+typedef
+struct {
+    const char          *name;
+    vba_kdf_t           kdf;
+    uint32_t            parameter;
+    uint16_t            work_factor;
+} check_kdf_t;
+
+typedef
+struct {
+    check_rotation_t    *rotation;
+    size_t              verified;
+    size_t              rejected;
+    size_t              errors;
+    int                 last_error;
+} check_verifier_t;
+
+
+
+static const subnet_t CHECK_SUBNET = {
+    .prefix = {0x20, 0x01, 0x0D, 0xB8, 0x00, 0x00, 0x00, 0x00},
+    .length = 8
+};
+
+static const check_kdf_t CHECK_KDFS[] = {
+    { "PBKDF2", VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, CHECK_WORK_FACTOR },
+    { "Argon2", VBA_ALGO_ARGON2, CHECK_ARGON2_PARAMETER, CHECK_ARGON2_WORK_FACTOR },
+    { "Scrypt", VBA_ALGO_SCRYPT, CHECK_SCRYPT_PARAMETER, CHECK_SCRYPT_WORK_FACTOR },
+};
+
+static const llid_t CHECK_LINK_LAYER_ID = {
+    .id = {0xAB, 0xCD, 0xEF, 0x11, 0x22, 0x33},
+    .length = 6
+};
+
+
+
+static void
+init_device(pseudo_net_dev_t *device)
+{
+    memset(device, 0, sizeof(pseudo_net_dev_t));
+
+    device->iem = VBA_IEM_AGV;
+    memcpy(&(device->link_layer_id), &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    device->subnet_prefixes = (subnet_t *)&CHECK_SUBNET;
+    device->subnet_prefixes_count = 1;
+}
+
+
+static void
+gate_init(check_gate_t *gate)
+{
+    pthread_mutex_init(&(gate->lock), NULL);
+    pthread_cond_init(&(gate->opened), NULL);
+    gate->is_open = false;
+}
+
+
+static void
+gate_open(check_gate_t *gate)
+{
+    pthread_mutex_lock(&(gate->lock));
+    gate->is_open = true;
+    pthread_cond_broadcast(&(gate->opened));
+    pthread_mutex_unlock(&(gate->lock));
+}
+
+
+static void
+gate_destroy(check_gate_t *gate)
+{
+    pthread_mutex_destroy(&(gate->lock));
+    pthread_cond_destroy(&(gate->opened));
+}
+
+
+static void
+gate_task(void *argument)
+{
+    check_gate_t *gate = (check_gate_t *)argument;
+
+    pthread_mutex_lock(&(gate->lock));
+    while (!gate->is_open) pthread_cond_wait(&(gate->opened), &(gate->lock));
+    pthread_mutex_unlock(&(gate->lock));
+}
+
+
+static void
+sleep_ms(uint64_t milliseconds)
+{
+    struct timespec duration = { .tv_sec = (time_t)(milliseconds / 1000), .tv_nsec = (long)(milliseconds % 1000) * 1000000 };
+
+    while (0 != nanosleep(&duration, &duration));
+}
+
+
+static uint64_t
+elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+
+/* An address on the check subnet which claims `work_factor`. It does not verify. */
+static void
+claim_work_factor(const nd_link_voucher_option_t *voucher,
+                  uint16_t work_factor,
+                  vba_t *address)
+{
+    memset(address, 0, sizeof(vba_t));
+    memcpy(address->prefix, CHECK_SUBNET.prefix, sizeof(address->prefix));
+    address->prefix_length = CHECK_SUBNET.length;
+
+    /* L = ~(Z ^ Seed[0..1]) */
+    address->suffix.Z = (uint16_t)~work_factor ^ *((const uint16_t *)voucher->seed);
+}
+
+
+/* A raw option whose seed depends only on `voucher_id`; `parameter` is as in `ndopt__encode_link_voucher`. */
+static int
+encode_voucher(uint8_t raw_ndopt[VBA_LINK_VOUCHER_MIN_LENGTH],
+               vba_kdf_t kdf,
+               uint32_t parameter,
+               uint32_t voucher_id)
+{
+    uint8_t seed[VBA_SEED_LENGTH];
+
+    for (int i = 0; i < VBA_SEED_LENGTH; ++i) seed[i] = (uint8_t)((voucher_id * 29) + (i * 5) + 3);
+
+    return ndopt__encode_link_voucher(raw_ndopt, VBA_LINK_VOUCHER_MIN_LENGTH, kdf, parameter, voucher_id, seed);
+}
+
+
+static nd_link_voucher_option_t *
+create_voucher(pseudo_net_dev_t *device,
+               vba_kdf_t kdf,
+               uint32_t parameter,
+               uint32_t voucher_id)
+{
+    uint8_t raw_ndopt[VBA_LINK_VOUCHER_MIN_LENGTH];
+    nd_link_voucher_option_t *voucher = NULL;
+
+    if (0 != encode_voucher(raw_ndopt, kdf, parameter, voucher_id)) return NULL;
+    if (0 != ndopt__process_link_voucher((void *)raw_ndopt, device, &voucher)) return NULL;
+
+    return voucher;
+}
+
+
+static void
+destroy_voucher(nd_link_voucher_option_t *voucher)
+{
+    if (NULL == voucher) return;
+
+    free(voucher->algorithm_spec);
+    free(voucher);
+}
+
+
+/* Generate the device's address in its first subnet, without the heap. */
+static int
+generate_into(pseudo_net_dev_t *device,
+              uint16_t work_factor,
+              vba_t *address)
+{
+    vba_ctx_t ctx;
+
+    vba_ctx__init(&ctx, device, NULL, 0);
+    return vba__generate_ctx(&ctx, 0, work_factor, address);
+}
+
+
+/* The same address with its suffix tampered with, so that it claims the same L but fails. */
+static void
+forge(const vba_t *address,
+      vba_t *forged)
+{
+    memcpy(forged, address, sizeof(vba_t));
+    forged->suffix.H[0] ^= 0x01;
+}
+
+
+
+static void *
+rotation_verifier(void *argument)
+{
+    check_verifier_t *verifier = (check_verifier_t *)argument;
+    check_rotation_t *rotation = verifier->rotation;
+    ipv6_addr_t address;
+    llid_t link_layer_id;
+    bool is_done = false;
+    int status = 0;
+
+    while (!is_done) {
+        pthread_mutex_lock(&(rotation->lock));
+        memcpy(&address, &(rotation->address), sizeof(ipv6_addr_t));
+        is_done = rotation->is_done;
+        pthread_mutex_unlock(&(rotation->lock));
+
+        memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+        status = vba__verify(rotation->device, &address, &link_layer_id);
+
+        if (0 == status) verifier->verified++;
+        else if (-5 == status) verifier->rejected++;   /* Rotated between the copy and the check. */
+        else {
+            verifier->errors++;
+            verifier->last_error = status;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Rotate the voucher while verifications run on the device. Every call must finish under the one
+ *   voucher it started with, so no address is ever cached as secured under a voucher it was not
+ *   generated with.
+ */
+static int
+check_rotation_under_verification(void)
+{
+    const char *name = "rotation while verifying";
+    pseudo_net_dev_t device;
+    vba_rotation_t *rotation = NULL;
+    check_rotation_t shared;
+    check_verifier_t verifiers[CHECK_VERIFIERS];
+    pthread_t threads[CHECK_VERIFIERS];
+    ipv6_addr_t addresses[CHECK_ROTATIONS], address;
+    llid_t link_layer_id;
+    uint32_t voucher_ids[CHECK_ROTATIONS];
+    size_t verified = 0, errors = 0, poisoned = 0;
+    int last_error = 0, status = 0;
+    uint8_t tag = 0;
+
+    init_device(&device);
+    device.neighbor_cache = ncache__create(CHECK_NCACHE_CAPACITY);
+    rotation = rotation__create(&device, NULL, CHECK_WORK_FACTOR);
+    if (NULL == device.neighbor_cache || NULL == rotation) CHECK_FAIL(name, "out of memory");
+
+    memset(&shared, 0, sizeof(check_rotation_t));
+    shared.device = &device;
+    pthread_mutex_init(&(shared.lock), NULL);
+
+    for (size_t i = 0; i < CHECK_ROTATIONS; ++i) {
+        voucher_ids[i] = 0xC000 + (uint32_t)i;
+
+        /* Without a pool the addresses are generated while staging, so the commit cannot be early. */
+        if (
+            0 != rotation__stage(rotation, create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, voucher_ids[i]))
+            || 0 != rotation__commit(rotation)
+        ) {
+            CHECK_FAIL(name, "rotation %zu failed", i);
+        }
+        memcpy(&addresses[i], &(device.address_pool[0]), sizeof(ipv6_addr_t));
+
+        pthread_mutex_lock(&(shared.lock));
+        memcpy(&(shared.address), &addresses[i], sizeof(ipv6_addr_t));
+        pthread_mutex_unlock(&(shared.lock));
+
+        if (0 != i) continue;
+
+        for (size_t t = 0; t < CHECK_VERIFIERS; ++t) {
+            memset(&verifiers[t], 0, sizeof(check_verifier_t));
+            verifiers[t].rotation = &shared;
+
+            if (0 != pthread_create(&threads[t], NULL, rotation_verifier, &verifiers[t])) {
+                CHECK_FAIL(name, "pthread_create");
+            }
+        }
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&(shared.lock));
+    shared.is_done = true;
+    pthread_mutex_unlock(&(shared.lock));
+
+    for (size_t t = 0; t < CHECK_VERIFIERS; ++t) {
+        pthread_join(threads[t], NULL);
+        verified += verifiers[t].verified;
+        errors += verifiers[t].errors;
+        if (0 != verifiers[t].errors) last_error = verifiers[t].last_error;
+    }
+
+    for (size_t i = 0; i < CHECK_ROTATIONS; ++i) {
+        for (size_t j = 0; j < CHECK_ROTATIONS; ++j) {
+            if (
+                i != j
+                && 0 == ncache__lookup(device.neighbor_cache, &addresses[i], &CHECK_LINK_LAYER_ID, voucher_ids[j], &tag)
+                && VBA_TAG_SECURED == tag
+            ) {
+                poisoned++;
+            }
+        }
+    }
+
+    /* Once the verifiers are gone, the last rotation's address checks out against the device. */
+    memcpy(&address, &addresses[CHECK_ROTATIONS - 1], sizeof(ipv6_addr_t));
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    status = vba__verify(&device, &address, &link_layer_id);
+
+    rotation__destroy(rotation);
+    ncache__destroy(device.neighbor_cache);
+    pthread_mutex_destroy(&(shared.lock));
+
+    if (0 != status) CHECK_FAIL(name, "the active address did not verify (%d)", status);
+    if (0 != errors) CHECK_FAIL(name, "%zu verification(s) failed, last with %d", errors, last_error);
+    if (0 != poisoned) CHECK_FAIL(name, "%zu address(es) cached as secured under another voucher", poisoned);
+    if (0 != vba__voucher_pins(&device)) CHECK_FAIL(name, "%u pin(s) left on the device", vba__voucher_pins(&device));
+
+    printf("  ok    %s (%zu verified)\n", name, verified);
+    return 0;
+}
+
+
+/*
+ * A voucher whose Argon2 MemorySize is under 8 blocks per lane cannot be derived. A resumable
+ *   verification must fail on it with -2 as `vba__verify` does, rather than fill nothing.
+ */
+static int
+check_resume_refuses_argon2_memory(void)
+{
+    const char *name = "resume refuses Argon2 MemorySize under 8 blocks per lane";
+    pseudo_net_dev_t device;
+    vba_verify_job_t *job = NULL;
+    vba_t address;
+    llid_t link_layer_id;
+    int verify_status = 0, begin_status = 0, resume_status = 0;
+
+    init_device(&device);
+
+    /* Parallelism byte 0x80 is 8 lanes; 8 blocks are rounded up to 16, still under 64. */
+    device.active_voucher = create_voucher(&device, VBA_ALGO_ARGON2, (0x80 << 24) | 8, 0xC100);
+    if (NULL == device.active_voucher) CHECK_FAIL(name, "voucher not parsed");
+
+    memset(&address, 0, sizeof(vba_t));
+    memcpy(address.prefix, CHECK_SUBNET.prefix, sizeof(address.prefix));
+    address.prefix_length = CHECK_SUBNET.length;
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+
+    verify_status = vba__verify(&device, &address, &link_layer_id);
+
+    begin_status = vba__verify_begin(&device, &address, &link_layer_id, &job);
+    if (0 == begin_status) {
+        resume_status = vba__verify_resume(job, UINT64_MAX);
+        vba__verify_job_free(job);
+    }
+
+    destroy_voucher(device.active_voucher);
+
+    if (-2 != verify_status) CHECK_FAIL(name, "vba__verify returned %d", verify_status);
+    if (0 != begin_status) CHECK_FAIL(name, "vba__verify_begin returned %d", begin_status);
+    if (-2 != resume_status) CHECK_FAIL(name, "vba__verify_resume returned %d", resume_status);
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+static void
+regular_task(void *argument)
+{
+    check_order_t *order = (check_order_t *)argument;
+
+    order->order[order->count++] = 'N';
+}
+
+
+/* Requeues itself the way a reservoir refill does, after queueing regular work on its own worker. */
+static void
+idle_task(void *argument)
+{
+    check_order_t *order = (check_order_t *)argument;
+
+    order->order[order->count++] = 'I';
+
+    if (1 == ++(order->idle_runs)) {
+        pool__submit(order->pool, NULL, regular_task, order);
+        pool__submit(order->pool, NULL, regular_task, order);
+    }
+
+    if (order->idle_runs < CHECK_IDLE_RUNS) pool__submit_idle(order->pool, idle_task, order);
+}
+
+
+/*
+ * An idle task only runs once no regular task is queued, even when it is requeued by the worker
+ *   whose own deque holds the regular work.
+ */
+static int
+check_idle_tasks_yield(void)
+{
+    const char *name = "idle tasks yield to queued work";
+    const char *expected = "NINNII";
+    check_gate_t gate;
+    check_order_t order;
+
+    memset(&order, 0, sizeof(check_order_t));
+    gate_init(&gate);
+
+    order.pool = pool__create(1);
+    if (NULL == order.pool) CHECK_FAIL(name, "pool__create");
+
+    pool__submit(order.pool, NULL, gate_task, &gate);
+    pool__submit_idle(order.pool, idle_task, &order);
+    pool__submit(order.pool, NULL, regular_task, &order);
+    gate_open(&gate);
+
+    /* Queued tasks are run before the workers exit. */
+    pool__destroy(order.pool);
+    gate_destroy(&gate);
+
+    if (0 != strcmp(order.order, expected)) CHECK_FAIL(name, "ran '%s', expected '%s'", order.order, expected);
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+static void
+probe_task(void *argument)
+{
+    check_probe_t *probe = (check_probe_t *)argument;
+
+    probe->available = reservoir__available(probe->reservoir, 0);
+}
+
+
+/*
+ * The reservoir's first refill waits behind work queued after it, then tops the subnet up, and
+ *   what it hands out verifies against the device.
+ */
+static int
+check_reservoir_refills_when_idle(void)
+{
+    const char *name = "reservoir refills on idle workers";
+    pseudo_net_dev_t device;
+    vba_pool_t *pool = NULL;
+    vba_reservoir_t *reservoir = NULL;
+    check_gate_t gate;
+    check_probe_t probe;
+    struct timespec started;
+    vba_t address;
+    llid_t link_layer_id;
+    size_t available = 0;
+    int take_status = 0, verify_status = 0;
+
+    init_device(&device);
+    device.active_voucher = create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xC200);
+    pool = pool__create(1);
+    if (NULL == device.active_voucher || NULL == pool) CHECK_FAIL(name, "setup failed");
+
+    gate_init(&gate);
+    pool__submit(pool, NULL, gate_task, &gate);
+
+    reservoir = reservoir__create(&device, pool, CHECK_RESERVOIR_CAPACITY, CHECK_WORK_FACTOR);
+    if (NULL == reservoir) CHECK_FAIL(name, "reservoir__create");
+
+    probe.reservoir = reservoir;
+    probe.available = SIZE_MAX;
+    pool__submit(pool, NULL, probe_task, &probe);
+    gate_open(&gate);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    while ((available = reservoir__available(reservoir, 0)) < CHECK_RESERVOIR_CAPACITY && elapsed_ms(&started) < CHECK_WAIT_MS) {
+        sched_yield();
+    }
+
+    take_status = reservoir__take(reservoir, 0, &address);
+    if (0 == take_status) {
+        memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+        verify_status = vba__verify(&device, &address, &link_layer_id);
+    }
+
+    reservoir__destroy(reservoir);
+    pool__destroy(pool);
+    gate_destroy(&gate);
+    destroy_voucher(device.active_voucher);
+
+    if (0 != probe.available) CHECK_FAIL(name, "%zu address(es) made before the queued task ran", probe.available);
+    if (CHECK_RESERVOIR_CAPACITY != available) CHECK_FAIL(name, "only %zu address(es) after %u ms", available, CHECK_WAIT_MS);
+    if (0 != take_status) CHECK_FAIL(name, "reservoir__take returned %d", take_status);
+    if (0 != verify_status) CHECK_FAIL(name, "the address taken did not verify (%d)", verify_status);
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/*
+ * A new LLID starts with nothing in its bucket, and one whose bucket was crowded out of the table
+ *   comes back just as empty rather than with a fresh burst.
+ */
+static int
+check_ratelimit_no_fresh_burst(void)
+{
+    const char *name = "rate limiter gives no burst to new or recycled keys";
+    ratelimit_config_t config = {
+        .capacity = CHECK_RATELIMIT_CAPACITY,
+        .llid_rate = CHECK_RATELIMIT_RATE,
+        .llid_burst = CHECK_RATELIMIT_RATE,
+    };
+    rate_limiter_t *limiter = ratelimit__create(&config);
+    vba_t address;
+    llid_t link_layer_id;
+    bool is_new_admitted = false, is_refilled_admitted = false, is_recycled_admitted = false;
+
+    if (NULL == limiter) CHECK_FAIL(name, "ratelimit__create");
+
+    memset(&address, 0, sizeof(vba_t));
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+
+    is_new_admitted = ratelimit__admit(limiter, &address, &link_layer_id, 1);
+
+    /* Refilled, then charged a whole burst: the LLID is deep in debt. */
+    sleep_ms(CHECK_RATELIMIT_SLEEP_MS);
+    is_refilled_admitted = ratelimit__admit(limiter, &address, &link_layer_id, CHECK_RATELIMIT_RATE);
+
+    /* Every other LLID lands in the same set; the fourth recycles the indebted one's bucket. */
+    for (int i = 1; i <= CHECK_RATELIMIT_CAPACITY; ++i) {
+        link_layer_id.id[0] = (uint8_t)i;
+        ratelimit__admit(limiter, &address, &link_layer_id, 1);
+    }
+
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    is_recycled_admitted = ratelimit__admit(limiter, &address, &link_layer_id, 1);
+
+    ratelimit__destroy(limiter);
+
+    if (is_new_admitted) CHECK_FAIL(name, "a new LLID was admitted before any refill");
+    if (!is_refilled_admitted) CHECK_FAIL(name, "the LLID was not admitted after %u ms", CHECK_RATELIMIT_SLEEP_MS);
+    if (is_recycled_admitted) CHECK_FAIL(name, "an LLID in debt was admitted once its bucket was recycled");
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+static void
+scheduled_callback(pseudo_net_dev_t *verifier_device,
+                   const ipv6_addr_t *ndar_ip,
+                   const llid_t *ndar_link_layer_id,
+                   int status,
+                   void *context)
+{
+    check_schedule_t *schedule = (check_schedule_t *)context;
+    uint16_t work_factor = vba__extract_work_factor(schedule->voucher, ndar_ip);
+    bool is_expensive = (0 != schedule->expensive_work_factor && work_factor >= schedule->expensive_work_factor);
+
+    pthread_mutex_lock(&(schedule->lock));
+    if (schedule->count < sizeof(schedule->order) / sizeof(schedule->order[0])) {
+        schedule->order[schedule->count++] = work_factor;
+    }
+    if (is_expensive) {
+        schedule->expensive_running++;
+        schedule->expensive_running_max = MAX(schedule->expensive_running_max, schedule->expensive_running);
+    }
+    pthread_mutex_unlock(&(schedule->lock));
+
+    if (!is_expensive) return;
+
+    /* Hold the slot long enough for a second expensive request to overlap, if it were let in. */
+    sleep_ms(CHECK_SCHEDULER_HOLD_MS);
+
+    pthread_mutex_lock(&(schedule->lock));
+    schedule->expensive_running--;
+    pthread_mutex_unlock(&(schedule->lock));
+}
+
+
+static uint64_t
+cpu_units_for(const nd_link_voucher_option_t *voucher,
+              uint16_t work_factor)
+{
+    vba_kdf_cost_t cost = {0};
+
+    vba__estimate_cost(voucher, work_factor, &cost);
+    return cost.cpu_units;
+}
+
+
+/*
+ * With its one worker held, the scheduler dispatches the first request and queues the rest. They
+ *   must then run cheapest first, and requests over the cost ceiling or beyond the queue depth
+ *   are turned away without a callback.
+ */
+static int
+check_scheduler_order_and_limits(void)
+{
+    const char *name = "scheduler runs cheapest first and turns requests away";
+    static const uint16_t QUEUED[] = { 0x0800, 0x2000, 0x0100, 0x1000, 0x0200 };
+    static const uint16_t EXPECTED[] = { 0x0800, 0x0100, 0x0200, 0x1000, 0x2000 };
+    pseudo_net_dev_t device;
+    vba_pool_t *pool = NULL;
+    vba_scheduler_t *sched = NULL;
+    scheduler_policy_t policy = {0};
+    check_schedule_t schedule;
+    check_gate_t gate;
+    vba_t address;
+    llid_t link_layer_id;
+    int statuses[sizeof(QUEUED) / sizeof(QUEUED[0])] = {0};
+    int full_status = 0, ceiling_status = 0;
+    bool is_ordered = true;
+
+    init_device(&device);
+    device.active_voucher = create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xC300);
+    pool = pool__create(1);
+    if (NULL == device.active_voucher || NULL == pool) CHECK_FAIL(name, "setup failed");
+
+    memset(&schedule, 0, sizeof(check_schedule_t));
+    pthread_mutex_init(&(schedule.lock), NULL);
+    schedule.voucher = device.active_voucher;
+
+    policy.max_cpu_units = cpu_units_for(device.active_voucher, 0x4000);
+    policy.max_pending = CHECK_SCHEDULER_PENDING;
+    sched = scheduler__create(pool, &policy);
+    if (NULL == sched) CHECK_FAIL(name, "scheduler__create");
+
+    gate_init(&gate);
+    pool__submit(pool, NULL, gate_task, &gate);
+
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    for (size_t i = 0; i < sizeof(QUEUED) / sizeof(QUEUED[0]); ++i) {
+        claim_work_factor(device.active_voucher, QUEUED[i], &address);
+        statuses[i] = scheduler__submit_verify(sched, &device, &address, &link_layer_id, scheduled_callback, &schedule);
+    }
+
+    /* The first request is already with the pool, and the queue now holds the other four. */
+    claim_work_factor(device.active_voucher, 0x0400, &address);
+    full_status = scheduler__submit_verify(sched, &device, &address, &link_layer_id, scheduled_callback, &schedule);
+
+    claim_work_factor(device.active_voucher, 0x8000, &address);
+    ceiling_status = scheduler__submit_verify(sched, &device, &address, &link_layer_id, scheduled_callback, &schedule);
+
+    gate_open(&gate);
+    scheduler__destroy(sched);
+    pool__destroy(pool);
+    gate_destroy(&gate);
+    pthread_mutex_destroy(&(schedule.lock));
+    destroy_voucher(device.active_voucher);
+
+    for (size_t i = 0; i < sizeof(QUEUED) / sizeof(QUEUED[0]); ++i) {
+        if (0 != statuses[i]) CHECK_FAIL(name, "request %zu was refused with %d", i, statuses[i]);
+        if (i >= schedule.count || EXPECTED[i] != schedule.order[i]) is_ordered = false;
+    }
+
+    if (-15 != full_status) CHECK_FAIL(name, "a request past the queue depth returned %d", full_status);
+    if (-14 != ceiling_status) CHECK_FAIL(name, "a request over the cost ceiling returned %d", ceiling_status);
+    if (sizeof(EXPECTED) / sizeof(EXPECTED[0]) != schedule.count) CHECK_FAIL(name, "%zu callback(s) for 5 requests", schedule.count);
+    if (!is_ordered) {
+        CHECK_FAIL(name, "ran L=%04X %04X %04X %04X %04X",
+                   schedule.order[0], schedule.order[1], schedule.order[2], schedule.order[3], schedule.order[4]);
+    }
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/*
+ * Two workers, but only one expensive KDF at a time: the cheap requests share the other slot.
+ */
+static int
+check_scheduler_expensive_cap(void)
+{
+    const char *name = "scheduler runs one expensive KDF at a time";
+    static const uint16_t REQUESTS[] = { 0x1000, 0x1100, 0x0010, 0x1200, 0x0020 };
+    pseudo_net_dev_t device;
+    vba_pool_t *pool = NULL;
+    vba_scheduler_t *sched = NULL;
+    scheduler_policy_t policy = {0};
+    check_schedule_t schedule;
+    vba_t address;
+    llid_t link_layer_id;
+    int status = 0;
+
+    init_device(&device);
+    device.active_voucher = create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xC400);
+    pool = pool__create(2);
+    if (NULL == device.active_voucher || NULL == pool) CHECK_FAIL(name, "setup failed");
+
+    memset(&schedule, 0, sizeof(check_schedule_t));
+    pthread_mutex_init(&(schedule.lock), NULL);
+    schedule.voucher = device.active_voucher;
+    schedule.expensive_work_factor = 0x1000;
+
+    policy.expensive_cpu_units = cpu_units_for(device.active_voucher, schedule.expensive_work_factor);
+    policy.max_expensive_inflight = 1;
+    policy.max_inflight = 2;
+    sched = scheduler__create(pool, &policy);
+    if (NULL == sched) CHECK_FAIL(name, "scheduler__create");
+
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    for (size_t i = 0; 0 == status && i < sizeof(REQUESTS) / sizeof(REQUESTS[0]); ++i) {
+        claim_work_factor(device.active_voucher, REQUESTS[i], &address);
+        status = scheduler__submit_verify(sched, &device, &address, &link_layer_id, scheduled_callback, &schedule);
+    }
+
+    scheduler__destroy(sched);
+    pool__destroy(pool);
+    pthread_mutex_destroy(&(schedule.lock));
+    destroy_voucher(device.active_voucher);
+
+    if (0 != status) CHECK_FAIL(name, "a request was refused with %d", status);
+    if (sizeof(REQUESTS) / sizeof(REQUESTS[0]) != schedule.count) CHECK_FAIL(name, "%zu callback(s) for 5 requests", schedule.count);
+    if (1 != schedule.expensive_running_max) CHECK_FAIL(name, "%zu expensive KDFs ran at once", schedule.expensive_running_max);
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/* PBKDF2 outcome and KDF latency counts, summed over the work factor buckets. */
+static void
+pbkdf2_counts(uint64_t *outcomes,
+              uint64_t *kdf_runs)
+{
+    vba_metrics_snapshot_t snapshot;
+
+    metrics__snapshot(&snapshot);
+    memset(outcomes, 0, VBA_OUTCOME_COUNT * sizeof(uint64_t));
+    *kdf_runs = 0;
+
+    for (size_t l = 0; l < VBA_METRICS_L_BUCKETS; ++l) {
+        for (size_t o = 0; o < VBA_OUTCOME_COUNT; ++o) outcomes[o] += snapshot.outcomes[0][l][o];
+        for (size_t b = 0; b < VBA_METRICS_LATENCY_BUCKETS; ++b) *kdf_runs += snapshot.kdf_latency[0][l][b];
+    }
+}
+
+
+/*
+ * A PBKDF2 batch goes through the multi-lane kernel. Each neighbor must get the result, outcome
+ *   and KDF count that `vba__verify` gives it, including those refused before or at the KDF.
+ */
+static int
+check_multilane_batch_matches_verify(void)
+{
+    const char *name = "multi-lane batch decides and counts like vba__verify";
+    static const uint16_t WORK_FACTORS[] = { 0x0010, 0x0020, 0x0040 };
+    pseudo_net_dev_t device;
+    vba_pool_t *pool = NULL;
+    vba_neighbor_t neighbors[CHECK_BATCH_NEIGHBORS];
+    int expected[CHECK_BATCH_NEIGHBORS] = {0}, results[CHECK_BATCH_NEIGHBORS] = {0};
+    uint64_t outcomes_before[VBA_OUTCOME_COUNT], outcomes_scalar[VBA_OUTCOME_COUNT], outcomes_batch[VBA_OUTCOME_COUNT];
+    uint64_t runs_before = 0, runs_scalar = 0, runs_batch = 0;
+    int status = 0;
+
+    if (pbkdf2_sha256_mb__lanes() < 2) {
+        printf("  skip  %s: the kernel has one lane here\n", name);
+        return 0;
+    }
+
+    init_device(&device);
+    device.active_voucher = create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xC500);
+    pool = pool__create(2);
+    if (NULL == device.active_voucher || NULL == pool) CHECK_FAIL(name, "setup failed");
+
+    memset(neighbors, 0, sizeof(neighbors));
+    for (size_t i = 0; i < CHECK_BATCH_NEIGHBORS; ++i) {
+        memcpy(&(neighbors[i].link_layer_id), &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    }
+
+    for (size_t i = 0; i < sizeof(WORK_FACTORS) / sizeof(WORK_FACTORS[0]); ++i) {
+        if (0 != generate_into(&device, WORK_FACTORS[i], &(neighbors[i].address))) CHECK_FAIL(name, "vba__generate_ctx");
+    }
+
+    /* A forged suffix, a prefix longer than /64, an overlong LLID and a claimed L of 0. */
+    forge(&(neighbors[0].address), &(neighbors[3].address));
+    memcpy(&(neighbors[4].address), &(neighbors[1].address), sizeof(vba_t));
+    neighbors[4].address.prefix_length = 9;
+    memcpy(&(neighbors[5].address), &(neighbors[2].address), sizeof(vba_t));
+    neighbors[5].link_layer_id.length = sizeof(neighbors[5].link_layer_id.id) + 1;
+    claim_work_factor(device.active_voucher, 0, &(neighbors[6].address));
+
+    pbkdf2_counts(outcomes_before, &runs_before);
+    for (size_t i = 0; i < CHECK_BATCH_NEIGHBORS; ++i) {
+        expected[i] = vba__verify(&device, &(neighbors[i].address), &(neighbors[i].link_layer_id));
+    }
+    pbkdf2_counts(outcomes_scalar, &runs_scalar);
+
+    status = vba__verify_batch(&device, pool, neighbors, CHECK_BATCH_NEIGHBORS, results);
+    pbkdf2_counts(outcomes_batch, &runs_batch);
+
+    pool__destroy(pool);
+    destroy_voucher(device.active_voucher);
+
+    if (0 != status) CHECK_FAIL(name, "vba__verify_batch returned %d", status);
+    for (size_t i = 0; i < CHECK_BATCH_NEIGHBORS; ++i) {
+        if (expected[i] != results[i]) CHECK_FAIL(name, "neighbor %zu: %d in the batch, %d alone", i, results[i], expected[i]);
+    }
+    for (size_t o = 0; o < VBA_OUTCOME_COUNT; ++o) {
+        uint64_t scalar = outcomes_scalar[o] - outcomes_before[o], batch = outcomes_batch[o] - outcomes_scalar[o];
+
+        if (scalar != batch) CHECK_FAIL(name, "outcome %zu: %lu in the batch, %lu alone", o, batch, scalar);
+    }
+    if (runs_scalar - runs_before != runs_batch - runs_scalar) {
+        CHECK_FAIL(name, "%lu KDF runs in the batch, %lu alone", runs_batch - runs_scalar, runs_scalar - runs_before);
+    }
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/*
+ * While a rotation settles, failures arrive under both the new voucher and the retired one. Each
+ *   voucher's must stay rejected, and neither may answer for the other.
+ */
+static int
+check_negfilter_keeps_vouchers_apart(void)
+{
+    const char *name = "negative filter keeps each voucher's failures";
+    pseudo_net_dev_t device;
+    nd_link_voucher_option_t *retired = NULL, *active = NULL;
+    negative_filter_t *filter = NULL;
+    vba_t late, fresh;
+    llid_t link_layer_id;
+    bool is_late_rejected = false, is_fresh_rejected = false, is_crossed = false;
+
+    init_device(&device);
+    retired = create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xC600);
+    active = create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xC601);
+    filter = negfilter__create(0, 0);
+    if (NULL == retired || NULL == active || NULL == filter) CHECK_FAIL(name, "setup failed");
+
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    claim_work_factor(retired, CHECK_WORK_FACTOR, &late);
+    claim_work_factor(active, CHECK_WORK_FACTOR, &fresh);
+    fresh.suffix.H[0] ^= 0x5A;
+
+    /* A failure under the retired voucher lands between two under the new one. */
+    negfilter__record_failure(filter, active, &fresh, &link_layer_id);
+    negfilter__record_failure(filter, retired, &late, &link_layer_id);
+    negfilter__record_failure(filter, active, &late, &link_layer_id);
+
+    is_late_rejected = negfilter__is_rejected(filter, retired, &late, &link_layer_id);
+    is_fresh_rejected = negfilter__is_rejected(filter, active, &fresh, &link_layer_id);
+    is_crossed = negfilter__is_rejected(filter, retired, &fresh, &link_layer_id);
+
+    negfilter__destroy(filter);
+    destroy_voucher(retired);
+    destroy_voucher(active);
+
+    if (!is_late_rejected) CHECK_FAIL(name, "the retired voucher's failure was dropped");
+    if (!is_fresh_rejected) CHECK_FAIL(name, "the active voucher's failure was dropped");
+    if (is_crossed) CHECK_FAIL(name, "a failure under one voucher rejected the binding under another");
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/*
+ * Batches run differently per KDF (multi-lane PBKDF2, a pool task per item otherwise), but every
+ *   item must come out exactly as the single call has it.
+ */
+static int
+check_batches_match_single_calls(const check_kdf_t *kdf)
+{
+    pseudo_net_dev_t device;
+    vba_pool_t *pool = NULL;
+    vba_ctx_t ctx;
+    vba_generate_request_t requests[4];
+    vba_t addresses[4], expected_addresses[4];
+    vba_neighbor_t neighbors[3];
+    int generated[4] = {0}, expected_generated[4] = {0};
+    int verified[3] = {0}, expected_verified[3] = {0};
+    int generate_status = 0, verify_status = 0;
+    char name[96] = {0};
+
+    snprintf(name, sizeof(name), "%s batches match the single calls", kdf->name);
+
+    init_device(&device);
+    device.active_voucher = create_voucher(&device, kdf->kdf, kdf->parameter, 0xC800 + kdf->kdf);
+    pool = pool__create(2);
+    if (NULL == device.active_voucher || NULL == pool) CHECK_FAIL(name, "setup failed");
+
+    /* Two good requests, then a subnet the device does not have and an L of 0. */
+    for (size_t i = 0; i < 4; ++i) {
+        requests[i].subnet_index = (2 == i) ? 1 : 0;
+        requests[i].work_factor = (3 == i) ? 0 : (uint16_t)(kdf->work_factor + (i & 1));
+    }
+
+    memset(addresses, 0, sizeof(addresses));
+    memset(expected_addresses, 0, sizeof(expected_addresses));
+    generate_status = vba__generate_batch(&device, pool, requests, 4, addresses, generated);
+
+    vba_ctx__init(&ctx, &device, NULL, 0);
+    for (size_t i = 0; i < 4; ++i) {
+        expected_generated[i] = vba__generate_ctx(&ctx, requests[i].subnet_index, requests[i].work_factor, &(expected_addresses[i]));
+    }
+
+    /* Both good addresses, and a forgery of the first. */
+    for (size_t i = 0; i < 3; ++i) {
+        memcpy(&(neighbors[i].link_layer_id), &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+        if (i < 2) {
+            memcpy(&(neighbors[i].address), &(addresses[i]), sizeof(vba_t));
+        } else {
+            forge(&(addresses[0]), &(neighbors[i].address));
+        }
+    }
+
+    verify_status = vba__verify_batch(&device, pool, neighbors, 3, verified);
+    for (size_t i = 0; i < 3; ++i) {
+        expected_verified[i] = vba__verify(&device, &(neighbors[i].address), &(neighbors[i].link_layer_id));
+    }
+
+    pool__destroy(pool);
+    destroy_voucher(device.active_voucher);
+
+    if (0 != generate_status) CHECK_FAIL(name, "vba__generate_batch returned %d", generate_status);
+    for (size_t i = 0; i < 4; ++i) {
+        if (expected_generated[i] != generated[i]) {
+            CHECK_FAIL(name, "request %zu: %d in the batch, %d alone", i, generated[i], expected_generated[i]);
+        }
+        if (0 == generated[i] && 0 != memcmp(&(expected_addresses[i]), &(addresses[i]), sizeof(vba_t))) {
+            CHECK_FAIL(name, "request %zu generated another address in the batch", i);
+        }
+    }
+    if (0 != generated[0] || 0 != generated[1] || 0 == generated[2] || 0 == generated[3]) {
+        CHECK_FAIL(name, "generated %d %d %d %d", generated[0], generated[1], generated[2], generated[3]);
+    }
+
+    if (0 != verify_status) CHECK_FAIL(name, "vba__verify_batch returned %d", verify_status);
+    for (size_t i = 0; i < 3; ++i) {
+        if (expected_verified[i] != verified[i]) {
+            CHECK_FAIL(name, "neighbor %zu: %d in the batch, %d alone", i, verified[i], expected_verified[i]);
+        }
+    }
+    if (0 != verified[0] || 0 != verified[1] || -5 != verified[2]) {
+        CHECK_FAIL(name, "verified %d %d %d", verified[0], verified[1], verified[2]);
+    }
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+static void
+async_callback(pseudo_net_dev_t *verifier_device,
+               const ipv6_addr_t *ndar_ip,
+               const llid_t *ndar_link_layer_id,
+               int status,
+               void *context)
+{
+    check_async_slot_t *slot = (check_async_slot_t *)context;
+
+    pthread_mutex_lock(&(slot->async->lock));
+    slot->async->statuses[slot->index] = status;
+    slot->async->callbacks[slot->index]++;
+    slot->async->completed++;
+    pthread_mutex_unlock(&(slot->async->lock));
+}
+
+
+/*
+ * AGVL admits a neighbor at once and settles it later: a good binding ends up SECURED in the
+ *   cache, and a forged one is evicted and then turned away by the negative filter. A neighbor
+ *   already in the cache is not queued again.
+ */
+static int
+check_verify_async_settles(void)
+{
+    const char *name = "asynchronous verification settles the neighbor cache";
+    pseudo_net_dev_t device;
+    vba_pool_t *pool = NULL;
+    check_async_t async;
+    check_async_slot_t slots[2];
+    vba_t addresses[2];
+    llid_t link_layer_id;
+    struct timespec started;
+    uint8_t tags[2] = {0};
+    int queued[2] = {0}, lookups[2] = {0};
+    int repeated = 0, refused = 0;
+    size_t completed = 0;
+
+    init_device(&device);
+    device.iem = VBA_IEM_AGVL;
+    device.active_voucher = create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xC900);
+    device.neighbor_cache = ncache__create(CHECK_NCACHE_CAPACITY);
+    device.negative_filter = negfilter__create(0, 0);
+    pool = pool__create(2);
+    if (
+        NULL == device.active_voucher
+        || NULL == device.neighbor_cache
+        || NULL == device.negative_filter
+        || NULL == pool
+    ) {
+        CHECK_FAIL(name, "setup failed");
+    }
+
+    memset(&async, 0, sizeof(check_async_t));
+    pthread_mutex_init(&(async.lock), NULL);
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+
+    if (0 != generate_into(&device, CHECK_WORK_FACTOR, &(addresses[0]))) CHECK_FAIL(name, "vba__generate_ctx");
+    forge(&(addresses[0]), &(addresses[1]));
+
+    for (size_t i = 0; i < 2; ++i) {
+        slots[i].async = &async;
+        slots[i].index = i;
+        queued[i] = vba__verify_async(&device, pool, &(addresses[i]), &link_layer_id, async_callback, &(slots[i]));
+    }
+
+    /* In flight or settled, the good neighbor is in the cache by now. */
+    repeated = vba__verify_async(&device, pool, &(addresses[0]), &link_layer_id, async_callback, &(slots[0]));
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    for (;;) {
+        pthread_mutex_lock(&(async.lock));
+        completed = async.completed;
+        pthread_mutex_unlock(&(async.lock));
+
+        if (completed >= 2 || elapsed_ms(&started) >= CHECK_WAIT_MS) break;
+        sleep_ms(1);
+    }
+
+    refused = vba__verify_async(&device, pool, &(addresses[1]), &link_layer_id, async_callback, &(slots[1]));
+
+    pool__destroy(pool);
+
+    for (size_t i = 0; i < 2; ++i) {
+        lookups[i] = ncache__lookup(device.neighbor_cache,
+                                    &(addresses[i]),
+                                    &link_layer_id,
+                                    device.active_voucher->voucher_id,
+                                    &(tags[i]));
+    }
+
+    ncache__destroy(device.neighbor_cache);
+    negfilter__destroy(device.negative_filter);
+    destroy_voucher(device.active_voucher);
+    pthread_mutex_destroy(&(async.lock));
+
+    if (0 != queued[0] || 0 != queued[1]) CHECK_FAIL(name, "vba__verify_async returned %d and %d", queued[0], queued[1]);
+    if (0 != repeated) CHECK_FAIL(name, "asking again returned %d", repeated);
+    if (completed < 2) CHECK_FAIL(name, "%zu of 2 verifications completed after %u ms", completed, CHECK_WAIT_MS);
+    if (1 != async.callbacks[0] || 1 != async.callbacks[1]) {
+        CHECK_FAIL(name, "%zu and %zu callbacks for one verification each", async.callbacks[0], async.callbacks[1]);
+    }
+    if (0 != async.statuses[0] || -5 != async.statuses[1]) {
+        CHECK_FAIL(name, "the callbacks got %d and %d", async.statuses[0], async.statuses[1]);
+    }
+    if (0 != lookups[0] || VBA_TAG_SECURED != tags[0]) CHECK_FAIL(name, "the good neighbor is not SECURED in the cache");
+    if (0 == lookups[1]) CHECK_FAIL(name, "the forged neighbor is still in the cache");
+    if (-5 != refused) CHECK_FAIL(name, "a known forgery returned %d", refused);
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/*
+ * The _ctx calls place Argon2 block memory in caller scratch. Nothing else may differ from the
+ *   device calls.
+ */
+static int
+check_ctx_matches_device_calls(void)
+{
+    const char *name = "_ctx calls with scratch match the device calls";
+    pseudo_net_dev_t device;
+    vba_ctx_t ctx;
+    void *scratch = NULL;
+    size_t scratch_size = 0;
+    vba_t address, forged;
+    vba_t *generated = NULL;
+    llid_t link_layer_id;
+    int generate_status = 0, device_generate_status = 0;
+    int verify_ctx_status = 0, verify_status = 0, forged_ctx_status = 0, forged_status = 0;
+    bool is_same_address = false;
+
+    init_device(&device);
+    device.active_voucher = create_voucher(&device, VBA_ALGO_ARGON2, CHECK_ARGON2_PARAMETER, 0xCA00);
+    if (NULL == device.active_voucher) CHECK_FAIL(name, "voucher not parsed");
+
+    scratch_size = vba__kdf_scratch_size(device.active_voucher);
+    scratch = malloc(scratch_size);
+    if (0 == scratch_size || NULL == scratch) CHECK_FAIL(name, "no scratch for %zu bytes", scratch_size);
+
+    vba_ctx__init(&ctx, &device, scratch, scratch_size);
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+
+    generate_status = vba__generate_ctx(&ctx, 0, CHECK_ARGON2_WORK_FACTOR, &address);
+    device_generate_status = vba__generate(&device, 0, CHECK_ARGON2_WORK_FACTOR, &generated);
+    is_same_address = (0 == device_generate_status && 0 == memcmp(generated, &address, sizeof(vba_t)));
+    forge(&address, &forged);
+
+    verify_ctx_status = vba__verify_ctx(&ctx, &address, &link_layer_id);
+    verify_status = vba__verify(&device, &address, &link_layer_id);
+    forged_ctx_status = vba__verify_ctx(&ctx, &forged, &link_layer_id);
+    forged_status = vba__verify(&device, &forged, &link_layer_id);
+
+    free(generated);
+    free(scratch);
+    destroy_voucher(device.active_voucher);
+
+    if (0 != generate_status) CHECK_FAIL(name, "vba__generate_ctx returned %d", generate_status);
+    if (!is_same_address) CHECK_FAIL(name, "vba__generate returned %d or another address", device_generate_status);
+    if (0 != verify_ctx_status || 0 != verify_status) {
+        CHECK_FAIL(name, "the address verified with %d (ctx) and %d (device)", verify_ctx_status, verify_status);
+    }
+    if (-5 != forged_ctx_status || -5 != forged_status) {
+        CHECK_FAIL(name, "the forgery verified with %d (ctx) and %d (device)", forged_ctx_status, forged_status);
+    }
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/*
+ * The C++ wrapper owns the voucher, device, scratch and cache, and its device stays put when the
+ *   handle is moved.
+ */
+static int
+check_cpp_wrapper(void)
+{
+    const char *name = "vba.hpp device generates and verifies, before and after a move";
+    uint8_t raw_ndopt[VBA_LINK_VOUCHER_MIN_LENGTH];
+    vba::Voucher voucher;
+    vba::Device device;
+    vba_t address, forged;
+    llid_t link_layer_id;
+    pseudo_net_dev_t *before = NULL, *after = NULL;
+    int parse_status = 0, generate_status = 0;
+    int statuses[3] = {0};
+
+    if (0 != encode_voucher(raw_ndopt, VBA_ALGO_ARGON2, CHECK_ARGON2_PARAMETER, 0xCB00)) CHECK_FAIL(name, "voucher not encoded");
+
+    parse_status = vba::Voucher::parse(raw_ndopt, voucher);
+    if (0 != parse_status) CHECK_FAIL(name, "vba::Voucher::parse returned %d", parse_status);
+
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    device.set_link_layer_id(link_layer_id.id, link_layer_id.length);
+    device.set_enforcement_mode(VBA_IEM_AGV);
+    device.add_subnet(CHECK_SUBNET.prefix, CHECK_SUBNET.length);
+    device.set_voucher(voucher);
+    if (!device.enable_neighbor_cache(CHECK_NCACHE_CAPACITY)) CHECK_FAIL(name, "no neighbor cache");
+
+    generate_status = device.generate(0, CHECK_ARGON2_WORK_FACTOR, address);
+    forge(&address, &forged);
+    statuses[0] = device.verify(address, link_layer_id);
+
+    before = device.get();
+    vba::Device moved(std::move(device));
+    after = moved.get();
+
+    /* From the cache this time. */
+    statuses[1] = moved.verify(address, link_layer_id);
+    statuses[2] = moved.verify(forged, link_layer_id);
+
+    if (0 != generate_status) CHECK_FAIL(name, "generate returned %d", generate_status);
+    if (before != after) CHECK_FAIL(name, "the device moved in memory with its handle");
+    if (0 != statuses[0] || 0 != statuses[1] || -5 != statuses[2]) {
+        CHECK_FAIL(name, "verified %d, %d once moved, and %d for the forgery", statuses[0], statuses[1], statuses[2]);
+    }
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/*
+ * A verification run in small slices takes several of them (Scrypt cannot be split), and ends
+ *   with the status `vba__verify` gives, on every later call too.
+ */
+static int
+check_resume_matches_verify(const check_kdf_t *kdf)
+{
+    pseudo_net_dev_t device;
+    vba_verify_job_t *job = NULL;
+    vba_kdf_cost_t cost = {0};
+    vba_t addresses[2];
+    llid_t link_layer_id;
+    uint64_t budget = 0;
+    size_t slices[2] = {0};
+    size_t min_slices = (VBA_ALGO_SCRYPT == kdf->kdf) ? 1 : CHECK_RESUME_MIN_SLICES;
+    int expected[2] = {0}, begun[2] = {0}, resumed[2] = {0}, repeated[2] = {0};
+    char name[96] = {0};
+
+    snprintf(name, sizeof(name), "%s verification resumed in slices matches vba__verify", kdf->name);
+
+    init_device(&device);
+    device.active_voucher = create_voucher(&device, kdf->kdf, kdf->parameter, 0xCC00 + kdf->kdf);
+    if (NULL == device.active_voucher) CHECK_FAIL(name, "voucher not parsed");
+
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    if (0 != generate_into(&device, kdf->work_factor, &(addresses[0]))) CHECK_FAIL(name, "vba__generate_ctx");
+    forge(&(addresses[0]), &(addresses[1]));
+
+    vba__estimate_cost(device.active_voucher, kdf->work_factor, &cost);
+    budget = MAX((uint64_t)1, cost.cpu_units / (2 * CHECK_RESUME_MIN_SLICES));
+
+    for (size_t i = 0; i < 2; ++i) {
+        expected[i] = vba__verify(&device, &(addresses[i]), &link_layer_id);
+
+        begun[i] = vba__verify_begin(&device, &(addresses[i]), &link_layer_id, &job);
+        if (0 != begun[i]) continue;
+
+        do {
+            slices[i]++;
+        } while (VBA_VERIFY_PENDING == (resumed[i] = vba__verify_resume(job, budget)));
+
+        repeated[i] = vba__verify_resume(job, budget);
+        vba__verify_job_free(job);
+    }
+
+    destroy_voucher(device.active_voucher);
+
+    for (size_t i = 0; i < 2; ++i) {
+        if (0 != begun[i]) CHECK_FAIL(name, "vba__verify_begin returned %d", begun[i]);
+        if (expected[i] != resumed[i]) CHECK_FAIL(name, "resumed to %d, vba__verify returned %d", resumed[i], expected[i]);
+        if (resumed[i] != repeated[i]) CHECK_FAIL(name, "finished with %d, then returned %d", resumed[i], repeated[i]);
+        if (slices[i] < min_slices) CHECK_FAIL(name, "ran in %zu slice(s) of %lu units", slices[i], budget);
+    }
+    if (0 != expected[0] || -5 != expected[1]) CHECK_FAIL(name, "verified %d and %d", expected[0], expected[1]);
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/* A forgery costs one KDF run; the same forgery again costs none. */
+static int
+check_negfilter_skips_repeat_forgery(void)
+{
+    const char *name = "a repeated forgery is rejected without a KDF run";
+    pseudo_net_dev_t device;
+    vba_t address, forged;
+    llid_t link_layer_id;
+    uint64_t outcomes_before[VBA_OUTCOME_COUNT], outcomes_first[VBA_OUTCOME_COUNT], outcomes_second[VBA_OUTCOME_COUNT];
+    uint64_t runs_before = 0, runs_first = 0, runs_second = 0;
+    int first = 0, second = 0, genuine = 0;
+
+    init_device(&device);
+    device.active_voucher = create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xCD00);
+    device.negative_filter = negfilter__create(0, 0);
+    if (NULL == device.active_voucher || NULL == device.negative_filter) CHECK_FAIL(name, "setup failed");
+
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    if (0 != generate_into(&device, CHECK_WORK_FACTOR, &address)) CHECK_FAIL(name, "vba__generate_ctx");
+    forge(&address, &forged);
+
+    pbkdf2_counts(outcomes_before, &runs_before);
+    first = vba__verify(&device, &forged, &link_layer_id);
+    pbkdf2_counts(outcomes_first, &runs_first);
+    second = vba__verify(&device, &forged, &link_layer_id);
+    pbkdf2_counts(outcomes_second, &runs_second);
+    genuine = vba__verify(&device, &address, &link_layer_id);
+
+    negfilter__destroy(device.negative_filter);
+    destroy_voucher(device.active_voucher);
+
+    if (-5 != first || -5 != second) CHECK_FAIL(name, "the forgery verified with %d, then %d", first, second);
+    if (1 != runs_first - runs_before) CHECK_FAIL(name, "%lu KDF runs for the first try", runs_first - runs_before);
+    if (runs_second != runs_first) CHECK_FAIL(name, "%lu KDF runs for the repeat", runs_second - runs_first);
+    if (1 != outcomes_second[VBA_OUTCOME_REJECTED] - outcomes_first[VBA_OUTCOME_REJECTED]) {
+        CHECK_FAIL(name, "the repeat was not counted as rejected");
+    }
+    if (0 != genuine) CHECK_FAIL(name, "the genuine binding verified with %d", genuine);
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/*
+ * Through `vba__verify`: a neighbor without budget is dropped under AGV, and admitted but not
+ *   cached under AGVL. Once its bucket has refilled it is verified and cached.
+ */
+static int
+check_ratelimit_gates_verify(void)
+{
+    const char *name = "neighbors without budget are dropped by AGV and deferred by AGVL";
+    pseudo_net_dev_t device;
+    vba_kdf_cost_t cost = {0};
+    ratelimit_config_t config = {0};
+    vba_t address;
+    llid_t link_layer_id;
+    uint8_t tag = 0;
+    int dropped = 0, deferred = 0, admitted = 0, deferred_lookup = 0, admitted_lookup = 0;
+
+    init_device(&device);
+    device.active_voucher = create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xCE00);
+    device.neighbor_cache = ncache__create(CHECK_NCACHE_CAPACITY);
+    if (NULL == device.active_voucher || NULL == device.neighbor_cache) CHECK_FAIL(name, "setup failed");
+
+    vba__estimate_cost(device.active_voucher, CHECK_WORK_FACTOR, &cost);
+    config.capacity = CHECK_RATELIMIT_CAPACITY;
+    config.llid_rate = cost.cpu_units * CHECK_RATELIMIT_RUNS_PER_SECOND;
+    config.llid_burst = config.llid_rate;
+    device.rate_limiter = ratelimit__create(&config);
+    if (NULL == device.rate_limiter) CHECK_FAIL(name, "ratelimit__create");
+
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    if (0 != generate_into(&device, CHECK_WORK_FACTOR, &address)) CHECK_FAIL(name, "vba__generate_ctx");
+
+    dropped = vba__verify(&device, &address, &link_layer_id);
+
+    device.iem = VBA_IEM_AGVL;
+    deferred = vba__verify(&device, &address, &link_layer_id);
+    deferred_lookup = ncache__lookup(device.neighbor_cache, &address, &link_layer_id, device.active_voucher->voucher_id, &tag);
+
+    sleep_ms(CHECK_RATELIMIT_REFILL_MS);
+    admitted = vba__verify(&device, &address, &link_layer_id);
+    admitted_lookup = ncache__lookup(device.neighbor_cache, &address, &link_layer_id, device.active_voucher->voucher_id, &tag);
+
+    ratelimit__destroy(device.rate_limiter);
+    ncache__destroy(device.neighbor_cache);
+    destroy_voucher(device.active_voucher);
+
+    if (-18 != dropped) CHECK_FAIL(name, "AGV returned %d", dropped);
+    if (0 != deferred) CHECK_FAIL(name, "AGVL returned %d", deferred);
+    if (0 == deferred_lookup) CHECK_FAIL(name, "a deferred neighbor was cached");
+    if (0 != admitted) CHECK_FAIL(name, "after %u ms, AGVL returned %d", CHECK_RATELIMIT_REFILL_MS, admitted);
+    if (0 != admitted_lookup || VBA_TAG_SECURED != tag) CHECK_FAIL(name, "the verified neighbor is not SECURED in the cache");
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/*
+ * Interfaces hold one shared copy of a voucher and verify each other's addresses. A voucher is
+ *   freed once the last interface holding it lets go.
+ */
+static int
+check_registry_shares_vouchers(void)
+{
+    const char *name = "registry shares vouchers between interfaces and frees them";
+    uint8_t raw_first[VBA_LINK_VOUCHER_MIN_LENGTH], raw_second[VBA_LINK_VOUCHER_MIN_LENGTH];
+    registry_config_t config = {0};
+    vba_registry_t *registry = NULL;
+    vba_pool_t *pool = NULL;
+    vba_device_id_t host = VBA_DEVICE_ID_INVALID, peer = VBA_DEVICE_ID_INVALID;
+    llid_t host_id, peer_id;
+    vba_neighbor_t neighbors[2];
+    int results[2] = {0};
+    int set_statuses[3] = {0}, generate_status = 0, batch_status = 0, remove_status = 0;
+    size_t shared_count = 0, rotated_count = 0, removed_count = 0;
+    bool is_shared = false;
+
+    if (
+        0 != encode_voucher(raw_first, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xCF00)
+        || 0 != encode_voucher(raw_second, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xCF01)
+    ) {
+        CHECK_FAIL(name, "vouchers not encoded");
+    }
+
+    config.neighbor_cache_capacity = CHECK_NCACHE_CAPACITY;
+    pool = pool__create(2);
+    registry = registry__create(pool, &config);
+    if (NULL == pool || NULL == registry) CHECK_FAIL(name, "setup failed");
+
+    memcpy(&host_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    memcpy(&peer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    peer_id.id[5] ^= 0xFF;
+
+    host = registry__add_device(registry, VBA_IEM_AGV, &host_id, &CHECK_SUBNET, 1);
+    peer = registry__add_device(registry, VBA_IEM_AGV, &peer_id, &CHECK_SUBNET, 1);
+    if (VBA_DEVICE_ID_INVALID == host || VBA_DEVICE_ID_INVALID == peer) CHECK_FAIL(name, "registry__add_device");
+
+    set_statuses[0] = registry__set_voucher(registry, host, raw_first, sizeof(raw_first));
+    set_statuses[1] = registry__set_voucher(registry, peer, raw_first, sizeof(raw_first));
+    shared_count = registry__voucher_count(registry);
+    is_shared = (vba__active_voucher(registry__device(registry, host)) == vba__active_voucher(registry__device(registry, peer)));
+
+    /* The host's address and a forgery of it, as the peer sees them. */
+    memcpy(&(neighbors[0].link_layer_id), &host_id, sizeof(llid_t));
+    memcpy(&(neighbors[1].link_layer_id), &host_id, sizeof(llid_t));
+    generate_status = generate_into(registry__device(registry, host), CHECK_WORK_FACTOR, &(neighbors[0].address));
+    forge(&(neighbors[0].address), &(neighbors[1].address));
+    batch_status = registry__verify_batch(registry, peer, neighbors, 2, results);
+
+    set_statuses[2] = registry__set_voucher(registry, host, raw_second, sizeof(raw_second));
+    rotated_count = registry__voucher_count(registry);
+
+    remove_status = registry__remove_device(registry, host);
+    removed_count = registry__voucher_count(registry);
+
+    registry__destroy(registry);
+    pool__destroy(pool);
+
+    if (0 != set_statuses[0] || 0 != set_statuses[1] || 0 != set_statuses[2]) {
+        CHECK_FAIL(name, "registry__set_voucher returned %d, %d and %d", set_statuses[0], set_statuses[1], set_statuses[2]);
+    }
+    if (1 != shared_count || !is_shared) CHECK_FAIL(name, "%zu voucher(s) held for one option", shared_count);
+    if (0 != generate_status) CHECK_FAIL(name, "vba__generate_ctx returned %d", generate_status);
+    if (0 != batch_status || 0 != results[0] || -5 != results[1]) {
+        CHECK_FAIL(name, "registry__verify_batch returned %d, verifying %d and %d", batch_status, results[0], results[1]);
+    }
+    if (2 != rotated_count) CHECK_FAIL(name, "%zu voucher(s) held for two options", rotated_count);
+    if (0 != remove_status || 1 != removed_count) {
+        CHECK_FAIL(name, "registry__remove_device returned %d and left %zu voucher(s)", remove_status, removed_count);
+    }
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+static size_t
+work_factor_bucket(uint16_t work_factor)
+{
+    size_t bucket = 0;
+
+    while (bucket + 1 < VBA_METRICS_L_BUCKETS && (2U << bucket) <= work_factor) ++bucket;
+    return bucket;
+}
+
+
+/*
+ * The Prometheus file holds what a snapshot taken just before it holds, here for PBKDF2 at an L
+ *   which no other check uses.
+ */
+static int
+check_prometheus_export(void)
+{
+    const char *name = "Prometheus export matches the metrics snapshot";
+    pseudo_net_dev_t device;
+    vba_metrics_snapshot_t *snapshot = NULL;
+    vba_t address;
+    llid_t link_layer_id;
+    FILE *input = NULL;
+    char path[64] = {0}, line[256] = {0}, pass_line[160] = {0}, count_line[160] = {0};
+    size_t bucket = work_factor_bucket(CHECK_TRACED_WORK_FACTOR);
+    uint64_t passes = 0, runs = 0;
+    int verify_status = 0, write_status = 0;
+    bool has_pass_line = false, has_count_line = false;
+
+    init_device(&device);
+    device.active_voucher = create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xD000);
+    snapshot = (vba_metrics_snapshot_t *)malloc(sizeof(vba_metrics_snapshot_t));
+    if (NULL == device.active_voucher || NULL == snapshot) CHECK_FAIL(name, "setup failed");
+
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    if (0 != generate_into(&device, CHECK_TRACED_WORK_FACTOR, &address)) CHECK_FAIL(name, "vba__generate_ctx");
+    verify_status = vba__verify(&device, &address, &link_layer_id);
+
+    metrics__snapshot(snapshot);
+    passes = snapshot->outcomes[0][bucket][VBA_OUTCOME_PASS];
+    for (size_t b = 0; b < VBA_METRICS_LATENCY_BUCKETS; ++b) runs += snapshot->kdf_latency[0][bucket][b];
+
+    snprintf(pass_line, sizeof(pass_line), "vba_verifications_total{kdf=\"pbkdf2\",l_min=\"%u\",outcome=\"pass\"} %lu\n",
+             1U << bucket, passes);
+    snprintf(count_line, sizeof(count_line), "vba_kdf_duration_seconds_count{kdf=\"pbkdf2\",l_min=\"%u\"} %lu\n",
+             1U << bucket, runs);
+
+    snprintf(path, sizeof(path), "/tmp/vba-check-%d.prom", (int)getpid());
+    write_status = metrics__write_prometheus(path);
+
+    input = fopen(path, "r");
+    while (NULL != input && NULL != fgets(line, sizeof(line), input)) {
+        has_pass_line = has_pass_line || (0 == strcmp(line, pass_line));
+        has_count_line = has_count_line || (0 == strcmp(line, count_line));
+    }
+    if (NULL != input) fclose(input);
+    unlink(path);
+
+    free(snapshot);
+    destroy_voucher(device.active_voucher);
+
+    if (0 != verify_status) CHECK_FAIL(name, "vba__verify returned %d", verify_status);
+    if (0 != write_status) CHECK_FAIL(name, "metrics__write_prometheus returned %d", write_status);
+    if (0 == passes || 0 == runs) CHECK_FAIL(name, "the snapshot missed the verification");
+    if (!has_pass_line) CHECK_FAIL(name, "no line %.*s", (int)strlen(pass_line) - 1, pass_line);
+    if (!has_count_line) CHECK_FAIL(name, "no line %.*s", (int)strlen(count_line) - 1, count_line);
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+/* A verification on this thread leaves its VERIFY and KDF events, in order, in the trace file. */
+static int
+check_trace_records_verification(void)
+{
+    const char *name = "trace file holds a verification's events in order";
+    static const uint8_t SEQUENCE[] = {
+        VBA_TRACE_VERIFY_BEGIN, VBA_TRACE_KDF_BEGIN, VBA_TRACE_KDF_END, VBA_TRACE_VERIFY_END
+    };
+    pseudo_net_dev_t device;
+    vba_trace_file_header_t header = {0};
+    vba_trace_thread_t thread = {0};
+    vba_trace_event_t event = {0};
+    vba_t address;
+    llid_t link_layer_id;
+    FILE *input = NULL;
+    char path[64] = {0};
+    size_t matched = 0;
+    int verify_status = 0, write_status = 0;
+    bool is_readable = false, is_found = false;
+
+    init_device(&device);
+    device.active_voucher = create_voucher(&device, VBA_ALGO_PBKDF2, CHECK_PBKDF2_PARAMETER, 0xD100);
+    if (NULL == device.active_voucher) CHECK_FAIL(name, "voucher not parsed");
+
+    memcpy(&link_layer_id, &CHECK_LINK_LAYER_ID, sizeof(llid_t));
+    if (0 != generate_into(&device, CHECK_TRACED_WORK_FACTOR, &address)) CHECK_FAIL(name, "vba__generate_ctx");
+
+    trace__set_enabled(true);
+    verify_status = vba__verify(&device, &address, &link_layer_id);
+
+    snprintf(path, sizeof(path), "/tmp/vba-check-%d.trace", (int)getpid());
+    write_status = trace__write(path);
+
+    input = fopen(path, "rb");
+    is_readable = (
+        NULL != input
+        && 1 == fread(&header, sizeof(header), 1, input)
+        && VBA_TRACE_FILE_MAGIC == header.magic
+        && sizeof(vba_trace_event_t) == header.event_size
+    );
+
+    for (uint64_t t = 0; is_readable && !is_found && t < header.thread_count; ++t) {
+        if (1 != fread(&thread, sizeof(thread), 1, input)) break;
+
+        matched = 0;
+        for (uint64_t e = 0; e < thread.event_count && 1 == fread(&event, sizeof(event), 1, input); ++e) {
+            if (is_found || CHECK_TRACED_WORK_FACTOR != event.work_factor || SEQUENCE[matched] != event.kind) continue;
+
+            if (++matched == sizeof(SEQUENCE)) is_found = (0 == event.result);
+        }
+    }
+
+    if (NULL != input) fclose(input);
+    unlink(path);
+    destroy_voucher(device.active_voucher);
+
+    if (0 != verify_status) CHECK_FAIL(name, "vba__verify returned %d", verify_status);
+    if (0 != write_status) CHECK_FAIL(name, "trace__write returned %d", write_status);
+    if (!is_readable) CHECK_FAIL(name, "the trace file has no valid header");
+    if (!is_found) CHECK_FAIL(name, "no thread has VERIFY_BEGIN, KDF_BEGIN, KDF_END, VERIFY_END at L=%04X", CHECK_TRACED_WORK_FACTOR);
+
+    printf("  ok    %s\n", name);
+    return 0;
+}
+
+
+
+int
+main(int argc,
+     char **argv)
+{
+    int failures = 0;
+
+    /*
+     * Usage: vba-check
+     *   Runs the library's behavior checks; exits non-zero on any failure.
+     */
+    if (argc > 1) {
+        fprintf(stderr, "Usage: %s\n", argv[0]);
+        return 2;
+    }
+
+    printf("Rotation:\n");
+    failures += check_rotation_under_verification();
+
+    printf("Batches:\n");
+    for (size_t i = 0; i < sizeof(CHECK_KDFS) / sizeof(CHECK_KDFS[0]); ++i) {
+        failures += check_batches_match_single_calls(&CHECK_KDFS[i]);
+    }
+    failures += check_multilane_batch_matches_verify();
+
+    printf("Asynchronous verification:\n");
+    failures += check_verify_async_settles();
+
+    printf("Context API:\n");
+    failures += check_ctx_matches_device_calls();
+    failures += check_cpp_wrapper();
+
+    printf("Pool:\n");
+    failures += check_idle_tasks_yield();
+
+    printf("Reservoir:\n");
+    failures += check_reservoir_refills_when_idle();
+
+    printf("Scheduler:\n");
+    failures += check_scheduler_order_and_limits();
+    failures += check_scheduler_expensive_cap();
+
+    printf("Negative filter:\n");
+    failures += check_negfilter_keeps_vouchers_apart();
+    failures += check_negfilter_skips_repeat_forgery();
+
+    printf("Rate limiter:\n");
+    failures += check_ratelimit_no_fresh_burst();
+    failures += check_ratelimit_gates_verify();
+
+    printf("Registry:\n");
+    failures += check_registry_shares_vouchers();
+
+    printf("Resumable verification:\n");
+    for (size_t i = 0; i < sizeof(CHECK_KDFS) / sizeof(CHECK_KDFS[0]); ++i) {
+        failures += check_resume_matches_verify(&CHECK_KDFS[i]);
+    }
+    failures += check_resume_refuses_argon2_memory();
+
+    printf("Metrics and trace:\n");
+    failures += check_prometheus_export();
+    failures += check_trace_records_verification();
+
+    if (0 != failures) {
+        printf("%d behavior check(s) failed.\n", failures);
+        return 1;
+    }
+
+    printf("All behavior checks passed.\n");
+    return 0;
+}
@@ -1,26 +1,128 @@
 #include "generator.h"
 
+#include <pthread.h>
+#include <string.h>
+
 
 static inline uint64_t rotl( const uint64_t x, int k ) {
     return ( (x << k) | (x >> (64 - k)) );
 }
 
 
-static uint64_t s[2];
-static int s_seeded = 0;
+/*
+ * Every thread draws from its own stream. Streams are cut from a single root state with the
+ *   long-jump function, so they are 2^96 outputs apart: a thread may jump ahead 2^64 outputs at a
+ *   time, 2^32 times over, without ever reaching the next thread's stream.
+ */
+static uint64_t root[2];
+static uint64_t root_epoch = 0;   /* Bumped by every `Xoshiro128p__init`; 0 means never seeded. */
+static pthread_mutex_t root_lock = PTHREAD_MUTEX_INITIALIZER;
 
-uint64_t
-Xoshiro128p__next_bounded(uint64_t low, uint64_t high)
-{
-    const uint64_t range = 1 + high - low;
+static __thread uint64_t s[2];
+static __thread uint64_t s_epoch = 0;
 
-    const uint64_t s0 = s[0];
-    uint64_t s1 = s[1];
+
+static inline uint64_t
+next(uint64_t *state)
+{
+    const uint64_t s0 = state[0];
+    uint64_t s1 = state[1];
     const uint64_t result = s0 + s1;
 
     s1 ^= s0;
-    s[0] = rotl( s0, 24 ) ^ s1 ^ (s1 << 16);
-    s[1] = rotl( s1, 37 );
+    state[0] = rotl( s0, 24 ) ^ s1 ^ (s1 << 16);
+    state[1] = rotl( s1, 37 );
+
+    return result;
+}
+
+
+// Equivalent to 2^64 calls to `next`.
+static const uint64_t JUMP[] = { 0xdf900294d8f554a5, 0x170865df4b3201fc };
+
+// Equivalent to 2^96 calls to `next`.
+static const uint64_t LONG_JUMP[] = { 0xd2a98b26625eee7b, 0xdddf9b1090aa7ac1 };
+
+
+// Advance the state by the jump polynomial given.
+static void
+jump(uint64_t *state, const uint64_t *polynomial)
+{
+    uint64_t s0 = 0;
+    uint64_t s1 = 0;
+
+    for (size_t i = 0; i < 2; ++i) {
+        for (int b = 0; b < 64; ++b) {
+            if (polynomial[i] & ((uint64_t)1 << b)) {
+                s0 ^= state[0];
+                s1 ^= state[1];
+            }
+            next(state);
+        }
+    }
+
+    state[0] = s0;
+    state[1] = s1;
+}
+
+
+// Must be called with the root lock held.
+static void
+seed_root()
+{
+    uint64_t seed_value;
+    unsigned int lo, hi;
+    tinymt64_t* p_prng_init;
+
+    // Get the amount of cycles since the processor was powered on.
+    //   This should act as a sufficient non-time-based PRNG seed.
+    __asm__ __volatile__ (  "rdtsc" : "=a" (lo), "=d" (hi)  );
+    seed_value = ( ((uint64_t)hi << 32) | lo );
+
+    p_prng_init = (tinymt64_t*)calloc( 1, sizeof(tinymt64_t) );
+    tinymt64_init( p_prng_init, seed_value );
+
+    // Seed the root Xoshiro128+ state.
+    root[0] = tinymt64_generate_uint64( p_prng_init );
+    root[1] = tinymt64_generate_uint64( p_prng_init );
+
+    free( p_prng_init );
+    __atomic_store_n( &root_epoch, root_epoch + 1, __ATOMIC_RELAXED );
+}
+
+
+// Hand the calling thread the next unused stream, seeding the root first if nobody has.
+static void
+claim_stream()
+{
+    pthread_mutex_lock( &root_lock );
+
+    if ( 0 == root_epoch ) seed_root();
+
+    s[0] = root[0];
+    s[1] = root[1];
+    s_epoch = root_epoch;
+
+    jump( root, LONG_JUMP );
+
+    pthread_mutex_unlock( &root_lock );
+}
+
+
+static inline uint64_t *
+thread_state()
+{
+    if ( s_epoch != __atomic_load_n( &root_epoch, __ATOMIC_RELAXED ) || 0 == s_epoch ) claim_stream();
+
+    return s;
+}
+
+
+uint64_t
+Xoshiro128p__next_bounded(uint64_t low, uint64_t high)
+{
+    const uint64_t range = 1 + high - low;
+    const uint64_t result = next( thread_state() );
 
     return (
         ( high > low )
@@ -45,24 +147,33 @@ uint64_t Xoshiro128p__next_bounded_any()
 }
 
 void
-Xoshiro128p__init()
+Xoshiro128p__fill(uint8_t *buffer, size_t length)
 {
-    uint64_t seed_value;
-    unsigned int lo, hi;
-    tinymt64_t* p_prng_init;
+    uint64_t *state = thread_state();
+    uint64_t value;
 
-    // Get the amount of cycles since the processor was powered on.
-    //   This should act as a sufficient non-time-based PRNG seed.
-    __asm__ __volatile__ (  "rdtsc" : "=a" (lo), "=d" (hi)  );
-    seed_value = ( ((uint64_t)hi << 32) | lo );
+    for ( ; length >= sizeof(value); length -= sizeof(value), buffer += sizeof(value) ) {
+        value = next( state );
+        memcpy( buffer, &value, sizeof(value) );
+    }
 
-    p_prng_init = (tinymt64_t*)calloc( 1, sizeof(tinymt64_t) );
-    tinymt64_init( p_prng_init, seed_value );
+    if ( length > 0 ) {
+        value = next( state );
+        memcpy( buffer, &value, length );
+    }
+}
 
-    // Seed Xoshiro128+.
-    s[0] = tinymt64_generate_uint64( p_prng_init );
-    s[1] = tinymt64_generate_uint64( p_prng_init );
+void
+Xoshiro128p__jump()
+{
+    jump( thread_state(), JUMP );
+}
 
-    free( p_prng_init );
-    s_seeded = 1;
+void
+Xoshiro128p__init()
+{
+    // Reseed the root; every thread picks up a fresh stream from it on its next draw.
+    pthread_mutex_lock( &root_lock );
+    seed_root();
+    pthread_mutex_unlock( &root_lock );
 }
@@ -8,10 +8,17 @@
 #include "tinymt64.h"
 
 
+/* Each thread draws from its own stream; all of them are cut 2^96 draws apart from one root. */
 void Xoshiro128p__init();
 
 uint64_t Xoshiro128p__next_bounded(uint64_t low, uint64_t high);
 uint64_t Xoshiro128p__next_bounded_any();
 
+/* Fill a buffer with random bytes from the calling thread's stream, 8 bytes per draw. */
+void Xoshiro128p__fill(uint8_t *buffer, size_t length);
+
+/* Skip the calling thread's stream 2^64 draws ahead. Up to 2^32 jumps stay within the stream. */
+void Xoshiro128p__jump();
+
 
 #endif /* _GENERATOR_H_ */
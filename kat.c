@@ -0,0 +1,357 @@
+#include "vba.h"
+
+#include "argon2_lanes.h"
+#include "argon2d.h"
+#include "pool.h"
+#include "scrypt.h"
+#include "sha256.h"
+#include "sha256_mb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+#define KAT_MAX_OUTPUT              64
+#define KAT_ARGON2_HELPERS          3
+#define KAT_SCRYPT_RESERVE_LOG2     2   /* V buffers sized for 4 N; the output must not change. */
+#define KAT_MULTILANE_SALT_MAX      64
+#define KAT_MULTILANE_ROUNDS        4    /* Jobs per lane, so retired lanes are refilled. */
+
+/**
+ * One RFC 7914 (section 11) PBKDF2-HMAC-SHA256 vector.
+ */
+typedef
+struct {
+    const char  *password;
+    const char  *salt;
+    uint32_t    iterations;
+    const char  *expected;   /* Hex, 64 bytes. */
+} kat_pbkdf2_vector_t;
+
+/**
+ * One RFC 7914 (section 12) scrypt vector.
+ */
+typedef
+struct {
+    const char  *password;
+    const char  *salt;
+    uint64_t    N;
+    uint32_t    r;
+    uint32_t    p;
+    const char  *expected;   /* Hex, 64 bytes. */
+} kat_scrypt_vector_t;
+
+
+
+/* RFC 9106, section 5.1: Argon2d v1.3 with a secret and associated data. */
+#define KAT_ARGON2D_T_COST          3
+#define KAT_ARGON2D_M_COST          32
+#define KAT_ARGON2D_LANES           4
+#define KAT_ARGON2D_TAG_LENGTH      32
+#define KAT_ARGON2D_TAG             "512b391b6f1162975371d30919734294f868e3be3984f3c1a13a4db9fabe4acb"
+
+static const kat_pbkdf2_vector_t KAT_PBKDF2_VECTORS[] = {
+    { "passwd", "salt", 1,
+      "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+      "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783" },
+    { "Password", "NaCl", 80000,
+      "4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56"
+      "a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d" },
+};
+
+static const kat_scrypt_vector_t KAT_SCRYPT_VECTORS[] = {
+    { "", "", 16, 1, 1,
+      "77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442"
+      "fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906" },
+    { "password", "NaCl", 1024, 8, 16,
+      "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162"
+      "2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640" },
+    { "pleaseletmein", "SodiumChloride", 16384, 8, 1,
+      "7023bdcb3afd7348461c06cd81fd38ebfda8fbba904f8e3ea9b543f6545da1f2"
+      "d5432955613f0fcf62d49705242a9af9e61e85dc0d651e40dfcf017b45575887" },
+};
+
+
+
+static int
+check_output(const char *name,
+             const uint8_t *output,
+             size_t output_length,
+             const char *expected)
+{
+    char hex[2 * KAT_MAX_OUTPUT + 1] = {0};
+
+    for (size_t i = 0; i < output_length; ++i) snprintf(&hex[2 * i], 3, "%02x", output[i]);
+
+    if (0 == strcmp(hex, expected)) {
+        printf("  ok    %s\n", name);
+        return 0;
+    }
+
+    printf("  FAIL  %s\n        got      %s\n        expected %s\n", name, hex, expected);
+    return 1;
+}
+
+
+static int
+check_pbkdf2(const kat_pbkdf2_vector_t *vector)
+{
+    hmac_sha256_midstate_t midstate;
+    uint8_t output[KAT_MAX_OUTPUT] = {0};
+    char name[64] = {0};
+
+    snprintf(name, sizeof(name), "pbkdf2-sha256 c=%u", vector->iterations);
+
+    hmac_sha256__prekey(&midstate, (const uint8_t *)vector->password, strlen(vector->password));
+
+    if (
+        0 != pbkdf2_sha256__from_midstate(&midstate,
+                                          (const uint8_t *)vector->salt,
+                                          strlen(vector->salt),
+                                          vector->iterations,
+                                          output,
+                                          sizeof(output))
+    ) {
+        printf("  FAIL  %s: pbkdf2_sha256__from_midstate\n", name);
+        return 1;
+    }
+
+    return check_output(name, output, sizeof(output), vector->expected);
+}
+
+
+/*
+ * The multi-lane kernel has no published vectors of its own: it must match the scalar PBKDF2
+ *   job for job, over salt lengths on both sides of a block boundary and uneven iteration
+ *   counts, so that lanes retire and are refilled at different times.
+ */
+static int
+check_pbkdf2_multilane(void)
+{
+    hmac_sha256_midstate_t midstate;
+    pbkdf2_sha256_job_t *jobs = NULL;
+    uint8_t *salts = NULL, *outputs = NULL;
+    uint8_t expected[SHA256_DIGEST_LENGTH_BYTES];
+    size_t lanes = pbkdf2_sha256_mb__lanes();
+    size_t count = (lanes * KAT_MULTILANE_ROUNDS) + 3;
+    char name[64] = {0};
+    int status = 0;
+
+    snprintf(name, sizeof(name), "pbkdf2-sha256 %zu lanes = scalar (%zu jobs)", lanes, count);
+
+    jobs = (pbkdf2_sha256_job_t *)calloc(count, sizeof(pbkdf2_sha256_job_t));
+    salts = (uint8_t *)calloc(count, KAT_MULTILANE_SALT_MAX);
+    outputs = (uint8_t *)calloc(count, SHA256_DIGEST_LENGTH_BYTES);
+    if (NULL == jobs || NULL == salts || NULL == outputs) {
+        printf("  FAIL  %s: out of memory\n", name);
+        status = 1;
+        goto Label__check_pbkdf2_multilane_Exit;
+    }
+
+    hmac_sha256__prekey(&midstate, (const uint8_t *)"password", strlen("password"));
+
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t *salt = &salts[i * KAT_MULTILANE_SALT_MAX];
+
+        for (size_t j = 0; j < KAT_MULTILANE_SALT_MAX; ++j) salt[j] = (uint8_t)((i * 31) + j);
+
+        jobs[i].salt = salt;
+        jobs[i].salt_length = (i * 7) % (KAT_MULTILANE_SALT_MAX + 1);
+        jobs[i].iterations = 1 + (uint32_t)((i * 37) % 257);
+        jobs[i].output = &outputs[i * SHA256_DIGEST_LENGTH_BYTES];
+    }
+
+    if (0 != pbkdf2_sha256_mb__run(&midstate, jobs, count)) {
+        printf("  FAIL  %s: pbkdf2_sha256_mb__run\n", name);
+        status = 1;
+        goto Label__check_pbkdf2_multilane_Exit;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        pbkdf2_sha256__from_midstate(&midstate, jobs[i].salt, jobs[i].salt_length, jobs[i].iterations, expected, sizeof(expected));
+
+        if (0 != jobs[i].status || 0 != memcmp(expected, jobs[i].output, sizeof(expected))) {
+            printf("  FAIL  %s: job %zu (salt %zu bytes, c=%u) differs\n",
+                   name, i, jobs[i].salt_length, jobs[i].iterations);
+            status = 1;
+            goto Label__check_pbkdf2_multilane_Exit;
+        }
+    }
+
+    printf("  ok    %s\n", name);
+
+Label__check_pbkdf2_multilane_Exit:
+    free(jobs);
+    free(salts);
+    free(outputs);
+    return status;
+}
+
+
+/*
+ * How the lanes are filled: all at once on this thread, a segment per call (as a resumed
+ *   generation job does), or shared with the lane crew.
+ */
+typedef
+enum {
+    KAT_FILL_SERIAL,
+    KAT_FILL_RESUMED,
+    KAT_FILL_CREW
+} kat_fill_t;
+
+static int
+check_argon2d(const char *name,
+              kat_fill_t fill)
+{
+    uint8_t password[32], salt[16], secret[8], associated_data[12];
+    uint8_t tag[KAT_ARGON2D_TAG_LENGTH] = {0};
+    argon2d_state_t state = {0};
+    argon2d_block_t *memory = NULL;
+    size_t memory_blocks = argon2d__memory_blocks(KAT_ARGON2D_M_COST, KAT_ARGON2D_LANES);
+    int status = 0;
+
+    memset(password, 0x01, sizeof(password));
+    memset(salt, 0x02, sizeof(salt));
+    memset(secret, 0x03, sizeof(secret));
+    memset(associated_data, 0x04, sizeof(associated_data));
+
+    memory = (argon2d_block_t *)aligned_alloc(64, memory_blocks * sizeof(argon2d_block_t));
+    if (NULL == memory) {
+        printf("  FAIL  %s: out of memory\n", name);
+        return 1;
+    }
+
+    if (
+        0 != argon2d__begin_keyed(&state,
+                                  memory,
+                                  password,
+                                  sizeof(password),
+                                  salt,
+                                  sizeof(salt),
+                                  secret,
+                                  sizeof(secret),
+                                  associated_data,
+                                  sizeof(associated_data),
+                                  KAT_ARGON2D_T_COST,
+                                  KAT_ARGON2D_M_COST,
+                                  KAT_ARGON2D_LANES,
+                                  KAT_ARGON2D_TAG_LENGTH)
+    ) {
+        printf("  FAIL  %s: argon2d__begin_keyed\n", name);
+        free(memory);
+        return 1;
+    }
+
+    switch (fill) {
+        case KAT_FILL_SERIAL:   argon2d__fill_segments(&state, SIZE_MAX); break;
+        case KAT_FILL_RESUMED:  while (0 == argon2d__fill_segments(&state, 1)); break;
+        case KAT_FILL_CREW:
+            argon2_lanes__set_helpers(KAT_ARGON2_HELPERS);
+            argon2_lanes__fill(&state);
+            argon2_lanes__set_helpers(0);
+            break;
+    }
+
+    argon2d__finish(&state, tag, sizeof(tag));
+    status = check_output(name, tag, sizeof(tag), KAT_ARGON2D_TAG);
+
+    free(memory);
+    return status;
+}
+
+
+static int
+check_scrypt(const kat_scrypt_vector_t *vector,
+             vba_pool_t *pool,
+             uint64_t reserve_N)
+{
+    hmac_sha256_midstate_t midstate;
+    uint8_t output[KAT_MAX_OUTPUT] = {0};
+    char name[96] = {0};
+
+    snprintf(name, sizeof(name), "scrypt N=%llu r=%u p=%u%s%s",
+             (unsigned long long)vector->N, vector->r, vector->p,
+             (NULL == pool) ? "" : " (pool)",
+             (reserve_N > vector->N) ? " (reserved)" : "");
+
+    hmac_sha256__prekey(&midstate, (const uint8_t *)vector->password, strlen(vector->password));
+
+    if (
+        0 != scrypt__derive(&midstate,
+                            (const uint8_t *)vector->salt,
+                            strlen(vector->salt),
+                            vector->N,
+                            vector->r,
+                            vector->p,
+                            reserve_N,
+                            pool,
+                            output,
+                            sizeof(output))
+    ) {
+        printf("  FAIL  %s: scrypt__derive\n", name);
+        return 1;
+    }
+
+    return check_output(name, output, sizeof(output), vector->expected);
+}
+
+
+
+int
+main(int argc,
+     char **argv)
+{
+    vba_pool_t *pool = NULL;
+    int failures = 0;
+
+    /*
+     * Usage: vba-kat
+     *   Runs the published KDF test vectors through the in-tree kernels; exits non-zero on any mismatch.
+     */
+    if (argc > 1) {
+        fprintf(stderr, "Usage: %s\n", argv[0]);
+        return 2;
+    }
+
+    printf("PBKDF2-HMAC-SHA256 (RFC 7914, section 11):\n");
+    for (size_t i = 0; i < sizeof(KAT_PBKDF2_VECTORS) / sizeof(KAT_PBKDF2_VECTORS[0]); ++i) {
+        failures += check_pbkdf2(&KAT_PBKDF2_VECTORS[i]);
+    }
+    failures += check_pbkdf2_multilane();
+
+    printf("Argon2d (RFC 9106, section 5.1):\n");
+    failures += check_argon2d("argon2d serial", KAT_FILL_SERIAL);
+    failures += check_argon2d("argon2d resumed per segment", KAT_FILL_RESUMED);
+    failures += check_argon2d("argon2d lane crew", KAT_FILL_CREW);
+
+    printf("scrypt (RFC 7914, section 12):\n");
+    for (size_t i = 0; i < sizeof(KAT_SCRYPT_VECTORS) / sizeof(KAT_SCRYPT_VECTORS[0]); ++i) {
+        failures += check_scrypt(&KAT_SCRYPT_VECTORS[i], NULL, KAT_SCRYPT_VECTORS[i].N);
+    }
+
+    /* The same vectors with the lanes split over pool workers. */
+    pool = pool__create(4);
+    if (NULL == pool) {
+        printf("  FAIL  pool__create\n");
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(KAT_SCRYPT_VECTORS) / sizeof(KAT_SCRYPT_VECTORS[0]); ++i) {
+        failures += check_scrypt(&KAT_SCRYPT_VECTORS[i], pool, KAT_SCRYPT_VECTORS[i].N);
+    }
+
+    /* And in buffers reserved for a larger N, as a voucher's derivations get them. */
+    for (size_t i = 0; i < sizeof(KAT_SCRYPT_VECTORS) / sizeof(KAT_SCRYPT_VECTORS[0]); ++i) {
+        failures += check_scrypt(&KAT_SCRYPT_VECTORS[i], pool, KAT_SCRYPT_VECTORS[i].N << KAT_SCRYPT_RESERVE_LOG2);
+    }
+    pool__destroy(pool);
+
+    if (0 != failures) {
+        printf("%d known-answer check(s) failed.\n", failures);
+        return 1;
+    }
+
+    printf("All known-answer checks passed.\n");
+    return 0;
+}
@@ -1,7 +1,10 @@
 #include "vba.h"
 
+#include "calibrate.h"
 #include "generator.h"
+#include "ncache.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
@@ -14,11 +17,15 @@
         goto Label__ErrorExit; \
     }
 
+/* How long `--calibrate` may spend measuring the KDFs. */
+#define CALIBRATION_BUDGET_MS   15000
+
 
 
 static pseudo_net_dev_t THIS_INTERFACE = {
     .iem                    = VBA_IEM_AGV,
     .active_voucher         = NULL,
+    .pending_voucher        = NULL,
     .link_layer_id          = {
         .id = {0xAB, 0xCD, 0xEF, 0x11, 0x22, 0x33},
         .length = 6
@@ -26,7 +33,12 @@ static pseudo_net_dev_t THIS_INTERFACE = {
     .subnet_prefixes        = NULL,
     .subnet_prefixes_count  = 0,
     .address_pool           = NULL,
-    .address_count          = 0
+    .address_count          = 0,
+    .neighbor_cache         = NULL,
+    .negative_filter        = NULL,
+    .rate_limiter           = NULL,
+    .kdf_calibration        = NULL,
+    .kdf_pool               = NULL
 };
 
 static const subnet_t LINK_LOCAL_SUBNET_PREFIX = {
@@ -54,6 +66,26 @@ main(int argc,
     uint32_t argon_memory_size = 0;
     uint8_t *argon_memory_size_scroll = NULL;
 
+    vba_calibration_t calibration = {0};
+    const char *calibrate_output_path = NULL;
+    const char *calibration_path = NULL;
+    uint32_t target_ms = 0;
+
+    /*
+     * Usage:
+     *   vba-tests --calibrate <file>                       Measure the KDFs on this host and save the model.
+     *   vba-tests --calibration <file> --target-ms <ms>    Pick work factors that fit the latency budget.
+     */
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "--calibrate") && (i + 1) < argc) {
+            calibrate_output_path = argv[++i];
+        } else if (0 == strcmp(argv[i], "--calibration") && (i + 1) < argc) {
+            calibration_path = argv[++i];
+        } else if (0 == strcmp(argv[i], "--target-ms") && (i + 1) < argc) {
+            target_ms = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+    }
+
     /* Ready the PRNG. */
     Xoshiro128p__init();
 
@@ -130,6 +162,37 @@ main(int argc,
     ASSERT(NULL != THIS_INTERFACE.active_voucher);
     printf("OK\n");
 
+    THIS_INTERFACE.neighbor_cache = ncache__create(VBA_NCACHE_DEFAULT_CAPACITY);
+    ASSERT(NULL != THIS_INTERFACE.neighbor_cache);
+
+    if (NULL != calibrate_output_path) {
+        printf("Calibrating KDFs (up to %us)...  ", CALIBRATION_BUDGET_MS / 1000); fflush(stdout);
+        status = calibrate__run(&calibration, CALIBRATION_BUDGET_MS);
+        if (0 != status) goto Label__ErrorExit;
+        printf("OK\n");
+
+        for (int kdf = VBA_ALGO_PBKDF2; kdf <= VBA_ALGO_SCRYPT; ++kdf) {
+            printf("\t%d: %.4f ns/unit + %.0f ns  (%u samples)\n",
+                   kdf,
+                   calibration.kdf[kdf].ns_per_unit,
+                   calibration.kdf[kdf].fixed_ns,
+                   calibration.kdf[kdf].samples);
+        }
+
+        status = calibrate__save(&calibration, calibrate_output_path);
+        if (0 != status) goto Label__ErrorExit;
+
+        printf("Saved calibration to '%s'.\n", calibrate_output_path);
+        return 0;
+    }
+
+    if (NULL != calibration_path) {
+        status = calibrate__load(&calibration, calibration_path);
+        if (0 != status) goto Label__ErrorExit;
+
+        THIS_INTERFACE.kdf_calibration = &calibration;
+    }
+
     printf("Important Voucher Details:\n");
     printf("\tSeed: 0x");
     for (int i = 0; i < VBA_SEED_LENGTH; ++i)
@@ -172,7 +235,12 @@ main(int argc,
         printf("%lu  ", i); fflush(stdout);
 
         vba_t *new_vba = NULL;
-        work_factor = (uint16_t)Xoshiro128p__next_bounded_any();
+        if (NULL != THIS_INTERFACE.kdf_calibration && target_ms > 0) {
+            /* Fall back to the cheapest work factor if nothing fits the budget. */
+            work_factor = MAX(1, vba__choose_work_factor(&THIS_INTERFACE, target_ms));
+        } else {
+            work_factor = (uint16_t)Xoshiro128p__next_bounded_any();
+        }
 
         begin = clock();
         status = vba__generate(&THIS_INTERFACE, (i < 2) ? 0 : 1, work_factor, &new_vba);
@@ -212,6 +280,23 @@ main(int argc,
         }
     }
 
+    printf("\n\nRe-verifying interface addresses from the neighbor cache...\n");
+    for (size_t i = 2; i < THIS_INTERFACE.address_count; ++i) {
+        llid_t link_layer_id = THIS_INTERFACE.link_layer_id;   /* An aligned copy; the interface is packed. */
+
+        printf("%lu  ", i); fflush(stdout);
+
+        begin = clock();
+        status = vba__verify(&THIS_INTERFACE,
+                             &(THIS_INTERFACE.address_pool[i]),
+                             &link_layer_id);
+        end = clock();
+        time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
+
+        ASSERT(0 == status);
+        printf("(verified in %fs)\n", time_spent);
+    }
+
     printf("\n\nSUMMARY\nMac Address:\n");
     printf("\t");
     for (size_t i = 0; i < THIS_INTERFACE.link_layer_id.length; ++i) {
@@ -0,0 +1,346 @@
+#include "metrics.h"
+
+#include "vba.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+#define METRICS_SHM_NAME_LENGTH     64
+
+/**
+ * One thread's counters. Only the owning thread writes them, so increments need no atomic
+ *   read-modify-write; readers only need each word to be read whole.
+ */
+typedef
+struct metrics_shard {
+    vba_metrics_snapshot_t  counts;
+    struct metrics_shard    *next;
+    struct metrics_shard    *prev;
+} __attribute__((aligned(64))) metrics_shard_t;
+
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_shard_t *shards = NULL;
+static vba_metrics_snapshot_t retired;   /* Folded in from threads which have exited. */
+
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t shard_key;
+static __thread metrics_shard_t *local_shard = NULL;
+
+static pthread_mutex_t page_lock = PTHREAD_MUTEX_INITIALIZER;
+static vba_metrics_page_t *page = NULL;
+static char page_name[METRICS_SHM_NAME_LENGTH];
+
+static const char *const KDF_NAMES[VBA_METRICS_KDF_TYPES] = { "pbkdf2", "argon2", "scrypt" };
+static const char *const OUTCOME_NAMES[VBA_OUTCOME_COUNT] = { "pass", "fail", "cached", "rejected", "error" };
+
+
+
+static inline void
+bump(uint64_t *counter,
+     uint64_t amount)
+{
+    __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+}
+
+
+static void
+add_snapshot(vba_metrics_snapshot_t *total,
+             const vba_metrics_snapshot_t *counts)
+{
+    const uint64_t *source = (const uint64_t *)counts;
+    uint64_t *target = (uint64_t *)total;
+
+    for (size_t i = 0; i < sizeof(vba_metrics_snapshot_t) / sizeof(uint64_t); ++i) {
+        target[i] += __atomic_load_n(&(source[i]), __ATOMIC_RELAXED);
+    }
+}
+
+
+static void
+retire_shard(void *argument)
+{
+    metrics_shard_t *shard = (metrics_shard_t *)argument;
+
+    pthread_mutex_lock(&shards_lock);
+
+    add_snapshot(&retired, &(shard->counts));
+
+    if (NULL != shard->prev) shard->prev->next = shard->next;
+    else shards = shard->next;
+    if (NULL != shard->next) shard->next->prev = shard->prev;
+
+    pthread_mutex_unlock(&shards_lock);
+
+    /* Anything recorded by later destructors on this thread goes into a fresh shard. */
+    local_shard = NULL;
+    free(shard);
+}
+
+
+static void
+create_shard_key()
+{
+    pthread_key_create(&shard_key, retire_shard);
+}
+
+
+static metrics_shard_t *
+thread_shard()
+{
+    metrics_shard_t *shard = local_shard;
+
+    if (__builtin_expect(NULL != shard, 1)) return shard;
+
+    shard = (metrics_shard_t *)aligned_alloc(64, sizeof(metrics_shard_t));
+    if (NULL == shard) return NULL;
+    memset(shard, 0x00, sizeof(metrics_shard_t));
+
+    pthread_once(&shard_key_once, create_shard_key);
+
+    pthread_mutex_lock(&shards_lock);
+    shard->next = shards;
+    if (NULL != shards) shards->prev = shard;
+    shards = shard;
+    pthread_mutex_unlock(&shards_lock);
+
+    /* Fold the counters into the totals when the thread exits. */
+    pthread_setspecific(shard_key, shard);
+
+    local_shard = shard;
+    return shard;
+}
+
+
+static int
+kdf_index(uint16_t kdf_type)
+{
+    switch (kdf_type) {
+        case VBA_PBKDF2_TYPE:   return 0;
+        case VBA_ARGON2_TYPE:   return 1;
+        case VBA_SCRYPT_TYPE:   return 2;
+        default:                return -1;
+    }
+}
+
+
+/* floor(log2(L)), with L = 0 sharing the first bucket. */
+static inline size_t
+work_factor_bucket(uint16_t work_factor)
+{
+    return (0 == work_factor) ? 0 : (size_t)(31 - __builtin_clz((uint32_t)work_factor));
+}
+
+
+static inline size_t
+latency_bucket(uint64_t elapsed_ns)
+{
+    uint64_t microseconds = elapsed_ns / 1000;
+    size_t bucket = (0 == microseconds) ? 0 : (size_t)(64 - __builtin_clzll(microseconds));
+
+    return MIN(bucket, (size_t)(VBA_METRICS_LATENCY_BUCKETS - 1));
+}
+
+
+
+void
+metrics__record_kdf(uint16_t kdf_type,
+                    uint16_t work_factor,
+                    uint64_t elapsed_ns)
+{
+    metrics_shard_t *shard = thread_shard();
+    int kdf = kdf_index(kdf_type);
+    size_t l_bucket = work_factor_bucket(work_factor);
+
+    if (NULL == shard || kdf < 0) return;
+
+    bump(&(shard->counts.kdf_latency[kdf][l_bucket][latency_bucket(elapsed_ns)]), 1);
+    bump(&(shard->counts.kdf_latency_sum_ns[kdf][l_bucket]), elapsed_ns);
+}
+
+
+void
+metrics__record_outcome(uint16_t kdf_type,
+                        uint16_t work_factor,
+                        vba_outcome_t outcome)
+{
+    metrics_shard_t *shard = thread_shard();
+    int kdf = kdf_index(kdf_type);
+
+    if (NULL == shard || kdf < 0 || outcome >= VBA_OUTCOME_COUNT) return;
+
+    bump(&(shard->counts.outcomes[kdf][work_factor_bucket(work_factor)][outcome]), 1);
+}
+
+
+uint64_t
+metrics__now_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+
+void
+metrics__snapshot(vba_metrics_snapshot_t *snapshot)
+{
+    if (NULL == snapshot) return;
+
+    pthread_mutex_lock(&shards_lock);
+
+    memcpy(snapshot, &retired, sizeof(vba_metrics_snapshot_t));
+    for (metrics_shard_t *shard = shards; NULL != shard; shard = shard->next) {
+        add_snapshot(snapshot, &(shard->counts));
+    }
+
+    pthread_mutex_unlock(&shards_lock);
+}
+
+
+int
+metrics__write_prometheus(const char *path)
+{
+    vba_metrics_snapshot_t *snapshot = NULL;
+    char temporary_path[4096];
+    FILE *output = NULL;
+    int status = 0;
+
+    if (NULL == path) return -1;
+    if ((size_t)snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path) >= sizeof(temporary_path)) return -1;
+
+    /* Too big to be comfortable on a stack. */
+    snapshot = (vba_metrics_snapshot_t *)malloc(sizeof(vba_metrics_snapshot_t));
+    if (NULL == snapshot) return -3;
+    metrics__snapshot(snapshot);
+
+    output = fopen(temporary_path, "w");
+    if (NULL == output) {
+        status = -4;
+        goto Label__write_prometheus_Free;
+    }
+
+    fprintf(output, "# HELP vba_verifications_total Verification decisions, by KDF, claimed work factor and outcome.\n");
+    fprintf(output, "# TYPE vba_verifications_total counter\n");
+    for (int k = 0; k < VBA_METRICS_KDF_TYPES; ++k) {
+        for (int l = 0; l < VBA_METRICS_L_BUCKETS; ++l) {
+            for (int o = 0; o < VBA_OUTCOME_COUNT; ++o) {
+                if (0 == snapshot->outcomes[k][l][o]) continue;
+
+                fprintf(output, "vba_verifications_total{kdf=\"%s\",l_min=\"%u\",outcome=\"%s\"} %lu\n",
+                        KDF_NAMES[k], 1U << l, OUTCOME_NAMES[o], snapshot->outcomes[k][l][o]);
+            }
+        }
+    }
+
+    fprintf(output, "# HELP vba_kdf_duration_seconds KDF run time, by KDF and work factor.\n");
+    fprintf(output, "# TYPE vba_kdf_duration_seconds histogram\n");
+    for (int k = 0; k < VBA_METRICS_KDF_TYPES; ++k) {
+        for (int l = 0; l < VBA_METRICS_L_BUCKETS; ++l) {
+            uint64_t cumulative = 0;
+
+            for (int b = 0; b < VBA_METRICS_LATENCY_BUCKETS; ++b) cumulative += snapshot->kdf_latency[k][l][b];
+            if (0 == cumulative) continue;
+
+            cumulative = 0;
+            for (int b = 0; b < VBA_METRICS_LATENCY_BUCKETS - 1; ++b) {
+                cumulative += snapshot->kdf_latency[k][l][b];
+                fprintf(output, "vba_kdf_duration_seconds_bucket{kdf=\"%s\",l_min=\"%u\",le=\"%g\"} %lu\n",
+                        KDF_NAMES[k], 1U << l, (double)(1ULL << b) / 1e6, cumulative);
+            }
+            cumulative += snapshot->kdf_latency[k][l][VBA_METRICS_LATENCY_BUCKETS - 1];
+
+            fprintf(output, "vba_kdf_duration_seconds_bucket{kdf=\"%s\",l_min=\"%u\",le=\"+Inf\"} %lu\n",
+                    KDF_NAMES[k], 1U << l, cumulative);
+            fprintf(output, "vba_kdf_duration_seconds_sum{kdf=\"%s\",l_min=\"%u\"} %.9f\n",
+                    KDF_NAMES[k], 1U << l, (double)snapshot->kdf_latency_sum_ns[k][l] / 1e9);
+            fprintf(output, "vba_kdf_duration_seconds_count{kdf=\"%s\",l_min=\"%u\"} %lu\n",
+                    KDF_NAMES[k], 1U << l, cumulative);
+        }
+    }
+
+    if (0 != fclose(output)) {
+        status = -4;
+        goto Label__write_prometheus_Free;
+    }
+
+    if (0 != rename(temporary_path, path)) status = -4;
+
+Label__write_prometheus_Free:
+    if (0 != status) unlink(temporary_path);
+    free(snapshot);
+    return status;
+}
+
+
+int
+metrics__publish_shm(const char *name)
+{
+    vba_metrics_snapshot_t *snapshot = NULL;
+    struct timespec now;
+    int descriptor = -1;
+    void *mapping = NULL;
+
+    if (NULL == name || strlen(name) >= METRICS_SHM_NAME_LENGTH) return -1;
+
+    snapshot = (vba_metrics_snapshot_t *)malloc(sizeof(vba_metrics_snapshot_t));
+    if (NULL == snapshot) return -3;
+    metrics__snapshot(snapshot);
+
+    pthread_mutex_lock(&page_lock);
+
+    /* Map the page once; a new name moves the page. */
+    if (NULL != page && 0 != strcmp(page_name, name)) {
+        munmap(page, sizeof(vba_metrics_page_t));
+        page = NULL;
+    }
+
+    if (NULL == page) {
+        descriptor = shm_open(name, O_CREAT | O_RDWR, 0644);
+        if (descriptor < 0) goto Label__publish_shm_Error;
+
+        if (0 != ftruncate(descriptor, sizeof(vba_metrics_page_t))) {
+            close(descriptor);
+            goto Label__publish_shm_Error;
+        }
+
+        mapping = mmap(NULL, sizeof(vba_metrics_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+        close(descriptor);
+        if (MAP_FAILED == mapping) goto Label__publish_shm_Error;
+
+        page = (vba_metrics_page_t *)mapping;
+        strcpy(page_name, name);
+
+        page->magic = VBA_METRICS_PAGE_MAGIC;
+        page->size = sizeof(vba_metrics_page_t);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    /* Odd while writing; readers retry until they see the same even value on both sides. */
+    __atomic_store_n(&(page->sequence), page->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    page->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    memcpy(&(page->snapshot), snapshot, sizeof(vba_metrics_snapshot_t));
+
+    __atomic_store_n(&(page->sequence), page->sequence + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&page_lock);
+    free(snapshot);
+    return 0;
+
+Label__publish_shm_Error:
+    pthread_mutex_unlock(&page_lock);
+    free(snapshot);
+    return -4;
+}
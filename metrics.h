@@ -0,0 +1,107 @@
+#ifndef LIB_VBA_METRICS_H
+#define LIB_VBA_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+#define VBA_METRICS_KDF_TYPES           3    /* PBKDF2, Argon2, Scrypt. */
+#define VBA_METRICS_L_BUCKETS           16   /* Bucket i holds 2^i <= L < 2^(i+1). */
+#define VBA_METRICS_LATENCY_BUCKETS     32   /* Bucket i holds runs under 2^i microseconds. */
+
+#define VBA_METRICS_PAGE_MAGIC          0x56424D31   /* "VBM1" */
+
+
+
+typedef
+enum {
+    VBA_OUTCOME_PASS = 0,
+    VBA_OUTCOME_FAIL,
+    VBA_OUTCOME_CACHED,     /* Decided by the neighbor cache. */
+    VBA_OUTCOME_REJECTED,   /* Turned away before the KDF: not a /64, negative filter or rate limit. */
+    VBA_OUTCOME_ERROR,      /* The KDF itself failed. */
+    VBA_OUTCOME_COUNT
+} vba_outcome_t;
+
+/**
+ * Totals over every thread. Latency buckets are not cumulative.
+ */
+typedef
+struct {
+    uint64_t    outcomes[VBA_METRICS_KDF_TYPES][VBA_METRICS_L_BUCKETS][VBA_OUTCOME_COUNT];
+    uint64_t    kdf_latency[VBA_METRICS_KDF_TYPES][VBA_METRICS_L_BUCKETS][VBA_METRICS_LATENCY_BUCKETS];
+    uint64_t    kdf_latency_sum_ns[VBA_METRICS_KDF_TYPES][VBA_METRICS_L_BUCKETS];
+} vba_metrics_snapshot_t;
+
+/**
+ * Layout of the shared-memory stats page. `sequence` is odd while a snapshot is being written:
+ *   readers copy the snapshot between two reads of an equal, even sequence.
+ */
+typedef
+struct {
+    uint32_t                magic;
+    uint32_t                size;   /* sizeof(vba_metrics_page_t), as a layout check. */
+    uint64_t                sequence;
+    uint64_t                timestamp_ns;   /* CLOCK_REALTIME of the snapshot. */
+    vba_metrics_snapshot_t  snapshot;
+} vba_metrics_page_t;
+
+
+
+/**
+ * Record one KDF run. Every thread counts into its own shard, so this takes no lock and
+ *   shares no cache line with other threads.
+ */
+void
+metrics__record_kdf(
+    uint16_t                    kdf_type,
+    uint16_t                    work_factor,
+    uint64_t                    elapsed_ns
+);
+
+/**
+ * Record how a verification was decided.
+ */
+void
+metrics__record_outcome(
+    uint16_t                    kdf_type,
+    uint16_t                    work_factor,
+    vba_outcome_t               outcome
+);
+
+/**
+ * CLOCK_MONOTONIC in nanoseconds. Every module and tool times with this one clock.
+ */
+uint64_t
+metrics__now_ns();
+
+/**
+ * Sum every thread's counters, including those of threads which have exited.
+ */
+void
+metrics__snapshot(
+    vba_metrics_snapshot_t      *snapshot
+);
+
+/**
+ * Write a snapshot in the Prometheus text format (e.g. for node_exporter's textfile collector).
+ *   The file is replaced atomically, so a scraper never sees half of it.
+ */
+int
+metrics__write_prometheus(
+    const char                  *path
+);
+
+/**
+ * Write a snapshot to a POSIX shared-memory page (see `vba_metrics_page_t`), creating it on the
+ *   first call. Call it periodically from one thread.
+ */
+int
+metrics__publish_shm(
+    const char                  *name
+);
+
+
+
+#endif   /* LIB_VBA_METRICS_H */
@@ -0,0 +1,287 @@
+#include "ncache.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+#define NCACHE_KEY_WORDS    4
+
+/**
+ * A single cache slot. Readers never lock: each slot is guarded by a sequence counter which
+ *   is odd while a writer is modifying it. Readers copy the slot and retry if the sequence moved.
+ */
+typedef
+struct {
+    uint32_t    sequence;
+    uint8_t     tag;   /* Zero when the slot is empty. */
+    uint8_t     __padding[3];
+    uint64_t    stamp;
+    uint64_t    key[NCACHE_KEY_WORDS];
+} ncache_slot_t;
+
+typedef
+struct {
+    ncache_slot_t   slots[VBA_NCACHE_BUCKET_WAYS];
+} __attribute__((aligned(64))) ncache_bucket_t;
+
+struct neighbor_cache {
+    ncache_bucket_t *buckets;
+    size_t          bucket_mask;
+    uint64_t        next_stamp;
+    pthread_mutex_t write_lock;   /* Serializes writers only. */
+};
+
+
+
+static void
+build_key(uint64_t key[NCACHE_KEY_WORDS],
+          const ipv6_addr_t *ip,
+          const llid_t *link_layer_id,
+          uint32_t voucher_id)
+{
+    uint8_t *scroll = (uint8_t *)key;
+    size_t llid_length = MIN(link_layer_id->length, sizeof(link_layer_id->id));
+
+    memset(key, 0x00, NCACHE_KEY_WORDS * sizeof(uint64_t));
+
+    memcpy(scroll, ip, sizeof(ipv6_addr_t));
+    scroll += sizeof(ipv6_addr_t);
+
+    *scroll++ = (uint8_t)llid_length;
+    memcpy(scroll, link_layer_id->id, llid_length);
+    scroll += sizeof(link_layer_id->id);
+
+    memcpy(scroll, &voucher_id, sizeof(uint32_t));
+}
+
+
+static inline size_t
+hash_key(const uint64_t key[NCACHE_KEY_WORDS])
+{
+    uint64_t h = 0;
+
+    for (int i = 0; i < NCACHE_KEY_WORDS; ++i) {
+        h = (h ^ key[i]) * 0x9E3779B97F4A7C15ULL;
+        h ^= (h >> 32);
+    }
+
+    return (size_t)h;
+}
+
+
+static inline bool
+key_equals(const uint64_t *a,
+           const uint64_t *b)
+{
+    return (a[0] == b[0]) && (a[1] == b[1]) && (a[2] == b[2]) && (a[3] == b[3]);
+}
+
+
+/* Take a consistent snapshot of a slot without locking. */
+static inline void
+read_slot(ncache_slot_t *slot,
+          uint8_t *tag,
+          uint64_t key[NCACHE_KEY_WORDS])
+{
+    uint32_t before, after;
+
+    do {
+        before = __atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE);
+        if (before & 1) continue;   /* A writer is mid-update. */
+
+        *tag = __atomic_load_n(&(slot->tag), __ATOMIC_RELAXED);
+        for (int i = 0; i < NCACHE_KEY_WORDS; ++i) {
+            key[i] = __atomic_load_n(&(slot->key[i]), __ATOMIC_RELAXED);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&(slot->sequence), __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
+
+
+/* Publish new slot contents. The caller must hold the write lock. */
+static inline void
+write_slot(ncache_slot_t *slot,
+           uint8_t tag,
+           uint64_t stamp,
+           const uint64_t key[NCACHE_KEY_WORDS])
+{
+    uint32_t sequence = slot->sequence;
+
+    __atomic_store_n(&(slot->sequence), sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&(slot->tag), tag, __ATOMIC_RELAXED);
+    slot->stamp = stamp;
+    for (int i = 0; i < NCACHE_KEY_WORDS; ++i) {
+        __atomic_store_n(&(slot->key[i]), key[i], __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&(slot->sequence), sequence + 2, __ATOMIC_RELEASE);
+}
+
+
+
+neighbor_cache_t *
+ncache__create(size_t capacity)
+{
+    size_t bucket_count = 1;
+    neighbor_cache_t *cache = NULL;
+
+    while ((bucket_count * VBA_NCACHE_BUCKET_WAYS) < MAX(capacity, (size_t)VBA_NCACHE_BUCKET_WAYS)) {
+        bucket_count <<= 1;
+    }
+
+    cache = (neighbor_cache_t *)calloc(1, sizeof(neighbor_cache_t));
+    if (NULL == cache) return NULL;
+
+    cache->buckets = (ncache_bucket_t *)aligned_alloc(64, bucket_count * sizeof(ncache_bucket_t));
+    if (NULL == cache->buckets) {
+        free(cache);
+        return NULL;
+    }
+
+    memset(cache->buckets, 0x00, bucket_count * sizeof(ncache_bucket_t));
+    cache->bucket_mask = bucket_count - 1;
+    pthread_mutex_init(&(cache->write_lock), NULL);
+
+    return cache;
+}
+
+
+void
+ncache__destroy(neighbor_cache_t *cache)
+{
+    if (NULL == cache) return;
+
+    pthread_mutex_destroy(&(cache->write_lock));
+    free(cache->buckets);
+    free(cache);
+}
+
+
+int
+ncache__lookup(neighbor_cache_t *cache,
+               const ipv6_addr_t *ip,
+               const llid_t *link_layer_id,
+               uint32_t voucher_id,
+               uint8_t *tag)
+{
+    uint64_t key[NCACHE_KEY_WORDS];
+    uint64_t slot_key[NCACHE_KEY_WORDS];
+    uint8_t slot_tag = 0;
+    ncache_bucket_t *bucket = NULL;
+
+    if (NULL == cache || NULL == ip || NULL == link_layer_id) return -1;
+
+    build_key(key, ip, link_layer_id, voucher_id);
+    bucket = &(cache->buckets[hash_key(key) & cache->bucket_mask]);
+
+    for (int i = 0; i < VBA_NCACHE_BUCKET_WAYS; ++i) {
+        read_slot(&(bucket->slots[i]), &slot_tag, slot_key);
+
+        if (0 != slot_tag && key_equals(key, slot_key)) {
+            if (NULL != tag) *tag = slot_tag;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+
+int
+ncache__insert(neighbor_cache_t *cache,
+               const ipv6_addr_t *ip,
+               const llid_t *link_layer_id,
+               uint32_t voucher_id,
+               uint8_t tag)
+{
+    uint64_t key[NCACHE_KEY_WORDS];
+    ncache_bucket_t *bucket = NULL;
+    ncache_slot_t *target = NULL;
+
+    if (NULL == cache || NULL == ip || NULL == link_layer_id || 0 == tag) return -1;
+
+    build_key(key, ip, link_layer_id, voucher_id);
+    bucket = &(cache->buckets[hash_key(key) & cache->bucket_mask]);
+
+    pthread_mutex_lock(&(cache->write_lock));
+
+    /* Prefer an existing entry for the same key, then an empty slot, then the oldest entry. */
+    for (int i = 0; i < VBA_NCACHE_BUCKET_WAYS; ++i) {
+        ncache_slot_t *slot = &(bucket->slots[i]);
+
+        if (0 != slot->tag && key_equals(key, slot->key)) {
+            target = slot;
+            break;
+        }
+
+        if (NULL == target || (0 != target->tag && (0 == slot->tag || slot->stamp < target->stamp))) {
+            target = slot;
+        }
+    }
+
+    write_slot(target, tag, ++(cache->next_stamp), key);
+
+    pthread_mutex_unlock(&(cache->write_lock));
+    return 0;
+}
+
+
+int
+ncache__remove(neighbor_cache_t *cache,
+               const ipv6_addr_t *ip,
+               const llid_t *link_layer_id,
+               uint32_t voucher_id)
+{
+    uint64_t key[NCACHE_KEY_WORDS];
+    const uint64_t empty_key[NCACHE_KEY_WORDS] = {0};
+    ncache_bucket_t *bucket = NULL;
+    int status = -1;
+
+    if (NULL == cache || NULL == ip || NULL == link_layer_id) return -1;
+
+    build_key(key, ip, link_layer_id, voucher_id);
+    bucket = &(cache->buckets[hash_key(key) & cache->bucket_mask]);
+
+    pthread_mutex_lock(&(cache->write_lock));
+
+    for (int i = 0; i < VBA_NCACHE_BUCKET_WAYS; ++i) {
+        ncache_slot_t *slot = &(bucket->slots[i]);
+
+        if (0 != slot->tag && key_equals(key, slot->key)) {
+            write_slot(slot, 0, 0, empty_key);
+            status = 0;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&(cache->write_lock));
+    return status;
+}
+
+
+void
+ncache__flush(neighbor_cache_t *cache)
+{
+    const uint64_t empty_key[NCACHE_KEY_WORDS] = {0};
+
+    if (NULL == cache) return;
+
+    pthread_mutex_lock(&(cache->write_lock));
+
+    for (size_t b = 0; b <= cache->bucket_mask; ++b) {
+        for (int i = 0; i < VBA_NCACHE_BUCKET_WAYS; ++i) {
+            if (0 != cache->buckets[b].slots[i].tag) {
+                write_slot(&(cache->buckets[b].slots[i]), 0, 0, empty_key);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&(cache->write_lock));
+}
@@ -0,0 +1,79 @@
+#ifndef LIB_VBA_NCACHE_H
+#define LIB_VBA_NCACHE_H
+
+#include "vba.h"
+
+
+
+/* Number of slots probed per bucket. A lookup never touches more than this many entries. */
+#define VBA_NCACHE_BUCKET_WAYS      4
+#define VBA_NCACHE_DEFAULT_CAPACITY 1024
+
+
+
+/**
+ * Create a new neighbor cache able to hold (at least) the given amount of entries.
+ *   The capacity is rounded up to a power-of-two amount of buckets.
+ */
+neighbor_cache_t *
+ncache__create(
+    size_t                      capacity
+);
+
+/**
+ * Destroy a neighbor cache. No readers may be using the cache when this is called.
+ */
+void
+ncache__destroy(
+    neighbor_cache_t            *cache
+);
+
+/**
+ * Probe the cache for a neighbor binding. This never takes a lock and can be called
+ *   from any amount of threads concurrently with writers.
+ *
+ * Returns 0 and sets `tag` (VBA_TAG_SECURED or VBA_TAG_UNSECURED) on a hit, -1 on a miss.
+ */
+int
+ncache__lookup(
+    neighbor_cache_t            *cache,
+    const ipv6_addr_t           *ip,
+    const llid_t                *link_layer_id,
+    uint32_t                    voucher_id,
+    uint8_t                     *tag
+);
+
+/**
+ * Insert or re-tag a neighbor binding. When the target bucket is full, its oldest entry is evicted.
+ */
+int
+ncache__insert(
+    neighbor_cache_t            *cache,
+    const ipv6_addr_t           *ip,
+    const llid_t                *link_layer_id,
+    uint32_t                    voucher_id,
+    uint8_t                     tag
+);
+
+/**
+ * Evict a neighbor binding. Returns 0 if the entry existed, -1 otherwise.
+ */
+int
+ncache__remove(
+    neighbor_cache_t            *cache,
+    const ipv6_addr_t           *ip,
+    const llid_t                *link_layer_id,
+    uint32_t                    voucher_id
+);
+
+/**
+ * Drop every entry in the cache.
+ */
+void
+ncache__flush(
+    neighbor_cache_t            *cache
+);
+
+
+
+#endif   /* LIB_VBA_NCACHE_H */
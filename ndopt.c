@@ -0,0 +1,262 @@
+#include "ndopt.h"
+
+#include <string.h>
+
+
+
+/* Loads go through memcpy: options sit at arbitrary offsets in the packet buffer. */
+static uint32_t
+load_u32(const uint8_t *source)
+{
+    uint32_t value;
+
+    memcpy(&value, source, sizeof(value));
+    return value;
+}
+
+
+static uint64_t
+load_u64(const uint8_t *source)
+{
+    uint64_t value;
+
+    memcpy(&value, source, sizeof(value));
+    return value;
+}
+
+
+
+int
+ndopt__view_link_voucher(const void *data,
+                         size_t data_length,
+                         nd_link_voucher_view_t *view)
+{
+    const uint8_t *option = (const uint8_t *)data;
+    size_t option_length = 0;
+    uint16_t algorithm_type = 0;
+    uint16_t algorithm_length = 0;
+
+    if (NULL == data || NULL == view) return -1;
+    if (data_length < 2) return -3;
+
+    if (VBA_LINK_VOUCHER_TYPE != option[0]) return -2;
+
+    option_length = (size_t)option[1] * ND_OPTION_LENGTH_UNIT;
+    if (option_length < VBA_LINK_VOUCHER_MIN_LENGTH || option_length > data_length) return -3;
+
+    algorithm_type = (option[VBA_LINK_VOUCHER_OFFSET_ALGO_TYPE] << 8) | option[VBA_LINK_VOUCHER_OFFSET_ALGO_TYPE + 1];
+    algorithm_length = (option[VBA_LINK_VOUCHER_OFFSET_ALGO_LENGTH] << 8) | option[VBA_LINK_VOUCHER_OFFSET_ALGO_LENGTH + 1];
+
+    if (
+        algorithm_length > VBA_MAX_ALGO_TYPE_LENGTH
+        || (VBA_LINK_VOUCHER_OFFSET_ALGO_VALUE + (size_t)algorithm_length) > option_length
+    ) {
+        return -3;
+    }
+
+    switch (algorithm_type) {
+        case VBA_PBKDF2_TYPE:
+        case VBA_ARGON2_TYPE:
+        case VBA_SCRYPT_TYPE:
+            break;
+        default:
+            return -4;
+    }
+
+    view->option = option;
+    view->length = option_length;
+    view->algorithm_type = algorithm_type;
+    view->algorithm_length = algorithm_length;
+
+    return 0;
+}
+
+
+void
+ndopt__iterator_init(ndopt_iterator_t *iterator,
+                     const void *data,
+                     size_t data_length)
+{
+    iterator->cursor = (const uint8_t *)data;
+    iterator->end = (NULL == data) ? (const uint8_t *)data : ((const uint8_t *)data + data_length);
+}
+
+
+int
+ndopt__iterator_next_voucher(ndopt_iterator_t *iterator,
+                             nd_link_voucher_view_t *view)
+{
+    size_t remaining = 0;
+    size_t option_length = 0;
+    const uint8_t *option = NULL;
+
+    while (iterator->cursor < iterator->end) {
+        option = iterator->cursor;
+        remaining = (size_t)(iterator->end - option);
+
+        if (remaining < 2) return -3;
+
+        /* A zero Length would never advance, and RFC 4861 says to drop the whole packet for it. */
+        option_length = (size_t)option[1] * ND_OPTION_LENGTH_UNIT;
+        if (0 == option_length || option_length > remaining) {
+            iterator->cursor = iterator->end;
+            return -3;
+        }
+
+        iterator->cursor += option_length;
+
+        if (VBA_LINK_VOUCHER_TYPE != option[0]) continue;
+        if (0 != ndopt__view_link_voucher(option, option_length, view)) continue;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+uint16_t
+ndopt__view_expiration(const nd_link_voucher_view_t *view)
+{
+    /* Network order on the wire, like the algorithm type and length. */
+    return (view->option[VBA_LINK_VOUCHER_OFFSET_EXPIRATION] << 8) | view->option[VBA_LINK_VOUCHER_OFFSET_EXPIRATION + 1];
+}
+
+
+uint64_t
+ndopt__view_timestamp(const nd_link_voucher_view_t *view)
+{
+    return load_u64(view->option + VBA_LINK_VOUCHER_OFFSET_TIMESTAMP);
+}
+
+
+uint32_t
+ndopt__view_voucher_id(const nd_link_voucher_view_t *view)
+{
+    return load_u32(view->option + VBA_LINK_VOUCHER_OFFSET_ID);
+}
+
+
+const uint8_t *
+ndopt__view_seed(const nd_link_voucher_view_t *view)
+{
+    return view->option + VBA_LINK_VOUCHER_OFFSET_SEED;
+}
+
+
+bool
+ndopt__view_matches(const nd_link_voucher_view_t *view,
+                    const nd_link_voucher_option_t *voucher)
+{
+    vba_algorithm_type_t algo = {0};
+
+    if (NULL == view || NULL == voucher || NULL == voucher->algorithm_spec) return false;
+
+    if (
+        ndopt__view_voucher_id(view) != voucher->voucher_id
+        || ndopt__view_timestamp(view) != voucher->timestamp
+        || ndopt__view_expiration(view) != voucher->expiration
+        || 0 != memcmp(ndopt__view_seed(view), voucher->seed, VBA_SEED_LENGTH)
+        || view->algorithm_type != voucher->algorithm_spec->type
+    ) {
+        return false;
+    }
+
+    /* Compare the algorithm value as the parser would have stored it. */
+    algo.type = view->algorithm_type;
+    memcpy(&(algo.data), view->option + VBA_LINK_VOUCHER_OFFSET_ALGO_VALUE, sizeof(uint32_t));
+    ndopt__normalize_algorithm(&algo);
+
+    return (0 == memcmp(&(algo.data), &(voucher->algorithm_spec->data), sizeof(algo.data)));
+}
+
+
+void
+ndopt__normalize_algorithm(vba_algorithm_type_t *algo)
+{
+    uint32_t argon_memory_size = 0;
+    uint8_t *argon_memory_size_scroll = NULL;
+
+    if (VBA_ARGON2_TYPE != algo->type) return;
+
+    /* Readjust and confine the Argon MemorySize and Parallelism parameters here. */
+    algo->data.argon2d_spec.parallelism = MAX(1, MIN(8, algo->data.argon2d_spec.parallelism >> 4));
+
+    /* Although the spec doesn't limit the memory size, I really don't want to program to crash. */
+    argon_memory_size_scroll = algo->data.argon2d_spec.memory_size;
+    for (int i = 0; i < 3; ++i) {
+        argon_memory_size += (0xFF & *(argon_memory_size_scroll + i)) << ((3-1-i) * 8);
+    }
+
+    /* MemorySize must be a multiple of 8*Parallelism */
+    argon_memory_size += (argon_memory_size % (8 * algo->data.argon2d_spec.parallelism));
+
+    /* I don't want 64KiB chosen every. single. time. So rather than below, I'm using a mod. */
+    // argon_memory_size = MIN(64 *1024, argon_memory_size);   /* limit to 64 KiB */
+    argon_memory_size %= (64 * 1024);
+
+    /* Commit the adjusted memory size. */
+    for (int i = 0; i < 3; ++i) {
+        algo->data.argon2d_spec.memory_size[i] = 0xFF & (argon_memory_size >> ((3-1-i) * 8));
+    }
+}
+
+
+int
+ndopt__view_to_voucher(const nd_link_voucher_view_t *view,
+                       vba_voucher_storage_t *storage)
+{
+    if (NULL == view || NULL == view->option || NULL == storage) return -1;
+
+    return ndopt__process_link_voucher_into((void *)view->option, NULL, storage);
+}
+
+
+int
+ndopt__encode_link_voucher(uint8_t *option,
+                           size_t option_length,
+                           vba_kdf_t kdf,
+                           uint32_t parameter,
+                           uint32_t voucher_id,
+                           const uint8_t *seed)
+{
+    uint16_t iterations_factor = 0;
+
+    if (
+        NULL == option
+        || NULL == seed
+        || option_length < VBA_LINK_VOUCHER_MIN_LENGTH
+        || (option_length / ND_OPTION_LENGTH_UNIT) > UINT8_MAX
+    ) {
+        return -1;
+    }
+
+    memset(option, 0x00, option_length);
+
+    option[0] = VBA_LINK_VOUCHER_TYPE;
+    option[1] = (uint8_t)(option_length / ND_OPTION_LENGTH_UNIT);
+    memcpy(&option[VBA_LINK_VOUCHER_OFFSET_ID], &voucher_id, sizeof(uint32_t));
+    memcpy(&option[VBA_LINK_VOUCHER_OFFSET_SEED], seed, VBA_SEED_LENGTH);
+    option[VBA_LINK_VOUCHER_OFFSET_ALGO_LENGTH + 1] = sizeof(uint32_t);
+
+    /* The algorithm value goes in the way the parser copies it out again. */
+    switch (kdf) {
+        case VBA_ALGO_PBKDF2:
+            option[VBA_LINK_VOUCHER_OFFSET_ALGO_TYPE + 1] = VBA_PBKDF2_TYPE;
+            iterations_factor = (uint16_t)parameter;
+            memcpy(&option[VBA_LINK_VOUCHER_OFFSET_ALGO_VALUE], &iterations_factor, sizeof(uint16_t));
+            break;
+        case VBA_ALGO_ARGON2:
+            option[VBA_LINK_VOUCHER_OFFSET_ALGO_TYPE + 1] = VBA_ARGON2_TYPE;
+            for (int i = 0; i < 4; ++i) option[VBA_LINK_VOUCHER_OFFSET_ALGO_VALUE + i] = (uint8_t)(parameter >> ((3 - i) * 8));
+            break;
+        case VBA_ALGO_SCRYPT:
+            option[VBA_LINK_VOUCHER_OFFSET_ALGO_TYPE + 1] = VBA_SCRYPT_TYPE;
+            option[VBA_LINK_VOUCHER_OFFSET_ALGO_VALUE] = (uint8_t)parameter;
+            break;
+        default:
+            return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+#ifndef LIB_VBA_NDOPT_H
+#define LIB_VBA_NDOPT_H
+
+#include "vba.h"
+
+#include <stdbool.h>
+
+
+
+/* ND option lengths are carried in units of 8 octets (RFC 4861, section 4.6). */
+#define ND_OPTION_LENGTH_UNIT               8
+
+/* Fixed part of a Link Voucher option, up to and including a 4-byte algorithm value. */
+#define VBA_LINK_VOUCHER_MIN_LENGTH         48
+
+#define VBA_LINK_VOUCHER_OFFSET_EXPIRATION  2
+#define VBA_LINK_VOUCHER_OFFSET_TIMESTAMP   12
+#define VBA_LINK_VOUCHER_OFFSET_ID          20
+#define VBA_LINK_VOUCHER_OFFSET_SEED        24
+#define VBA_LINK_VOUCHER_OFFSET_ALGO_TYPE   40
+#define VBA_LINK_VOUCHER_OFFSET_ALGO_LENGTH 42
+#define VBA_LINK_VOUCHER_OFFSET_ALGO_VALUE  44
+
+
+
+/**
+ * A validated, read-only view of a Link Voucher option which still lives in the packet buffer.
+ *   Nothing is copied out; the view is only good for as long as the buffer is.
+ */
+typedef
+struct {
+    const uint8_t   *option;
+    size_t          length;   /* In bytes. */
+    uint16_t        algorithm_type;
+    uint16_t        algorithm_length;
+} nd_link_voucher_view_t;
+
+/**
+ * Cursor over a buffer of concatenated ND options.
+ */
+typedef
+struct {
+    const uint8_t   *cursor;
+    const uint8_t   *end;
+} ndopt_iterator_t;
+
+
+
+/**
+ * Validate a Link Voucher option in place. Every offset the accessors read is checked here
+ *   against both the buffer and the option's own Length field.
+ *
+ * Returns 0 on success, -1 on bad input, -2 if this is not a Link Voucher option, -3 if the
+ *   option is truncated or its lengths disagree, and -4 for an unknown KDF type.
+ */
+int
+ndopt__view_link_voucher(
+    const void                  *data,
+    size_t                      data_length,
+    nd_link_voucher_view_t      *view
+);
+
+/**
+ * Start walking a buffer of concatenated ND options (e.g. the options section of an RA).
+ */
+void
+ndopt__iterator_init(
+    ndopt_iterator_t            *iterator,
+    const void                  *data,
+    size_t                      data_length
+);
+
+/**
+ * Advance to the next valid Link Voucher option, skipping other option types and Link Voucher
+ *   options which fail validation. Returns 1 when a view was produced and 0 at the end of the
+ *   buffer. Returns -3 on a zero-length or overrunning option; per RFC 4861, the remaining options
+ *   cannot be trusted after that.
+ */
+int
+ndopt__iterator_next_voucher(
+    ndopt_iterator_t            *iterator,
+    nd_link_voucher_view_t      *view
+);
+
+/**
+ * The voucher's Expiration, decoded from network order as the parser does.
+ */
+uint16_t
+ndopt__view_expiration(
+    const nd_link_voucher_view_t    *view
+);
+
+uint64_t
+ndopt__view_timestamp(
+    const nd_link_voucher_view_t    *view
+);
+
+uint32_t
+ndopt__view_voucher_id(
+    const nd_link_voucher_view_t    *view
+);
+
+const uint8_t *
+ndopt__view_seed(
+    const nd_link_voucher_view_t    *view
+);
+
+/**
+ * Check whether the view carries exactly the voucher that was already parsed, so that a
+ *   re-advertised voucher can be recognized without parsing it again.
+ */
+bool
+ndopt__view_matches(
+    const nd_link_voucher_view_t    *view,
+    const nd_link_voucher_option_t  *voucher
+);
+
+/**
+ * Apply the library's confinement rules to a freshly copied algorithm value (e.g. Argon2
+ *   Parallelism and MemorySize). Every voucher parser goes through this.
+ */
+void
+ndopt__normalize_algorithm(
+    vba_algorithm_type_t            *algo
+);
+
+/**
+ * Materialize a view into caller-owned voucher storage.
+ */
+int
+ndopt__view_to_voucher(
+    const nd_link_voucher_view_t    *view,
+    vba_voucher_storage_t           *storage
+);
+
+/**
+ * Write a Link Voucher option of `option_length` bytes (a multiple of 8, at least
+ *   VBA_LINK_VOUCHER_MIN_LENGTH) for a KDF with known parameters, as the benchmark and the
+ *   calibration need. `parameter` is the algorithm value: the ITERATIONS_FACTOR, (raw Parallelism
+ *   byte << 24 | MemorySize) for Argon2, or the SCALING_FACTOR.
+ */
+int
+ndopt__encode_link_voucher(
+    uint8_t                         *option,
+    size_t                          option_length,
+    vba_kdf_t                       kdf,
+    uint32_t                        parameter,
+    uint32_t                        voucher_id,
+    const uint8_t                   *seed
+);
+
+
+
+#endif   /* LIB_VBA_NDOPT_H */
@@ -0,0 +1,259 @@
+#include "negfilter.h"
+
+#include "generator.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+#define NEGFILTER_BLOCK_WORDS   8
+#define NEGFILTER_BITS_PER_KEY  16   /* Well under 1% false positives, even with both generations full. */
+#define NEGFILTER_KEY_WORDS     4
+
+/**
+ * One block fits half a cache line. A key sets exactly one bit in each of the block's words,
+ *   so every lookup touches a single block.
+ */
+typedef
+struct {
+    uint32_t    words[NEGFILTER_BLOCK_WORDS];
+} __attribute__((aligned(32))) negfilter_block_t;
+
+struct negative_filter {
+    negfilter_block_t   *generations[2];
+    size_t              block_mask;
+    size_t              capacity;   /* Insertions per generation. */
+    size_t              inserted;   /* Into the current generation. */
+    size_t              current;
+    uint64_t            hash_seed;   /* Per filter, so colliding keys cannot be precomputed. */
+    uint16_t            max_work_factor;
+    pthread_mutex_t     write_lock;   /* Serializes writers only. */
+};
+
+/* Odd multipliers, one per block word (from the Parquet split-block Bloom filter). */
+static const uint32_t NEGFILTER_SALTS[NEGFILTER_BLOCK_WORDS] = {
+    0x47B6137BU, 0x44974D91U, 0x8824AD5BU, 0xA2B7289DU,
+    0x705495C7U, 0x2DF1424BU, 0x9EFC4947U, 0x5C6BFB31U
+};
+
+
+
+/*
+ * The voucher ID is part of the key. Failures under one voucher then never answer for another,
+ *   and the active and retired vouchers (or those of the interfaces sharing a filter) coexist.
+ */
+static uint64_t
+hash_binding(const negative_filter_t *filter,
+             const nd_link_voucher_option_t *voucher,
+             const ipv6_addr_t *ip,
+             const llid_t *link_layer_id)
+{
+    uint64_t key[NEGFILTER_KEY_WORDS];
+    uint8_t *scroll = (uint8_t *)key;
+    size_t llid_length = MIN(link_layer_id->length, sizeof(link_layer_id->id));
+    uint64_t h = filter->hash_seed;
+
+    memset(key, 0x00, sizeof(key));
+
+    memcpy(scroll, ip, sizeof(ipv6_addr_t));
+    scroll += sizeof(ipv6_addr_t);
+
+    *scroll++ = (uint8_t)llid_length;
+    memcpy(scroll, link_layer_id->id, llid_length);
+    scroll += sizeof(link_layer_id->id);
+
+    memcpy(scroll, &(voucher->voucher_id), sizeof(voucher->voucher_id));
+
+    for (int i = 0; i < NEGFILTER_KEY_WORDS; ++i) {
+        h = (h ^ key[i]) * 0x9E3779B97F4A7C15ULL;
+        h ^= (h >> 32);
+    }
+
+    /* Finalize, so the low bits (bit positions) and high bits (block index) are both well mixed. */
+    h ^= (h >> 29);
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= (h >> 32);
+
+    return h;
+}
+
+
+static inline negfilter_block_t *
+block_for(const negative_filter_t *filter,
+          size_t generation,
+          uint64_t h)
+{
+    return &(filter->generations[generation][(h >> 32) & filter->block_mask]);
+}
+
+
+static bool
+block_contains(const negfilter_block_t *block,
+               uint32_t key)
+{
+    uint32_t mask = 0;
+
+    for (int i = 0; i < NEGFILTER_BLOCK_WORDS; ++i) {
+        mask = 1U << ((key * NEGFILTER_SALTS[i]) >> 27);
+        if (0 == (__atomic_load_n(&(block->words[i]), __ATOMIC_RELAXED) & mask)) return false;
+    }
+
+    return true;
+}
+
+
+static void
+block_insert(negfilter_block_t *block,
+             uint32_t key)
+{
+    for (int i = 0; i < NEGFILTER_BLOCK_WORDS; ++i) {
+        __atomic_fetch_or(&(block->words[i]), 1U << ((key * NEGFILTER_SALTS[i]) >> 27), __ATOMIC_RELAXED);
+    }
+}
+
+
+/* Must be called with the write lock held. Readers may see a half-cleared generation, which only costs a KDF run. */
+static void
+clear_generation(negative_filter_t *filter,
+                 size_t generation)
+{
+    uint32_t *words = (uint32_t *)filter->generations[generation];
+    size_t word_count = (filter->block_mask + 1) * NEGFILTER_BLOCK_WORDS;
+
+    for (size_t i = 0; i < word_count; ++i) {
+        __atomic_store_n(&(words[i]), 0, __ATOMIC_RELAXED);
+    }
+}
+
+
+/* Known-invalid without any hashing: not a /64, or a claimed work factor above the policy. */
+static bool
+violates_policy(const negative_filter_t *filter,
+                const nd_link_voucher_option_t *voucher,
+                const ipv6_addr_t *ip)
+{
+    if ((ip->prefix_length * 8) > 64) return true;
+
+    return (0 != filter->max_work_factor && vba__extract_work_factor(voucher, ip) > filter->max_work_factor);
+}
+
+
+
+negative_filter_t *
+negfilter__create(size_t capacity,
+                  uint16_t max_work_factor)
+{
+    negative_filter_t *filter = NULL;
+    size_t block_count = 1;
+    size_t wanted_blocks = 0;
+    struct timespec now;
+
+    filter = (negative_filter_t *)calloc(1, sizeof(negative_filter_t));
+    if (NULL == filter) return NULL;
+
+    filter->capacity = (0 == capacity) ? VBA_NEGFILTER_DEFAULT_CAPACITY : capacity;
+    filter->max_work_factor = max_work_factor;
+    pthread_mutex_init(&(filter->write_lock), NULL);
+
+    wanted_blocks = (filter->capacity * NEGFILTER_BITS_PER_KEY) / (NEGFILTER_BLOCK_WORDS * 32);
+    while (block_count < wanted_blocks) block_count <<= 1;
+    filter->block_mask = block_count - 1;
+
+    for (int i = 0; i < 2; ++i) {
+        filter->generations[i] = (negfilter_block_t *)aligned_alloc(sizeof(negfilter_block_t), block_count * sizeof(negfilter_block_t));
+        if (NULL == filter->generations[i]) {
+            negfilter__destroy(filter);
+            return NULL;
+        }
+        memset(filter->generations[i], 0x00, block_count * sizeof(negfilter_block_t));
+    }
+
+    /* The PRNG may not have been seeded by the application, so fold in the clock as well. */
+    clock_gettime(CLOCK_REALTIME, &now);
+    filter->hash_seed = Xoshiro128p__next_bounded_any() ^ ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec;
+
+    return filter;
+}
+
+
+void
+negfilter__destroy(negative_filter_t *filter)
+{
+    if (NULL == filter) return;
+
+    pthread_mutex_destroy(&(filter->write_lock));
+    free(filter->generations[0]);
+    free(filter->generations[1]);
+    free(filter);
+}
+
+
+bool
+negfilter__is_rejected(negative_filter_t *filter,
+                       const nd_link_voucher_option_t *voucher,
+                       const ipv6_addr_t *ip,
+                       const llid_t *link_layer_id)
+{
+    uint64_t h = 0;
+
+    if (NULL == filter || NULL == voucher || NULL == ip || NULL == link_layer_id) return false;
+
+    if (violates_policy(filter, voucher, ip)) return true;
+
+    h = hash_binding(filter, voucher, ip, link_layer_id);
+
+    return (
+        block_contains(block_for(filter, 0, h), (uint32_t)h)
+        || block_contains(block_for(filter, 1, h), (uint32_t)h)
+    );
+}
+
+
+void
+negfilter__record_failure(negative_filter_t *filter,
+                          const nd_link_voucher_option_t *voucher,
+                          const ipv6_addr_t *ip,
+                          const llid_t *link_layer_id)
+{
+    uint64_t h = 0;
+
+    if (NULL == filter || NULL == voucher || NULL == ip || NULL == link_layer_id) return;
+
+    /* Policy violations are rejected before any hashing, so they need no bits. */
+    if (violates_policy(filter, voucher, ip)) return;
+
+    h = hash_binding(filter, voucher, ip, link_layer_id);
+
+    pthread_mutex_lock(&(filter->write_lock));
+
+    /*
+     * A full generation ages out the older one, which keeps the false-positive rate bounded under
+     *   a flood. Failures under vouchers retired since go with it.
+     */
+    if (filter->inserted >= filter->capacity) {
+        filter->current ^= 1;
+        clear_generation(filter, filter->current);
+        filter->inserted = 0;
+    }
+
+    block_insert(block_for(filter, filter->current, h), (uint32_t)h);
+    filter->inserted++;
+
+    pthread_mutex_unlock(&(filter->write_lock));
+}
+
+
+void
+negfilter__flush(negative_filter_t *filter)
+{
+    if (NULL == filter) return;
+
+    pthread_mutex_lock(&(filter->write_lock));
+    clear_generation(filter, 0);
+    clear_generation(filter, 1);
+    filter->inserted = 0;
+    pthread_mutex_unlock(&(filter->write_lock));
+}
@@ -0,0 +1,76 @@
+#ifndef LIB_VBA_NEGFILTER_H
+#define LIB_VBA_NEGFILTER_H
+
+#include "vba.h"
+
+#include <stdbool.h>
+
+
+
+/* Failures remembered per generation by default. Two generations are kept. */
+#define VBA_NEGFILTER_DEFAULT_CAPACITY  4096
+
+
+
+/**
+ * Create a filter of recent verification failures. It is a split-block Bloom filter of two
+ *   generations: once `capacity` failures went into the newer one, the older one is dropped and
+ *   reused. Its memory is fixed at creation, however many forgeries arrive.
+ *
+ * Failures are kept apart by voucher ID, so verifications still finishing under a retired voucher,
+ *   or interfaces sharing the filter under different vouchers, never clear each other's.
+ *
+ * A `max_work_factor` other than 0 rejects neighbors whose address claims a larger L outright.
+ */
+negative_filter_t *
+negfilter__create(
+    size_t                          capacity,
+    uint16_t                        max_work_factor
+);
+
+/**
+ * Destroy a filter. No readers may be using the filter when this is called.
+ */
+void
+negfilter__destroy(
+    negative_filter_t               *filter
+);
+
+/**
+ * Decide whether a neighbor binding can be turned away without a KDF run: either it cannot be a
+ *   valid VBA under the policy, or it already failed verification under this voucher. Like all
+ *   Bloom filters, this has false positives but no false negatives.
+ *
+ * This never takes a lock. A NULL filter rejects nothing.
+ */
+bool
+negfilter__is_rejected(
+    negative_filter_t               *filter,
+    const nd_link_voucher_option_t  *voucher,
+    const ipv6_addr_t               *ip,
+    const llid_t                    *link_layer_id
+);
+
+/**
+ * Remember that a binding failed verification under the voucher. Failures under vouchers which
+ *   are no longer used are not dropped at once; they age out with their generation.
+ */
+void
+negfilter__record_failure(
+    negative_filter_t               *filter,
+    const nd_link_voucher_option_t  *voucher,
+    const ipv6_addr_t               *ip,
+    const llid_t                    *link_layer_id
+);
+
+/**
+ * Forget every recorded failure.
+ */
+void
+negfilter__flush(
+    negative_filter_t               *filter
+);
+
+
+
+#endif   /* LIB_VBA_NEGFILTER_H */
@@ -0,0 +1,729 @@
+#include "vba.h"
+
+#include "metrics.h"
+#include "ncache.h"
+#include "ndopt.h"
+#include "pool.h"
+#include "scheduler.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+#define PCAP_MAGIC_MICROSECONDS     0xA1B2C3D4
+#define PCAP_MAGIC_NANOSECONDS      0xA1B23C4D
+#define PCAP_GLOBAL_HEADER_LENGTH   24
+#define PCAP_RECORD_HEADER_LENGTH   16
+
+#define LINKTYPE_ETHERNET           1
+#define LINKTYPE_RAW                101
+#define LINKTYPE_LINUX_SLL          113
+#define LINKTYPE_IPV6               229
+
+#define ETHERTYPE_IPV6              0x86DD
+#define ETHERTYPE_VLAN              0x8100
+#define ETHERTYPE_QINQ              0x88A8
+
+#define IPV6_HEADER_LENGTH          40
+#define IPV6_NEXT_HOP_BY_HOP        0
+#define IPV6_NEXT_ROUTING           43
+#define IPV6_NEXT_DESTINATION       60
+#define IPV6_NEXT_ICMPV6            58
+
+#define ICMPV6_ROUTER_ADVERTISEMENT 134
+#define ICMPV6_NEIGHBOR_SOLICIT     135
+#define ICMPV6_NEIGHBOR_ADVERT      136
+
+#define ND_OPTION_SOURCE_LLADDR     1
+#define ND_OPTION_TARGET_LLADDR     2
+
+/* Offsets of the options area within each ICMPv6 ND message. */
+#define RA_OPTIONS_OFFSET           16
+#define NS_NA_TARGET_OFFSET         8
+#define NS_NA_OPTIONS_OFFSET        24
+
+#define REPLAY_DEFAULT_BATCH        64
+#define REPLAY_MAX_BATCH            4096
+#define REPLAY_INFLIGHT_PER_THREAD  4
+
+typedef struct replay_state replay_state_t;
+typedef struct replay_batch replay_batch_t;
+
+typedef
+struct {
+    vba_neighbor_t  neighbor;
+    uint64_t        ingest_ns;
+    replay_batch_t  *batch;
+} replay_item_t;
+
+/**
+ * A run of neighbors verified by one pool task, or handed one by one to the scheduler with
+ *   `--schedule`. The batch carries a copy of the device as it was when the batch was sealed, so
+ *   a voucher rotation later in the capture does not affect it.
+ */
+struct replay_batch {
+    replay_state_t      *state;
+    pseudo_net_dev_t    device;
+    replay_item_t       *items;
+    uint64_t            *latencies;
+    int                 *results;
+    size_t              count;
+    size_t              remaining;   /* Scheduled neighbors still waiting for a verdict. */
+};
+
+struct replay_state {
+    vba_pool_t          *pool;
+    vba_scheduler_t     *scheduler;   /* NULL unless `--schedule`. */
+    pseudo_net_dev_t    device;
+    pthread_mutex_t     lock;
+    pthread_cond_t      slot_free;
+    size_t              inflight;
+    size_t              max_inflight;
+    size_t              batch_size;
+    replay_batch_t      *open_batch;
+    replay_batch_t      **batches;
+    size_t              batch_count;
+    size_t              batch_capacity;
+    nd_link_voucher_option_t **vouchers;
+    size_t              voucher_count;
+
+    /* Counters. */
+    uint64_t            packets;
+    uint64_t            truncated;
+    uint64_t            router_adverts;
+    uint64_t            vouchers_parsed;
+    uint64_t            vouchers_reused;
+    uint64_t            vouchers_invalid;
+    uint64_t            neighbor_messages;
+    uint64_t            neighbors_without_voucher;
+    uint64_t            neighbors_without_lladdr;
+};
+
+
+
+static uint32_t
+load_u32(const uint8_t *source,
+         bool is_swapped)
+{
+    uint32_t value;
+
+    memcpy(&value, source, sizeof(value));
+    return is_swapped ? __builtin_bswap32(value) : value;
+}
+
+
+static int
+compare_u64(const void *a,
+            const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+static void
+release_slot(replay_state_t *state)
+{
+    pthread_mutex_lock(&(state->lock));
+    state->inflight--;
+    pthread_cond_signal(&(state->slot_free));
+    pthread_mutex_unlock(&(state->lock));
+}
+
+
+static void
+replay_batch_task(void *argument)
+{
+    replay_batch_t *batch = (replay_batch_t *)argument;
+
+    for (size_t i = 0; i < batch->count; ++i) {
+        batch->results[i] = vba__verify(&(batch->device),
+                                        &(batch->items[i].neighbor.address),
+                                        &(batch->items[i].neighbor.link_layer_id));
+        batch->latencies[i] = metrics__now_ns() - batch->items[i].ingest_ns;
+    }
+
+    release_slot(batch->state);
+}
+
+
+/* Record one scheduled neighbor's verdict. The batch's slot is freed with its last one. */
+static void
+finish_scheduled_item(replay_item_t *item,
+                      int status)
+{
+    replay_batch_t *batch = item->batch;
+    size_t i = (size_t)(item - batch->items);
+
+    batch->results[i] = status;
+    batch->latencies[i] = metrics__now_ns() - item->ingest_ns;
+
+    if (0 == __atomic_sub_fetch(&(batch->remaining), 1, __ATOMIC_ACQ_REL)) release_slot(batch->state);
+}
+
+
+static void
+scheduled_verify_done(pseudo_net_dev_t *verifier_device,
+                      const ipv6_addr_t *ndar_ip,
+                      const llid_t *ndar_link_layer_id,
+                      int status,
+                      void *context)
+{
+    finish_scheduled_item((replay_item_t *)context, status);
+}
+
+
+static void
+schedule_batch(replay_batch_t *batch)
+{
+    replay_state_t *state = batch->state;
+    int status = 0;
+
+    /* One extra count keeps the slot until every neighbor has at least been submitted. */
+    batch->remaining = batch->count + 1;
+
+    for (size_t i = 0; i < batch->count; ++i) {
+        status = scheduler__submit_verify(state->scheduler,
+                                          &(batch->device),
+                                          &(batch->items[i].neighbor.address),
+                                          &(batch->items[i].neighbor.link_layer_id),
+                                          scheduled_verify_done,
+                                          &(batch->items[i]));
+
+        /* Turned away (-14, -15): the callback never comes, so the verdict is the refusal. */
+        if (0 != status) finish_scheduled_item(&(batch->items[i]), status);
+    }
+
+    if (0 == __atomic_sub_fetch(&(batch->remaining), 1, __ATOMIC_ACQ_REL)) release_slot(state);
+}
+
+
+static replay_batch_t *
+create_batch(replay_state_t *state)
+{
+    replay_batch_t *batch = (replay_batch_t *)calloc(1, sizeof(replay_batch_t));
+    replay_batch_t **batches = NULL;
+
+    if (NULL == batch) return NULL;
+
+    batch->state = state;
+    batch->items = (replay_item_t *)calloc(state->batch_size, sizeof(replay_item_t));
+    batch->latencies = (uint64_t *)calloc(state->batch_size, sizeof(uint64_t));
+    batch->results = (int *)calloc(state->batch_size, sizeof(int));
+
+    if (state->batch_count == state->batch_capacity) {
+        state->batch_capacity = MAX(64, state->batch_capacity * 2);
+        batches = (replay_batch_t **)realloc(state->batches, state->batch_capacity * sizeof(replay_batch_t *));
+        if (NULL != batches) state->batches = batches;
+    }
+
+    if (NULL == batch->items || NULL == batch->latencies || NULL == batch->results || state->batch_count == state->batch_capacity) {
+        free(batch->items);
+        free(batch->latencies);
+        free(batch->results);
+        free(batch);
+        return NULL;
+    }
+
+    state->batches[state->batch_count++] = batch;
+    return batch;
+}
+
+
+/* Hand the open batch to the pool, waiting for a free slot so that parsing stays a bounded distance ahead. */
+static void
+seal_batch(replay_state_t *state)
+{
+    replay_batch_t *batch = state->open_batch;
+
+    if (NULL == batch || 0 == batch->count) return;
+
+    state->open_batch = NULL;
+    memcpy(&(batch->device), &(state->device), sizeof(pseudo_net_dev_t));
+
+    pthread_mutex_lock(&(state->lock));
+    while (state->inflight >= state->max_inflight) {
+        pthread_cond_wait(&(state->slot_free), &(state->lock));
+    }
+    state->inflight++;
+    pthread_mutex_unlock(&(state->lock));
+
+    if (NULL != state->scheduler) {
+        schedule_batch(batch);
+        return;
+    }
+
+    if (0 != pool__submit(state->pool, NULL, replay_batch_task, batch)) {
+        replay_batch_task(batch);
+    }
+}
+
+
+static void
+handle_router_advert(replay_state_t *state,
+                     const uint8_t *icmp,
+                     size_t icmp_length)
+{
+    ndopt_iterator_t iterator;
+    nd_link_voucher_view_t view;
+    nd_link_voucher_option_t *voucher = NULL;
+    nd_link_voucher_option_t **vouchers = NULL;
+
+    state->router_adverts++;
+    if (icmp_length < RA_OPTIONS_OFFSET) return;
+
+    ndopt__iterator_init(&iterator, icmp + RA_OPTIONS_OFFSET, icmp_length - RA_OPTIONS_OFFSET);
+
+    while (1 == ndopt__iterator_next_voucher(&iterator, &view)) {
+        /* The same voucher is re-advertised in every RA; only a new one is worth parsing. */
+        if (ndopt__view_matches(&view, state->device.active_voucher)) {
+            state->vouchers_reused++;
+            continue;
+        }
+
+        if (0 != ndopt__process_link_voucher((void *)view.option, &(state->device), &voucher)) {
+            state->vouchers_invalid++;
+            continue;
+        }
+
+        vouchers = (nd_link_voucher_option_t **)realloc(state->vouchers, (state->voucher_count + 1) * sizeof(nd_link_voucher_option_t *));
+        if (NULL == vouchers) {
+            free(voucher->algorithm_spec);
+            free(voucher);
+            continue;
+        }
+
+        /* Neighbors seen so far belong to the previous voucher. Old vouchers live until the end of the run. */
+        seal_batch(state);
+
+        state->vouchers = vouchers;
+        state->vouchers[state->voucher_count++] = voucher;
+        state->device.active_voucher = voucher;
+        state->vouchers_parsed++;
+    }
+}
+
+
+static void
+handle_neighbor_message(replay_state_t *state,
+                        const uint8_t *ipv6,
+                        const uint8_t *icmp,
+                        size_t icmp_length,
+                        uint64_t ingest_ns)
+{
+    static const uint8_t unspecified[16] = {0};
+
+    const uint8_t *address = NULL;
+    const uint8_t *option = NULL;
+    const uint8_t *lladdr_option = NULL;
+    size_t remaining = 0;
+    size_t option_length = 0;
+    uint8_t wanted_option = 0;
+    replay_item_t *item = NULL;
+
+    state->neighbor_messages++;
+    if (icmp_length < NS_NA_OPTIONS_OFFSET) return;
+
+    /*
+     * An NS binds its source address to the Source Link-Layer Address option. An NA binds the
+     *   target address to the Target Link-Layer Address option.
+     */
+    if (ICMPV6_NEIGHBOR_SOLICIT == icmp[0]) {
+        address = ipv6 + 8;
+        wanted_option = ND_OPTION_SOURCE_LLADDR;
+
+        /* DAD probes come from the unspecified address and carry no binding. */
+        if (0 == memcmp(address, unspecified, sizeof(unspecified))) return;
+    } else {
+        address = icmp + NS_NA_TARGET_OFFSET;
+        wanted_option = ND_OPTION_TARGET_LLADDR;
+    }
+
+    if (NULL == state->device.active_voucher) {
+        state->neighbors_without_voucher++;
+        return;
+    }
+
+    option = icmp + NS_NA_OPTIONS_OFFSET;
+    remaining = icmp_length - NS_NA_OPTIONS_OFFSET;
+
+    /* A truncated or zero-length option ends the walk without being selected. */
+    while (remaining >= 2) {
+        option_length = (size_t)option[1] * ND_OPTION_LENGTH_UNIT;
+        if (0 == option_length || option_length > remaining) break;
+
+        if (wanted_option == option[0]) {
+            lladdr_option = option;
+            break;
+        }
+
+        option += option_length;
+        remaining -= option_length;
+    }
+
+    if (NULL == lladdr_option) {
+        state->neighbors_without_lladdr++;
+        return;
+    }
+
+    if (NULL == state->open_batch) {
+        state->open_batch = create_batch(state);
+        if (NULL == state->open_batch) return;
+    }
+
+    item = &(state->open_batch->items[state->open_batch->count++]);
+    item->ingest_ns = ingest_ns;
+    item->batch = state->open_batch;
+
+    /* On the wire, the suffix bytes are exactly the VBA's raw suffix. */
+    memcpy(item->neighbor.address.prefix, address, VBA_PREFIX_LENGTH);
+    item->neighbor.address.prefix_length = VBA_PREFIX_LENGTH;
+    memcpy(item->neighbor.address.suffix.raw, address + VBA_PREFIX_LENGTH, VBA_SUFFIX_LENGTH);
+
+    /* Option payload is the link-layer address, padded out to the 8-byte option boundary. */
+    item->neighbor.link_layer_id.length = MIN(sizeof(item->neighbor.link_layer_id.id), option_length - 2);
+    memcpy(item->neighbor.link_layer_id.id, lladdr_option + 2, item->neighbor.link_layer_id.length);
+
+    if (state->open_batch->count == state->batch_size) seal_batch(state);
+}
+
+
+/* Strip the link-layer header. Returns the IPv6 header or NULL when this is not an IPv6 frame. */
+static const uint8_t *
+find_ipv6_header(uint32_t link_type,
+                 const uint8_t *frame,
+                 size_t frame_length,
+                 size_t *ipv6_length)
+{
+    size_t offset = 0;
+    uint16_t ether_type = 0;
+
+    switch (link_type) {
+        case LINKTYPE_ETHERNET:
+            offset = 12;
+            for (;;) {
+                if (frame_length < offset + 2) return NULL;
+                ether_type = (frame[offset] << 8) | frame[offset + 1];
+                offset += 2;
+
+                if (ETHERTYPE_VLAN != ether_type && ETHERTYPE_QINQ != ether_type) break;
+                offset += 2;   /* Skip the tag's TCI. */
+            }
+            if (ETHERTYPE_IPV6 != ether_type) return NULL;
+            break;
+        case LINKTYPE_LINUX_SLL:
+            if (frame_length < 16) return NULL;
+            ether_type = (frame[14] << 8) | frame[15];
+            if (ETHERTYPE_IPV6 != ether_type) return NULL;
+            offset = 16;
+            break;
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV6:
+            offset = 0;
+            break;
+        default:
+            return NULL;
+    }
+
+    if (frame_length < offset + IPV6_HEADER_LENGTH) return NULL;
+    if (6 != (frame[offset] >> 4)) return NULL;
+
+    *ipv6_length = frame_length - offset;
+    return frame + offset;
+}
+
+
+static void
+handle_frame(replay_state_t *state,
+             uint32_t link_type,
+             const uint8_t *frame,
+             size_t frame_length)
+{
+    const uint8_t *ipv6 = NULL;
+    const uint8_t *icmp = NULL;
+    size_t ipv6_length = 0;
+    size_t offset = IPV6_HEADER_LENGTH;
+    size_t extension_length = 0;
+    uint8_t next_header = 0;
+    uint64_t ingest_ns = metrics__now_ns();
+
+    ipv6 = find_ipv6_header(link_type, frame, frame_length, &ipv6_length);
+    if (NULL == ipv6) return;
+
+    /* ND messages may only carry the extension headers an MLD-style stack would put in front. */
+    next_header = ipv6[6];
+    while (
+        IPV6_NEXT_HOP_BY_HOP == next_header
+        || IPV6_NEXT_ROUTING == next_header
+        || IPV6_NEXT_DESTINATION == next_header
+    ) {
+        if (ipv6_length < offset + 2) return;
+
+        extension_length = ((size_t)ipv6[offset + 1] + 1) * 8;
+        next_header = ipv6[offset];
+        offset += extension_length;
+    }
+
+    if (IPV6_NEXT_ICMPV6 != next_header || ipv6_length < offset + 4) return;
+
+    icmp = ipv6 + offset;
+
+    switch (icmp[0]) {
+        case ICMPV6_ROUTER_ADVERTISEMENT:
+            handle_router_advert(state, icmp, ipv6_length - offset);
+            break;
+        case ICMPV6_NEIGHBOR_SOLICIT:
+        case ICMPV6_NEIGHBOR_ADVERT:
+            handle_neighbor_message(state, ipv6, icmp, ipv6_length - offset, ingest_ns);
+            break;
+        default:
+            break;
+    }
+}
+
+
+static int
+replay_capture(replay_state_t *state,
+               const uint8_t *capture,
+               size_t capture_length)
+{
+    uint32_t magic = 0;
+    uint32_t link_type = 0;
+    uint32_t captured_length = 0;
+    size_t offset = PCAP_GLOBAL_HEADER_LENGTH;
+    bool is_swapped = false;
+
+    if (capture_length < PCAP_GLOBAL_HEADER_LENGTH) return -3;
+
+    memcpy(&magic, capture, sizeof(magic));
+    if (PCAP_MAGIC_MICROSECONDS == magic || PCAP_MAGIC_NANOSECONDS == magic) {
+        is_swapped = false;
+    } else if (
+        PCAP_MAGIC_MICROSECONDS == __builtin_bswap32(magic)
+        || PCAP_MAGIC_NANOSECONDS == __builtin_bswap32(magic)
+    ) {
+        is_swapped = true;
+    } else {
+        return -2;   /* Not a classic pcap file (pcapng is not supported). */
+    }
+
+    link_type = load_u32(capture + 20, is_swapped) & 0x0FFFFFFF;
+
+    while (offset + PCAP_RECORD_HEADER_LENGTH <= capture_length) {
+        captured_length = load_u32(capture + offset + 8, is_swapped);
+        offset += PCAP_RECORD_HEADER_LENGTH;
+
+        if (captured_length > capture_length - offset) {
+            state->truncated++;
+            break;
+        }
+
+        state->packets++;
+        handle_frame(state, link_type, capture + offset, captured_length);
+
+        offset += captured_length;
+    }
+
+    seal_batch(state);
+    return 0;
+}
+
+
+static void
+print_report(replay_state_t *state,
+             uint64_t elapsed_ns)
+{
+    uint64_t *latencies = NULL;
+    uint64_t verified = 0;
+    uint64_t failed = 0;
+    uint64_t turned_away = 0;
+    size_t total = 0;
+    size_t n = 0;
+    double seconds = (double)MAX(1, elapsed_ns) / 1e9;
+
+    for (size_t i = 0; i < state->batch_count; ++i) total += state->batches[i]->count;
+
+    latencies = (uint64_t *)calloc(MAX(1, total), sizeof(uint64_t));
+    for (size_t i = 0; NULL != latencies && i < state->batch_count; ++i) {
+        for (size_t j = 0; j < state->batches[i]->count; ++j) {
+            latencies[n++] = state->batches[i]->latencies[j];
+            if (0 == state->batches[i]->results[j]) verified++;
+            else if (-14 == state->batches[i]->results[j] || -15 == state->batches[i]->results[j]) turned_away++;
+            else failed++;
+        }
+    }
+
+    printf("Packets:              %lu (%lu truncated)\n", state->packets, state->truncated);
+    printf("Router Adverts:       %lu\n", state->router_adverts);
+    printf("  Vouchers parsed:    %lu\n", state->vouchers_parsed);
+    printf("  Vouchers reused:    %lu\n", state->vouchers_reused);
+    printf("  Vouchers invalid:   %lu\n", state->vouchers_invalid);
+    printf("NS/NA messages:       %lu\n", state->neighbor_messages);
+    printf("  Before any voucher: %lu\n", state->neighbors_without_voucher);
+    printf("  Missing LL option:  %lu\n", state->neighbors_without_lladdr);
+    printf("Verifications:        %lu (%lu verified, %lu failed)\n", (uint64_t)n, verified, failed);
+    if (NULL != state->scheduler) printf("  Turned away:        %lu\n", turned_away);
+    printf("Wall time:            %.3f s\n", seconds);
+    printf("Throughput:           %.1f packets/s, %.1f verifications/s\n", state->packets / seconds, n / seconds);
+
+    if (n > 0) {
+        qsort(latencies, n, sizeof(uint64_t), compare_u64);
+        printf("Latency (ingest to verdict):\n");
+        printf("  min %.3f ms  median %.3f ms  p99 %.3f ms  max %.3f ms\n",
+               latencies[0] / 1e6,
+               latencies[n / 2] / 1e6,
+               latencies[MIN(n - 1, ((n * 99) + 99) / 100 - 1)] / 1e6,
+               latencies[n - 1] / 1e6);
+    }
+
+    free(latencies);
+}
+
+
+
+int
+main(int argc,
+     char **argv)
+{
+    replay_state_t state = {};
+    const char *path = NULL;
+    const char *trace_path = NULL;
+    size_t thread_count = 0;
+    bool use_cache = true;
+    bool use_scheduler = false;
+    scheduler_policy_t policy = {0};
+    struct stat file_stat;
+    uint8_t *capture = NULL;
+    uint64_t started = 0;
+    int file = -1;
+    int status = 0;
+
+    state.batch_size = REPLAY_DEFAULT_BATCH;
+    state.device.iem = VBA_IEM_AGV;
+
+    /*
+     * Usage: vba-pcap-replay <capture.pcap> [--threads <n>] [--batch <n>] [--no-cache] [--agvl] [--schedule] [--max-cost <units>] [--trace <file>]
+     */
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "--threads") && (i + 1) < argc) {
+            thread_count = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (0 == strcmp(argv[i], "--batch") && (i + 1) < argc) {
+            state.batch_size = (size_t)strtoul(argv[++i], NULL, 10);
+            state.batch_size = MAX(1, MIN(REPLAY_MAX_BATCH, state.batch_size));
+        } else if (0 == strcmp(argv[i], "--no-cache")) {
+            use_cache = false;
+        } else if (0 == strcmp(argv[i], "--agvl")) {
+            state.device.iem = VBA_IEM_AGVL;
+        } else if (0 == strcmp(argv[i], "--schedule")) {
+            use_scheduler = true;
+        } else if (0 == strcmp(argv[i], "--max-cost") && (i + 1) < argc) {
+            policy.max_cpu_units = (uint64_t)strtoull(argv[++i], NULL, 10);
+            use_scheduler = true;
+        } else if (0 == strcmp(argv[i], "--trace") && (i + 1) < argc) {
+            trace_path = argv[++i];
+        } else if ('-' != argv[i][0] && NULL == path) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+
+    if (NULL == path) {
+        fprintf(stderr, "Usage: %s <capture.pcap> [--threads <n>] [--batch <n>] [--no-cache] [--agvl] [--schedule] [--max-cost <units>] [--trace <file>]\n", argv[0]);
+        return 1;
+    }
+
+    file = open(path, O_RDONLY);
+    if (file < 0 || 0 != fstat(file, &file_stat) || 0 == file_stat.st_size) {
+        fprintf(stderr, "Cannot open '%s'.\n", path);
+        if (file >= 0) close(file);
+        return 2;
+    }
+
+    capture = (uint8_t *)mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (MAP_FAILED == capture) {
+        fprintf(stderr, "Cannot map '%s'.\n", path);
+        return 2;
+    }
+
+    /* The whole capture is read front to back exactly once. */
+    madvise(capture, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+
+    state.pool = pool__create(thread_count);
+    if (NULL == state.pool) {
+        status = 3;
+        goto Label__main_Unmap;
+    }
+
+    if (use_cache) state.device.neighbor_cache = ncache__create(VBA_NCACHE_DEFAULT_CAPACITY);
+
+    /* Cheapest-first admission per neighbor, instead of one pool task per batch. */
+    if (use_scheduler) {
+        state.scheduler = scheduler__create(state.pool, &policy);
+        if (NULL == state.scheduler) {
+            status = 3;
+            pool__destroy(state.pool);
+            goto Label__main_Unmap;
+        }
+    }
+
+    state.max_inflight = pool__thread_count(state.pool) * REPLAY_INFLIGHT_PER_THREAD;
+    pthread_mutex_init(&(state.lock), NULL);
+    pthread_cond_init(&(state.slot_free), NULL);
+
+    started = metrics__now_ns();
+
+    status = replay_capture(&state, capture, (size_t)file_stat.st_size);
+    if (0 != status) {
+        fprintf(stderr, "'%s' is not a usable pcap capture (%d).\n", path, status);
+    }
+
+    /* Wait for the pipeline to drain. */
+    pthread_mutex_lock(&(state.lock));
+    while (0 != state.inflight) pthread_cond_wait(&(state.slot_free), &(state.lock));
+    pthread_mutex_unlock(&(state.lock));
+
+    if (0 == status) print_report(&state, metrics__now_ns() - started);
+
+    /* Dump before the pool goes, while its threads' rings are all still live. */
+    if (NULL != trace_path && 0 != trace__write(trace_path)) {
+        fprintf(stderr, "Cannot write the trace to '%s'.\n", trace_path);
+    }
+
+    scheduler__destroy(state.scheduler);
+    pool__destroy(state.pool);
+    ncache__destroy(state.device.neighbor_cache);
+
+    for (size_t i = 0; i < state.batch_count; ++i) {
+        free(state.batches[i]->items);
+        free(state.batches[i]->latencies);
+        free(state.batches[i]->results);
+        free(state.batches[i]);
+    }
+    free(state.batches);
+
+    for (size_t i = 0; i < state.voucher_count; ++i) {
+        free(state.vouchers[i]->algorithm_spec);
+        free(state.vouchers[i]);
+    }
+    free(state.vouchers);
+
+    pthread_mutex_destroy(&(state.lock));
+    pthread_cond_destroy(&(state.slot_free));
+
+Label__main_Unmap:
+    munmap(capture, (size_t)file_stat.st_size);
+    return (0 == status) ? 0 : 1;
+}
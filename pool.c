@@ -0,0 +1,437 @@
+#include "pool.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+#define POOL_DEQUE_INITIAL_CAPACITY     64
+
+typedef
+struct {
+    pool_task_fn    task;
+    void            *argument;
+    pool_group_t    *group;
+} pool_task_t;
+
+/**
+ * A per-worker double-ended queue. The owning worker pushes and pops at the bottom (LIFO, which
+ *   keeps its caches warm) while thieves take from the top (FIFO, which hands out the oldest work).
+ */
+typedef
+struct {
+    pthread_mutex_t lock;
+    pool_task_t     *tasks;
+    size_t          capacity;
+    size_t          top;
+    size_t          bottom;
+} __attribute__((aligned(64))) pool_deque_t;
+
+struct vba_pool {
+    pthread_t       *threads;
+    pool_deque_t    *deques;
+    pool_deque_t    *idle_tasks;   /* Run oldest first, only by workers which find nothing else. */
+    size_t          thread_count;
+    size_t          next_deque;
+    size_t          queued;
+    bool            shutdown;
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t  work_available;
+};
+
+typedef
+struct {
+    vba_pool_t  *pool;
+    size_t      index;
+} pool_worker_arg_t;
+
+
+
+/* The pool and deque owned by the current thread, if the current thread is a pool worker. */
+static __thread vba_pool_t *current_pool = NULL;
+static __thread size_t current_index = 0;
+
+
+
+static int
+deque_push(pool_deque_t *deque,
+           const pool_task_t *task)
+{
+    pthread_mutex_lock(&(deque->lock));
+
+    if ((deque->bottom - deque->top) == deque->capacity) {
+        size_t new_capacity = deque->capacity * 2;
+        pool_task_t *tasks = (pool_task_t *)calloc(new_capacity, sizeof(pool_task_t));
+
+        if (NULL == tasks) {
+            pthread_mutex_unlock(&(deque->lock));
+            return -1;
+        }
+
+        for (size_t i = deque->top; i < deque->bottom; ++i) {
+            tasks[i % new_capacity] = deque->tasks[i % deque->capacity];
+        }
+
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = new_capacity;
+    }
+
+    deque->tasks[deque->bottom % deque->capacity] = *task;
+    deque->bottom++;
+
+    pthread_mutex_unlock(&(deque->lock));
+    return 0;
+}
+
+
+static bool
+deque_pop_bottom(pool_deque_t *deque,
+                 pool_task_t *task)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&(deque->lock));
+    if (deque->bottom > deque->top) {
+        deque->bottom--;
+        *task = deque->tasks[deque->bottom % deque->capacity];
+        found = true;
+    }
+    pthread_mutex_unlock(&(deque->lock));
+
+    return found;
+}
+
+
+static bool
+deque_steal_top(pool_deque_t *deque,
+                pool_task_t *task)
+{
+    bool found = false;
+
+    /* Thieves never wait on a busy deque; there is likely another victim with work. */
+    if (0 != pthread_mutex_trylock(&(deque->lock))) return false;
+
+    if (deque->bottom > deque->top) {
+        *task = deque->tasks[deque->top % deque->capacity];
+        deque->top++;
+        found = true;
+    }
+    pthread_mutex_unlock(&(deque->lock));
+
+    return found;
+}
+
+
+static bool
+deque_pop_top(pool_deque_t *deque,
+              pool_task_t *task)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&(deque->lock));
+    if (deque->bottom > deque->top) {
+        *task = deque->tasks[deque->top % deque->capacity];
+        deque->top++;
+        found = true;
+    }
+    pthread_mutex_unlock(&(deque->lock));
+
+    return found;
+}
+
+
+/* Take a task from `home` first, then try to steal from everyone else. */
+static bool
+find_task(vba_pool_t *pool,
+          size_t home,
+          pool_task_t *task)
+{
+    if (home < pool->thread_count && deque_pop_bottom(&(pool->deques[home]), task)) {
+        goto Label__find_task_Found;
+    }
+
+    /* Two sweeps: the first can miss deques whose locks were briefly held. */
+    for (size_t sweep = 0; sweep < 2; ++sweep) {
+        for (size_t i = 1; i <= pool->thread_count; ++i) {
+            size_t victim = (home + i) % pool->thread_count;
+
+            if (deque_steal_top(&(pool->deques[victim]), task)) goto Label__find_task_Found;
+        }
+    }
+
+    return false;
+
+Label__find_task_Found:
+    __atomic_sub_fetch(&(pool->queued), 1, __ATOMIC_ACQ_REL);
+    return true;
+}
+
+
+static void
+run_task(pool_task_t *task)
+{
+    task->task(task->argument);
+
+    if (NULL != task->group) {
+        pthread_mutex_lock(&(task->group->lock));
+        if (0 == --(task->group->pending)) {
+            pthread_cond_broadcast(&(task->group->done));
+        }
+        pthread_mutex_unlock(&(task->group->lock));
+    }
+}
+
+
+/* Called only once every deque came up empty. */
+static bool
+find_idle_task(vba_pool_t *pool,
+               pool_task_t *task)
+{
+    if (!deque_pop_top(pool->idle_tasks, task)) return false;
+
+    __atomic_sub_fetch(&(pool->queued), 1, __ATOMIC_ACQ_REL);
+    return true;
+}
+
+
+static void *
+worker_main(void *argument)
+{
+    pool_worker_arg_t *worker = (pool_worker_arg_t *)argument;
+    vba_pool_t *pool = worker->pool;
+    pool_task_t task;
+
+    current_pool = pool;
+    current_index = worker->index;
+    free(worker);
+
+    for (;;) {
+        if (find_task(pool, current_index, &task) || find_idle_task(pool, &task)) {
+            run_task(&task);
+            continue;
+        }
+
+        pthread_mutex_lock(&(pool->sleep_lock));
+        while (false == pool->shutdown && 0 == __atomic_load_n(&(pool->queued), __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&(pool->work_available), &(pool->sleep_lock));
+        }
+
+        if (true == pool->shutdown && 0 == __atomic_load_n(&(pool->queued), __ATOMIC_ACQUIRE)) {
+            pthread_mutex_unlock(&(pool->sleep_lock));
+            break;
+        }
+        pthread_mutex_unlock(&(pool->sleep_lock));
+    }
+
+    return NULL;
+}
+
+
+
+vba_pool_t *
+pool__create(size_t thread_count)
+{
+    vba_pool_t *pool = NULL;
+    long online_cores = 0;
+
+    if (0 == thread_count) {
+        online_cores = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = (online_cores > 0) ? (size_t)online_cores : 1;
+    }
+
+    pool = (vba_pool_t *)calloc(1, sizeof(vba_pool_t));
+    if (NULL == pool) return NULL;
+
+    pool->threads = (pthread_t *)calloc(thread_count, sizeof(pthread_t));
+
+    /* The idle-task queue sits after the workers' deques and is never stolen from. */
+    pool->deques = (pool_deque_t *)aligned_alloc(64, (thread_count + 1) * sizeof(pool_deque_t));
+    if (NULL == pool->threads || NULL == pool->deques) goto Label__pool_create_Error;
+
+    memset(pool->deques, 0x00, (thread_count + 1) * sizeof(pool_deque_t));
+    for (size_t i = 0; i <= thread_count; ++i) {
+        pthread_mutex_init(&(pool->deques[i].lock), NULL);
+        pool->deques[i].capacity = POOL_DEQUE_INITIAL_CAPACITY;
+        pool->deques[i].tasks = (pool_task_t *)calloc(POOL_DEQUE_INITIAL_CAPACITY, sizeof(pool_task_t));
+        if (NULL == pool->deques[i].tasks) goto Label__pool_create_Error;
+    }
+    pool->idle_tasks = &(pool->deques[thread_count]);
+
+    pthread_mutex_init(&(pool->sleep_lock), NULL);
+    pthread_cond_init(&(pool->work_available), NULL);
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        pool_worker_arg_t *worker = (pool_worker_arg_t *)calloc(1, sizeof(pool_worker_arg_t));
+        if (NULL == worker) break;
+
+        worker->pool = pool;
+        worker->index = i;
+
+        if (0 != pthread_create(&(pool->threads[i]), NULL, worker_main, worker)) {
+            free(worker);
+            break;
+        }
+
+        pool->thread_count++;
+    }
+
+    if (0 == pool->thread_count) goto Label__pool_create_Error;
+    return pool;
+
+Label__pool_create_Error:
+    if (NULL != pool->deques) {
+        for (size_t i = 0; i <= thread_count; ++i) free(pool->deques[i].tasks);
+    }
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+    return NULL;
+}
+
+
+void
+pool__destroy(vba_pool_t *pool)
+{
+    if (NULL == pool) return;
+
+    pthread_mutex_lock(&(pool->sleep_lock));
+    pool->shutdown = true;
+    pthread_cond_broadcast(&(pool->work_available));
+    pthread_mutex_unlock(&(pool->sleep_lock));
+
+    for (size_t i = 0; i < pool->thread_count; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < pool->thread_count; ++i) {
+        pthread_mutex_destroy(&(pool->deques[i].lock));
+        free(pool->deques[i].tasks);
+    }
+    pthread_mutex_destroy(&(pool->idle_tasks->lock));
+    free(pool->idle_tasks->tasks);
+
+    pthread_mutex_destroy(&(pool->sleep_lock));
+    pthread_cond_destroy(&(pool->work_available));
+
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
+
+
+size_t
+pool__thread_count(vba_pool_t *pool)
+{
+    return (NULL == pool) ? 0 : pool->thread_count;
+}
+
+
+int
+pool__submit(vba_pool_t *pool,
+             pool_group_t *group,
+             pool_task_fn task,
+             void *argument)
+{
+    size_t target = 0;
+    pool_task_t entry = { .task = task, .argument = argument, .group = group };
+
+    if (NULL == pool || NULL == task) return -1;
+
+    if (current_pool == pool) {
+        target = current_index;
+    } else {
+        target = __atomic_fetch_add(&(pool->next_deque), 1, __ATOMIC_RELAXED) % pool->thread_count;
+    }
+
+    if (NULL != group) {
+        pthread_mutex_lock(&(group->lock));
+        group->pending++;
+        pthread_mutex_unlock(&(group->lock));
+    }
+
+    /* Count the task before it becomes visible so a thief can never drive the count below zero. */
+    __atomic_add_fetch(&(pool->queued), 1, __ATOMIC_ACQ_REL);
+
+    if (0 != deque_push(&(pool->deques[target]), &entry)) {
+        __atomic_sub_fetch(&(pool->queued), 1, __ATOMIC_ACQ_REL);
+        if (NULL != group) {
+            pthread_mutex_lock(&(group->lock));
+            group->pending--;
+            pthread_mutex_unlock(&(group->lock));
+        }
+        return -2;
+    }
+
+    /* Signalling under the sleep lock guarantees no worker misses the wakeup. */
+    pthread_mutex_lock(&(pool->sleep_lock));
+    pthread_cond_signal(&(pool->work_available));
+    pthread_mutex_unlock(&(pool->sleep_lock));
+
+    return 0;
+}
+
+
+int
+pool__submit_idle(vba_pool_t *pool,
+                  pool_task_fn task,
+                  void *argument)
+{
+    pool_task_t entry = { .task = task, .argument = argument, .group = NULL };
+
+    if (NULL == pool || NULL == task) return -1;
+
+    __atomic_add_fetch(&(pool->queued), 1, __ATOMIC_ACQ_REL);
+
+    if (0 != deque_push(pool->idle_tasks, &entry)) {
+        __atomic_sub_fetch(&(pool->queued), 1, __ATOMIC_ACQ_REL);
+        return -2;
+    }
+
+    pthread_mutex_lock(&(pool->sleep_lock));
+    pthread_cond_signal(&(pool->work_available));
+    pthread_mutex_unlock(&(pool->sleep_lock));
+
+    return 0;
+}
+
+
+void
+pool__group_init(pool_group_t *group)
+{
+    group->pending = 0;
+    pthread_mutex_init(&(group->lock), NULL);
+    pthread_cond_init(&(group->done), NULL);
+}
+
+
+void
+pool__group_wait(vba_pool_t *pool,
+                 pool_group_t *group)
+{
+    pool_task_t task;
+    size_t home = (current_pool == pool) ? current_index : pool__thread_count(pool);
+
+    for (;;) {
+        pthread_mutex_lock(&(group->lock));
+        if (0 == group->pending) {
+            pthread_mutex_unlock(&(group->lock));
+            return;
+        }
+        pthread_mutex_unlock(&(group->lock));
+
+        /* Lend a hand rather than idling while the group drains. */
+        if (NULL != pool && find_task(pool, home, &task)) {
+            run_task(&task);
+            continue;
+        }
+
+        pthread_mutex_lock(&(group->lock));
+        if (0 != group->pending) {
+            pthread_cond_wait(&(group->done), &(group->lock));
+        }
+        pthread_mutex_unlock(&(group->lock));
+    }
+}
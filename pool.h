@@ -0,0 +1,94 @@
+#ifndef LIB_VBA_POOL_H
+#define LIB_VBA_POOL_H
+
+#include "vba.h"
+
+#include <pthread.h>
+
+
+
+/**
+ * A unit of work handed to the pool.
+ */
+typedef void (*pool_task_fn)(void *argument);
+
+/**
+ * Tracks completion of a set of related tasks (e.g. one batch) so the submitter can wait on them.
+ */
+typedef
+struct {
+    size_t          pending;
+    pthread_mutex_t lock;
+    pthread_cond_t  done;
+} pool_group_t;
+
+
+
+/**
+ * Create a persistent work-stealing pool. A `thread_count` of 0 sizes the pool to the online core count.
+ */
+vba_pool_t *
+pool__create(
+    size_t              thread_count
+);
+
+/**
+ * Stop all workers and release the pool. Tasks which are still queued are run before the workers exit.
+ */
+void
+pool__destroy(
+    vba_pool_t          *pool
+);
+
+/**
+ * Get the amount of worker threads owned by the pool.
+ */
+size_t
+pool__thread_count(
+    vba_pool_t          *pool
+);
+
+/**
+ * Queue a task. When called from a pool worker the task goes onto that worker's own deque;
+ *   otherwise it is distributed round-robin. Idle workers steal from busy ones.
+ */
+int
+pool__submit(
+    vba_pool_t          *pool,
+    pool_group_t        *group,
+    pool_task_fn        task,
+    void                *argument
+);
+
+/**
+ * Queue a task which is only run by a worker that finds no other queued work, e.g. topping up a
+ *   cache. Such tasks run oldest first, and `pool__group_wait` never picks them up to help.
+ */
+int
+pool__submit_idle(
+    vba_pool_t          *pool,
+    pool_task_fn        task,
+    void                *argument
+);
+
+/**
+ * Prepare a task group for use.
+ */
+void
+pool__group_init(
+    pool_group_t        *group
+);
+
+/**
+ * Wait for every task in the group to finish. The waiting thread helps to run queued tasks
+ *   while it waits, so this is also safe to call from inside a pool worker.
+ */
+void
+pool__group_wait(
+    vba_pool_t          *pool,
+    pool_group_t        *group
+);
+
+
+
+#endif   /* LIB_VBA_POOL_H */
@@ -0,0 +1,237 @@
+#include "ratelimit.h"
+
+#include "generator.h"
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+#define RATELIMIT_WAYS          4    /* Buckets per set; the least recently charged one is recycled. */
+#define RATELIMIT_LOCK_STRIPES  64
+
+typedef
+struct {
+    uint64_t    key;        /* 0 for an unused bucket. */
+    int64_t     balance;    /* Negative while in debt. */
+    uint64_t    stamp_ns;   /* Last refill, which is also the last charge. */
+} ratelimit_bucket_t;
+
+typedef
+struct {
+    ratelimit_bucket_t  *buckets;
+    size_t              set_mask;
+    uint64_t            rate;
+    uint64_t            burst;
+    pthread_mutex_t     locks[RATELIMIT_LOCK_STRIPES];
+} ratelimit_table_t;
+
+struct rate_limiter {
+    ratelimit_table_t   llids;
+    ratelimit_table_t   prefixes;
+    uint64_t            hash_seed;   /* Per limiter, so neighbors cannot aim for each other's buckets. */
+};
+
+
+
+static uint64_t
+hash_key(uint64_t seed,
+         const uint8_t *key,
+         size_t key_length)
+{
+    uint64_t h = seed ^ key_length;
+    uint64_t word = 0;
+
+    for (size_t i = 0; i < key_length; i += sizeof(word)) {
+        word = 0;
+        memcpy(&word, key + i, MIN(sizeof(word), key_length - i));
+
+        h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+        h ^= (h >> 32);
+    }
+
+    h ^= (h >> 29);
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= (h >> 32);
+
+    return (0 == h) ? 1 : h;   /* 0 marks an unused bucket. */
+}
+
+
+static int
+table_init(ratelimit_table_t *table,
+           size_t capacity,
+           uint64_t rate,
+           uint64_t burst)
+{
+    size_t set_count = 1;
+
+    table->rate = rate;
+    table->burst = MIN((0 == burst) ? rate : burst, (uint64_t)INT64_MAX / 2);   /* One second's worth by default. */
+
+    for (int i = 0; i < RATELIMIT_LOCK_STRIPES; ++i) pthread_mutex_init(&(table->locks[i]), NULL);
+
+    if (0 == rate) return 0;   /* Unlimited; no buckets needed. */
+
+    while (set_count * RATELIMIT_WAYS < capacity) set_count <<= 1;
+    table->set_mask = set_count - 1;
+
+    table->buckets = (ratelimit_bucket_t *)calloc(set_count * RATELIMIT_WAYS, sizeof(ratelimit_bucket_t));
+    return (NULL == table->buckets) ? -3 : 0;
+}
+
+
+static void
+table_destroy(ratelimit_table_t *table)
+{
+    for (int i = 0; i < RATELIMIT_LOCK_STRIPES; ++i) pthread_mutex_destroy(&(table->locks[i]));
+    free(table->buckets);
+}
+
+
+static inline pthread_mutex_t *
+lock_for(ratelimit_table_t *table,
+         uint64_t key)
+{
+    return &(table->locks[(key & table->set_mask) % RATELIMIT_LOCK_STRIPES]);
+}
+
+
+/* Must be called with the key's lock held. Finds or recycles the key's bucket and refills it. */
+static ratelimit_bucket_t *
+bucket_for(ratelimit_table_t *table,
+           uint64_t key,
+           uint64_t now_ns)
+{
+    ratelimit_bucket_t *set = &(table->buckets[(key & table->set_mask) * RATELIMIT_WAYS]);
+    ratelimit_bucket_t *bucket = NULL;
+    unsigned __int128 refill = 0;
+
+    for (int i = 0; i < RATELIMIT_WAYS; ++i) {
+        if (key == set[i].key) {
+            bucket = &(set[i]);
+            break;
+        }
+        if (NULL == bucket || set[i].stamp_ns < bucket->stamp_ns) bucket = &(set[i]);
+    }
+
+    /*
+     * A newcomer (or a key whose bucket was recycled) starts with an empty bucket. A full one
+     *   would let a neighbor buy a fresh burst by crowding its own bucket out of the set.
+     */
+    if (key != bucket->key) {
+        bucket->key = key;
+        bucket->balance = 0;
+        bucket->stamp_ns = now_ns;
+        return bucket;
+    }
+
+    if (now_ns > bucket->stamp_ns) {
+        refill = (unsigned __int128)(now_ns - bucket->stamp_ns) * table->rate / 1000000000ULL;
+        refill = MIN(refill, (unsigned __int128)((int64_t)table->burst - bucket->balance));
+
+        bucket->balance += (int64_t)refill;
+        bucket->stamp_ns = now_ns;
+    }
+
+    return bucket;
+}
+
+
+
+rate_limiter_t *
+ratelimit__create(const ratelimit_config_t *config)
+{
+    rate_limiter_t *limiter = NULL;
+    size_t capacity = 0;
+    struct timespec now;
+
+    if (NULL == config) return NULL;
+
+    limiter = (rate_limiter_t *)calloc(1, sizeof(rate_limiter_t));
+    if (NULL == limiter) return NULL;
+
+    capacity = (0 == config->capacity) ? VBA_RATELIMIT_DEFAULT_CAPACITY : config->capacity;
+
+    if (
+        0 != table_init(&(limiter->llids), capacity, config->llid_rate, config->llid_burst)
+        || 0 != table_init(&(limiter->prefixes), capacity, config->prefix_rate, config->prefix_burst)
+    ) {
+        ratelimit__destroy(limiter);
+        return NULL;
+    }
+
+    /* The PRNG may not have been seeded by the application, so fold in the clock as well. */
+    clock_gettime(CLOCK_REALTIME, &now);
+    limiter->hash_seed = Xoshiro128p__next_bounded_any() ^ ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec;
+
+    return limiter;
+}
+
+
+void
+ratelimit__destroy(rate_limiter_t *limiter)
+{
+    if (NULL == limiter) return;
+
+    table_destroy(&(limiter->llids));
+    table_destroy(&(limiter->prefixes));
+    free(limiter);
+}
+
+
+bool
+ratelimit__admit(rate_limiter_t *limiter,
+                 const ipv6_addr_t *ip,
+                 const llid_t *link_layer_id,
+                 uint64_t cost_units)
+{
+    ratelimit_bucket_t *llid_bucket = NULL;
+    ratelimit_bucket_t *prefix_bucket = NULL;
+    pthread_mutex_t *llid_lock = NULL;
+    pthread_mutex_t *prefix_lock = NULL;
+    uint64_t llid_key = 0;
+    uint64_t prefix_key = 0;
+    uint64_t now_ns = 0;
+    bool is_admitted = false;
+
+    if (NULL == limiter || NULL == ip || NULL == link_layer_id) return true;
+
+    now_ns = metrics__now_ns();
+    cost_units = MIN(cost_units, (uint64_t)INT64_MAX / 2);
+
+    /* The full 8-byte prefix: that is the /64 whatever length the neighbor claims. */
+    llid_key = hash_key(limiter->hash_seed, link_layer_id->id, MIN(link_layer_id->length, sizeof(link_layer_id->id)));
+    prefix_key = hash_key(~(limiter->hash_seed), ip->prefix, VBA_PREFIX_LENGTH);
+
+    /* Always LLID before prefix, so two admissions can never wait on each other. */
+    if (0 != limiter->llids.rate) {
+        llid_lock = lock_for(&(limiter->llids), llid_key);
+        pthread_mutex_lock(llid_lock);
+        llid_bucket = bucket_for(&(limiter->llids), llid_key, now_ns);
+    }
+
+    if (0 != limiter->prefixes.rate) {
+        prefix_lock = lock_for(&(limiter->prefixes), prefix_key);
+        pthread_mutex_lock(prefix_lock);
+        prefix_bucket = bucket_for(&(limiter->prefixes), prefix_key, now_ns);
+    }
+
+    is_admitted = (
+        (NULL == llid_bucket || llid_bucket->balance > 0)
+        && (NULL == prefix_bucket || prefix_bucket->balance > 0)
+    );
+
+    if (is_admitted) {
+        if (NULL != llid_bucket) llid_bucket->balance -= (int64_t)cost_units;
+        if (NULL != prefix_bucket) prefix_bucket->balance -= (int64_t)cost_units;
+    }
+
+    if (NULL != prefix_lock) pthread_mutex_unlock(prefix_lock);
+    if (NULL != llid_lock) pthread_mutex_unlock(llid_lock);
+
+    return is_admitted;
+}
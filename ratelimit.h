@@ -0,0 +1,65 @@
+#ifndef LIB_VBA_RATELIMIT_H
+#define LIB_VBA_RATELIMIT_H
+
+#include "vba.h"
+
+#include <stdbool.h>
+
+
+
+/* Buckets kept per key kind (LLIDs, /64 prefixes) by default. */
+#define VBA_RATELIMIT_DEFAULT_CAPACITY  1024
+
+
+
+/**
+ * Budgets, in the cost units of `vba__estimate_cost`. A rate of 0 leaves that key kind unlimited.
+ */
+typedef
+struct {
+    size_t      capacity;       /* Buckets per key kind; 0 for VBA_RATELIMIT_DEFAULT_CAPACITY. */
+    uint64_t    llid_rate;      /* Units refilled per second, per LLID. */
+    uint64_t    llid_burst;     /* Most units an idle LLID can bank. */
+    uint64_t    prefix_rate;    /* Units refilled per second, per /64 prefix. */
+    uint64_t    prefix_burst;   /* Most units an idle /64 prefix can bank. */
+} ratelimit_config_t;
+
+
+
+/**
+ * Create token buckets which share verification CPU fairly between neighbors: one bucket per
+ *   LLID and one per /64 prefix, each refilled at its configured rate. Buckets live in a fixed
+ *   table; once it is full, the least recently charged bucket of a set is recycled. A key without
+ *   a bucket starts with an empty one, so it is first admitted once the rate has refilled it.
+ */
+rate_limiter_t *
+ratelimit__create(
+    const ratelimit_config_t        *config
+);
+
+/**
+ * Destroy a limiter. No thread may be using it.
+ */
+void
+ratelimit__destroy(
+    rate_limiter_t                  *limiter
+);
+
+/**
+ * Charge a verification costing `cost_units` to the neighbor's LLID and /64 prefix. It is admitted
+ *   when neither bucket is in debt; then both are charged the full cost, which may put them in
+ *   debt until they refill. A refused request charges nothing.
+ *
+ * A NULL limiter admits everything.
+ */
+bool
+ratelimit__admit(
+    rate_limiter_t                  *limiter,
+    const ipv6_addr_t               *ip,
+    const llid_t                    *link_layer_id,
+    uint64_t                        cost_units
+);
+
+
+
+#endif   /* LIB_VBA_RATELIMIT_H */
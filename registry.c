@@ -0,0 +1,544 @@
+#include "registry.h"
+
+#include "ncache.h"
+#include "ndopt.h"
+#include "negfilter.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+#define REGISTRY_SHARD_INITIAL_SLOTS    64
+#define REGISTRY_CACHE_LINE             64
+
+/**
+ * One interface. Each is allocated on its own cache lines, so threads working on neighboring
+ *   interfaces never write to the same line.
+ *
+ * When the active voucher is replaced, the previous one is retired. Calls through
+ *   `registry__device` may still be running under it, however long ago it was replaced, so
+ *   retired vouchers are only released once the device has been seen with no pins at all.
+ */
+typedef
+struct {
+    pseudo_net_dev_t            device;
+    subnet_t                    subnets[MAX_PSEDUO_SUBNETS];
+    nd_link_voucher_option_t    **retired;
+    size_t                      retired_count;
+    size_t                      retired_capacity;
+} __attribute__((aligned(REGISTRY_CACHE_LINE))) registry_device_t;
+
+typedef
+struct {
+    pthread_mutex_t     lock;
+    registry_device_t   **slots;   /* NULL for a free slot. */
+    size_t              slot_count;
+    size_t              slot_capacity;
+    uint32_t            *free_slots;
+    size_t              free_count;
+} __attribute__((aligned(REGISTRY_CACHE_LINE))) registry_shard_t;
+
+typedef
+struct {
+    nd_link_voucher_option_t    *voucher;
+    size_t                      references;
+} registry_voucher_t;
+
+struct vba_registry {
+    vba_pool_t          *pool;
+    neighbor_cache_t    *neighbor_cache;
+    negative_filter_t   *negative_filter;
+    registry_shard_t    *shards;
+    size_t              shard_count;
+    uint32_t            next_shard;
+    pthread_mutex_t     voucher_lock;
+    registry_voucher_t  *vouchers;
+    size_t              voucher_count;
+    size_t              voucher_capacity;
+};
+
+
+
+static void
+free_voucher(nd_link_voucher_option_t *voucher)
+{
+    free(voucher->algorithm_spec);
+    free(voucher);
+}
+
+
+/*
+ * Device IDs interleave the shards: the low part of the ID picks the shard. Returns NULL for an
+ *   ID which no registry could have handed out.
+ */
+static registry_shard_t *
+device_shard(vba_registry_t *registry,
+             vba_device_id_t device_id,
+             size_t *slot)
+{
+    if (NULL == registry || VBA_DEVICE_ID_INVALID == device_id) return NULL;
+
+    *slot = device_id / registry->shard_count;
+    return &(registry->shards[device_id % registry->shard_count]);
+}
+
+
+/*
+ * Must be called with the shard lock held, and the entry may only be used until it is released:
+ *   `claim_slot` may move the slot table and `registry__remove_device` frees the entry.
+ */
+static registry_device_t *
+locked_device(registry_shard_t *shard,
+              size_t slot)
+{
+    return (slot < shard->slot_count) ? shard->slots[slot] : NULL;
+}
+
+
+/* Take another reference to a voucher the registry holds. Returns false if it holds no such voucher. */
+static bool
+retain_voucher(vba_registry_t *registry,
+               nd_link_voucher_option_t *voucher)
+{
+    bool is_held = false;
+
+    pthread_mutex_lock(&(registry->voucher_lock));
+
+    for (size_t i = 0; i < registry->voucher_count; ++i) {
+        if (voucher != registry->vouchers[i].voucher) continue;
+
+        registry->vouchers[i].references++;
+        is_held = true;
+        break;
+    }
+
+    pthread_mutex_unlock(&(registry->voucher_lock));
+
+    return is_held;
+}
+
+
+/*
+ * Must be called with the shard lock held. Hands the entry's retired vouchers over to `expired`
+ *   (to be released once the lock is dropped) if no call can still be using them.
+ */
+static void
+reap_retired(registry_device_t *entry,
+             nd_link_voucher_option_t ***expired,
+             size_t *expired_count)
+{
+    *expired = NULL;
+    *expired_count = 0;
+
+    if (0 == entry->retired_count || 0 != vba__voucher_pins(&(entry->device))) return;
+
+    *expired = entry->retired;
+    *expired_count = entry->retired_count;
+
+    entry->retired = NULL;
+    entry->retired_count = 0;
+    entry->retired_capacity = 0;
+}
+
+
+static void
+release_vouchers(vba_registry_t *registry,
+                 nd_link_voucher_option_t **vouchers,
+                 size_t count)
+{
+    for (size_t i = 0; i < count; ++i) registry__release_voucher(registry, vouchers[i]);
+    free(vouchers);
+}
+
+
+/* Must be called with the shard lock held. Returns the slot index, or -1. */
+static long
+claim_slot(registry_shard_t *shard)
+{
+    registry_device_t **slots = NULL;
+    uint32_t *free_slots = NULL;
+    size_t new_capacity = 0;
+
+    if (shard->free_count > 0) return (long)shard->free_slots[--(shard->free_count)];
+
+    if (shard->slot_count == shard->slot_capacity) {
+        new_capacity = MAX(REGISTRY_SHARD_INITIAL_SLOTS, shard->slot_capacity * 2);
+
+        slots = (registry_device_t **)realloc(shard->slots, new_capacity * sizeof(registry_device_t *));
+        if (NULL == slots) return -1;
+        shard->slots = slots;
+
+        free_slots = (uint32_t *)realloc(shard->free_slots, new_capacity * sizeof(uint32_t));
+        if (NULL == free_slots) return -1;
+        shard->free_slots = free_slots;
+
+        shard->slot_capacity = new_capacity;
+    }
+
+    shard->slots[shard->slot_count] = NULL;
+    return (long)(shard->slot_count++);
+}
+
+
+
+vba_registry_t *
+registry__create(vba_pool_t *pool,
+                 const registry_config_t *config)
+{
+    vba_registry_t *registry = NULL;
+    registry_config_t defaults = {0};
+
+    if (NULL == config) config = &defaults;
+
+    registry = (vba_registry_t *)calloc(1, sizeof(vba_registry_t));
+    if (NULL == registry) return NULL;
+
+    registry->pool = pool;
+    registry->shard_count = (0 == config->shard_count) ? VBA_REGISTRY_DEFAULT_SHARDS : config->shard_count;
+    registry->shard_count = MIN(VBA_REGISTRY_MAX_SHARDS, registry->shard_count);
+
+    registry->shards = (registry_shard_t *)aligned_alloc(REGISTRY_CACHE_LINE, registry->shard_count * sizeof(registry_shard_t));
+    if (NULL == registry->shards) goto Label__registry_create_Error;
+    memset(registry->shards, 0x00, registry->shard_count * sizeof(registry_shard_t));
+
+    if (0 != config->neighbor_cache_capacity) {
+        registry->neighbor_cache = ncache__create(config->neighbor_cache_capacity);
+        if (NULL == registry->neighbor_cache) goto Label__registry_create_Error;
+    }
+
+    if (0 != config->negative_filter_capacity) {
+        registry->negative_filter = negfilter__create(config->negative_filter_capacity, config->max_work_factor);
+        if (NULL == registry->negative_filter) goto Label__registry_create_Error;
+    }
+
+    for (size_t i = 0; i < registry->shard_count; ++i) {
+        pthread_mutex_init(&(registry->shards[i].lock), NULL);
+    }
+    pthread_mutex_init(&(registry->voucher_lock), NULL);
+
+    return registry;
+
+Label__registry_create_Error:
+    ncache__destroy(registry->neighbor_cache);
+    free(registry->shards);
+    free(registry);
+    return NULL;
+}
+
+
+void
+registry__destroy(vba_registry_t *registry)
+{
+    registry_shard_t *shard = NULL;
+
+    if (NULL == registry) return;
+
+    for (size_t i = 0; i < registry->shard_count; ++i) {
+        shard = &(registry->shards[i]);
+
+        for (size_t j = 0; j < shard->slot_count; ++j) {
+            if (NULL != shard->slots[j]) free(shard->slots[j]->retired);
+            free(shard->slots[j]);
+        }
+
+        free(shard->slots);
+        free(shard->free_slots);
+        pthread_mutex_destroy(&(shard->lock));
+    }
+
+    for (size_t i = 0; i < registry->voucher_count; ++i) free_voucher(registry->vouchers[i].voucher);
+
+    pthread_mutex_destroy(&(registry->voucher_lock));
+
+    ncache__destroy(registry->neighbor_cache);
+    negfilter__destroy(registry->negative_filter);
+    free(registry->vouchers);
+    free(registry->shards);
+    free(registry);
+}
+
+
+vba_device_id_t
+registry__add_device(vba_registry_t *registry,
+                     interface_enforcement_mode_t iem,
+                     const llid_t *link_layer_id,
+                     const subnet_t *subnets,
+                     size_t subnet_count)
+{
+    registry_device_t *entry = NULL;
+    registry_shard_t *shard = NULL;
+    size_t shard_index = 0;
+    long slot = -1;
+
+    if (NULL == registry || NULL == link_layer_id || (NULL == subnets && 0 != subnet_count)) return VBA_DEVICE_ID_INVALID;
+
+    entry = (registry_device_t *)aligned_alloc(REGISTRY_CACHE_LINE, sizeof(registry_device_t));
+    if (NULL == entry) return VBA_DEVICE_ID_INVALID;
+    memset(entry, 0x00, sizeof(registry_device_t));
+
+    subnet_count = MIN(MAX_PSEDUO_SUBNETS, subnet_count);
+    if (subnet_count > 0) memcpy(entry->subnets, subnets, subnet_count * sizeof(subnet_t));
+
+    entry->device.iem = iem;
+    memcpy(&(entry->device.link_layer_id), link_layer_id, sizeof(llid_t));
+    entry->device.subnet_prefixes = entry->subnets;
+    entry->device.subnet_prefixes_count = subnet_count;
+    entry->device.neighbor_cache = registry->neighbor_cache;
+    entry->device.negative_filter = registry->negative_filter;
+
+    /* Round-robin, so interfaces added in a burst do not all queue on one shard lock. */
+    shard_index = __atomic_fetch_add(&(registry->next_shard), 1, __ATOMIC_RELAXED) % registry->shard_count;
+    shard = &(registry->shards[shard_index]);
+
+    pthread_mutex_lock(&(shard->lock));
+    slot = claim_slot(shard);
+    if (slot >= 0) shard->slots[slot] = entry;
+    pthread_mutex_unlock(&(shard->lock));
+
+    if (slot < 0 || ((size_t)slot * registry->shard_count + shard_index) >= VBA_DEVICE_ID_INVALID) {
+        free(entry);
+        return VBA_DEVICE_ID_INVALID;
+    }
+
+    return (vba_device_id_t)((size_t)slot * registry->shard_count + shard_index);
+}
+
+
+int
+registry__remove_device(vba_registry_t *registry,
+                        vba_device_id_t device_id)
+{
+    registry_device_t *entry = NULL;
+    size_t slot = 0;
+    registry_shard_t *shard = device_shard(registry, device_id, &slot);
+
+    if (NULL == shard) return -1;
+
+    pthread_mutex_lock(&(shard->lock));
+    entry = locked_device(shard, slot);
+    if (NULL != entry) {
+        shard->slots[slot] = NULL;
+        shard->free_slots[shard->free_count++] = (uint32_t)slot;
+    }
+    pthread_mutex_unlock(&(shard->lock));
+
+    if (NULL == entry) return -1;
+
+    registry__release_voucher(registry, entry->device.active_voucher);
+    release_vouchers(registry, entry->retired, entry->retired_count);
+    free(entry);
+
+    return 0;
+}
+
+
+pseudo_net_dev_t *
+registry__device(vba_registry_t *registry,
+                 vba_device_id_t device_id)
+{
+    registry_device_t *entry = NULL;
+    size_t slot = 0;
+    registry_shard_t *shard = device_shard(registry, device_id, &slot);
+
+    if (NULL == shard) return NULL;
+
+    pthread_mutex_lock(&(shard->lock));
+    entry = locked_device(shard, slot);
+    pthread_mutex_unlock(&(shard->lock));
+
+    return (NULL == entry) ? NULL : &(entry->device);
+}
+
+
+nd_link_voucher_option_t *
+registry__intern_voucher(vba_registry_t *registry,
+                         const void *raw_option,
+                         size_t option_length)
+{
+    nd_link_voucher_view_t view;
+    nd_link_voucher_option_t *voucher = NULL;
+    registry_voucher_t *vouchers = NULL;
+
+    if (NULL == registry || 0 != ndopt__view_link_voucher(raw_option, option_length, &view)) return NULL;
+
+    pthread_mutex_lock(&(registry->voucher_lock));
+
+    /* Few distinct vouchers exist at once (one or two per link), so a scan is enough. */
+    for (size_t i = 0; i < registry->voucher_count; ++i) {
+        if (ndopt__view_matches(&view, registry->vouchers[i].voucher)) {
+            registry->vouchers[i].references++;
+            voucher = registry->vouchers[i].voucher;
+            goto Label__intern_voucher_Unlock;
+        }
+    }
+
+    if (registry->voucher_count == registry->voucher_capacity) {
+        size_t new_capacity = MAX(8, registry->voucher_capacity * 2);
+
+        vouchers = (registry_voucher_t *)realloc(registry->vouchers, new_capacity * sizeof(registry_voucher_t));
+        if (NULL == vouchers) goto Label__intern_voucher_Unlock;
+
+        registry->vouchers = vouchers;
+        registry->voucher_capacity = new_capacity;
+    }
+
+    if (0 != ndopt__process_link_voucher((void *)view.option, NULL, &voucher)) {
+        voucher = NULL;
+        goto Label__intern_voucher_Unlock;
+    }
+
+    registry->vouchers[registry->voucher_count].voucher = voucher;
+    registry->vouchers[registry->voucher_count].references = 1;
+    registry->voucher_count++;
+
+Label__intern_voucher_Unlock:
+    pthread_mutex_unlock(&(registry->voucher_lock));
+    return voucher;
+}
+
+
+void
+registry__release_voucher(vba_registry_t *registry,
+                          nd_link_voucher_option_t *voucher)
+{
+    nd_link_voucher_option_t *unused = NULL;
+
+    if (NULL == registry || NULL == voucher) return;
+
+    pthread_mutex_lock(&(registry->voucher_lock));
+
+    for (size_t i = 0; i < registry->voucher_count; ++i) {
+        if (voucher != registry->vouchers[i].voucher) continue;
+
+        if (0 == --(registry->vouchers[i].references)) {
+            unused = voucher;
+            registry->vouchers[i] = registry->vouchers[--(registry->voucher_count)];
+        }
+        break;
+    }
+
+    pthread_mutex_unlock(&(registry->voucher_lock));
+
+    if (NULL != unused) free_voucher(unused);
+}
+
+
+int
+registry__set_voucher(vba_registry_t *registry,
+                      vba_device_id_t device_id,
+                      const void *raw_option,
+                      size_t option_length)
+{
+    registry_device_t *entry = NULL;
+    nd_link_voucher_option_t *voucher = NULL;
+    nd_link_voucher_option_t *unused = NULL;
+    nd_link_voucher_option_t **retired = NULL;
+    nd_link_voucher_option_t **expired = NULL;
+    size_t expired_count = 0;
+    size_t new_capacity = 0;
+    size_t slot = 0;
+    int status = 0;
+    registry_shard_t *shard = device_shard(registry, device_id, &slot);
+
+    if (NULL == shard) return -1;
+
+    voucher = registry__intern_voucher(registry, raw_option, option_length);
+    if (NULL == voucher) return -3;
+
+    /* The shard lock keeps the entry alive and orders concurrent replacements on the same interface. */
+    pthread_mutex_lock(&(shard->lock));
+
+    entry = locked_device(shard, slot);
+    if (NULL == entry) {
+        unused = voucher;   /* Removed meanwhile (or never added). */
+        status = -1;
+        goto Label__set_voucher_Unlock;
+    }
+
+    if (voucher == entry->device.active_voucher) {
+        unused = voucher;   /* Re-advertising the same voucher must not leak a reference. */
+        goto Label__set_voucher_Unlock;
+    }
+
+    if (entry->retired_count == entry->retired_capacity) {
+        new_capacity = MAX(4, entry->retired_capacity * 2);
+
+        retired = (nd_link_voucher_option_t **)realloc(entry->retired, new_capacity * sizeof(nd_link_voucher_option_t *));
+        if (NULL == retired) {
+            unused = voucher;
+            status = -3;
+            goto Label__set_voucher_Unlock;
+        }
+
+        entry->retired = retired;
+        entry->retired_capacity = new_capacity;
+    }
+
+    /* Calls which pinned the old voucher may still be running; a pin taken from here on gets the new one. */
+    entry->retired[entry->retired_count++] = vba__publish_voucher(&(entry->device), voucher);
+    reap_retired(entry, &expired, &expired_count);
+
+Label__set_voucher_Unlock:
+    pthread_mutex_unlock(&(shard->lock));
+
+    registry__release_voucher(registry, unused);
+    release_vouchers(registry, expired, expired_count);
+
+    return status;
+}
+
+
+size_t
+registry__voucher_count(vba_registry_t *registry)
+{
+    size_t count = 0;
+
+    if (NULL == registry) return 0;
+
+    pthread_mutex_lock(&(registry->voucher_lock));
+    count = registry->voucher_count;
+    pthread_mutex_unlock(&(registry->voucher_lock));
+
+    return count;
+}
+
+
+int
+registry__verify_batch(vba_registry_t *registry,
+                       vba_device_id_t device_id,
+                       const vba_neighbor_t *neighbors,
+                       size_t count,
+                       int *results)
+{
+    registry_device_t *entry = NULL;
+    pseudo_net_dev_t device;
+    int status = 0;
+    size_t slot = 0;
+    registry_shard_t *shard = device_shard(registry, device_id, &slot);
+
+    if (NULL == shard) return -1;
+
+    /* Hold the voucher for the whole batch, however many times it is replaced meanwhile. */
+    pthread_mutex_lock(&(shard->lock));
+    entry = locked_device(shard, slot);
+    if (NULL == entry) {
+        pthread_mutex_unlock(&(shard->lock));
+        return -1;
+    }
+    /* Pins change without the lock, so the copy starts with none of its own. */
+    memcpy(&device, &(entry->device), offsetof(pseudo_net_dev_t, voucher_pins));
+    device.voucher_pins = 0;
+    if (NULL != device.active_voucher && !retain_voucher(registry, device.active_voucher)) device.active_voucher = NULL;
+    pthread_mutex_unlock(&(shard->lock));
+
+    if (NULL == device.active_voucher) return -1;
+
+    status = vba__verify_batch(&device, registry->pool, neighbors, count, results);
+
+    registry__release_voucher(registry, device.active_voucher);
+    return status;
+}
@@ -0,0 +1,142 @@
+#ifndef LIB_VBA_REGISTRY_H
+#define LIB_VBA_REGISTRY_H
+
+#include "vba.h"
+
+
+
+#define VBA_REGISTRY_DEFAULT_SHARDS     16
+#define VBA_REGISTRY_MAX_SHARDS         256
+
+#define VBA_DEVICE_ID_INVALID           UINT32_MAX
+
+typedef struct vba_registry vba_registry_t;
+
+typedef uint32_t vba_device_id_t;
+
+/**
+ * Sizing for a registry. Anything left at 0 takes its default or is not created.
+ */
+typedef
+struct {
+    size_t      shard_count;                /* Default VBA_REGISTRY_DEFAULT_SHARDS. */
+    size_t      neighbor_cache_capacity;    /* 0 for no shared neighbor cache. */
+    size_t      negative_filter_capacity;   /* 0 for no shared negative filter. */
+    uint16_t    max_work_factor;            /* Policy for the negative filter, if one is created. */
+} registry_config_t;
+
+
+
+/**
+ * Create a registry for many interfaces on one host. All interfaces share the worker pool,
+ *   one copy of every distinct voucher (and so its decoded KDF parameters and PBKDF2 midstate),
+ *   and optionally one neighbor cache and negative filter. Verification results depend only on
+ *   the neighbor's binding and the voucher, so interfaces on the same link reuse each other's.
+ *
+ * Interfaces are spread over shards, each with its own lock, and each interface's state sits
+ *   on its own cache lines.
+ */
+vba_registry_t *
+registry__create(
+    vba_pool_t                  *pool,
+    const registry_config_t     *config
+);
+
+/**
+ * Release the registry with every interface and voucher in it. Nothing may be using them.
+ */
+void
+registry__destroy(
+    vba_registry_t              *registry
+);
+
+/**
+ * Add an interface. Its LLID and subnet list are copied (at most MAX_PSEDUO_SUBNETS subnets).
+ *   Returns VBA_DEVICE_ID_INVALID on failure.
+ */
+vba_device_id_t
+registry__add_device(
+    vba_registry_t              *registry,
+    interface_enforcement_mode_t iem,
+    const llid_t                *link_layer_id,
+    const subnet_t              *subnets,
+    size_t                      subnet_count
+);
+
+/**
+ * Remove an interface and drop its voucher reference. No thread may still be using its device.
+ */
+int
+registry__remove_device(
+    vba_registry_t              *registry,
+    vba_device_id_t             device_id
+);
+
+/**
+ * The interface's device, which stays at the same address until it is removed. It can be passed
+ *   to every `vba__*` call as usual.
+ */
+pseudo_net_dev_t *
+registry__device(
+    vba_registry_t              *registry,
+    vba_device_id_t             device_id
+);
+
+/**
+ * Find or parse a raw Link Voucher option. A voucher the registry already holds is recognized
+ *   without parsing it again. Returns a new reference, or NULL if the option is not valid.
+ */
+nd_link_voucher_option_t *
+registry__intern_voucher(
+    vba_registry_t              *registry,
+    const void                  *raw_option,
+    size_t                      option_length
+);
+
+/**
+ * Drop a reference taken with `registry__intern_voucher`. The last one frees the voucher.
+ */
+void
+registry__release_voucher(
+    vba_registry_t              *registry,
+    nd_link_voucher_option_t    *voucher
+);
+
+/**
+ * Make a raw Link Voucher option the interface's active voucher, e.g. when an RA arrives on it.
+ *   Calls already running may go on under the previous voucher: it is retired, and its reference
+ *   is only dropped by a later replacement (or removal) which finds no voucher pinned on the device.
+ */
+int
+registry__set_voucher(
+    vba_registry_t              *registry,
+    vba_device_id_t             device_id,
+    const void                  *raw_option,
+    size_t                      option_length
+);
+
+/**
+ * The amount of distinct vouchers currently held.
+ */
+size_t
+registry__voucher_count(
+    vba_registry_t              *registry
+);
+
+/**
+ * Verify neighbors for one interface on the shared pool (see `vba__verify_batch`). The batch holds
+ *   a reference to the voucher that was active when it started, so it may overlap any amount of
+ *   `registry__set_voucher` calls.
+ */
+int
+registry__verify_batch(
+    vba_registry_t              *registry,
+    vba_device_id_t             device_id,
+    const vba_neighbor_t        *neighbors,
+    size_t                      count,
+    int                         *results
+);
+
+
+
+#endif   /* LIB_VBA_REGISTRY_H */
@@ -0,0 +1,307 @@
+#include "reservoir.h"
+
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+typedef
+struct {
+    vba_t                           address;
+    const nd_link_voucher_option_t  *voucher;
+    uint32_t                        voucher_id;
+} reservoir_entry_t;
+
+typedef
+struct {
+    vba_reservoir_t     *reservoir;
+    size_t              subnet_index;
+    reservoir_entry_t   *entries;   /* Oldest first. */
+    size_t              count;
+    bool                is_refilling;
+} reservoir_subnet_t;
+
+struct vba_reservoir {
+    pseudo_net_dev_t    *net_device;
+    vba_pool_t          *pool;
+    size_t              capacity;
+    uint16_t            work_factor;
+    pthread_mutex_t     lock;
+    pthread_cond_t      idle;
+    reservoir_subnet_t  *subnets;
+    size_t              subnet_count;
+    size_t              refilling;   /* Subnets with a refill running. */
+    bool                is_stopping;
+};
+
+
+
+static bool
+is_current(const vba_reservoir_t *reservoir,
+           const reservoir_entry_t *entry)
+{
+    const nd_link_voucher_option_t *voucher = vba__active_voucher(reservoir->net_device);
+
+    return (NULL != voucher && entry->voucher == voucher && entry->voucher_id == voucher->voucher_id);
+}
+
+
+/* Must be called with the lock held. */
+static void
+purge_stale(vba_reservoir_t *reservoir,
+            reservoir_subnet_t *subnet)
+{
+    size_t kept = 0;
+
+    for (size_t i = 0; i < subnet->count; ++i) {
+        if (!is_current(reservoir, &(subnet->entries[i]))) continue;
+
+        if (kept != i) memcpy(&(subnet->entries[kept]), &(subnet->entries[i]), sizeof(reservoir_entry_t));
+        kept++;
+    }
+
+    subnet->count = kept;
+}
+
+
+/*
+ * Generate one address for the subnet. Returns whether the subnet still wants more. The KDF
+ *   runs outside the lock, against a copy of the device taken just before.
+ */
+static bool
+refill_one(vba_reservoir_t *reservoir,
+           reservoir_subnet_t *subnet)
+{
+    pseudo_net_dev_t device;
+    vba_ctx_t ctx;
+    reservoir_entry_t entry;
+    int status = 0;
+
+    pthread_mutex_lock(&(reservoir->lock));
+    purge_stale(reservoir, subnet);
+    if (reservoir->is_stopping || subnet->count >= reservoir->capacity || NULL == vba__active_voucher(reservoir->net_device)) {
+        pthread_mutex_unlock(&(reservoir->lock));
+        return false;
+    }
+    /* Pins change without the lock, so the copy starts with none of its own. */
+    memcpy(&device, reservoir->net_device, offsetof(pseudo_net_dev_t, voucher_pins));
+    device.voucher_pins = 0;
+    pthread_mutex_unlock(&(reservoir->lock));
+
+    /* The copy generates under the voucher pinned on the real device, which stays put until the unpin. */
+    device.active_voucher = vba__pin_voucher(reservoir->net_device);
+    device.neighbor_cache = NULL;
+    vba_ctx__init(&ctx, &device, NULL, 0);
+
+    status = (NULL == device.active_voucher) ? -1 : vba__generate_ctx(&ctx, subnet->subnet_index, reservoir->work_factor, &(entry.address));
+    if (0 != status) {
+        vba__unpin_voucher(reservoir->net_device);
+        return false;   /* Try again at the next take or refill rather than spin. */
+    }
+
+    entry.voucher = device.active_voucher;
+    entry.voucher_id = device.active_voucher->voucher_id;
+    vba__unpin_voucher(reservoir->net_device);
+
+    pthread_mutex_lock(&(reservoir->lock));
+    if (is_current(reservoir, &entry) && subnet->count < reservoir->capacity) {
+        memcpy(&(subnet->entries[subnet->count++]), &entry, sizeof(reservoir_entry_t));
+    }
+    pthread_mutex_unlock(&(reservoir->lock));
+
+    return true;
+}
+
+
+static void
+refill_task(void *argument)
+{
+    reservoir_subnet_t *subnet = (reservoir_subnet_t *)argument;
+    vba_reservoir_t *reservoir = subnet->reservoir;
+
+    while (refill_one(reservoir, subnet)) {
+        /* Requeue behind all other work between addresses, so a long refill never holds a worker. */
+        if (NULL != reservoir->pool && 0 == pool__submit_idle(reservoir->pool, refill_task, subnet)) return;
+        if (NULL != reservoir->pool) break;
+    }
+
+    pthread_mutex_lock(&(reservoir->lock));
+    subnet->is_refilling = false;
+
+    /* The reservoir is not touched after this; a waiter in `reservoir__destroy` may free it. */
+    if (0 == --(reservoir->refilling)) pthread_cond_broadcast(&(reservoir->idle));
+    pthread_mutex_unlock(&(reservoir->lock));
+}
+
+
+/* Must be called with the lock held. Returns whether the caller should launch the refill. */
+static bool
+claim_refill(vba_reservoir_t *reservoir,
+             reservoir_subnet_t *subnet)
+{
+    if (reservoir->is_stopping || subnet->is_refilling || subnet->count >= reservoir->capacity) return false;
+
+    subnet->is_refilling = true;
+    reservoir->refilling++;
+
+    return true;
+}
+
+
+static void
+launch_refill(vba_reservoir_t *reservoir,
+              reservoir_subnet_t *subnet)
+{
+    if (NULL == reservoir->pool || 0 != pool__submit_idle(reservoir->pool, refill_task, subnet)) {
+        refill_task(subnet);
+    }
+}
+
+
+
+vba_reservoir_t *
+reservoir__create(pseudo_net_dev_t *net_device,
+                  vba_pool_t *pool,
+                  size_t capacity,
+                  uint16_t work_factor)
+{
+    vba_reservoir_t *reservoir = NULL;
+
+    if (NULL == net_device) return NULL;
+
+    reservoir = (vba_reservoir_t *)calloc(1, sizeof(vba_reservoir_t));
+    if (NULL == reservoir) return NULL;
+
+    reservoir->net_device = net_device;
+    reservoir->pool = pool;
+    reservoir->capacity = (0 == capacity) ? VBA_RESERVOIR_DEFAULT_CAPACITY : capacity;
+    reservoir->work_factor = work_factor;
+    reservoir->subnet_count = MIN(MAX_PSEDUO_SUBNETS, net_device->subnet_prefixes_count);
+
+    reservoir->subnets = (reservoir_subnet_t *)calloc(MAX(1, reservoir->subnet_count), sizeof(reservoir_subnet_t));
+    if (NULL == reservoir->subnets) goto Label__reservoir_create_Error;
+
+    for (size_t i = 0; i < reservoir->subnet_count; ++i) {
+        reservoir->subnets[i].reservoir = reservoir;
+        reservoir->subnets[i].subnet_index = i;
+        reservoir->subnets[i].entries = (reservoir_entry_t *)calloc(reservoir->capacity, sizeof(reservoir_entry_t));
+
+        if (NULL == reservoir->subnets[i].entries) goto Label__reservoir_create_Error;
+    }
+
+    pthread_mutex_init(&(reservoir->lock), NULL);
+    pthread_cond_init(&(reservoir->idle), NULL);
+
+    reservoir__refill(reservoir);
+
+    return reservoir;
+
+Label__reservoir_create_Error:
+    for (size_t i = 0; NULL != reservoir->subnets && i < reservoir->subnet_count; ++i) {
+        free(reservoir->subnets[i].entries);
+    }
+    free(reservoir->subnets);
+    free(reservoir);
+    return NULL;
+}
+
+
+void
+reservoir__destroy(vba_reservoir_t *reservoir)
+{
+    if (NULL == reservoir) return;
+
+    pthread_mutex_lock(&(reservoir->lock));
+    reservoir->is_stopping = true;
+    while (reservoir->refilling > 0) {
+        pthread_cond_wait(&(reservoir->idle), &(reservoir->lock));
+    }
+    pthread_mutex_unlock(&(reservoir->lock));
+
+    for (size_t i = 0; i < reservoir->subnet_count; ++i) {
+        /* Addresses are not secrets, but there is no reason to leave them lying around either. */
+        memset(reservoir->subnets[i].entries, 0x00, reservoir->capacity * sizeof(reservoir_entry_t));
+        free(reservoir->subnets[i].entries);
+    }
+
+    pthread_mutex_destroy(&(reservoir->lock));
+    pthread_cond_destroy(&(reservoir->idle));
+    free(reservoir->subnets);
+    free(reservoir);
+}
+
+
+int
+reservoir__take(vba_reservoir_t *reservoir,
+                size_t subnet_index,
+                vba_t *address)
+{
+    reservoir_subnet_t *subnet = NULL;
+    bool should_refill = false;
+    int status = 0;
+
+    if (NULL == reservoir || NULL == address) return -1;
+    if (subnet_index >= reservoir->subnet_count) return -7;
+
+    subnet = &(reservoir->subnets[subnet_index]);
+
+    pthread_mutex_lock(&(reservoir->lock));
+
+    purge_stale(reservoir, subnet);
+
+    if (0 == subnet->count) {
+        status = -17;   /* Nothing ready yet. */
+    } else {
+        memcpy(address, &(subnet->entries[0].address), sizeof(vba_t));
+        memmove(&(subnet->entries[0]), &(subnet->entries[1]), (subnet->count - 1) * sizeof(reservoir_entry_t));
+        subnet->count--;
+    }
+
+    should_refill = claim_refill(reservoir, subnet);
+
+    pthread_mutex_unlock(&(reservoir->lock));
+
+    if (should_refill) launch_refill(reservoir, subnet);
+
+    return status;
+}
+
+
+size_t
+reservoir__available(vba_reservoir_t *reservoir,
+                     size_t subnet_index)
+{
+    size_t available = 0;
+
+    if (NULL == reservoir || subnet_index >= reservoir->subnet_count) return 0;
+
+    pthread_mutex_lock(&(reservoir->lock));
+    purge_stale(reservoir, &(reservoir->subnets[subnet_index]));
+    available = reservoir->subnets[subnet_index].count;
+    pthread_mutex_unlock(&(reservoir->lock));
+
+    return available;
+}
+
+
+void
+reservoir__refill(vba_reservoir_t *reservoir)
+{
+    bool should_refill = false;
+
+    if (NULL == reservoir) return;
+
+    for (size_t i = 0; i < reservoir->subnet_count; ++i) {
+        pthread_mutex_lock(&(reservoir->lock));
+        purge_stale(reservoir, &(reservoir->subnets[i]));
+        should_refill = claim_refill(reservoir, &(reservoir->subnets[i]));
+        pthread_mutex_unlock(&(reservoir->lock));
+
+        if (should_refill) launch_refill(reservoir, &(reservoir->subnets[i]));
+    }
+}
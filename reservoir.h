@@ -0,0 +1,72 @@
+#ifndef LIB_VBA_RESERVOIR_H
+#define LIB_VBA_RESERVOIR_H
+
+#include "vba.h"
+
+
+
+#define VBA_RESERVOIR_DEFAULT_CAPACITY  4
+
+typedef struct vba_reservoir vba_reservoir_t;
+
+
+
+/**
+ * Create a reservoir of ready-to-use addresses for every subnet prefix of a device. Pool workers
+ *   top it up one address at a time, and only when they have no other queued work (see
+ *   `pool__submit_idle`). With a NULL pool, refills run to completion on the thread that asked.
+ *
+ * Each address is generated separately, so every one gets its own random prefix noise. A
+ *   `capacity` of 0 keeps `VBA_RESERVOIR_DEFAULT_CAPACITY` addresses per subnet.
+ */
+vba_reservoir_t *
+reservoir__create(
+    pseudo_net_dev_t            *net_device,
+    vba_pool_t                  *pool,
+    size_t                      capacity,
+    uint16_t                    work_factor
+);
+
+/**
+ * Wait for running refills to finish, then release the reservoir and all addresses left in it.
+ */
+void
+reservoir__destroy(
+    vba_reservoir_t             *reservoir
+);
+
+/**
+ * Take the oldest address generated for `subnet_index` under the device's active voucher, e.g.
+ *   to replace an address which collided during DAD. A refill is started behind it.
+ *
+ * Returns 0 on success, -7 for a subnet the reservoir does not cover, and -17 when no address is
+ *   ready; callers which cannot wait should then fall back to `vba__generate`.
+ */
+int
+reservoir__take(
+    vba_reservoir_t             *reservoir,
+    size_t                      subnet_index,
+    vba_t                       *address
+);
+
+/**
+ * The amount of addresses ready for a subnet under the device's active voucher.
+ */
+size_t
+reservoir__available(
+    vba_reservoir_t             *reservoir,
+    size_t                      subnet_index
+);
+
+/**
+ * Drop addresses made under an old voucher and top every subnet back up. Call after changing
+ *   the device's active voucher; stale addresses are never handed out either way.
+ */
+void
+reservoir__refill(
+    vba_reservoir_t             *reservoir
+);
+
+
+
+#endif   /* LIB_VBA_RESERVOIR_H */
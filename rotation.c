@@ -0,0 +1,387 @@
+#include "rotation.h"
+
+#include "metrics.h"
+#include "pool.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+typedef struct rotation_epoch rotation_epoch_t;
+
+typedef
+struct {
+    rotation_epoch_t    *epoch;
+    size_t              subnet_index;
+} rotation_job_t;
+
+/**
+ * One voucher together with the addresses generated under it. An epoch is generated while it is
+ *   pending, then becomes active, then is retired. The last retired epoch is kept for one more
+ *   rotation so that threads still holding a snapshot of the device do not read freed memory;
+ *   older ones are freed once no call has the device's voucher pinned.
+ */
+struct rotation_epoch {
+    vba_rotation_t              *rotation;
+    nd_link_voucher_option_t    *voucher;
+    pseudo_net_dev_t            device;   /* The rotation's device, generating under `voucher`. */
+    vba_t                       *addresses;   /* One per subnet prefix, in the same order. */
+    size_t                      address_count;
+    rotation_job_t              *jobs;
+    size_t                      remaining;   /* Addresses still being generated. */
+    int                         status;   /* First generation failure, if any. */
+    bool                        is_superseded;   /* Replaced while generating; freed by its last job. */
+    rotation_epoch_t            *older;   /* The epoch retired before this one. */
+};
+
+struct vba_rotation {
+    pseudo_net_dev_t    *net_device;
+    vba_pool_t          *pool;
+    uint16_t            work_factor;
+    pthread_mutex_t     lock;
+    pthread_cond_t      idle;
+    size_t              generating;   /* Epochs with jobs still outstanding. */
+    rotation_epoch_t    *active;   /* NULL while the caller's own voucher is active. */
+    rotation_epoch_t    *pending;
+    rotation_epoch_t    *retired;   /* Most recently retired first. */
+    uint64_t            active_since;
+};
+
+
+
+static void
+epoch_free(rotation_epoch_t *epoch)
+{
+    if (NULL == epoch) return;
+
+    if (NULL != epoch->voucher) {
+        free(epoch->voucher->algorithm_spec);
+        free(epoch->voucher);
+    }
+
+    free(epoch->addresses);
+    free(epoch->jobs);
+    free(epoch);
+}
+
+
+static rotation_epoch_t *
+epoch_create(vba_rotation_t *rotation,
+             nd_link_voucher_option_t *voucher)
+{
+    rotation_epoch_t *epoch = (rotation_epoch_t *)calloc(1, sizeof(rotation_epoch_t));
+    size_t count = rotation->net_device->subnet_prefixes_count;
+
+    if (NULL == epoch) return NULL;
+
+    epoch->rotation = rotation;
+    epoch->voucher = voucher;
+    epoch->address_count = count;
+    epoch->remaining = count;
+
+    /* Generation only needs the subnets and the LLID; results are not cached here. */
+    memcpy(&(epoch->device), rotation->net_device, offsetof(pseudo_net_dev_t, voucher_pins));
+    epoch->device.voucher_pins = 0;
+    epoch->device.active_voucher = voucher;
+    epoch->device.pending_voucher = NULL;
+    epoch->device.address_pool = NULL;
+    epoch->device.address_count = 0;
+    epoch->device.neighbor_cache = NULL;
+
+    if (count > 0) {
+        epoch->addresses = (vba_t *)calloc(count, sizeof(vba_t));
+        epoch->jobs = (rotation_job_t *)calloc(count, sizeof(rotation_job_t));
+
+        if (NULL == epoch->addresses || NULL == epoch->jobs) {
+            epoch->voucher = NULL;   /* Still the caller's to free. */
+            epoch_free(epoch);
+            return NULL;
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        epoch->jobs[i].epoch = epoch;
+        epoch->jobs[i].subnet_index = i;
+    }
+
+    return epoch;
+}
+
+
+static void
+generate_task(void *argument)
+{
+    rotation_job_t *job = (rotation_job_t *)argument;
+    rotation_epoch_t *epoch = job->epoch;
+    vba_rotation_t *rotation = epoch->rotation;
+    vba_ctx_t ctx;
+    int status = 0;
+
+    vba_ctx__init(&ctx, &(epoch->device), NULL, 0);
+    status = vba__generate_ctx(&ctx, job->subnet_index, rotation->work_factor, &(epoch->addresses[job->subnet_index]));
+
+    pthread_mutex_lock(&(rotation->lock));
+
+    if (0 != status && 0 == epoch->status) epoch->status = status;
+
+    if (0 == --(epoch->remaining)) {
+        if (epoch->is_superseded) epoch_free(epoch);
+
+        /* The rotation is not touched after this; a waiter in `rotation__destroy` may free it. */
+        if (0 == --(rotation->generating)) pthread_cond_broadcast(&(rotation->idle));
+    }
+
+    pthread_mutex_unlock(&(rotation->lock));
+}
+
+
+/*
+ * Free the retired epochs but the last one, unless a call may still be using their vouchers.
+ *   Must be called with the lock held, after the active voucher has been published.
+ */
+static void
+reap_retired_locked(vba_rotation_t *rotation)
+{
+    rotation_epoch_t *epoch = NULL;
+
+    if (NULL == rotation->retired || NULL == rotation->retired->older) return;
+    if (0 != vba__voucher_pins(rotation->net_device)) return;
+
+    epoch = rotation->retired->older;
+    rotation->retired->older = NULL;
+
+    while (NULL != epoch) {
+        rotation_epoch_t *older = epoch->older;
+        epoch_free(epoch);
+        epoch = older;
+    }
+}
+
+
+/* Must be called with the lock held. */
+static int
+commit_locked(vba_rotation_t *rotation)
+{
+    rotation_epoch_t *pending = rotation->pending;
+    pseudo_net_dev_t *net_device = rotation->net_device;
+    int status = 0;
+
+    if (NULL == pending) return -1;
+    if (pending->remaining > 0) return -16;   /* Still generating. */
+
+    if (0 != pending->status) {
+        /* A voucher that cannot produce addresses would otherwise block every later rotation. */
+        status = pending->status;
+        rotation->pending = NULL;
+        net_device->pending_voucher = NULL;
+        epoch_free(pending);
+        return status;
+    }
+
+    if (NULL != rotation->active) {
+        rotation->active->older = rotation->retired;
+        rotation->retired = rotation->active;
+    }
+    rotation->active = pending;
+    rotation->pending = NULL;
+
+    vba__publish_voucher(net_device, pending->voucher);
+    net_device->pending_voucher = NULL;
+    net_device->address_pool = pending->addresses;
+    net_device->address_count = pending->address_count;
+
+    reap_retired_locked(rotation);
+
+    rotation->active_since = metrics__now_ns();
+
+    return 0;
+}
+
+
+
+vba_rotation_t *
+rotation__create(pseudo_net_dev_t *net_device,
+                 vba_pool_t *pool,
+                 uint16_t work_factor)
+{
+    vba_rotation_t *rotation = NULL;
+
+    if (NULL == net_device) return NULL;
+
+    rotation = (vba_rotation_t *)calloc(1, sizeof(vba_rotation_t));
+    if (NULL == rotation) return NULL;
+
+    rotation->net_device = net_device;
+    rotation->pool = pool;
+    rotation->work_factor = work_factor;
+    rotation->active_since = metrics__now_ns();
+
+    pthread_mutex_init(&(rotation->lock), NULL);
+    pthread_cond_init(&(rotation->idle), NULL);
+
+    return rotation;
+}
+
+
+void
+rotation__destroy(vba_rotation_t *rotation)
+{
+    if (NULL == rotation) return;
+
+    pthread_mutex_lock(&(rotation->lock));
+
+    while (rotation->generating > 0) {
+        pthread_cond_wait(&(rotation->idle), &(rotation->lock));
+    }
+
+    if (NULL != rotation->active) {
+        vba__publish_voucher(rotation->net_device, NULL);
+        rotation->net_device->address_pool = NULL;
+        rotation->net_device->address_count = 0;
+    }
+    rotation->net_device->pending_voucher = NULL;
+
+    epoch_free(rotation->pending);
+    epoch_free(rotation->active);
+
+    while (NULL != rotation->retired) {
+        rotation_epoch_t *older = rotation->retired->older;
+        epoch_free(rotation->retired);
+        rotation->retired = older;
+    }
+
+    pthread_mutex_unlock(&(rotation->lock));
+
+    pthread_mutex_destroy(&(rotation->lock));
+    pthread_cond_destroy(&(rotation->idle));
+    free(rotation);
+}
+
+
+int
+rotation__stage(vba_rotation_t *rotation,
+                nd_link_voucher_option_t *voucher)
+{
+    rotation_epoch_t *epoch = NULL;
+    size_t count = 0;
+
+    if (NULL == rotation || NULL == voucher) {
+        if (NULL != voucher) {
+            free(voucher->algorithm_spec);
+            free(voucher);
+        }
+        return -1;
+    }
+
+    epoch = epoch_create(rotation, voucher);
+    if (NULL == epoch) {
+        free(voucher->algorithm_spec);
+        free(voucher);
+        return -3;
+    }
+
+    /* The epoch may be freed by its own last job once submitted, so keep the count aside. */
+    count = epoch->address_count;
+
+    pthread_mutex_lock(&(rotation->lock));
+
+    if (NULL != rotation->pending) {
+        if (rotation->pending->remaining > 0) rotation->pending->is_superseded = true;
+        else epoch_free(rotation->pending);
+    }
+
+    rotation->pending = epoch;
+    rotation->net_device->pending_voucher = voucher;
+    if (count > 0) rotation->generating++;
+
+    pthread_mutex_unlock(&(rotation->lock));
+
+    for (size_t i = 0; i < count; ++i) {
+        if (NULL == rotation->pool || 0 != pool__submit(rotation->pool, NULL, generate_task, &(epoch->jobs[i]))) {
+            generate_task(&(epoch->jobs[i]));
+        }
+    }
+
+    return 0;
+}
+
+
+bool
+rotation__is_ready(vba_rotation_t *rotation)
+{
+    bool is_ready = false;
+
+    if (NULL == rotation) return false;
+
+    pthread_mutex_lock(&(rotation->lock));
+    is_ready = (
+        NULL != rotation->pending
+        && 0 == rotation->pending->remaining
+        && 0 == rotation->pending->status
+    );
+    pthread_mutex_unlock(&(rotation->lock));
+
+    return is_ready;
+}
+
+
+int
+rotation__commit(vba_rotation_t *rotation)
+{
+    int status = 0;
+
+    if (NULL == rotation) return -1;
+
+    pthread_mutex_lock(&(rotation->lock));
+    status = commit_locked(rotation);
+    pthread_mutex_unlock(&(rotation->lock));
+
+    return status;
+}
+
+
+int
+rotation__poll(vba_rotation_t *rotation)
+{
+    nd_link_voucher_option_t *voucher = NULL;
+    uint64_t lifetime = 0;
+    int status = 0;
+
+    if (NULL == rotation) return 0;
+
+    pthread_mutex_lock(&(rotation->lock));
+
+    voucher = vba__active_voucher(rotation->net_device);
+    if (NULL != voucher) lifetime = (uint64_t)voucher->expiration * 1000000000ULL;
+
+    if (
+        NULL != rotation->pending
+        && 0 == rotation->pending->remaining
+        && (NULL == voucher || (metrics__now_ns() - rotation->active_since) >= lifetime)
+    ) {
+        status = commit_locked(rotation);
+    } else {
+        reap_retired_locked(rotation);
+        status = -1;
+    }
+
+    pthread_mutex_unlock(&(rotation->lock));
+
+    return (0 == status) ? 1 : 0;
+}
+
+
+void
+rotation__snapshot(vba_rotation_t *rotation,
+                   pseudo_net_dev_t *device)
+{
+    if (NULL == rotation || NULL == device) return;
+
+    pthread_mutex_lock(&(rotation->lock));
+    memcpy(device, rotation->net_device, offsetof(pseudo_net_dev_t, voucher_pins));
+    device->voucher_pins = 0;
+    pthread_mutex_unlock(&(rotation->lock));
+}
@@ -0,0 +1,95 @@
+#ifndef LIB_VBA_ROTATION_H
+#define LIB_VBA_ROTATION_H
+
+#include "vba.h"
+
+#include <stdbool.h>
+
+
+
+typedef struct vba_rotation vba_rotation_t;
+
+
+
+/**
+ * Take over voucher rotation for a device. The device's current active voucher stays owned by
+ *   the caller; every voucher staged afterwards is owned by the rotation. Addresses are generated
+ *   on `pool` in the background, or on the staging thread when `pool` is NULL.
+ *
+ * A voucher's `expiration` is read as its lifetime in seconds, counted from the moment it became
+ *   active. An expiration of 0 means the voucher may be replaced as soon as a successor is ready.
+ */
+vba_rotation_t *
+rotation__create(
+    pseudo_net_dev_t            *net_device,
+    vba_pool_t                  *pool,
+    uint16_t                    work_factor
+);
+
+/**
+ * Wait for background generation to finish, then release the rotation. Vouchers and address
+ *   pools installed by the rotation are freed too, and the device's pointers to them are cleared.
+ */
+void
+rotation__destroy(
+    vba_rotation_t              *rotation
+);
+
+/**
+ * Stage `voucher` (as returned by `ndopt__process_link_voucher`) as the device's next voucher and
+ *   start generating one address for every subnet prefix under it. The rotation takes ownership
+ *   of the voucher, even on failure. A voucher staged while another is still pending replaces it.
+ *
+ * Callers should not stage a voucher they already have; `ndopt__view_matches` recognizes a
+ *   re-advertised one without parsing it.
+ */
+int
+rotation__stage(
+    vba_rotation_t              *rotation,
+    nd_link_voucher_option_t    *voucher
+);
+
+/**
+ * Whether a staged voucher's addresses are all generated and it is ready to be switched to.
+ */
+bool
+rotation__is_ready(
+    vba_rotation_t              *rotation
+);
+
+/**
+ * Switch to the pending voucher now. The active voucher, address pool and pending voucher
+ *   change together under the rotation's lock, and the voucher is published atomically (see
+ *   `vba__publish_voucher`), so verifications may run on the device meanwhile. Returns 0 on
+ *   success, -1 when nothing is staged, -16 while its addresses are still being generated, or
+ *   the generation failure status.
+ */
+int
+rotation__commit(
+    vba_rotation_t              *rotation
+);
+
+/**
+ * Switch to the pending voucher if the active one has expired. An expired voucher stays active
+ *   until its successor is ready, so there is never a window without usable addresses.
+ *   Returns 1 if the device was rotated and 0 otherwise.
+ */
+int
+rotation__poll(
+    vba_rotation_t              *rotation
+);
+
+/**
+ * Copy the device as it is between rotations, for threads which must see an active voucher
+ *   and the address pool generated under it as one consistent pair. The copy holds no pins of
+ *   its own and stays valid until the second rotation after it.
+ */
+void
+rotation__snapshot(
+    vba_rotation_t              *rotation,
+    pseudo_net_dev_t            *device
+);
+
+
+
+#endif   /* LIB_VBA_ROTATION_H */
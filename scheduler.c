@@ -0,0 +1,353 @@
+#include "scheduler.h"
+
+#include "ncache.h"
+#include "negfilter.h"
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+#define SCHEDULER_HEAP_INITIAL_CAPACITY     64
+
+typedef
+struct {
+    vba_scheduler_t         *sched;
+    pseudo_net_dev_t        *verifier_device;
+    ipv6_addr_t             address;
+    llid_t                  link_layer_id;
+    vba_verify_callback_t   callback;
+    void                    *context;
+    vba_kdf_cost_t          cost;
+    bool                    is_expensive;
+    uint64_t                sequence;
+} scheduler_request_t;
+
+struct vba_scheduler {
+    vba_pool_t              *pool;
+    scheduler_policy_t      policy;
+    pthread_mutex_t         lock;
+    pthread_cond_t          idle;
+    scheduler_request_t     **heap;   /* Min-heap ordered by `request_before`. */
+    size_t                  heap_count;
+    size_t                  heap_capacity;
+    uint64_t                next_sequence;
+    size_t                  inflight;
+    size_t                  expensive_inflight;
+};
+
+
+
+/*
+ * Cheap requests always sort ahead of expensive ones, then by estimated CPU cost (shortest job
+ *   first), then by arrival. With that ordering, a blocked expensive request at the top of the
+ *   heap means everything behind it is blocked too.
+ */
+static bool
+request_before(const scheduler_request_t *a,
+               const scheduler_request_t *b)
+{
+    if (a->is_expensive != b->is_expensive) return !a->is_expensive;
+    if (a->cost.cpu_units != b->cost.cpu_units) return a->cost.cpu_units < b->cost.cpu_units;
+    return a->sequence < b->sequence;
+}
+
+
+static int
+heap_push(vba_scheduler_t *sched,
+          scheduler_request_t *request)
+{
+    size_t i = 0;
+    scheduler_request_t *swap = NULL;
+
+    if (sched->heap_count == sched->heap_capacity) {
+        size_t new_capacity = sched->heap_capacity * 2;
+        scheduler_request_t **heap = (scheduler_request_t **)realloc(sched->heap, new_capacity * sizeof(scheduler_request_t *));
+
+        if (NULL == heap) return -1;
+
+        sched->heap = heap;
+        sched->heap_capacity = new_capacity;
+    }
+
+    i = sched->heap_count++;
+    sched->heap[i] = request;
+
+    while (i > 0 && request_before(sched->heap[i], sched->heap[(i - 1) / 2])) {
+        swap = sched->heap[i];
+        sched->heap[i] = sched->heap[(i - 1) / 2];
+        sched->heap[(i - 1) / 2] = swap;
+        i = (i - 1) / 2;
+    }
+
+    return 0;
+}
+
+
+static scheduler_request_t *
+heap_pop(vba_scheduler_t *sched)
+{
+    scheduler_request_t *top = sched->heap[0];
+    scheduler_request_t *swap = NULL;
+    size_t i = 0;
+    size_t smallest = 0;
+
+    sched->heap[0] = sched->heap[--(sched->heap_count)];
+
+    for (;;) {
+        smallest = i;
+
+        if ((2 * i + 1) < sched->heap_count && request_before(sched->heap[2 * i + 1], sched->heap[smallest])) {
+            smallest = 2 * i + 1;
+        }
+        if ((2 * i + 2) < sched->heap_count && request_before(sched->heap[2 * i + 2], sched->heap[smallest])) {
+            smallest = 2 * i + 2;
+        }
+
+        if (smallest == i) break;
+
+        swap = sched->heap[i];
+        sched->heap[i] = sched->heap[smallest];
+        sched->heap[smallest] = swap;
+        i = smallest;
+    }
+
+    return top;
+}
+
+
+static void scheduler_task(void *argument);
+
+
+/*
+ * Hand queued requests to the pool for as long as the concurrency limits allow. A worker that
+ *   just finished `retired` gives back its slot under the same lock, and the scheduler is not
+ *   touched again once it has gone idle, because a waiter in `scheduler__destroy` may free it.
+ */
+static void
+dispatch(vba_scheduler_t *sched,
+         scheduler_request_t *retired)
+{
+    scheduler_request_t *request = NULL;
+    vba_pool_t *pool = sched->pool;
+
+    for (;;) {
+        pthread_mutex_lock(&(sched->lock));
+
+        if (NULL != retired) {
+            sched->inflight--;
+            if (retired->is_expensive) sched->expensive_inflight--;
+            retired = NULL;
+        }
+
+        if (
+            0 == sched->heap_count
+            || sched->inflight >= sched->policy.max_inflight
+            || (
+                sched->heap[0]->is_expensive
+                && sched->expensive_inflight >= sched->policy.max_expensive_inflight
+            )
+        ) {
+            if (0 == sched->inflight && 0 == sched->heap_count) {
+                pthread_cond_broadcast(&(sched->idle));
+            }
+            pthread_mutex_unlock(&(sched->lock));
+            return;
+        }
+
+        request = heap_pop(sched);
+        sched->inflight++;
+        if (request->is_expensive) sched->expensive_inflight++;
+
+        pthread_mutex_unlock(&(sched->lock));
+
+        if (0 != pool__submit(pool, NULL, scheduler_task, request)) {
+            /* Nowhere to run it; do it here rather than lose the callback. */
+            scheduler_task(request);
+        }
+    }
+}
+
+
+static void
+scheduler_task(void *argument)
+{
+    scheduler_request_t *request = (scheduler_request_t *)argument;
+    int status = 0;
+
+    status = vba__verify(request->verifier_device, &(request->address), &(request->link_layer_id));
+
+    if (NULL != request->callback) {
+        request->callback(request->verifier_device, &(request->address), &(request->link_layer_id), status, request->context);
+    }
+
+    /* A finished slot may let the next request in. */
+    dispatch(request->sched, request);
+
+    free(request);
+}
+
+
+
+vba_scheduler_t *
+scheduler__create(vba_pool_t *pool,
+                  const scheduler_policy_t *policy)
+{
+    vba_scheduler_t *sched = NULL;
+
+    if (NULL == pool || NULL == policy) return NULL;
+
+    sched = (vba_scheduler_t *)calloc(1, sizeof(vba_scheduler_t));
+    if (NULL == sched) return NULL;
+
+    sched->heap = (scheduler_request_t **)calloc(SCHEDULER_HEAP_INITIAL_CAPACITY, sizeof(scheduler_request_t *));
+    if (NULL == sched->heap) {
+        free(sched);
+        return NULL;
+    }
+
+    sched->pool = pool;
+    sched->heap_capacity = SCHEDULER_HEAP_INITIAL_CAPACITY;
+    memcpy(&(sched->policy), policy, sizeof(scheduler_policy_t));
+
+    if (0 == sched->policy.max_inflight) sched->policy.max_inflight = pool__thread_count(pool);
+    if (0 == sched->policy.max_expensive_inflight) sched->policy.max_expensive_inflight = 1;
+
+    pthread_mutex_init(&(sched->lock), NULL);
+    pthread_cond_init(&(sched->idle), NULL);
+
+    return sched;
+}
+
+
+void
+scheduler__destroy(vba_scheduler_t *sched)
+{
+    if (NULL == sched) return;
+
+    scheduler__drain(sched);
+
+    pthread_mutex_destroy(&(sched->lock));
+    pthread_cond_destroy(&(sched->idle));
+
+    free(sched->heap);
+    free(sched);
+}
+
+
+int
+scheduler__submit_verify(vba_scheduler_t *sched,
+                         pseudo_net_dev_t *verifier_device,
+                         const ipv6_addr_t *ndar_ip,
+                         const llid_t *ndar_link_layer_id,
+                         vba_verify_callback_t callback,
+                         void *context)
+{
+    scheduler_request_t *request = NULL;
+    nd_link_voucher_option_t *voucher = NULL;
+    vba_kdf_cost_t cost = {0};
+    uint8_t cached_tag = 0;
+    int status = 0;
+
+    if (
+        NULL == sched
+        || NULL == verifier_device
+        || NULL == ndar_ip
+        || NULL == ndar_link_layer_id
+    ) {
+        return -1;   /* Invalid input parameter. */
+    }
+
+    /* Only the admission checks run under this pin; the verification itself takes its own. */
+    voucher = vba__pin_voucher(verifier_device);
+    if (NULL == voucher) {
+        vba__unpin_voucher(verifier_device);
+        return -1;
+    }
+
+    /* Requests that never reach the KDF are too cheap to be worth queueing. */
+    if (
+        (ndar_ip->prefix_length * 8) > 64
+        || 0 == ncache__lookup(verifier_device->neighbor_cache,
+                               ndar_ip,
+                               ndar_link_layer_id,
+                               voucher->voucher_id,
+                               &cached_tag)
+        || negfilter__is_rejected(verifier_device->negative_filter, voucher, ndar_ip, ndar_link_layer_id)
+    ) {
+        vba__unpin_voucher(verifier_device);
+        goto Label__submit_verify_Inline;
+    }
+
+    status = vba__estimate_cost(voucher, vba__extract_work_factor(voucher, ndar_ip), &cost);
+    vba__unpin_voucher(verifier_device);
+    if (0 != status || 0 == cost.cpu_units) goto Label__submit_verify_Inline;
+
+    if (
+        (0 != sched->policy.max_cpu_units && cost.cpu_units > sched->policy.max_cpu_units)
+        || (0 != sched->policy.max_memory_bytes && cost.memory_bytes > sched->policy.max_memory_bytes)
+    ) {
+        return -14;   /* Claimed work factor is above the cost ceiling. */
+    }
+
+    request = (scheduler_request_t *)calloc(1, sizeof(scheduler_request_t));
+    if (NULL == request) return -3;
+
+    request->sched = sched;
+    request->verifier_device = verifier_device;
+    memcpy(&(request->address), ndar_ip, sizeof(ipv6_addr_t));
+    memcpy(&(request->link_layer_id), ndar_link_layer_id, sizeof(llid_t));
+    request->callback = callback;
+    request->context = context;
+    memcpy(&(request->cost), &cost, sizeof(vba_kdf_cost_t));
+    request->is_expensive = (
+        (0 != sched->policy.expensive_cpu_units && cost.cpu_units >= sched->policy.expensive_cpu_units)
+        || (0 != sched->policy.expensive_memory_bytes && cost.memory_bytes >= sched->policy.expensive_memory_bytes)
+    );
+
+    pthread_mutex_lock(&(sched->lock));
+
+    if (0 != sched->policy.max_pending && sched->heap_count >= sched->policy.max_pending) {
+        pthread_mutex_unlock(&(sched->lock));
+        free(request);
+        return -15;   /* Too many requests already waiting. */
+    }
+
+    request->sequence = sched->next_sequence++;
+
+    if (0 != heap_push(sched, request)) {
+        pthread_mutex_unlock(&(sched->lock));
+        free(request);
+        return -3;
+    }
+
+    pthread_mutex_unlock(&(sched->lock));
+
+    dispatch(sched, NULL);
+    return 0;
+
+Label__submit_verify_Inline:
+    status = vba__verify(verifier_device, (ipv6_addr_t *)ndar_ip, (llid_t *)ndar_link_layer_id);
+
+    if (NULL != callback) {
+        callback(verifier_device, ndar_ip, ndar_link_layer_id, status, context);
+    }
+
+    return 0;
+}
+
+
+void
+scheduler__drain(vba_scheduler_t *sched)
+{
+    if (NULL == sched) return;
+
+    pthread_mutex_lock(&(sched->lock));
+    while (0 != sched->inflight || 0 != sched->heap_count) {
+        pthread_cond_wait(&(sched->idle), &(sched->lock));
+    }
+    pthread_mutex_unlock(&(sched->lock));
+}
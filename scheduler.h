@@ -0,0 +1,75 @@
+#ifndef LIB_VBA_SCHEDULER_H
+#define LIB_VBA_SCHEDULER_H
+
+#include "vba.h"
+
+
+
+typedef struct vba_scheduler vba_scheduler_t;
+
+/**
+ * Admission policy for a verification scheduler. Any limit left at 0 is not enforced, except
+ *   `max_inflight` which then defaults to the pool's thread count.
+ */
+typedef
+struct {
+    uint64_t    max_cpu_units;              /* Reject requests costing more than this outright. */
+    uint64_t    max_memory_bytes;
+    uint64_t    expensive_cpu_units;        /* Requests at or above either bound count as expensive. */
+    uint64_t    expensive_memory_bytes;
+    size_t      max_expensive_inflight;     /* At most this many expensive KDFs run at once (min. 1). */
+    size_t      max_inflight;
+    size_t      max_pending;                /* Queue depth before new requests are turned away. */
+} scheduler_policy_t;
+
+
+
+/**
+ * Create a scheduler that feeds verifications into `pool`. Waiting requests are dispatched
+ *   cheapest-first by their estimated KDF cost, so one neighbor claiming a huge work factor
+ *   cannot hold up every other neighbor behind it.
+ */
+vba_scheduler_t *
+scheduler__create(
+    vba_pool_t                  *pool,
+    const scheduler_policy_t    *policy
+);
+
+/**
+ * Wait for all queued and running verifications to finish, then release the scheduler.
+ */
+void
+scheduler__destroy(
+    vba_scheduler_t             *sched
+);
+
+/**
+ * Queue a neighbor for verification. The work factor is read from the address and costed
+ *   before anything else happens; no KDF work is done for a request that is turned away.
+ *
+ * Neighbors which need no KDF run (cache hits, non-VBA prefixes, known forgeries) are verified
+ *   on the calling thread. Either way, when 0 is returned `callback` is invoked exactly once
+ *   with the `vba__verify` status. Returns -14 when the request is above the cost ceiling and -15
+ *   when the queue is full; the callback is not invoked in those cases.
+ */
+int
+scheduler__submit_verify(
+    vba_scheduler_t             *sched,
+    pseudo_net_dev_t            *verifier_device,
+    const ipv6_addr_t           *ndar_ip,
+    const llid_t                *ndar_link_layer_id,
+    vba_verify_callback_t       callback,
+    void                        *context
+);
+
+/**
+ * Block until no verification is queued or running. Must not be called from a pool worker.
+ */
+void
+scheduler__drain(
+    vba_scheduler_t             *sched
+);
+
+
+
+#endif   /* LIB_VBA_SCHEDULER_H */
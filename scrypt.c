@@ -0,0 +1,259 @@
+#include "scrypt.h"
+
+#include "arena.h"
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/**
+ * A run of neighboring lanes handled by one worker, so the V buffer is set up once per worker
+ *   rather than once per lane.
+ */
+typedef
+struct {
+    uint8_t     *lanes;   /* The first lane of the run, within B. */
+    uint32_t    lane_count;
+    uint64_t    N;
+    uint64_t    reserve_N;
+    uint32_t    r;
+    int         status;
+} scrypt_lanes_task_t;
+
+typedef void (*romix_kernel_fn)(
+    uint8_t     *lanes,
+    uint64_t    N,
+    uint32_t    r,
+    void        *memory
+);
+
+
+
+static inline uint32_t
+load_le32(const uint8_t *input)
+{
+    return (uint32_t)input[0]
+        | ((uint32_t)input[1] << 8)
+        | ((uint32_t)input[2] << 16)
+        | ((uint32_t)input[3] << 24);
+}
+
+
+static inline void
+store_le32(uint8_t *output,
+           uint32_t value)
+{
+    output[0] = (uint8_t)value;
+    output[1] = (uint8_t)(value >> 8);
+    output[2] = (uint8_t)(value >> 16);
+    output[3] = (uint8_t)(value >> 24);
+}
+
+
+#define ROMIX_GLUE2(a, b)   a##_##b
+#define ROMIX_GLUE(a, b)    ROMIX_GLUE2(a, b)
+#define ROMIX_FN(name)      ROMIX_GLUE(ROMIX_KERNEL, name)
+
+#if defined(__x86_64__)
+
+#define ROMIX_LANES         1
+#define ROMIX_VECTOR        romix_vector_sse2_t
+#define ROMIX_TARGET        __attribute__((target("sse2")))
+#define ROMIX_KERNEL        romix_sse2
+#define ROMIX_SHUFFLE_3012  { 3, 0, 1, 2 }
+#define ROMIX_SHUFFLE_2301  { 2, 3, 0, 1 }
+#define ROMIX_SHUFFLE_1230  { 1, 2, 3, 0 }
+#include "scrypt_kernel.h"
+#undef ROMIX_LANES
+#undef ROMIX_VECTOR
+#undef ROMIX_TARGET
+#undef ROMIX_KERNEL
+#undef ROMIX_SHUFFLE_3012
+#undef ROMIX_SHUFFLE_2301
+#undef ROMIX_SHUFFLE_1230
+
+/* A single lane's BlockMix is one long dependency chain, so AVX2 runs two lanes side by side. */
+#define ROMIX_LANES         2
+#define ROMIX_VECTOR        romix_vector_avx2_t
+#define ROMIX_TARGET        __attribute__((target("avx2")))
+#define ROMIX_KERNEL        romix_avx2
+#define ROMIX_SHUFFLE_3012  { 3, 0, 1, 2, 7, 4, 5, 6 }
+#define ROMIX_SHUFFLE_2301  { 2, 3, 0, 1, 6, 7, 4, 5 }
+#define ROMIX_SHUFFLE_1230  { 1, 2, 3, 0, 5, 6, 7, 4 }
+#include "scrypt_kernel.h"
+#undef ROMIX_LANES
+#undef ROMIX_VECTOR
+#undef ROMIX_TARGET
+#undef ROMIX_KERNEL
+#undef ROMIX_SHUFFLE_3012
+#undef ROMIX_SHUFFLE_2301
+#undef ROMIX_SHUFFLE_1230
+
+#else
+
+/* Elsewhere the compiler maps the vectors onto whatever SIMD the target has, or onto scalars. */
+#define ROMIX_LANES         1
+#define ROMIX_VECTOR        romix_vector_generic_t
+#define ROMIX_TARGET
+#define ROMIX_KERNEL        romix_generic
+#define ROMIX_SHUFFLE_3012  { 3, 0, 1, 2 }
+#define ROMIX_SHUFFLE_2301  { 2, 3, 0, 1 }
+#define ROMIX_SHUFFLE_1230  { 1, 2, 3, 0 }
+#include "scrypt_kernel.h"
+#undef ROMIX_LANES
+#undef ROMIX_VECTOR
+#undef ROMIX_TARGET
+#undef ROMIX_KERNEL
+#undef ROMIX_SHUFFLE_3012
+#undef ROMIX_SHUFFLE_2301
+#undef ROMIX_SHUFFLE_1230
+
+#endif   /* __x86_64__ */
+
+
+
+static romix_kernel_fn narrow_kernel = NULL;
+static romix_kernel_fn wide_kernel = NULL;
+static size_t wide_lanes = 0;   /* 0 until a kernel has been picked. */
+
+
+
+static void
+select_kernels(void)
+{
+    size_t lanes = 1;
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    narrow_kernel = romix_sse2;
+    wide_kernel = romix_sse2;
+
+    if (__builtin_cpu_supports("avx2")) {
+        wide_kernel = romix_avx2;
+        lanes = 2;
+    }
+#else
+    narrow_kernel = romix_generic;
+    wide_kernel = romix_generic;
+#endif
+
+    __atomic_store_n(&wide_lanes, lanes, __ATOMIC_RELEASE);
+}
+
+
+static void
+scrypt_lanes_task(void *argument)
+{
+    scrypt_lanes_task_t *task = (scrypt_lanes_task_t *)argument;
+    size_t lanes = __atomic_load_n(&wide_lanes, __ATOMIC_ACQUIRE);
+    size_t lane_length = 128 * (size_t)task->r;
+    uint32_t done = 0;
+    void *memory = NULL;
+
+    /* Sized for the largest N the voucher allows, so the thread's buffer is never regrown. */
+    memory = arena__acquire(lanes * scrypt__lane_memory(MAX(task->N, task->reserve_N), task->r));
+    if (NULL == memory) {
+        task->status = -3;
+        return;
+    }
+
+    for (; done + lanes <= task->lane_count; done += lanes) {
+        wide_kernel(&(task->lanes[done * lane_length]), task->N, task->r, memory);
+    }
+    for (; done < task->lane_count; ++done) {
+        narrow_kernel(&(task->lanes[done * lane_length]), task->N, task->r, memory);
+    }
+}
+
+
+
+size_t
+scrypt__lane_memory(uint64_t N,
+                    uint32_t r)
+{
+    return (size_t)128 * r * (N + 2);
+}
+
+
+int
+scrypt__derive(const hmac_sha256_midstate_t *midstate,
+               const uint8_t *salt,
+               size_t salt_length,
+               uint64_t N,
+               uint32_t r,
+               uint32_t p,
+               uint64_t reserve_N,
+               vba_pool_t *pool,
+               uint8_t *output,
+               size_t output_length)
+{
+    pool_group_t group;
+    scrypt_lanes_task_t *tasks = NULL;
+    uint8_t *B = NULL;
+    size_t lane_length = 128 * (size_t)r;
+    size_t task_count = 1;
+    uint32_t chunk = 0;
+    int status = 0;
+
+    if (
+        NULL == midstate
+        || NULL == output
+        || N < 2
+        || 0 != (N & (N - 1))
+        || 0 == r
+        || 0 == p
+    ) {
+        return -1;   /* Invalid parameter. */
+    }
+
+    if (0 == __atomic_load_n(&wide_lanes, __ATOMIC_ACQUIRE)) select_kernels();
+
+    B = (uint8_t *)malloc(lane_length * p);
+    if (NULL == B) return -3;
+
+    /* B = PBKDF2(P, S, 1, p * 128 * r) */
+    pbkdf2_sha256__from_midstate(midstate, salt, salt_length, 1, B, lane_length * p);
+
+    /* One run of lanes per worker, and never more V buffers than lanes. */
+    if (NULL != pool) task_count = MIN((size_t)p, MAX((size_t)1, pool__thread_count(pool)));
+    chunk = (uint32_t)((p + task_count - 1) / task_count);
+    chunk = (uint32_t)(((chunk + wide_lanes - 1) / wide_lanes) * wide_lanes);   /* Keep lanes paired. */
+    task_count = (p + chunk - 1) / chunk;
+
+    tasks = (scrypt_lanes_task_t *)calloc(task_count, sizeof(scrypt_lanes_task_t));
+    if (NULL == tasks) {
+        status = -3;
+        goto Label__derive_Free;
+    }
+
+    pool__group_init(&group);
+
+    for (size_t i = 0; i < task_count; ++i) {
+        tasks[i].lanes = &B[i * chunk * lane_length];
+        tasks[i].lane_count = MIN(chunk, (uint32_t)(p - i * chunk));
+        tasks[i].N = N;
+        tasks[i].reserve_N = reserve_N;
+        tasks[i].r = r;
+
+        if (1 == task_count || 0 != pool__submit(pool, &group, scrypt_lanes_task, &(tasks[i]))) {
+            scrypt_lanes_task(&(tasks[i]));
+        }
+    }
+
+    pool__group_wait(pool, &group);
+
+    for (size_t i = 0; i < task_count; ++i) {
+        if (0 != tasks[i].status) status = tasks[i].status;
+    }
+
+    /* DK = PBKDF2(P, B, 1, dkLen) */
+    if (0 == status) pbkdf2_sha256__from_midstate(midstate, B, lane_length * p, 1, output, output_length);
+
+Label__derive_Free:
+    free(tasks);
+    free(B);
+    return status;
+}
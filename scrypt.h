@@ -0,0 +1,54 @@
+#ifndef LIB_VBA_SCRYPT_H
+#define LIB_VBA_SCRYPT_H
+
+#include "sha256.h"
+#include "vba.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+#define SCRYPT_SALSA_BLOCK_WORDS    16   /* One 64-byte Salsa20/8 block. */
+
+
+
+/**
+ * Scrypt (RFC 7914), with its two PBKDF2-HMAC-SHA256 steps keyed from a precomputed midstate of
+ *   the password. Output is identical to `libscrypt_scrypt` for the same inputs.
+ *
+ * The p ROMix lanes do not depend on each other. With a pool, they are split into at most one
+ *   run of lanes per worker, and each worker gets its own V buffer from its thread's arena;
+ *   without one (or for p = 1) every lane runs on the calling thread. Safe to call from inside
+ *   a pool worker. Where AVX2 is available, lanes are mixed two at a time.
+ *
+ * V buffers are sized for `reserve_N` (when it is larger than N), so that a thread which later
+ *   sees a larger N under the same voucher does not have to grow its arena again.
+ */
+int
+scrypt__derive(
+    const hmac_sha256_midstate_t    *midstate,
+    const uint8_t                   *salt,
+    size_t                          salt_length,
+    uint64_t                        N,
+    uint32_t                        r,
+    uint32_t                        p,
+    uint64_t                        reserve_N,
+    vba_pool_t                      *pool,
+    uint8_t                         *output,
+    size_t                          output_length
+);
+
+/**
+ * Working memory one ROMix lane needs (V, plus room for X and Y), in bytes. Runs of paired lanes
+ *   need twice as much.
+ */
+size_t
+scrypt__lane_memory(
+    uint64_t                        N,
+    uint32_t                        r
+);
+
+
+
+#endif   /* LIB_VBA_SCRYPT_H */
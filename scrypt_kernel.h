@@ -0,0 +1,172 @@
+/*
+ * Scrypt ROMix kernel.
+ *
+ * This file is included once per instruction set by scrypt.c with these macros defined:
+ *   ROMIX_LANES          - the amount of ROMix lanes run side by side (1 or 2)
+ *   ROMIX_VECTOR         - the name to give the vector type
+ *   ROMIX_TARGET         - the function target attribute for the instruction set
+ *   ROMIX_KERNEL         - the name of the generated kernel function
+ *   ROMIX_SHUFFLE_3012,
+ *   ROMIX_SHUFFLE_2301,
+ *   ROMIX_SHUFFLE_1230   - per-lane word rotations of one row, as vector initializers
+ *
+ * A 64-byte Salsa20/8 block is held as four row vectors, pre-shuffled so that word `p` of the
+ *   block's storage is word `(p * 5) % 16` of the RFC 7914 block. In that layout the column and
+ *   row rounds each act on whole rows, and only three word rotations are needed between them.
+ *   With two lanes, each row vector holds the same row of both lanes, one per 128-bit half. V is
+ *   kept in the same layout, so blocks are only shuffled on the way in and out.
+ */
+
+typedef uint32_t ROMIX_VECTOR __attribute__((vector_size(ROMIX_LANES * 4 * sizeof(uint32_t))));
+
+
+ROMIX_TARGET static inline void
+ROMIX_FN(salsa20_8)(ROMIX_VECTOR B[4])
+{
+    const ROMIX_VECTOR shuffle_3012 = ROMIX_SHUFFLE_3012;
+    const ROMIX_VECTOR shuffle_2301 = ROMIX_SHUFFLE_2301;
+    const ROMIX_VECTOR shuffle_1230 = ROMIX_SHUFFLE_1230;
+    ROMIX_VECTOR x0 = B[0], x1 = B[1], x2 = B[2], x3 = B[3], t;
+
+#define ROMIX_ROTL(x, n)    (((x) << (n)) | ((x) >> (32 - (n))))
+    for (int round = 0; round < 8; round += 2) {
+        /* Columns. */
+        t = x0 + x3;    x1 ^= ROMIX_ROTL(t, 7);
+        t = x1 + x0;    x2 ^= ROMIX_ROTL(t, 9);
+        t = x2 + x1;    x3 ^= ROMIX_ROTL(t, 13);
+        t = x3 + x2;    x0 ^= ROMIX_ROTL(t, 18);
+
+        x1 = __builtin_shuffle(x1, shuffle_3012);
+        x2 = __builtin_shuffle(x2, shuffle_2301);
+        x3 = __builtin_shuffle(x3, shuffle_1230);
+
+        /* Rows. */
+        t = x0 + x1;    x3 ^= ROMIX_ROTL(t, 7);
+        t = x3 + x0;    x2 ^= ROMIX_ROTL(t, 9);
+        t = x2 + x3;    x1 ^= ROMIX_ROTL(t, 13);
+        t = x1 + x2;    x0 ^= ROMIX_ROTL(t, 18);
+
+        x1 = __builtin_shuffle(x1, shuffle_1230);
+        x2 = __builtin_shuffle(x2, shuffle_2301);
+        x3 = __builtin_shuffle(x3, shuffle_3012);
+    }
+#undef ROMIX_ROTL
+
+    B[0] += x0;
+    B[1] += x1;
+    B[2] += x2;
+    B[3] += x3;
+}
+
+
+/* Row `index` of each lane's own V entry, gathered into one vector. */
+ROMIX_TARGET static inline ROMIX_VECTOR
+ROMIX_FN(gather)(const ROMIX_VECTOR *const entries[ROMIX_LANES],
+                 size_t index)
+{
+#if 1 == ROMIX_LANES
+    return entries[0][index];
+#else
+    const ROMIX_VECTOR halves = { 0, 1, 2, 3, 12, 13, 14, 15 };
+
+    return __builtin_shuffle(entries[0][index], entries[1][index], halves);
+#endif
+}
+
+
+/* scryptBlockMix: Y = BlockMix(B). With `entries`, B ^ V[j] is mixed instead, without storing it. */
+ROMIX_TARGET static inline void
+ROMIX_FN(block_mix)(const ROMIX_VECTOR *B,
+                    const ROMIX_VECTOR *const *entries,
+                    ROMIX_VECTOR *Y,
+                    uint32_t r)
+{
+    ROMIX_VECTOR X[4];
+    ROMIX_VECTOR *target = NULL;
+    size_t last = (2 * (size_t)r - 1) * 4;
+
+    for (int k = 0; k < 4; ++k) {
+        X[k] = B[last + k];
+        if (NULL != entries) X[k] ^= ROMIX_FN(gather)(entries, last + k);
+    }
+
+    for (size_t i = 0; i < 2 * (size_t)r; ++i) {
+        for (int k = 0; k < 4; ++k) {
+            X[k] ^= B[i * 4 + k];
+            if (NULL != entries) X[k] ^= ROMIX_FN(gather)(entries, i * 4 + k);
+        }
+
+        ROMIX_FN(salsa20_8)(X);
+
+        /* Even blocks go to the first half of Y, odd blocks to the second. */
+        target = &Y[((i / 2) + (i % 2) * r) * 4];
+        for (int k = 0; k < 4; ++k) target[k] = X[k];
+    }
+}
+
+
+/* The low 64 bits of one lane's last Salsa block (words 0 and 1, stored at 0 and 13), modulo N. */
+ROMIX_TARGET static inline uint64_t
+ROMIX_FN(integerify)(const ROMIX_VECTOR *B,
+                     uint32_t r,
+                     int lane,
+                     uint64_t N)
+{
+    const ROMIX_VECTOR *last = &B[(2 * (size_t)r - 1) * 4];
+
+    return (((uint64_t)last[3][lane * 4 + 1] << 32) | last[0][lane * 4]) & (N - 1);
+}
+
+
+/*
+ * scryptROMix over ROMIX_LANES neighboring 128*r-byte lanes of B, in place. `memory` must hold
+ *   ROMIX_LANES * scrypt__lane_memory(N, r) bytes, aligned for ROMIX_VECTOR.
+ */
+ROMIX_TARGET static void
+ROMIX_KERNEL(uint8_t *lanes,
+             uint64_t N,
+             uint32_t r,
+             void *memory)
+{
+    size_t entry = 2 * (size_t)r * 4;   /* Row vectors in one V entry. */
+    size_t lane_length = 128 * (size_t)r;
+    ROMIX_VECTOR *X = (ROMIX_VECTOR *)memory;
+    ROMIX_VECTOR *Y = X + entry;
+    ROMIX_VECTOR *V = Y + entry;
+    const ROMIX_VECTOR *entries[ROMIX_LANES];
+
+    /* V[0] = B, shuffled into rows. */
+    for (int lane = 0; lane < ROMIX_LANES; ++lane) {
+        const uint8_t *source = &lanes[lane * lane_length];
+
+        for (size_t b = 0; b < 2 * (size_t)r; ++b) {
+            for (int p = 0; p < SCRYPT_SALSA_BLOCK_WORDS; ++p) {
+                V[b * 4 + p / 4][lane * 4 + p % 4] = load_le32(&source[(b * SCRYPT_SALSA_BLOCK_WORDS + (p * 5) % 16) * 4]);
+            }
+        }
+    }
+
+    /* V[i + 1] = BlockMix(V[i]), mixed straight into place; X = BlockMix(V[N - 1]). */
+    for (uint64_t i = 0; i + 1 < N; ++i) {
+        ROMIX_FN(block_mix)(&V[i * entry], NULL, &V[(i + 1) * entry], r);
+    }
+    ROMIX_FN(block_mix)(&V[(N - 1) * entry], NULL, X, r);
+
+    for (uint64_t i = 0; i < N; i += 2) {
+        for (int lane = 0; lane < ROMIX_LANES; ++lane) entries[lane] = &V[ROMIX_FN(integerify)(X, r, lane, N) * entry];
+        ROMIX_FN(block_mix)(X, entries, Y, r);
+
+        for (int lane = 0; lane < ROMIX_LANES; ++lane) entries[lane] = &V[ROMIX_FN(integerify)(Y, r, lane, N) * entry];
+        ROMIX_FN(block_mix)(Y, entries, X, r);
+    }
+
+    for (int lane = 0; lane < ROMIX_LANES; ++lane) {
+        uint8_t *target = &lanes[lane * lane_length];
+
+        for (size_t b = 0; b < 2 * (size_t)r; ++b) {
+            for (int p = 0; p < SCRYPT_SALSA_BLOCK_WORDS; ++p) {
+                store_le32(&target[(b * SCRYPT_SALSA_BLOCK_WORDS + (p * 5) % 16) * 4], X[b * 4 + p / 4][lane * 4 + p % 4]);
+            }
+        }
+    }
+}
@@ -0,0 +1,319 @@
+#include "sha256.h"
+
+/* The one-block transform is deprecated in OpenSSL 3, but it is also the only public entry point
+ *   to its hardware-accelerated (SHA-NI/AVX2) compression. We need exactly that. */
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+
+#include <string.h>
+
+
+
+static const uint32_t sha256_initial_state[SHA256_STATE_WORDS] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+
+
+static inline void
+store_be32(uint8_t *output,
+           uint32_t value)
+{
+    output[0] = (uint8_t)(value >> 24);
+    output[1] = (uint8_t)(value >> 16);
+    output[2] = (uint8_t)(value >> 8);
+    output[3] = (uint8_t)(value);
+}
+
+
+static inline void
+store_state(uint8_t digest[SHA256_DIGEST_LENGTH_BYTES],
+            const uint32_t state[SHA256_STATE_WORDS])
+{
+    for (int i = 0; i < SHA256_STATE_WORDS; ++i) {
+        store_be32(&digest[i * 4], state[i]);
+    }
+}
+
+
+/*
+ * Minimal streaming state for hashes whose first block (the keyed pad) is already absorbed.
+ */
+typedef
+struct {
+    uint32_t    state[SHA256_STATE_WORDS];
+    uint8_t     buffer[SHA256_BLOCK_LENGTH];
+    size_t      buffered;
+    uint64_t    total_length;
+} keyed_stream_t;
+
+
+static void
+stream_begin(keyed_stream_t *stream,
+             const uint32_t midstate[SHA256_STATE_WORDS])
+{
+    memcpy(stream->state, midstate, sizeof(stream->state));
+    stream->buffered = 0;
+    stream->total_length = SHA256_BLOCK_LENGTH;
+}
+
+
+static void
+stream_update(keyed_stream_t *stream,
+              const uint8_t *data,
+              size_t length)
+{
+    stream->total_length += length;
+    if (0 == length) return;
+
+    if (stream->buffered > 0) {
+        size_t take = SHA256_BLOCK_LENGTH - stream->buffered;
+        if (take > length) take = length;
+
+        memcpy(&(stream->buffer[stream->buffered]), data, take);
+        stream->buffered += take;
+        data += take;
+        length -= take;
+
+        if (SHA256_BLOCK_LENGTH != stream->buffered) return;
+
+        sha256__compress(stream->state, stream->buffer);
+        stream->buffered = 0;
+    }
+
+    while (length >= SHA256_BLOCK_LENGTH) {
+        sha256__compress(stream->state, data);
+        data += SHA256_BLOCK_LENGTH;
+        length -= SHA256_BLOCK_LENGTH;
+    }
+
+    memcpy(stream->buffer, data, length);
+    stream->buffered = length;
+}
+
+
+static void
+stream_finish(keyed_stream_t *stream,
+              uint8_t digest[SHA256_DIGEST_LENGTH_BYTES])
+{
+    uint64_t total_bits = stream->total_length * 8;
+
+    stream->buffer[stream->buffered++] = 0x80;
+    if (stream->buffered > (SHA256_BLOCK_LENGTH - 8)) {
+        memset(&(stream->buffer[stream->buffered]), 0x00, SHA256_BLOCK_LENGTH - stream->buffered);
+        sha256__compress(stream->state, stream->buffer);
+        stream->buffered = 0;
+    }
+
+    memset(&(stream->buffer[stream->buffered]), 0x00, SHA256_BLOCK_LENGTH - stream->buffered);
+    for (int i = 0; i < 8; ++i) {
+        stream->buffer[SHA256_BLOCK_LENGTH - 1 - i] = (uint8_t)(total_bits >> (i * 8));
+    }
+
+    sha256__compress(stream->state, stream->buffer);
+    store_state(digest, stream->state);
+}
+
+
+/* HMAC over the concatenation of two messages, e.g. a PBKDF2 salt and its block index. */
+static void
+hmac_two_part(const hmac_sha256_midstate_t *midstate,
+              const uint8_t *first,
+              size_t first_length,
+              const uint8_t *second,
+              size_t second_length,
+              uint8_t digest[SHA256_DIGEST_LENGTH_BYTES])
+{
+    keyed_stream_t stream;
+    uint8_t inner_digest[SHA256_DIGEST_LENGTH_BYTES];
+
+    stream_begin(&stream, midstate->inner);
+    stream_update(&stream, first, first_length);
+    stream_update(&stream, second, second_length);
+    stream_finish(&stream, inner_digest);
+
+    stream_begin(&stream, midstate->outer);
+    stream_update(&stream, inner_digest, sizeof(inner_digest));
+    stream_finish(&stream, digest);
+}
+
+
+void
+sha256__compress(uint32_t state[SHA256_STATE_WORDS],
+                 const uint8_t block[SHA256_BLOCK_LENGTH])
+{
+    SHA256_CTX context;
+
+    memcpy(context.h, state, sizeof(context.h));
+    SHA256_Transform(&context, block);
+    memcpy(state, context.h, sizeof(context.h));
+}
+
+
+void
+hmac_sha256__prekey(hmac_sha256_midstate_t *midstate,
+                    const uint8_t *key,
+                    size_t key_length)
+{
+    uint8_t key_block[SHA256_BLOCK_LENGTH] = {0};
+    uint8_t pad[SHA256_BLOCK_LENGTH];
+
+    /* Keys longer than a block are hashed down first, per RFC 2104. */
+    if (key_length > SHA256_BLOCK_LENGTH) {
+        SHA256(key, key_length, key_block);
+    } else {
+        memcpy(key_block, key, key_length);
+    }
+
+    for (int i = 0; i < SHA256_BLOCK_LENGTH; ++i) pad[i] = key_block[i] ^ 0x36;
+    memcpy(midstate->inner, sha256_initial_state, sizeof(midstate->inner));
+    sha256__compress(midstate->inner, pad);
+
+    for (int i = 0; i < SHA256_BLOCK_LENGTH; ++i) pad[i] = key_block[i] ^ 0x5C;
+    memcpy(midstate->outer, sha256_initial_state, sizeof(midstate->outer));
+    sha256__compress(midstate->outer, pad);
+}
+
+
+void
+hmac_sha256__from_midstate(const hmac_sha256_midstate_t *midstate,
+                           const uint8_t *message,
+                           size_t message_length,
+                           uint8_t digest[SHA256_DIGEST_LENGTH_BYTES])
+{
+    hmac_two_part(midstate, message, message_length, NULL, 0, digest);
+}
+
+
+/* A single padded block holding a 32-byte message, ready for the outer compression. */
+static void
+prepare_digest_block(uint8_t block[SHA256_BLOCK_LENGTH])
+{
+    memset(block, 0x00, SHA256_BLOCK_LENGTH);
+    block[SHA256_DIGEST_LENGTH_BYTES] = 0x80;
+    block[SHA256_BLOCK_LENGTH - 2] = (uint8_t)(((SHA256_BLOCK_LENGTH + SHA256_DIGEST_LENGTH_BYTES) * 8) >> 8);
+    block[SHA256_BLOCK_LENGTH - 1] = (uint8_t)(((SHA256_BLOCK_LENGTH + SHA256_DIGEST_LENGTH_BYTES) * 8) & 0xFF);
+}
+
+
+/* U_1 = HMAC(P, S || INT(i)), which also seeds the accumulator. */
+static void
+first_iteration(const hmac_sha256_midstate_t *midstate,
+                const uint8_t *salt,
+                size_t salt_length,
+                uint32_t block_index,
+                uint8_t digest[SHA256_DIGEST_LENGTH_BYTES],
+                uint32_t accumulator[SHA256_STATE_WORDS])
+{
+    uint8_t block_index_be[4];
+
+    store_be32(block_index_be, block_index);
+    hmac_two_part(midstate, salt, salt_length, block_index_be, sizeof(block_index_be), digest);
+
+    for (int i = 0; i < SHA256_STATE_WORDS; ++i) {
+        accumulator[i] = ((uint32_t)digest[i * 4] << 24) | ((uint32_t)digest[i * 4 + 1] << 16)
+                       | ((uint32_t)digest[i * 4 + 2] << 8) | (uint32_t)digest[i * 4 + 3];
+    }
+}
+
+
+/*
+ * U_n = HMAC(P, U_{n-1}); T = U_1 ^ U_2 ^ ... ^ U_c. Every U_i after the first is an HMAC over a
+ *   32-byte message, which is always a single padded block; only its first 32 bytes (the previous
+ *   U, kept in `block`) ever change.
+ */
+static void
+run_iterations(const hmac_sha256_midstate_t *midstate,
+               uint8_t block[SHA256_BLOCK_LENGTH],
+               uint32_t accumulator[SHA256_STATE_WORDS],
+               uint32_t count)
+{
+    uint32_t state[SHA256_STATE_WORDS];
+
+    for (uint32_t n = 0; n < count; ++n) {
+        memcpy(state, midstate->inner, sizeof(state));
+        sha256__compress(state, block);
+        store_state(block, state);
+
+        memcpy(state, midstate->outer, sizeof(state));
+        sha256__compress(state, block);
+        store_state(block, state);
+
+        for (int i = 0; i < SHA256_STATE_WORDS; ++i) accumulator[i] ^= state[i];
+    }
+}
+
+
+int
+pbkdf2_sha256__from_midstate(const hmac_sha256_midstate_t *midstate,
+                             const uint8_t *salt,
+                             size_t salt_length,
+                             uint32_t iterations,
+                             uint8_t *output,
+                             size_t output_length)
+{
+    uint8_t digest[SHA256_DIGEST_LENGTH_BYTES];
+    uint8_t block[SHA256_BLOCK_LENGTH];
+    uint32_t accumulator[SHA256_STATE_WORDS];
+    uint32_t block_index = 1;
+
+    if (NULL == midstate || NULL == output || 0 == iterations) return -1;
+
+    prepare_digest_block(block);
+
+    while (output_length > 0) {
+        size_t chunk = (output_length < SHA256_DIGEST_LENGTH_BYTES) ? output_length : SHA256_DIGEST_LENGTH_BYTES;
+
+        first_iteration(midstate, salt, salt_length, block_index, block, accumulator);
+        run_iterations(midstate, block, accumulator, iterations - 1);
+
+        store_state(digest, accumulator);
+        memcpy(output, digest, chunk);
+
+        output += chunk;
+        output_length -= chunk;
+        block_index++;
+    }
+
+    return 0;
+}
+
+
+int
+pbkdf2_sha256__begin(const hmac_sha256_midstate_t *midstate,
+                     const uint8_t *salt,
+                     size_t salt_length,
+                     uint32_t iterations,
+                     pbkdf2_sha256_state_t *state)
+{
+    if (NULL == midstate || NULL == state || 0 == iterations) return -1;
+
+    prepare_digest_block(state->block);
+    first_iteration(midstate, salt, salt_length, 1, state->block, state->accumulator);
+    state->remaining = iterations - 1;
+
+    return 0;
+}
+
+
+uint32_t
+pbkdf2_sha256__step(const hmac_sha256_midstate_t *midstate,
+                    pbkdf2_sha256_state_t *state,
+                    uint32_t max_iterations)
+{
+    uint32_t count = (max_iterations < state->remaining) ? max_iterations : state->remaining;
+
+    run_iterations(midstate, state->block, state->accumulator, count);
+    state->remaining -= count;
+
+    return state->remaining;
+}
+
+
+void
+pbkdf2_sha256__finish(const pbkdf2_sha256_state_t *state,
+                      uint8_t output[SHA256_DIGEST_LENGTH_BYTES])
+{
+    store_state(output, state->accumulator);
+}
@@ -0,0 +1,116 @@
+#ifndef LIB_VBA_SHA256_H
+#define LIB_VBA_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+#define SHA256_BLOCK_LENGTH         64
+#define SHA256_DIGEST_LENGTH_BYTES  32
+#define SHA256_STATE_WORDS          8
+
+
+
+/**
+ * Keyed HMAC-SHA256 state: the compression state after absorbing (key ^ ipad) and (key ^ opad).
+ *   Deriving this once per key removes two compressions and all context setup from every HMAC.
+ */
+typedef
+struct {
+    uint32_t    inner[SHA256_STATE_WORDS];
+    uint32_t    outer[SHA256_STATE_WORDS];
+} hmac_sha256_midstate_t;
+
+/**
+ * A PBKDF2-HMAC-SHA256 run over the first (and only, for a 32-byte key) output block which can
+ *   be stopped between iterations.
+ */
+typedef
+struct {
+    uint8_t     block[SHA256_BLOCK_LENGTH];   /* U_n, already padded for the next HMAC. */
+    uint32_t    accumulator[SHA256_STATE_WORDS];
+    uint32_t    remaining;   /* Iterations still to run. */
+} pbkdf2_sha256_state_t;
+
+
+
+/**
+ * Run the SHA-256 compression function over one 64-byte block.
+ */
+void
+sha256__compress(
+    uint32_t                        state[SHA256_STATE_WORDS],
+    const uint8_t                   block[SHA256_BLOCK_LENGTH]
+);
+
+/**
+ * Precompute the inner and outer HMAC-SHA256 midstates for a key.
+ */
+void
+hmac_sha256__prekey(
+    hmac_sha256_midstate_t          *midstate,
+    const uint8_t                   *key,
+    size_t                          key_length
+);
+
+/**
+ * HMAC-SHA256 of a message, starting from precomputed midstates.
+ */
+void
+hmac_sha256__from_midstate(
+    const hmac_sha256_midstate_t    *midstate,
+    const uint8_t                   *message,
+    size_t                          message_length,
+    uint8_t                         digest[SHA256_DIGEST_LENGTH_BYTES]
+);
+
+/**
+ * PBKDF2-HMAC-SHA256 (RFC 8018) starting from precomputed midstates. Every iteration after the
+ *   first costs exactly two compressions. Output is identical to PKCS5_PBKDF2_HMAC with SHA-256.
+ */
+int
+pbkdf2_sha256__from_midstate(
+    const hmac_sha256_midstate_t    *midstate,
+    const uint8_t                   *salt,
+    size_t                          salt_length,
+    uint32_t                        iterations,
+    uint8_t                         *output,
+    size_t                          output_length
+);
+
+
+/**
+ * Start a resumable PBKDF2-HMAC-SHA256 run with a 32-byte output. Runs the first iteration.
+ */
+int
+pbkdf2_sha256__begin(
+    const hmac_sha256_midstate_t    *midstate,
+    const uint8_t                   *salt,
+    size_t                          salt_length,
+    uint32_t                        iterations,
+    pbkdf2_sha256_state_t           *state
+);
+
+/**
+ * Run at most `max_iterations` more iterations. Returns how many are still left.
+ */
+uint32_t
+pbkdf2_sha256__step(
+    const hmac_sha256_midstate_t    *midstate,
+    pbkdf2_sha256_state_t           *state,
+    uint32_t                        max_iterations
+);
+
+/**
+ * The derived key, once `pbkdf2_sha256__step` has returned 0.
+ */
+void
+pbkdf2_sha256__finish(
+    const pbkdf2_sha256_state_t     *state,
+    uint8_t                         output[SHA256_DIGEST_LENGTH_BYTES]
+);
+
+
+
+#endif   /* LIB_VBA_SHA256_H */
@@ -0,0 +1,270 @@
+#include "sha256_mb.h"
+
+#include <string.h>
+
+
+
+typedef void (*mb_kernel_fn)(
+    const hmac_sha256_midstate_t    *midstate,
+    uint32_t                        u[SHA256_STATE_WORDS][SHA256_MB_MAX_LANES],
+    uint32_t                        t[SHA256_STATE_WORDS][SHA256_MB_MAX_LANES],
+    uint32_t                        steps
+);
+
+static const uint32_t sha256_mb_k[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+
+
+#if defined(__x86_64__)
+
+#define MB_LANES    4
+#define MB_VECTOR   mb_vector_sse2_t
+#define MB_TARGET   __attribute__((target("sse2")))
+#define MB_KERNEL   mb_kernel_sse2
+#include "sha256_mb_kernel.h"
+#undef MB_LANES
+#undef MB_VECTOR
+#undef MB_TARGET
+#undef MB_KERNEL
+
+#define MB_LANES    8
+#define MB_VECTOR   mb_vector_avx2_t
+#define MB_TARGET   __attribute__((target("avx2")))
+#define MB_KERNEL   mb_kernel_avx2
+#include "sha256_mb_kernel.h"
+#undef MB_LANES
+#undef MB_VECTOR
+#undef MB_TARGET
+#undef MB_KERNEL
+
+#define MB_LANES    16
+#define MB_VECTOR   mb_vector_avx512_t
+#define MB_TARGET   __attribute__((target("avx512f")))
+#define MB_KERNEL   mb_kernel_avx512
+#include "sha256_mb_kernel.h"
+#undef MB_LANES
+#undef MB_VECTOR
+#undef MB_TARGET
+#undef MB_KERNEL
+
+#endif   /* __x86_64__ */
+
+
+
+static mb_kernel_fn selected_kernel = NULL;
+static size_t selected_lanes = 0;
+
+
+
+static void
+select_kernel(void)
+{
+    mb_kernel_fn kernel = NULL;
+    size_t lanes = 1;
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f")) {
+        kernel = mb_kernel_avx512;
+        lanes = 16;
+    } else if (__builtin_cpu_supports("avx2")) {
+        kernel = mb_kernel_avx2;
+        lanes = 8;
+    } else {
+        kernel = mb_kernel_sse2;
+        lanes = 4;
+    }
+#endif
+
+    /* Racing initializers all compute the same answer, so plain stores are enough. */
+    selected_kernel = kernel;
+    __atomic_store_n(&selected_lanes, lanes, __ATOMIC_RELEASE);
+}
+
+
+/* Advance one lane with the scalar (hardware SHA where available) compression. */
+static void
+scalar_steps(const hmac_sha256_midstate_t *midstate,
+             uint32_t u[SHA256_STATE_WORDS][SHA256_MB_MAX_LANES],
+             uint32_t t[SHA256_STATE_WORDS][SHA256_MB_MAX_LANES],
+             size_t lane,
+             uint32_t steps)
+{
+    uint8_t block[SHA256_BLOCK_LENGTH] = {0};
+    uint32_t state[SHA256_STATE_WORDS];
+
+    block[SHA256_DIGEST_LENGTH_BYTES] = 0x80;
+    block[SHA256_BLOCK_LENGTH - 2] = (uint8_t)(((SHA256_BLOCK_LENGTH + SHA256_DIGEST_LENGTH_BYTES) * 8) >> 8);
+    block[SHA256_BLOCK_LENGTH - 1] = (uint8_t)(((SHA256_BLOCK_LENGTH + SHA256_DIGEST_LENGTH_BYTES) * 8) & 0xFF);
+
+    for (int i = 0; i < SHA256_STATE_WORDS; ++i) state[i] = u[i][lane];
+
+    for (uint32_t n = 0; n < steps; ++n) {
+        for (int i = 0; i < SHA256_STATE_WORDS; ++i) {
+            block[i * 4]     = (uint8_t)(state[i] >> 24);
+            block[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+            block[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+            block[i * 4 + 3] = (uint8_t)(state[i]);
+        }
+        memcpy(state, midstate->inner, sizeof(state));
+        sha256__compress(state, block);
+
+        for (int i = 0; i < SHA256_STATE_WORDS; ++i) {
+            block[i * 4]     = (uint8_t)(state[i] >> 24);
+            block[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+            block[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+            block[i * 4 + 3] = (uint8_t)(state[i]);
+        }
+        memcpy(state, midstate->outer, sizeof(state));
+        sha256__compress(state, block);
+
+        for (int i = 0; i < SHA256_STATE_WORDS; ++i) t[i][lane] ^= state[i];
+    }
+
+    for (int i = 0; i < SHA256_STATE_WORDS; ++i) u[i][lane] = state[i];
+}
+
+
+/* Compute U_1 for a job and park it in a lane. Returns the iterations still left after U_1. */
+static uint32_t
+load_lane(const hmac_sha256_midstate_t *midstate,
+          pbkdf2_sha256_job_t *job,
+          uint32_t u[SHA256_STATE_WORDS][SHA256_MB_MAX_LANES],
+          uint32_t t[SHA256_STATE_WORDS][SHA256_MB_MAX_LANES],
+          size_t lane)
+{
+    uint8_t first[SHA256_DIGEST_LENGTH_BYTES];
+
+    /* A single iteration of PBKDF2 is exactly U_1. */
+    job->status = pbkdf2_sha256__from_midstate(midstate, job->salt, job->salt_length, 1, first, sizeof(first));
+    if (0 != job->status || 0 == job->iterations) {
+        job->status = -1;
+        return 0;
+    }
+
+    for (int i = 0; i < SHA256_STATE_WORDS; ++i) {
+        u[i][lane] = ((uint32_t)first[i * 4] << 24) | ((uint32_t)first[i * 4 + 1] << 16)
+                   | ((uint32_t)first[i * 4 + 2] << 8) | (uint32_t)first[i * 4 + 3];
+        t[i][lane] = u[i][lane];
+    }
+
+    return job->iterations - 1;
+}
+
+
+static void
+store_lane(pbkdf2_sha256_job_t *job,
+           uint32_t t[SHA256_STATE_WORDS][SHA256_MB_MAX_LANES],
+           size_t lane)
+{
+    for (int i = 0; i < SHA256_STATE_WORDS; ++i) {
+        job->output[i * 4]     = (uint8_t)(t[i][lane] >> 24);
+        job->output[i * 4 + 1] = (uint8_t)(t[i][lane] >> 16);
+        job->output[i * 4 + 2] = (uint8_t)(t[i][lane] >> 8);
+        job->output[i * 4 + 3] = (uint8_t)(t[i][lane]);
+    }
+}
+
+
+
+size_t
+pbkdf2_sha256_mb__lanes(void)
+{
+    if (0 == __atomic_load_n(&selected_lanes, __ATOMIC_ACQUIRE)) select_kernel();
+    return selected_lanes;
+}
+
+
+int
+pbkdf2_sha256_mb__run(const hmac_sha256_midstate_t *midstate,
+                      pbkdf2_sha256_job_t *jobs,
+                      size_t count)
+{
+    uint32_t u[SHA256_STATE_WORDS][SHA256_MB_MAX_LANES] __attribute__((aligned(64))) = {{0}};
+    uint32_t t[SHA256_STATE_WORDS][SHA256_MB_MAX_LANES] __attribute__((aligned(64))) = {{0}};
+    pbkdf2_sha256_job_t *lane_job[SHA256_MB_MAX_LANES] = {0};
+    uint32_t remaining[SHA256_MB_MAX_LANES] = {0};
+    size_t lanes = pbkdf2_sha256_mb__lanes();
+    size_t next_job = 0;
+    size_t active = 0;
+    uint32_t steps = 0;
+
+    if (NULL == midstate || (NULL == jobs && count > 0)) return -1;
+
+    /* Without a vector kernel, every job simply runs on its own. */
+    if (NULL == selected_kernel || lanes <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            jobs[i].status = pbkdf2_sha256__from_midstate(midstate,
+                                                          jobs[i].salt,
+                                                          jobs[i].salt_length,
+                                                          jobs[i].iterations,
+                                                          jobs[i].output,
+                                                          SHA256_DIGEST_LENGTH_BYTES);
+        }
+        return 0;
+    }
+
+    for (;;) {
+        /* Retire finished lanes and refill every empty lane from the queue. */
+        active = 0;
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            for (;;) {
+                if (NULL != lane_job[lane] && 0 == remaining[lane]) {
+                    if (0 == lane_job[lane]->status) store_lane(lane_job[lane], t, lane);
+                    lane_job[lane] = NULL;
+                }
+
+                /* A freshly loaded job may need no iterations beyond U_1, so loop until one sticks. */
+                if (NULL == lane_job[lane] && next_job < count) {
+                    lane_job[lane] = &(jobs[next_job++]);
+                    remaining[lane] = load_lane(midstate, lane_job[lane], u, t, lane);
+                    continue;
+                }
+
+                break;
+            }
+
+            if (NULL != lane_job[lane]) active++;
+        }
+
+        if (0 == active) break;
+
+        /*
+         * Once the queue is dry and only a few lanes are still busy, a full-width vector pass mostly
+         *   computes garbage. The scalar path (SHA-NI where present) finishes the stragglers faster.
+         */
+        if (next_job >= count && (active * 3) <= lanes) {
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                if (NULL == lane_job[lane]) continue;
+
+                scalar_steps(midstate, u, t, lane, remaining[lane]);
+                remaining[lane] = 0;
+            }
+            continue;
+        }
+
+        /* Run everyone up to the point where the next lane retires. */
+        steps = UINT32_MAX;
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            if (NULL != lane_job[lane] && remaining[lane] < steps) steps = remaining[lane];
+        }
+
+        selected_kernel(midstate, u, t, steps);
+
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            if (NULL != lane_job[lane]) remaining[lane] -= steps;
+        }
+    }
+
+    return 0;
+}
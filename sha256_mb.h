@@ -0,0 +1,49 @@
+#ifndef LIB_VBA_SHA256_MB_H
+#define LIB_VBA_SHA256_MB_H
+
+#include "sha256.h"
+
+
+
+#define SHA256_MB_MAX_LANES     16
+
+
+
+/**
+ * One PBKDF2-HMAC-SHA256 derivation to run in a multi-lane batch. Every job in a batch shares
+ *   the same key (midstate) and produces a single 32-byte output block.
+ */
+typedef
+struct {
+    const uint8_t   *salt;
+    size_t          salt_length;
+    uint32_t        iterations;
+    uint8_t         *output;   /* SHA256_DIGEST_LENGTH_BYTES */
+    int             status;
+} pbkdf2_sha256_job_t;
+
+
+
+/**
+ * The amount of lanes the best kernel for this CPU runs in lockstep (16 for AVX-512, 8 for AVX2,
+ *   4 for SSE2, or 1 when only the scalar path is available).
+ */
+size_t
+pbkdf2_sha256_mb__lanes(void);
+
+/**
+ * Run a batch of PBKDF2 jobs under one key, several at a time in SIMD lanes. A lane whose job
+ *   runs out of iterations retires early and is immediately refilled with the next job.
+ *
+ * Results are identical to running each job through `pbkdf2_sha256__from_midstate`.
+ */
+int
+pbkdf2_sha256_mb__run(
+    const hmac_sha256_midstate_t    *midstate,
+    pbkdf2_sha256_job_t             *jobs,
+    size_t                          count
+);
+
+
+
+#endif   /* LIB_VBA_SHA256_MB_H */
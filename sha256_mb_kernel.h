@@ -0,0 +1,83 @@
+/*
+ * Multi-lane PBKDF2-HMAC-SHA256 iteration kernel.
+ *
+ * This file is included once per instruction set by sha256_mb.c with these macros defined:
+ *   MB_LANES     - the amount of 32-bit lanes in one vector
+ *   MB_VECTOR    - the name to give the vector type
+ *   MB_TARGET    - the function target attribute for the instruction set
+ *   MB_KERNEL    - the name of the generated kernel function
+ *
+ * The kernel advances every lane by `steps` PBKDF2 iterations. State is kept as structure-of-arrays
+ *   (`u[word][lane]`), so each SHA-256 working variable is one vector holding the same word of
+ *   every lane. All lanes share the key midstates; only their running U and T values differ.
+ */
+
+typedef uint32_t MB_VECTOR __attribute__((vector_size(MB_LANES * sizeof(uint32_t))));
+
+
+MB_TARGET static void
+MB_KERNEL(const hmac_sha256_midstate_t *midstate,
+          uint32_t u[SHA256_STATE_WORDS][SHA256_MB_MAX_LANES],
+          uint32_t t[SHA256_STATE_WORDS][SHA256_MB_MAX_LANES],
+          uint32_t steps)
+{
+    MB_VECTOR current[SHA256_STATE_WORDS];
+    MB_VECTOR accumulator[SHA256_STATE_WORDS];
+    MB_VECTOR inner[SHA256_STATE_WORDS];
+    MB_VECTOR outer[SHA256_STATE_WORDS];
+    MB_VECTOR digest[SHA256_STATE_WORDS];
+    MB_VECTOR w[16];
+    MB_VECTOR a, b, c, d, e, f, g, h, t1, t2;
+    const MB_VECTOR zero = {0};
+
+    for (int i = 0; i < SHA256_STATE_WORDS; ++i) {
+        memcpy(&current[i], u[i], sizeof(MB_VECTOR));
+        memcpy(&accumulator[i], t[i], sizeof(MB_VECTOR));
+
+        inner[i] = zero + midstate->inner[i];
+        outer[i] = zero + midstate->outer[i];
+    }
+
+#define MB_ROTR(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+#define MB_COMPRESS(initial, message, result) \
+    do { \
+        for (int i = 0; i < SHA256_STATE_WORDS; ++i) w[i] = (message)[i]; \
+        w[8] = zero + 0x80000000U; \
+        for (int i = 9; i < 15; ++i) w[i] = zero; \
+        w[15] = zero + ((SHA256_BLOCK_LENGTH + SHA256_DIGEST_LENGTH_BYTES) * 8); \
+        a = (initial)[0]; b = (initial)[1]; c = (initial)[2]; d = (initial)[3]; \
+        e = (initial)[4]; f = (initial)[5]; g = (initial)[6]; h = (initial)[7]; \
+        for (int r = 0; r < 64; ++r) { \
+            if (r >= 16) { \
+                MB_VECTOR w15 = w[(r - 15) & 15], w2 = w[(r - 2) & 15]; \
+                w[r & 15] += (MB_ROTR(w15, 7) ^ MB_ROTR(w15, 18) ^ (w15 >> 3)) \
+                           + w[(r - 7) & 15] \
+                           + (MB_ROTR(w2, 17) ^ MB_ROTR(w2, 19) ^ (w2 >> 10)); \
+            } \
+            t1 = h + (MB_ROTR(e, 6) ^ MB_ROTR(e, 11) ^ MB_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_mb_k[r] + w[r & 15]; \
+            t2 = (MB_ROTR(a, 2) ^ MB_ROTR(a, 13) ^ MB_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c)); \
+            h = g; g = f; f = e; e = d + t1; \
+            d = c; c = b; b = a; a = t1 + t2; \
+        } \
+        (result)[0] = (initial)[0] + a; (result)[1] = (initial)[1] + b; \
+        (result)[2] = (initial)[2] + c; (result)[3] = (initial)[3] + d; \
+        (result)[4] = (initial)[4] + e; (result)[5] = (initial)[5] + f; \
+        (result)[6] = (initial)[6] + g; (result)[7] = (initial)[7] + h; \
+    } while (0)
+
+    for (uint32_t n = 0; n < steps; ++n) {
+        /* U_n = HMAC(P, U_{n-1}): one inner and one outer compression over a single padded block. */
+        MB_COMPRESS(inner, current, digest);
+        MB_COMPRESS(outer, digest, current);
+
+        for (int i = 0; i < SHA256_STATE_WORDS; ++i) accumulator[i] ^= current[i];
+    }
+
+#undef MB_COMPRESS
+#undef MB_ROTR
+
+    for (int i = 0; i < SHA256_STATE_WORDS; ++i) {
+        memcpy(u[i], &current[i], sizeof(MB_VECTOR));
+        memcpy(t[i], &accumulator[i], sizeof(MB_VECTOR));
+    }
+}
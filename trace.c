@@ -0,0 +1,311 @@
+#include "trace.h"
+
+#include "metrics.h"
+#include "vba.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+
+#define TRACE_RING_MASK             (VBA_TRACE_RING_EVENTS - 1)
+#define TRACE_MIN_CALIBRATION_NS    10000000ULL   /* Time the TSC over at least 10 ms. */
+
+/**
+ * One thread's events. Only the owning thread writes to the ring; `head` counts every event the
+ *   thread has ever emitted, so event `i` lives in slot `i & TRACE_RING_MASK`.
+ */
+typedef
+struct trace_ring {
+    vba_trace_event_t   events[VBA_TRACE_RING_EVENTS];
+    uint64_t            head __attribute__((aligned(64)));
+    uint64_t            thread_id;
+    struct trace_ring   *next;
+    struct trace_ring   *prev;
+} __attribute__((aligned(64))) trace_ring_t;
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t *rings = NULL;
+static trace_ring_t *retired_head = NULL;   /* Oldest first; linked through `next`. */
+static trace_ring_t *retired_tail = NULL;
+static size_t retired_count = 0;
+
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static __thread trace_ring_t *local_ring = NULL;
+
+static bool is_enabled = true;
+
+/* Where the timestamp counter stood when the first ring was made, to measure its rate. */
+static uint64_t origin_tsc = 0;
+static uint64_t origin_ns = 0;
+
+
+
+static inline uint64_t
+read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return metrics__now_ns();
+#endif
+}
+
+
+static void
+retire_ring(void *argument)
+{
+    trace_ring_t *ring = (trace_ring_t *)argument;
+    trace_ring_t *oldest = NULL;
+
+    pthread_mutex_lock(&rings_lock);
+
+    if (NULL != ring->prev) ring->prev->next = ring->next;
+    else rings = ring->next;
+    if (NULL != ring->next) ring->next->prev = ring->prev;
+
+    /* Keep the ring for the next dump: the thread that just exited may be the interesting one. */
+    ring->next = NULL;
+    ring->prev = retired_tail;
+    if (NULL != retired_tail) retired_tail->next = ring;
+    else retired_head = ring;
+    retired_tail = ring;
+
+    if (++retired_count > VBA_TRACE_RETIRED_RINGS) {
+        oldest = retired_head;
+        retired_head = oldest->next;
+        retired_head->prev = NULL;
+        --retired_count;
+    }
+
+    pthread_mutex_unlock(&rings_lock);
+
+    /* Anything emitted by later destructors on this thread goes into a fresh ring. */
+    local_ring = NULL;
+    free(oldest);
+}
+
+
+static void
+create_ring_key()
+{
+    pthread_key_create(&ring_key, retire_ring);
+
+    origin_ns = metrics__now_ns();
+    origin_tsc = read_tsc();
+}
+
+
+static trace_ring_t *
+thread_ring()
+{
+    trace_ring_t *ring = (trace_ring_t *)aligned_alloc(64, sizeof(trace_ring_t));
+
+    if (NULL == ring) return NULL;
+    memset(ring, 0x00, sizeof(trace_ring_t));
+
+    ring->thread_id = (uint64_t)syscall(SYS_gettid);
+
+    pthread_once(&ring_key_once, create_ring_key);
+
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    if (NULL != rings) rings->prev = ring;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_setspecific(ring_key, ring);
+
+    local_ring = ring;
+    return ring;
+}
+
+
+/* Copy out a ring's surviving events, oldest first. Returns how many were copied. */
+static size_t
+copy_ring(const trace_ring_t *ring,
+          vba_trace_event_t *events,
+          uint64_t *dropped)
+{
+    uint64_t head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+    uint64_t first = (head > VBA_TRACE_RING_EVENTS) ? (head - VBA_TRACE_RING_EVENTS) : 0;
+    uint64_t latest_head = 0;
+    uint64_t first_intact = 0;
+    size_t count = (size_t)(head - first);
+    size_t skipped = 0;
+    uint64_t *target = (uint64_t *)events;
+
+    for (uint64_t i = first; i < head; ++i) {
+        const uint64_t *source = (const uint64_t *)&(ring->events[i & TRACE_RING_MASK]);
+
+        for (size_t w = 0; w < sizeof(vba_trace_event_t) / sizeof(uint64_t); ++w) {
+            *(target++) = __atomic_load_n(&(source[w]), __ATOMIC_RELAXED);
+        }
+    }
+
+    /*
+     * The owner kept writing while we copied. Anything it has lapped since is garbage, and so is
+     *   the slot of the event it may be writing right now.
+     */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    latest_head = __atomic_load_n(&(ring->head), __ATOMIC_RELAXED);
+    first_intact = (latest_head + 1 > VBA_TRACE_RING_EVENTS) ? (latest_head + 1 - VBA_TRACE_RING_EVENTS) : 0;
+
+    if (first_intact > first) {
+        skipped = (size_t)MIN(first_intact - first, (uint64_t)count);
+        count -= skipped;
+        memmove(events, events + skipped, count * sizeof(vba_trace_event_t));
+    }
+
+    *dropped = first + skipped;
+    return count;
+}
+
+
+static uint64_t
+measure_tsc_rate()
+{
+    uint64_t elapsed_ns = metrics__now_ns() - origin_ns;
+    struct timespec pause;
+
+    if (elapsed_ns < TRACE_MIN_CALIBRATION_NS) {
+        pause.tv_sec = 0;
+        pause.tv_nsec = (long)(TRACE_MIN_CALIBRATION_NS - elapsed_ns);
+        nanosleep(&pause, NULL);
+    }
+
+    elapsed_ns = metrics__now_ns() - origin_ns;
+    return (uint64_t)((unsigned __int128)(read_tsc() - origin_tsc) * 1000000000ULL / elapsed_ns);
+}
+
+
+static int
+write_ring(FILE *output,
+           const trace_ring_t *ring,
+           vba_trace_event_t *events)
+{
+    vba_trace_thread_t thread = {0};
+
+    thread.thread_id = ring->thread_id;
+    thread.event_count = copy_ring(ring, events, &(thread.dropped));
+
+    if (1 != fwrite(&thread, sizeof(thread), 1, output)) return -4;
+    if (thread.event_count != fwrite(events, sizeof(vba_trace_event_t), thread.event_count, output)) return -4;
+
+    return 0;
+}
+
+
+
+void
+trace__emit(vba_trace_kind_t kind,
+            uint8_t flags,
+            uint16_t kdf_type,
+            uint16_t work_factor,
+            size_t salt_length,
+            int result)
+{
+    trace_ring_t *ring = local_ring;
+    vba_trace_event_t event;
+    uint64_t words[sizeof(vba_trace_event_t) / sizeof(uint64_t)];
+    uint64_t *slot = NULL;
+    uint64_t head = 0;
+
+    if (!__atomic_load_n(&is_enabled, __ATOMIC_RELAXED)) return;
+
+    if (__builtin_expect(NULL == ring, 0)) {
+        ring = thread_ring();
+        if (NULL == ring) return;
+    }
+
+    event.tsc = read_tsc();
+    event.kind = (uint8_t)kind;
+    event.flags = flags;
+    event.kdf_type = (uint8_t)kdf_type;
+    event.salt_length = (uint8_t)MIN(salt_length, (size_t)UINT8_MAX);
+    event.work_factor = work_factor;
+    event.result = (int16_t)result;
+    memcpy(words, &event, sizeof(words));
+
+    head = ring->head;
+    slot = (uint64_t *)&(ring->events[head & TRACE_RING_MASK]);
+
+    /* Order the slot after the previous head, so a reader who sees the new slot sees that head too. */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (size_t w = 0; w < sizeof(words) / sizeof(uint64_t); ++w) {
+        __atomic_store_n(&(slot[w]), words[w], __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&(ring->head), head + 1, __ATOMIC_RELEASE);
+}
+
+
+void
+trace__set_enabled(bool enabled)
+{
+    __atomic_store_n(&is_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+
+int
+trace__write(const char *path)
+{
+    vba_trace_file_header_t header = {0};
+    vba_trace_event_t *events = NULL;
+    char temporary_path[4096];
+    FILE *output = NULL;
+    int status = 0;
+
+    if (NULL == path) return -1;
+    if ((size_t)snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path) >= sizeof(temporary_path)) return -1;
+
+    events = (vba_trace_event_t *)malloc(VBA_TRACE_RING_EVENTS * sizeof(vba_trace_event_t));
+    if (NULL == events) return -3;
+
+    output = fopen(temporary_path, "w");
+    if (NULL == output) {
+        status = -4;
+        goto Label__write_Free;
+    }
+
+    pthread_once(&ring_key_once, create_ring_key);
+
+    header.magic = VBA_TRACE_FILE_MAGIC;
+    header.event_size = sizeof(vba_trace_event_t);
+    header.ticks_per_second = measure_tsc_rate();
+
+    /* Rings cannot come or go while they are being counted and copied. */
+    pthread_mutex_lock(&rings_lock);
+
+    for (trace_ring_t *ring = rings; NULL != ring; ring = ring->next) ++header.thread_count;
+    header.thread_count += retired_count;
+
+    if (1 != fwrite(&header, sizeof(header), 1, output)) status = -4;
+
+    for (trace_ring_t *ring = rings; NULL != ring && 0 == status; ring = ring->next) {
+        status = write_ring(output, ring, events);
+    }
+    for (trace_ring_t *ring = retired_head; NULL != ring && 0 == status; ring = ring->next) {
+        status = write_ring(output, ring, events);
+    }
+
+    pthread_mutex_unlock(&rings_lock);
+
+    if (0 != fclose(output)) status = -4;
+    if (0 == status && 0 != rename(temporary_path, path)) status = -4;
+
+Label__write_Free:
+    if (0 != status) unlink(temporary_path);
+    free(events);
+    return status;
+}
@@ -0,0 +1,99 @@
+#ifndef LIB_VBA_TRACE_H
+#define LIB_VBA_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+#define VBA_TRACE_RING_EVENTS       4096   /* Per thread; a power of 2. 64 KiB of events. */
+#define VBA_TRACE_RETIRED_RINGS     16     /* Rings of exited threads kept for the next dump. */
+
+#define VBA_TRACE_FILE_MAGIC        0x56425431   /* "VBT1" */
+
+#define VBA_TRACE_FLAG_CACHE_HIT    0x01
+
+
+
+typedef
+enum {
+    VBA_TRACE_VOUCHER_PARSED = 1,
+    VBA_TRACE_GENERATE_BEGIN,
+    VBA_TRACE_GENERATE_END,
+    VBA_TRACE_VERIFY_BEGIN,
+    VBA_TRACE_VERIFY_END,
+    VBA_TRACE_KDF_BEGIN,
+    VBA_TRACE_KDF_END
+} vba_trace_kind_t;
+
+/**
+ * One traced event. Fields which do not apply to the event's kind are 0.
+ */
+typedef
+struct {
+    uint64_t    tsc;            /* Timestamp counter (or CLOCK_MONOTONIC ns where there is none). */
+    uint8_t     kind;           /* vba_trace_kind_t */
+    uint8_t     flags;          /* VBA_TRACE_FLAG_* */
+    uint8_t     kdf_type;       /* VBA_*_TYPE of the voucher. */
+    uint8_t     salt_length;
+    uint16_t    work_factor;
+    int16_t     result;         /* Return status, on the closing event. */
+} vba_trace_event_t;
+
+/**
+ * Trace files start with this header. Then, for each thread, come a `vba_trace_thread_t`
+ *   and its `event_count` events, oldest first.
+ */
+typedef
+struct {
+    uint32_t    magic;
+    uint32_t    event_size;         /* sizeof(vba_trace_event_t), as a layout check. */
+    uint64_t    ticks_per_second;   /* Timestamp rate, measured over the process' lifetime. */
+    uint64_t    thread_count;
+} vba_trace_file_header_t;
+
+typedef
+struct {
+    uint64_t    thread_id;          /* Kernel thread ID. */
+    uint64_t    event_count;
+    uint64_t    dropped;            /* Events overwritten before this dump. */
+} vba_trace_thread_t;
+
+
+
+/**
+ * Record one event in the calling thread's ring. The ring is only ever written by its own thread,
+ *   so this takes no lock and no atomic read-modify-write; the oldest events are overwritten once
+ *   the ring is full. A thread's first event allocates its ring.
+ */
+void
+trace__emit(
+    vba_trace_kind_t            kind,
+    uint8_t                     flags,
+    uint16_t                    kdf_type,
+    uint16_t                    work_factor,
+    size_t                      salt_length,
+    int                         result
+);
+
+/**
+ * Turn tracing on or off for every thread. It is on by default.
+ */
+void
+trace__set_enabled(
+    bool                        enabled
+);
+
+/**
+ * Write every ring, including those of recently exited threads, to a binary trace file. The
+ *   rings keep recording while they are copied. Convert the file with `vba-trace-dump`.
+ */
+int
+trace__write(
+    const char                  *path
+);
+
+
+
+#endif   /* LIB_VBA_TRACE_H */
@@ -0,0 +1,207 @@
+#include "vba.h"
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+typedef
+struct {
+    FILE        *output;
+    uint64_t    origin_tsc;
+    uint64_t    ticks_per_second;
+    bool        is_first;
+} dump_state_t;
+
+
+
+static const char *
+kdf_name(uint8_t kdf_type)
+{
+    switch (kdf_type) {
+        case VBA_PBKDF2_TYPE:   return "pbkdf2";
+        case VBA_ARGON2_TYPE:   return "argon2";
+        case VBA_SCRYPT_TYPE:   return "scrypt";
+        default:                return "none";
+    }
+}
+
+
+/* Chrome traces count in microseconds; keep the TSC's resolution in the fraction. */
+static double
+to_microseconds(const dump_state_t *state,
+                uint64_t tsc)
+{
+    if (tsc < state->origin_tsc) return 0.0;
+    return (double)(tsc - state->origin_tsc) * 1e6 / (double)state->ticks_per_second;
+}
+
+
+static void
+print_event(dump_state_t *state,
+            uint64_t thread_id,
+            const vba_trace_event_t *event)
+{
+    const char *name = NULL;
+    char phase = 'i';
+    bool has_salt = false;
+    bool has_result = false;
+
+    switch (event->kind) {
+        case VBA_TRACE_VOUCHER_PARSED:  name = "voucher parsed";   phase = 'i';   has_result = true;   break;
+        case VBA_TRACE_GENERATE_BEGIN:  name = "generate";         phase = 'B';                        break;
+        case VBA_TRACE_GENERATE_END:    name = "generate";         phase = 'E';   has_result = true;   break;
+        case VBA_TRACE_VERIFY_BEGIN:    name = "verify";           phase = 'B';                        break;
+        case VBA_TRACE_VERIFY_END:      name = "verify";           phase = 'E';   has_result = true;   break;
+        case VBA_TRACE_KDF_BEGIN:       name = "kdf";              phase = 'B';   has_salt = true;     break;
+        case VBA_TRACE_KDF_END:         name = "kdf";              phase = 'E';   has_result = true;   break;
+        default: return;
+    }
+
+    fprintf(state->output,
+            "%s\n{\"name\":\"%s\",\"cat\":\"vba\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%lu",
+            state->is_first ? "" : ",",
+            name,
+            phase,
+            to_microseconds(state, event->tsc),
+            thread_id);
+    if ('i' == phase) fprintf(state->output, ",\"s\":\"t\"");
+
+    fprintf(state->output, ",\"args\":{\"kdf\":\"%s\",\"L\":%u", kdf_name(event->kdf_type), event->work_factor);
+    if (has_salt) fprintf(state->output, ",\"salt_length\":%u", event->salt_length);
+    if (has_result) fprintf(state->output, ",\"result\":%d", event->result);
+    if (VBA_TRACE_VERIFY_END == event->kind) {
+        fprintf(state->output, ",\"cache_hit\":%s", (event->flags & VBA_TRACE_FLAG_CACHE_HIT) ? "true" : "false");
+    }
+    fprintf(state->output, "}}");
+
+    state->is_first = false;
+}
+
+
+/* Reads one thread's block. Returns its events (to be freed), or NULL at the end of the file. */
+static vba_trace_event_t *
+read_thread(FILE *input,
+            vba_trace_thread_t *thread,
+            int *status)
+{
+    vba_trace_event_t *events = NULL;
+
+    *status = 0;
+    if (1 != fread(thread, sizeof(vba_trace_thread_t), 1, input)) {
+        *status = -4;
+        return NULL;
+    }
+
+    if (thread->event_count > VBA_TRACE_RING_EVENTS) {
+        *status = -1;
+        return NULL;
+    }
+
+    events = (vba_trace_event_t *)malloc(MAX(1, thread->event_count) * sizeof(vba_trace_event_t));
+    if (NULL == events) {
+        *status = -3;
+        return NULL;
+    }
+
+    if (thread->event_count != fread(events, sizeof(vba_trace_event_t), thread->event_count, input)) {
+        free(events);
+        *status = -4;
+        return NULL;
+    }
+
+    return events;
+}
+
+
+
+int
+main(int argc,
+     char **argv)
+{
+    vba_trace_file_header_t header = {0};
+    vba_trace_thread_t thread = {0};
+    vba_trace_event_t *events = NULL;
+    dump_state_t state = {};
+    FILE *input = NULL;
+    long threads_offset = 0;
+    uint64_t dropped = 0;
+    int status = 0;
+
+    /*
+     * Usage: vba-trace-dump <trace.bin> [output.json]
+     *   Without an output path, the JSON goes to stdout. Open it in chrome://tracing or Perfetto.
+     */
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <trace.bin> [output.json]\n", argv[0]);
+        return 1;
+    }
+
+    input = fopen(argv[1], "rb");
+    if (NULL == input) {
+        fprintf(stderr, "Cannot open '%s'.\n", argv[1]);
+        return 2;
+    }
+
+    if (
+        1 != fread(&header, sizeof(header), 1, input)
+        || VBA_TRACE_FILE_MAGIC != header.magic
+        || sizeof(vba_trace_event_t) != header.event_size
+        || 0 == header.ticks_per_second
+    ) {
+        fprintf(stderr, "'%s' is not a trace written by this build.\n", argv[1]);
+        fclose(input);
+        return 2;
+    }
+
+    /* First pass: find the earliest timestamp, so the trace starts at 0. */
+    threads_offset = ftell(input);
+    state.origin_tsc = UINT64_MAX;
+    for (uint64_t t = 0; t < header.thread_count; ++t) {
+        events = read_thread(input, &thread, &status);
+        if (NULL == events) break;
+
+        for (uint64_t i = 0; i < thread.event_count; ++i) state.origin_tsc = MIN(state.origin_tsc, events[i].tsc);
+        free(events);
+    }
+
+    if (0 != status) {
+        fprintf(stderr, "'%s' is truncated or damaged (%d).\n", argv[1], status);
+        fclose(input);
+        return 2;
+    }
+
+    state.output = (3 == argc) ? fopen(argv[2], "w") : stdout;
+    if (NULL == state.output) {
+        fprintf(stderr, "Cannot create '%s'.\n", argv[2]);
+        fclose(input);
+        return 2;
+    }
+
+    state.ticks_per_second = header.ticks_per_second;
+    state.is_first = true;
+
+    fprintf(state.output, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    fseek(input, threads_offset, SEEK_SET);
+    for (uint64_t t = 0; t < header.thread_count; ++t) {
+        events = read_thread(input, &thread, &status);
+        if (NULL == events) break;
+
+        for (uint64_t i = 0; i < thread.event_count; ++i) print_event(&state, thread.thread_id, &(events[i]));
+        dropped += thread.dropped;
+        free(events);
+    }
+
+    fprintf(state.output, "\n]}\n");
+
+    fprintf(stderr, "%lu threads; %lu older events were overwritten before the dump.\n",
+            header.thread_count, dropped);
+
+    if (stdout != state.output) fclose(state.output);
+    fclose(input);
+    return (0 == status) ? 0 : 1;
+}
@@ -1,25 +1,277 @@
 #include "vba.h"
 
+#include "arena.h"
+#include "argon2_lanes.h"
+#include "argon2d.h"
+#include "calibrate.h"
 #include "generator.h"
+#include "metrics.h"
+#include "ncache.h"
+#include "ndopt.h"
+#include "negfilter.h"
+#include "pool.h"
+#include "ratelimit.h"
+#include "scrypt.h"
+#include "sha256_mb.h"
+#include "trace.h"
 
-#include <openssl/evp.h>
 #include <openssl/rand.h>
-#include <argon2.h>
-#include <libscrypt.h>
 
 #include <string.h>
 #include <stdbool.h>
 
 
 
+/*
+ * Relative CPU weights for `vba__estimate_cost`, in units of one 64-byte SHA-256 compression.
+ *   These only need to rank requests sensibly; calibration turns units into real time.
+ */
+#define COST_UNITS_PER_SHA256_BLOCK     1
+#define COST_UNITS_PER_ARGON2_BLOCK     16   /* One 1 KiB BlaMka block fill. */
+#define COST_UNITS_PER_SALSA_CORE       1    /* One 64-byte Salsa20/8 core. */
+
+#define ARGON2_SYNC_POINT_COUNT         4
+
+#define SCRYPT_MAX_BASE_N_LOG2          10   /* 0xFF / 24: N is at most 2^10, before the voucher's scaling. */
+
+/* LLID + "vba" + the full 8-byte prefix. */
+#define KDF_SALT_MAX_LENGTH     (sizeof(((llid_t *)0)->id) + VBA_SALT_STRING_LENGTH + VBA_PREFIX_LENGTH)
+
 static int calculate_address_suffix(
     vba_t                       *vba,
     nd_link_voucher_option_t    *voucher,
     subnet_t                    *subnet,
     llid_t                      *link_layer_id,
-    uint16_t                    work_factor
+    uint16_t                    work_factor,
+    const vba_ctx_t             *ctx
+);
+
+static int verify_address_binding(
+    nd_link_voucher_option_t    *voucher,
+    ipv6_addr_t                 *ndar_ip,
+    llid_t                      *ndar_link_layer_id,
+    bool                        *is_verified,
+    const vba_ctx_t             *ctx
+);
+
+static int parse_link_voucher(
+    const uint8_t               *input,
+    nd_link_voucher_option_t    *voucher,
+    vba_algorithm_type_t        *algo
+);
+
+static int generate_address(
+    pseudo_net_dev_t            *net_device,
+    nd_link_voucher_option_t    *voucher,
+    size_t                      subnet_index,
+    uint16_t                    work_factor,
+    vba_t                       *vba,
+    const vba_ctx_t             *ctx
+);
+
+static int verify_address(
+    pseudo_net_dev_t            *verifier_device,
+    nd_link_voucher_option_t    *voucher,
+    ipv6_addr_t                 *ndar_ip,
+    llid_t                      *ndar_link_layer_id,
+    const vba_ctx_t             *ctx
+);
+
+static int prepare_address_prefix(
+    vba_t                       *vba,
+    pseudo_net_dev_t            *net_device,
+    size_t                      subnet_index
+);
+
+static uint32_t argon2_memory_size(
+    const vba_algorithm_type_t      *algo
+);
+
+static void resolve_kdf(
+    nd_link_voucher_option_t        *voucher
+);
+
+static int derive_pbkdf2(
+    const nd_link_voucher_option_t  *voucher,
+    const uint8_t                   *salt,
+    size_t                          salt_length,
+    uint16_t                        work_factor,
+    const vba_ctx_t                 *ctx,
+    uint8_t                         *hash_result
+);
+
+static size_t argon2_block_count(
+    const nd_link_voucher_option_t  *voucher
+);
+
+static int derive_argon2(
+    const nd_link_voucher_option_t  *voucher,
+    const uint8_t                   *salt,
+    size_t                          salt_length,
+    uint16_t                        work_factor,
+    const vba_ctx_t                 *ctx,
+    uint8_t                         *hash_result
+);
+
+static int derive_scrypt(
+    const nd_link_voucher_option_t  *voucher,
+    const uint8_t                   *salt,
+    size_t                          salt_length,
+    uint16_t                        work_factor,
+    const vba_ctx_t                 *ctx,
+    uint8_t                         *hash_result
 );
 
+static void scrypt_parameters(
+    const nd_link_voucher_option_t  *voucher,
+    uint16_t                        work_factor,
+    uint64_t                        *N,
+    uint32_t                        *r,
+    uint32_t                        *p
+);
+
+static size_t build_kdf_salt(
+    const vba_t                 *vba,
+    const llid_t                *link_layer_id,
+    uint8_t                     *salt
+);
+
+static void finish_address_suffix(
+    vba_t                       *vba,
+    const uint8_t               *hash_result,
+    uint16_t                    Z
+);
+
+static int generate_batch_multilane(
+    pseudo_net_dev_t                *net_device,
+    nd_link_voucher_option_t        *voucher,
+    vba_pool_t                      *pool,
+    const vba_generate_request_t    *requests,
+    size_t                          count,
+    vba_t                           *addresses,
+    int                             *results
+);
+
+static int verify_batch_multilane(
+    pseudo_net_dev_t            *verifier_device,
+    nd_link_voucher_option_t    *voucher,
+    vba_pool_t                  *pool,
+    const vba_neighbor_t        *neighbors,
+    size_t                      count,
+    int                         *results
+);
+
+static int render_verification(
+    pseudo_net_dev_t            *verifier_device,
+    const nd_link_voucher_option_t *voucher,
+    ipv6_addr_t                 *ndar_ip,
+    llid_t                      *ndar_link_layer_id,
+    bool                        is_cached,
+    bool                        is_verified
+);
+
+static bool admit_verification(
+    pseudo_net_dev_t                *verifier_device,
+    const nd_link_voucher_option_t  *voucher,
+    const ipv6_addr_t               *ndar_ip,
+    const llid_t                    *ndar_link_layer_id
+);
+
+static int render_rate_limited(
+    pseudo_net_dev_t            *verifier_device
+);
+
+static uint16_t voucher_kdf_type(
+    const nd_link_voucher_option_t  *voucher
+);
+
+static void record_outcome(
+    const nd_link_voucher_option_t  *voucher,
+    const ipv6_addr_t               *ndar_ip,
+    vba_outcome_t                   outcome
+);
+
+static void decide_verify_job(
+    vba_verify_job_t            *job,
+    bool                        is_cached,
+    bool                        is_verified
+);
+
+static void finish_verify_job(
+    vba_verify_job_t            *job,
+    const uint8_t               *hash_result
+);
+
+
+
+typedef
+struct {
+    pseudo_net_dev_t            *net_device;
+    nd_link_voucher_option_t    *voucher;   /* Pinned by the batch. */
+    size_t                      subnet_index;
+    uint16_t                    work_factor;
+    vba_t                       *address;
+    int                         *result;
+} generate_batch_task_t;
+
+typedef
+struct {
+    pseudo_net_dev_t            *verifier_device;
+    nd_link_voucher_option_t    *voucher;   /* Pinned by the batch. */
+    const vba_neighbor_t        *neighbor;
+    int                         *result;
+} verify_batch_task_t;
+
+typedef
+struct {
+    pseudo_net_dev_t            *verifier_device;
+    nd_link_voucher_option_t    *voucher;   /* Pinned until the task completes. */
+    ipv6_addr_t                 address;
+    llid_t                      link_layer_id;
+    vba_verify_callback_t       callback;
+    void                        *context;
+} verify_async_task_t;
+
+/**
+ * Per-item state for batches which are run through the multi-lane PBKDF2 kernel.
+ */
+typedef
+struct {
+    uint8_t     salt[KDF_SALT_MAX_LENGTH];
+    uint8_t     hash_result[SHA256_DIGEST_LENGTH_BYTES];
+    uint16_t    Z;
+    uint16_t    work_factor;   /* Claimed by the neighbor, for traces. */
+    size_t      job_index;
+    bool        needs_kdf;
+    bool        needs_decision;
+    bool        is_cached;
+    bool        is_verified;
+} multilane_item_t;
+
+typedef
+struct {
+    const hmac_sha256_midstate_t    *midstate;
+    uint32_t                        iterations_factor;
+    pbkdf2_sha256_job_t             *jobs;
+    size_t                          count;
+} multilane_task_t;
+
+struct vba_verify_job {
+    pseudo_net_dev_t            *verifier_device;
+    nd_link_voucher_option_t    *voucher;   /* The active voucher when the job began; pinned until it is freed. */
+    ipv6_addr_t                 address;
+    llid_t                      link_layer_id;
+    vba_t                       expected;   /* The address being regenerated. */
+    uint8_t                     salt[KDF_SALT_MAX_LENGTH];
+    size_t                      salt_length;
+    uint16_t                    work_factor;
+    int                         status;     /* VBA_VERIFY_PENDING until decided. */
+    uint64_t                    kdf_elapsed_ns;
+    pbkdf2_sha256_state_t       pbkdf2;
+    argon2d_state_t             argon2;
+    argon2d_block_t             *argon2_memory;
+};
+
 
 
 int
@@ -27,73 +279,96 @@ ndopt__process_link_voucher(void *input_data,
                             pseudo_net_dev_t *net_device,
                             nd_link_voucher_option_t **new_voucher)
 {
-    uint8_t *input = (uint8_t *)input_data;
-
-    uint32_t argon_memory_size = 0;
-    uint8_t *argon_memory_size_scroll = NULL;
+    int status = 0;
 
     nd_link_voucher_option_t *voucher =
         (nd_link_voucher_option_t *)calloc(1, sizeof(nd_link_voucher_option_t));
     vba_algorithm_type_t *algo =
         (vba_algorithm_type_t *)calloc(1, sizeof(vba_algorithm_type_t));
-    if (NULL == voucher || NULL == algo) return -1;
+    if (NULL == voucher || NULL == algo) {
+        status = -1;
+        goto Label__process_link_voucher_Free;
+    }
 
-    if (VBA_LINK_VOUCHER_TYPE != input[0]) return -2;
-    if (input[1] < 6) return -3;   /* vouchers should be a minimum of 48 bytes in length */
+    status = parse_link_voucher((const uint8_t *)input_data, voucher, algo);
+    trace__emit(VBA_TRACE_VOUCHER_PARSED, 0, algo->type, 0, 0, status);
+    if (0 != status) goto Label__process_link_voucher_Free;
 
-    voucher->type = VBA_LINK_VOUCHER_TYPE;
-    voucher->length = input[1];
-    voucher->expiration = *((uint16_t *)&input[2]);
-    voucher->timestamp = *((uint64_t *)&input[12]);
-    voucher->voucher_id = *((uint32_t *)&input[20]);
-    memcpy(&(voucher->seed), &input[24], VBA_SEED_LENGTH);
+    if (NULL != new_voucher) {
+        *new_voucher = voucher;
+        return 0;
+    }
 
-    algo->type   = (input[40] << 8) | input[41];
-    algo->length = (input[42] << 8) | input[43];
-    switch (algo->type) {
-        case VBA_PBKDF2_TYPE:
-        case VBA_SCRYPT_TYPE:
-            memcpy(&(algo->data), &input[44], sizeof(uint32_t));
-            break;
-        case VBA_ARGON2_TYPE:
-            memcpy(&(algo->data), &input[44], sizeof(uint32_t));
+Label__process_link_voucher_Free:
+    /* Just free them if no one's going to use them (or if parsing failed). */
+    free(algo);
+    free(voucher);
+    return status;
+}
 
-            /* Readjust and confine the Argon MemorySize and Parallelism parameters here. */
-            algo->data.argon2d_spec.parallelism = MAX(1, MIN(8, algo->data.argon2d_spec.parallelism >> 4));
-            
-            /* Although the spec doesn't limit the memory size, I really don't want to program to crash. */
-            argon_memory_size_scroll = algo->data.argon2d_spec.memory_size;
-            for (int i = 0; i < 3; ++i) {
-                argon_memory_size += (0xFF & *(argon_memory_size_scroll + i)) << ((3-1-i) * 8);
-            }
 
-            /* MemorySize must be a multiple of 8*Parallelism */
-            argon_memory_size += (argon_memory_size % (8 * algo->data.argon2d_spec.parallelism));
+int
+ndopt__process_link_voucher_into(void *input_data,
+                                 pseudo_net_dev_t *net_device,
+                                 vba_voucher_storage_t *storage)
+{
+    int status = 0;
 
-            /* I don't want 64KiB chosen every. single. time. So rather than below, I'm using a mod. */
-            // argon_memory_size = MIN(64 *1024, argon_memory_size);   /* limit to 64 KiB */
-            argon_memory_size %= (64 * 1024);
+    if (NULL == input_data || NULL == storage) return -1;
 
-            /* Commit the adjusted memory size. */
-            for (int i = 0; i < 3; ++i) {
-                algo->data.argon2d_spec.memory_size[i] = 0xFF & (argon_memory_size >> ((3-1-i) * 8));
-            }
+    memset(storage, 0x00, sizeof(vba_voucher_storage_t));
+    status = parse_link_voucher((const uint8_t *)input_data, &(storage->voucher), &(storage->algorithm));
+    trace__emit(VBA_TRACE_VOUCHER_PARSED, 0, storage->algorithm.type, 0, 0, status);
 
-            break;
-        default: printf("%02X", input[41]); printf("  and Type: %u", algo->type); return -3;
-    }
+    return status;
+}
 
-    voucher->algorithm_spec = algo;
 
-    if (NULL != new_voucher) {
-        *new_voucher = voucher;
-    } else {
-        /* Just free them if no one's going to use them. */
-        free(algo);
-        free(voucher);
-    }
+nd_link_voucher_option_t *
+vba__active_voucher(const pseudo_net_dev_t *net_device)
+{
+    if (NULL == net_device) return NULL;
 
-    return 0;
+    return __atomic_load_n(&(net_device->active_voucher), __ATOMIC_ACQUIRE);
+}
+
+
+nd_link_voucher_option_t *
+vba__publish_voucher(pseudo_net_dev_t *net_device,
+                     nd_link_voucher_option_t *voucher)
+{
+    if (NULL == net_device) return NULL;
+
+    /* Sequentially consistent against `vba__pin_voucher`: a pin taken after this sees the new voucher. */
+    return __atomic_exchange_n(&(net_device->active_voucher), voucher, __ATOMIC_SEQ_CST);
+}
+
+
+nd_link_voucher_option_t *
+vba__pin_voucher(pseudo_net_dev_t *net_device)
+{
+    if (NULL == net_device) return NULL;
+
+    __atomic_add_fetch(&(net_device->voucher_pins), 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&(net_device->active_voucher), __ATOMIC_SEQ_CST);
+}
+
+
+void
+vba__unpin_voucher(pseudo_net_dev_t *net_device)
+{
+    if (NULL == net_device) return;
+
+    __atomic_sub_fetch(&(net_device->voucher_pins), 1, __ATOMIC_RELEASE);
+}
+
+
+uint32_t
+vba__voucher_pins(const pseudo_net_dev_t *net_device)
+{
+    if (NULL == net_device) return 0;
+
+    return __atomic_load_n(&(net_device->voucher_pins), __ATOMIC_SEQ_CST);
 }
 
 
@@ -110,28 +385,14 @@ vba__generate(pseudo_net_dev_t *net_device,
         return -1;
     }
 
-    if (subnet_index + 1 > net_device->subnet_prefixes_count) return -7;
-
-    /* Copy in prefix information to the VBA. */
     vba = (vba_t *)calloc(1, sizeof(vba_t));
-    vba->prefix_length = net_device->subnet_prefixes[subnet_index].length;
-    memcpy(vba->prefix, net_device->subnet_prefixes[subnet_index].prefix, sizeof(vba->prefix));
-
-    /* If the prefix length is less than 8 bytes, create some random noise. */
-    if (vba->prefix_length < VBA_PREFIX_LENGTH) {
-        for (size_t i = (VBA_PREFIX_LENGTH - 1); i >= vba->prefix_length; --i) {
-            vba->prefix[i] = (uint8_t)Xoshiro128p__next_bounded_any();
-        }
-    }
+    if (NULL == vba) return -3;
 
-    status = calculate_address_suffix(vba,
-                                      net_device->active_voucher,
-                                      &(net_device->subnet_prefixes[subnet_index]),
-                                      &(net_device->link_layer_id),
-                                      work_factor);
+    status = generate_address(net_device, vba__pin_voucher(net_device), subnet_index, work_factor, vba, NULL);
+    vba__unpin_voucher(net_device);
     if (0 != status) {
         free(vba);
-        return -2;   /* Exception while calculating the address suffix. */
+        return status;
     }
 
     if (NULL != new_vba) {
@@ -150,235 +411,1692 @@ vba__verify(pseudo_net_dev_t *verifier_device,
             llid_t *ndar_link_layer_id)
 {
     int status = 0;
-    bool is_verified = false;
-    uint16_t extracted_work_factor = 0;
-    uint16_t z = 0;
-    subnet_t addr_net = {0};
-    vba_t *new_vba = NULL;
 
-    if (
-        NULL == verifier_device
-        || NULL == ndar_ip
-        || NULL == ndar_link_layer_id
-    ) {
-        return -1;   /* Invalid input parameter. */
-    }
+    if (NULL == verifier_device) return -1;
 
-    new_vba = (vba_t *)calloc(1, sizeof(vba_t));
+    status = verify_address(verifier_device, vba__pin_voucher(verifier_device), ndar_ip, ndar_link_layer_id, NULL);
+    vba__unpin_voucher(verifier_device);
 
-    /*
-     * VBAs cannot use subnets smaller than /64 (8 bytes).
-     *   If the indicated subnet is smaller, it can't be a VBA.
-     */
-    if ((ndar_ip->prefix_length * 8) > 64) goto Label__verify_RenderDecision;
+    return status;
+}
 
-    /* Copy all the current VBA info into the new one, then clear the suffix. */
-    memcpy(new_vba, (vba_t *)ndar_ip, sizeof(vba_t));
-    memset(new_vba->suffix.raw, 0x00, sizeof(new_vba->suffix.raw));
 
-    /* NOTE: Really should have just made VBA prefix info a subnet_t type, but alas. */
-    addr_net.length = new_vba->prefix_length,
-    memcpy(addr_net.prefix, new_vba->prefix, sizeof(new_vba->prefix));
+int
+vba_ctx__init(vba_ctx_t *ctx,
+              pseudo_net_dev_t *net_device,
+              void *kdf_scratch,
+              size_t kdf_scratch_size)
+{
+    if (NULL == ctx || NULL == net_device) return -1;
 
-    /* First, extract the work factor component (L) from the NDAR IP address given by the neighbor. */
-    z = ndar_ip->suffix.Z;
-    /* L = ~(Z ^ Seed[0..1]) */
-    extracted_work_factor = ~(z ^ *((uint16_t *)&(verifier_device->active_voucher->seed)));
+    ctx->net_device = net_device;
+    ctx->kdf_scratch = kdf_scratch;
+    ctx->kdf_scratch_size = (NULL == kdf_scratch) ? 0 : kdf_scratch_size;
 
-    /* Now use these components to regenerate the address suffix. */
-    status = calculate_address_suffix(new_vba,
-                                      verifier_device->active_voucher,
-                                      &addr_net,
-                                      ndar_link_layer_id,
-                                      extracted_work_factor);
-    if (0 != status) {
-        free(new_vba);
-        return -2;   /* Exception while calculating the address suffix. */
-    }
+    return 0;
+}
 
-    /*
-     * If the two VBAs match -- that is, both the one we computed locally AND the one given
-     *   during NDP address resolution -- then the binding of the LLID to the IP address is
-     *   legitimate. When this verification function returns a SUCCESS, the NDP implementation
-     *   should continue caching and processing the communication with the neighbor. Otherwise,
-     *   the neighbor should be denied communications, depending on IEM.
-     */
-    is_verified = (0 == memcmp(ndar_ip, new_vba, sizeof(vba_t)));
-    // printf("\nIN:  ");
-    // for (size_t i = 0; i < sizeof(vba_t); ++i) printf("%02X ", ((uint8_t *)ndar_ip)[i]);
-    // printf("\nOUT: ");
-    // for (size_t i = 0; i < sizeof(vba_t); ++i) printf("%02X ", ((uint8_t *)new_vba)[i]);
-    // printf("\n");
-    // fflush(stdout);
 
-Label__verify_RenderDecision:
+size_t
+vba__kdf_scratch_size(const nd_link_voucher_option_t *voucher)
+{
+    vba_kdf_cost_t cost = {0};
 
-    /* NOTE: The `new_vba` object is not freed up here because cases would theoretically use it to enter NC entries. */
+    /* Only Argon2 block memory can be placed in caller scratch; the size does not depend on L. */
+    if (NULL == voucher || NULL == voucher->algorithm_spec) return 0;
+    if (VBA_ARGON2_TYPE != voucher->algorithm_spec->type) return 0;
 
-    switch (verifier_device->iem) {
-        /* Neither AAD nor AGO regard verification results. */
-        case VBA_IEM_AAD:
-        case VBA_IEM_AGO:
-            free(new_vba);
-            return 0;
-        case VBA_IEM_AGVL:
-            /* Set the cache entry on the net device regardless of `is_verified`. */
-            /* If the verification succeeded, tag the cache entry as SECURED. */
-            /* If not, tag it as UNSECURED. */
-            free(new_vba);
-            return 0;   /* AGVL should always succeed here because the entry is cached. */
-        case VBA_IEM_AGV:
-            /* In strict mode, the address either passes or fails verification. */
-            /* If the address is verified, make sure to cache it on the net device here. */
-            free(new_vba);
-            return (true == is_verified) ? 0 : -5;   /* Either SUCCESS or a verification failure. */
-        default:
-            free(new_vba);
-            return -10;   /* Invalid IEM setting */
-    }
+    if (0 != vba__estimate_cost(voucher, 1, &cost)) return 0;
+    return (size_t)cost.memory_bytes;
 }
 
 
-void
-vba__print(vba_t *vba,
-           nd_link_voucher_option_t *voucher)
+int
+vba__generate_ctx(vba_ctx_t *ctx,
+                  size_t subnet_index,
+                  uint16_t work_factor,
+                  vba_t *address)
 {
-    printf("Prefix (/%u subnet): ", vba->prefix_length * 8);
-    for (int i = 0; i < VBA_PREFIX_LENGTH; ++i) {
-        printf("%02X", vba->prefix[i]);
-        if (i > 0 && i < (VBA_PREFIX_LENGTH - 1) && (i % 2)) printf(":");
-    }
+    int status = 0;
 
-    printf(" //  Suffix: ");
-    for (int i = 0; i < VBA_PREFIX_LENGTH; ++i) {
-        printf("%02X", vba->suffix.raw[i]);
-        if (i > 0 && i < (VBA_PREFIX_LENGTH - 1) && (i % 2)) printf(":");
-    }
+    if (NULL == ctx || NULL == ctx->net_device || NULL == address) return -1;
 
-    // printf(" //  Z: 0x"); for (int i = 0; i < 2; ++i) printf("%02X", ((uint8_t *)&(vba->suffix.Z))[i]);
-    printf(" //  Z: 0x%04X", vba->suffix.Z);
-    if (NULL != voucher) {
-        printf(" //  L: 0x%04X", (uint16_t)~(vba->suffix.Z ^ *((uint16_t *)(voucher->seed))));
-    }
+    status = generate_address(ctx->net_device, vba__pin_voucher(ctx->net_device), subnet_index, work_factor, address, ctx);
+    vba__unpin_voucher(ctx->net_device);
 
-    printf(" //  H: 0x"); for (int i = 0; i < 6; ++i) printf("%02X", vba->suffix.H[i]);
+    return status;
 }
 
 
-
-static
 int
-calculate_address_suffix(vba_t *vba,
-                         nd_link_voucher_option_t *voucher,
-                         subnet_t *subnet,
-                         llid_t *link_layer_id,
-                         uint16_t work_factor)
+vba__verify_ctx(vba_ctx_t *ctx,
+                ipv6_addr_t *ndar_ip,
+                llid_t *ndar_link_layer_id)
 {
-    const uint8_t hash_result_length = 32;
-    uint8_t hash_result[hash_result_length] = {0};
-    uint8_t *salt = NULL;
-    uint16_t Z = 0;
-    const char *vba_salt_string = VBA_SALT_STRING;
+    int status = 0;
 
-    uint8_t *memory_size_scroll = NULL;
-    uint32_t memory_size = 0;
+    if (NULL == ctx || NULL == ctx->net_device) return -1;
 
-    uint8_t scaling_factor = 0;
+    status = verify_address(ctx->net_device, vba__pin_voucher(ctx->net_device), ndar_ip, ndar_link_layer_id, ctx);
+    vba__unpin_voucher(ctx->net_device);
 
-    /* NOTE: The salt always uses the full 8 bytes of the prefix, even if the actual mask length is less. */
-    /*   This is because generating nodes can pad their prefixes with noise; that can be used no problem. */
-    size_t salt_length = link_layer_id->length + VBA_SALT_STRING_LENGTH + VBA_PREFIX_LENGTH;
+    return status;
+}
 
-    if (
-        NULL == vba
-        || NULL == voucher
-        || NULL == subnet
-        || NULL == link_layer_id
-        || 0 == work_factor
-    ) {
-        return -1;   /* Invalid parameter. */
+
+static void
+verify_async_task(void *argument)
+{
+    verify_async_task_t *task = (verify_async_task_t *)argument;
+    bool is_verified = false;
+    int status = 0;
+
+    status = verify_address_binding(task->voucher,
+                                    &(task->address),
+                                    &(task->link_layer_id),
+                                    &is_verified,
+                                    NULL);
+
+    /* Upgrade the provisional entry, or throw it out if the neighbor lied about its binding. */
+    if (0 == status && true == is_verified) {
+        ncache__insert(task->verifier_device->neighbor_cache,
+                       &(task->address),
+                       &(task->link_layer_id),
+                       task->voucher->voucher_id,
+                       VBA_TAG_SECURED);
+    } else {
+        ncache__remove(task->verifier_device->neighbor_cache,
+                       &(task->address),
+                       &(task->link_layer_id),
+                       task->voucher->voucher_id);
+
+        if (0 == status) {
+            negfilter__record_failure(task->verifier_device->negative_filter,
+                                      task->voucher,
+                                      &(task->address),
+                                      &(task->link_layer_id));
+        }
+
+        status = (0 != status) ? -2 : -5;
     }
 
-    /* Calculate Z. */
-    Z = ~(work_factor ^ *((uint16_t *)(voucher->seed)));
+    record_outcome(task->voucher,
+                   &(task->address),
+                   (0 == status) ? VBA_OUTCOME_PASS : ((-5 == status) ? VBA_OUTCOME_FAIL : VBA_OUTCOME_ERROR));
 
-    /* Construct the KDF salt. */
-    salt = (uint8_t *)calloc(1, salt_length);
-    memcpy(salt, link_layer_id->id, link_layer_id->length);
-    memcpy((salt + link_layer_id->length), vba_salt_string, VBA_SALT_STRING_LENGTH);
-    memcpy((salt + link_layer_id->length + VBA_SALT_STRING_LENGTH), vba->prefix, VBA_PREFIX_LENGTH);
+    vba__unpin_voucher(task->verifier_device);
 
-    /* Now get the hash results based on the algorithm from the voucher. */
-    switch (voucher->algorithm_spec->type) {
-        case VBA_PBKDF2_TYPE:
-            if (
-                1 != PKCS5_PBKDF2_HMAC((const char *)voucher->seed,
-                                       VBA_SEED_LENGTH,
-                                       (const uint8_t *)salt,
-                                       (int)salt_length,
-                                       (int)((int)work_factor * MAX(1, voucher->algorithm_spec->data.pbkdf2_spec.iterations_factor)),
-                                       EVP_sha256(),
-                                       (int)hash_result_length,
-                                       hash_result)
-            ) {
-                fprintf(stderr, "The PBKDF2 KDF failed!\n");
-                free(salt);
-                return -3;
-            }
-            break;
-        case VBA_ARGON2_TYPE:
-            memory_size_scroll = (uint8_t *)&(voucher->algorithm_spec->data) + 1;
+    if (NULL != task->callback) {
+        task->callback(task->verifier_device, &(task->address), &(task->link_layer_id), status, task->context);
+    }
 
-            /* Really having a big think on this 24-bit big-endian value. */
-            for (int i = 0; i < 3; ++i) {
-                memory_size += (0xFF & *(memory_size_scroll + i)) << ((3-1-i) * 8);
-            }
+    free(task);
+}
 
-            if (
-                ARGON2_OK != argon2d_hash_raw((work_factor >> 8) + 1,
-                                              (const uint32_t)memory_size,
-                                              (const uint32_t)voucher->algorithm_spec->data.argon2d_spec.parallelism,
-                                              (void *)voucher->seed,
-                                              VBA_SEED_LENGTH,
-                                              (void *)salt,
-                                              salt_length,
-                                              hash_result,
-                                              (const size_t)hash_result_length)
-            ) {
-                fprintf(stderr, "The Argon2 KDF failed!\n");
-                free(salt);
-                return -3;
-            }
-            break;
-        case VBA_SCRYPT_TYPE:
-            scaling_factor = MIN(5, voucher->algorithm_spec->data.scrypt_spec.scaling_factor);
 
-            if (
-                0 != libscrypt_scrypt(voucher->seed,
-                                      VBA_SEED_LENGTH,
-                                      salt,
-                                      salt_length,
-                                      MAX(1 << (MIN(11, MAX(1, ((work_factor & 0xFF00) >> 8) / 24))), 2) << scaling_factor,   /* N */
-                                      MAX(1, (work_factor & 0x0F)),   /* r */
-                                      MAX(1, (work_factor & 0xF0)),   /* p */
-                                      hash_result,
-                                      hash_result_length)
-            ) {
-                fprintf(stderr, "The Scrypt KDF failed!\n");
-                free(salt);
+int
+vba__verify_async(pseudo_net_dev_t *verifier_device,
+                  vba_pool_t *pool,
+                  ipv6_addr_t *ndar_ip,
+                  llid_t *ndar_link_layer_id,
+                  vba_verify_callback_t callback,
+                  void *context)
+{
+    verify_async_task_t *task = NULL;
+    nd_link_voucher_option_t *voucher = NULL;
+    int status = 0;
+
+    if (
+        NULL == verifier_device
+        || NULL == pool
+        || NULL == ndar_ip
+        || NULL == ndar_link_layer_id
+        || NULL == verifier_device->neighbor_cache
+    ) {
+        return -1;   /* Invalid input parameter. */
+    }
+
+    /* Provisional admission only exists in the lenient mode. */
+    if (VBA_IEM_AGVL != verifier_device->iem) return -12;
+
+    /* Can't be a VBA, so there is nothing to verify later. */
+    if ((ndar_ip->prefix_length * 8) > 64) return -5;
+
+    /* The pin is handed to the task, which drops it once the KDF has decided. */
+    voucher = vba__pin_voucher(verifier_device);
+    if (NULL == voucher) {
+        status = -1;
+        goto Label__verify_async_Unpin;
+    }
+
+    /* Known neighbors (verified, or with a verification already in flight) are not queued again. */
+    if (0 == ncache__lookup(verifier_device->neighbor_cache, ndar_ip, ndar_link_layer_id, voucher->voucher_id, NULL)) {
+        goto Label__verify_async_Unpin;
+    }
+
+    /* A repeat forgery is not even admitted provisionally. */
+    if (negfilter__is_rejected(verifier_device->negative_filter, voucher, ndar_ip, ndar_link_layer_id)) {
+        record_outcome(voucher, ndar_ip, VBA_OUTCOME_REJECTED);
+        status = -5;
+        goto Label__verify_async_Unpin;
+    }
+
+    /* Over budget: try again once the neighbor's buckets have refilled. */
+    if (!admit_verification(verifier_device, voucher, ndar_ip, ndar_link_layer_id)) {
+        record_outcome(voucher, ndar_ip, VBA_OUTCOME_REJECTED);
+        status = -18;
+        goto Label__verify_async_Unpin;
+    }
+
+    task = (verify_async_task_t *)calloc(1, sizeof(verify_async_task_t));
+    if (NULL == task) {
+        status = -3;
+        goto Label__verify_async_Unpin;
+    }
+
+    task->verifier_device = verifier_device;
+    task->voucher = voucher;
+    memcpy(&(task->address), ndar_ip, sizeof(ipv6_addr_t));
+    memcpy(&(task->link_layer_id), ndar_link_layer_id, sizeof(llid_t));
+    task->callback = callback;
+    task->context = context;
+
+    /* Admit the neighbor right away; the KDF decides later whether it stays. */
+    ncache__insert(verifier_device->neighbor_cache, ndar_ip, ndar_link_layer_id, voucher->voucher_id, VBA_TAG_UNSECURED);
+
+    if (0 != pool__submit(pool, NULL, verify_async_task, task)) {
+        ncache__remove(verifier_device->neighbor_cache, ndar_ip, ndar_link_layer_id, voucher->voucher_id);
+        free(task);
+        status = -3;
+        goto Label__verify_async_Unpin;
+    }
+
+    return 0;
+
+Label__verify_async_Unpin:
+    vba__unpin_voucher(verifier_device);
+    return status;
+}
+
+
+int
+vba__verify_begin(pseudo_net_dev_t *verifier_device,
+                  const ipv6_addr_t *ndar_ip,
+                  const llid_t *ndar_link_layer_id,
+                  vba_verify_job_t **job)
+{
+    vba_verify_job_t *new_job = NULL;
+    nd_link_voucher_option_t *voucher = NULL;
+    uint8_t cached_tag = 0;
+    size_t memory_blocks = 0;
+
+    if (
+        NULL == verifier_device
+        || NULL == ndar_ip
+        || NULL == ndar_link_layer_id
+        || NULL == job
+    ) {
+        return -1;   /* Invalid input parameter. */
+    }
+
+    /* The job holds this pin until `vba__verify_job_free`. */
+    voucher = vba__pin_voucher(verifier_device);
+    if (NULL == voucher) {
+        vba__unpin_voucher(verifier_device);
+        return -1;
+    }
+
+    new_job = (vba_verify_job_t *)calloc(1, sizeof(vba_verify_job_t));
+    if (NULL == new_job) {
+        vba__unpin_voucher(verifier_device);
+        return -3;
+    }
+
+    new_job->verifier_device = verifier_device;
+    new_job->voucher = voucher;
+    memcpy(&(new_job->address), ndar_ip, sizeof(ipv6_addr_t));
+    memcpy(&(new_job->link_layer_id), ndar_link_layer_id, sizeof(llid_t));
+    new_job->status = VBA_VERIFY_PENDING;
+
+    /* The same early exits as `verify_address`, all of which are decided right away. */
+    if ((ndar_ip->prefix_length * 8) > 64) {
+        record_outcome(voucher, ndar_ip, VBA_OUTCOME_REJECTED);
+        decide_verify_job(new_job, false, false);
+        goto Label__verify_begin_Done;
+    }
+
+    if (
+        0 == ncache__lookup(verifier_device->neighbor_cache,
+                            ndar_ip,
+                            ndar_link_layer_id,
+                            voucher->voucher_id,
+                            &cached_tag)
+    ) {
+        record_outcome(voucher, ndar_ip, VBA_OUTCOME_CACHED);
+        decide_verify_job(new_job, true, (VBA_TAG_SECURED == cached_tag));
+        goto Label__verify_begin_Done;
+    }
+
+    if (negfilter__is_rejected(verifier_device->negative_filter, voucher, ndar_ip, ndar_link_layer_id)) {
+        record_outcome(voucher, ndar_ip, VBA_OUTCOME_REJECTED);
+        decide_verify_job(new_job, false, false);
+        goto Label__verify_begin_Done;
+    }
+
+    if (!admit_verification(verifier_device, voucher, ndar_ip, ndar_link_layer_id)) {
+        record_outcome(voucher, ndar_ip, VBA_OUTCOME_REJECTED);
+        new_job->status = render_rate_limited(verifier_device);
+        goto Label__verify_begin_Done;
+    }
+
+    new_job->work_factor = vba__extract_work_factor(voucher, ndar_ip);
+
+    if (
+        0 == new_job->work_factor
+        || ndar_link_layer_id->length > sizeof(ndar_link_layer_id->id)
+        || NULL == voucher->kdf.derive
+    ) {
+        record_outcome(voucher, ndar_ip, VBA_OUTCOME_ERROR);
+        new_job->status = -2;   /* Exception while calculating the address suffix. */
+        goto Label__verify_begin_Done;
+    }
+
+    /* Regenerate the neighbor's address from its own prefix, as `verify_address_binding` does. */
+    memcpy(&(new_job->expected), ndar_ip, sizeof(vba_t));
+    memset(new_job->expected.suffix.raw, 0x00, sizeof(new_job->expected.suffix.raw));
+    new_job->salt_length = build_kdf_salt(&(new_job->expected), ndar_link_layer_id, new_job->salt);
+
+    switch (voucher->algorithm_spec->type) {
+        case VBA_PBKDF2_TYPE:
+            if (
+                0 != pbkdf2_sha256__begin(&(voucher->pbkdf2_midstate),
+                                          new_job->salt,
+                                          new_job->salt_length,
+                                          (uint32_t)new_job->work_factor * voucher->kdf.pbkdf2_iterations_factor,
+                                          &(new_job->pbkdf2))
+            ) {
+                record_outcome(voucher, ndar_ip, VBA_OUTCOME_ERROR);
+                new_job->status = -2;
+            }
+            break;
+        case VBA_ARGON2_TYPE:
+            /* The job outlives this call, so its blocks cannot come from the thread's arena. */
+            memory_blocks = argon2_block_count(voucher);
+            if (0 == memory_blocks) {
+                record_outcome(voucher, ndar_ip, VBA_OUTCOME_ERROR);
+                new_job->status = -2;
+                break;
+            }
+
+            new_job->argon2_memory = (argon2d_block_t *)aligned_alloc(64, memory_blocks * sizeof(argon2d_block_t));
+            if (NULL == new_job->argon2_memory) {
+                vba__verify_job_free(new_job);
                 return -3;
             }
+
+            if (
+                0 != argon2d__begin(&(new_job->argon2),
+                                    new_job->argon2_memory,
+                                    voucher->seed,
+                                    VBA_SEED_LENGTH,
+                                    new_job->salt,
+                                    new_job->salt_length,
+                                    (new_job->work_factor >> 8) + 1,
+                                    voucher->kdf.argon2_memory_blocks,
+                                    voucher->kdf.argon2_lanes,
+                                    SHA256_DIGEST_LENGTH_BYTES)
+            ) {
+                record_outcome(voucher, ndar_ip, VBA_OUTCOME_ERROR);
+                new_job->status = -2;
+            }
             break;
         default:
-            free(salt);
-            return -2;   /* Unknown KDF/algo type. */
+            break;   /* Run whole on the first resume. */
     }
 
-    /* Now that the H value is computed and placed, compute Z. */
-    memcpy(vba->suffix.raw, hash_result, VBA_SUFFIX_LENGTH);
-    memcpy(vba->suffix.raw, &Z, sizeof(uint16_t));
+Label__verify_begin_Done:
+    *job = new_job;
+    return 0;
+}
 
-    /* All done! */
-    free(salt);
+
+int
+vba__verify_resume(vba_verify_job_t *job,
+                   uint64_t budget_units)
+{
+    uint8_t hash_result[SHA256_DIGEST_LENGTH_BYTES] = {0};
+    uint64_t steps = 0;
+    uint64_t segment_units = 0;
+    uint64_t started_ns = 0;
+    bool is_done = true;
+
+    if (NULL == job) return -1;
+    if (VBA_VERIFY_PENDING != job->status) return job->status;
+
+    started_ns = metrics__now_ns();
+
+    switch (job->voucher->algorithm_spec->type) {
+        case VBA_PBKDF2_TYPE:
+            steps = MAX(1, budget_units / (2 * COST_UNITS_PER_SHA256_BLOCK));
+
+            is_done = (0 == pbkdf2_sha256__step(&(job->voucher->pbkdf2_midstate), &(job->pbkdf2), (uint32_t)MIN(steps, UINT32_MAX)));
+            if (is_done) pbkdf2_sha256__finish(&(job->pbkdf2), hash_result);
+            break;
+        case VBA_ARGON2_TYPE:
+            segment_units = COST_UNITS_PER_ARGON2_BLOCK * (uint64_t)job->argon2.segment_length;
+            steps = MAX(1, budget_units / segment_units);
+
+            is_done = (1 == argon2d__fill_segments(&(job->argon2), (size_t)steps));
+            if (is_done) {
+                argon2d__finish(&(job->argon2), hash_result, SHA256_DIGEST_LENGTH_BYTES);
+
+                /* Give back the block memory as soon as it is no longer needed. */
+                free(job->argon2_memory);
+                job->argon2_memory = NULL;
+            }
+            break;
+        default:
+            if (0 != job->voucher->kdf.derive(job->voucher, job->salt, job->salt_length, job->work_factor, NULL, hash_result)) {
+                record_outcome(job->voucher, &(job->address), VBA_OUTCOME_ERROR);
+                job->status = -2;   /* Exception while calculating the address suffix. */
+                return job->status;
+            }
+            break;
+    }
+
+    /* The KDF time is the sum of the slices, not the wall time the job was open. */
+    job->kdf_elapsed_ns += metrics__now_ns() - started_ns;
+    if (!is_done) return VBA_VERIFY_PENDING;
+
+    metrics__record_kdf(job->voucher->algorithm_spec->type, job->work_factor, job->kdf_elapsed_ns);
+
+    finish_verify_job(job, hash_result);
+    return job->status;
+}
+
+
+void
+vba__verify_job_free(vba_verify_job_t *job)
+{
+    if (NULL == job) return;
+
+    vba__unpin_voucher(job->verifier_device);
+    free(job->argon2_memory);
+    free(job);
+}
+
+
+static void
+generate_batch_task(void *argument)
+{
+    generate_batch_task_t *task = (generate_batch_task_t *)argument;
+    pseudo_net_dev_t *net_device = task->net_device;
+    llid_t link_layer_id = net_device->link_layer_id;   /* An aligned copy; the device is packed. */
+
+    *(task->result) = (0 == calculate_address_suffix(task->address,
+                                                     task->voucher,
+                                                     &(net_device->subnet_prefixes[task->subnet_index]),
+                                                     &link_layer_id,
+                                                     task->work_factor,
+                                                     NULL)) ? 0 : -2;
+}
+
+
+int
+vba__generate_batch(pseudo_net_dev_t *net_device,
+                    vba_pool_t *pool,
+                    const vba_generate_request_t *requests,
+                    size_t count,
+                    vba_t *addresses,
+                    int *results)
+{
+    pool_group_t group;
+    generate_batch_task_t *tasks = NULL;
+    nd_link_voucher_option_t *voucher = NULL;
+    int status = 0;
+
+    if (NULL == net_device || NULL == requests || NULL == addresses || NULL == results) return -1;
+    if (0 == count) return 0;
+
+    /* The whole batch is generated under one voucher. */
+    voucher = vba__pin_voucher(net_device);
+    if (NULL == voucher) {
+        status = -1;
+        goto Label__generate_batch_Unpin;
+    }
+
+    /* Independent PBKDF2 chains under the same key run several to a core in SIMD lanes. */
+    if (VBA_PBKDF2_TYPE == voucher->algorithm_spec->type && pbkdf2_sha256_mb__lanes() > 1) {
+        status = generate_batch_multilane(net_device, voucher, pool, requests, count, addresses, results);
+        goto Label__generate_batch_Unpin;
+    }
+
+    tasks = (generate_batch_task_t *)calloc(count, sizeof(generate_batch_task_t));
+    if (NULL == tasks) {
+        status = -3;
+        goto Label__generate_batch_Unpin;
+    }
+
+    pool__group_init(&group);
+
+    for (size_t i = 0; i < count; ++i) {
+        tasks[i].net_device = net_device;
+        tasks[i].voucher = voucher;
+        tasks[i].subnet_index = requests[i].subnet_index;
+        tasks[i].work_factor = requests[i].work_factor;
+        tasks[i].address = &(addresses[i]);
+        tasks[i].result = &(results[i]);
+
+        memset(&(addresses[i]), 0x00, sizeof(vba_t));
+        if (requests[i].subnet_index + 1 > net_device->subnet_prefixes_count) {
+            results[i] = -7;
+            continue;
+        }
+
+        /* Prefix noise is drawn here on the submitting thread; only the KDF runs on the workers. */
+        prepare_address_prefix(&(addresses[i]), net_device, requests[i].subnet_index);
+
+        if (NULL == pool || 0 != pool__submit(pool, &group, generate_batch_task, &(tasks[i]))) {
+            generate_batch_task(&(tasks[i]));
+        }
+    }
+
+    pool__group_wait(pool, &group);
+
+    free(tasks);
+
+Label__generate_batch_Unpin:
+    vba__unpin_voucher(net_device);
+    return status;
+}
+
+
+static void
+verify_batch_task(void *argument)
+{
+    verify_batch_task_t *task = (verify_batch_task_t *)argument;
+
+    *(task->result) = verify_address(task->verifier_device,
+                                     task->voucher,
+                                     (ipv6_addr_t *)&(task->neighbor->address),
+                                     (llid_t *)&(task->neighbor->link_layer_id),
+                                     NULL);
+}
+
+
+int
+vba__verify_batch(pseudo_net_dev_t *verifier_device,
+                  vba_pool_t *pool,
+                  const vba_neighbor_t *neighbors,
+                  size_t count,
+                  int *results)
+{
+    pool_group_t group;
+    verify_batch_task_t *tasks = NULL;
+    nd_link_voucher_option_t *voucher = NULL;
+    int status = 0;
+
+    if (NULL == verifier_device || NULL == neighbors || NULL == results) return -1;
+    if (0 == count) return 0;
+
+    /* The whole batch is verified, and cached, under one voucher. */
+    voucher = vba__pin_voucher(verifier_device);
+    if (NULL == voucher) {
+        status = -1;
+        goto Label__verify_batch_Unpin;
+    }
+
+    if (VBA_PBKDF2_TYPE == voucher->algorithm_spec->type && pbkdf2_sha256_mb__lanes() > 1) {
+        status = verify_batch_multilane(verifier_device, voucher, pool, neighbors, count, results);
+        goto Label__verify_batch_Unpin;
+    }
+
+    tasks = (verify_batch_task_t *)calloc(count, sizeof(verify_batch_task_t));
+    if (NULL == tasks) {
+        status = -3;
+        goto Label__verify_batch_Unpin;
+    }
+
+    pool__group_init(&group);
+
+    /* One task per neighbor: per-item cost varies by orders of magnitude, so let the workers steal. */
+    for (size_t i = 0; i < count; ++i) {
+        tasks[i].verifier_device = verifier_device;
+        tasks[i].voucher = voucher;
+        tasks[i].neighbor = &(neighbors[i]);
+        tasks[i].result = &(results[i]);
+
+        if (NULL == pool || 0 != pool__submit(pool, &group, verify_batch_task, &(tasks[i]))) {
+            verify_batch_task(&(tasks[i]));
+        }
+    }
+
+    pool__group_wait(pool, &group);
+
+    free(tasks);
+
+Label__verify_batch_Unpin:
+    vba__unpin_voucher(verifier_device);
+    return status;
+}
+
+
+/*
+ * Run one chunk of PBKDF2 jobs in the kernel's lanes. A lane's output is only handed back with
+ *   the whole chunk, so every job in it is charged the chunk's time.
+ */
+static void
+multilane_task(void *argument)
+{
+    multilane_task_t *task = (multilane_task_t *)argument;
+    uint64_t started_ns = 0, elapsed_ns = 0;
+
+    for (size_t i = 0; i < task->count; ++i) {
+        trace__emit(VBA_TRACE_KDF_BEGIN,
+                    0,
+                    VBA_PBKDF2_TYPE,
+                    (uint16_t)(task->jobs[i].iterations / task->iterations_factor),
+                    task->jobs[i].salt_length,
+                    0);
+    }
+
+    started_ns = metrics__now_ns();
+    pbkdf2_sha256_mb__run(task->midstate, task->jobs, task->count);
+    elapsed_ns = metrics__now_ns() - started_ns;
+
+    for (size_t i = 0; i < task->count; ++i) {
+        uint16_t work_factor = (uint16_t)(task->jobs[i].iterations / task->iterations_factor);
+
+        trace__emit(VBA_TRACE_KDF_END,
+                    0,
+                    VBA_PBKDF2_TYPE,
+                    work_factor,
+                    task->jobs[i].salt_length,
+                    task->jobs[i].status);
+        if (0 == task->jobs[i].status) metrics__record_kdf(VBA_PBKDF2_TYPE, work_factor, elapsed_ns);
+    }
+}
+
+
+/* Split a voucher's PBKDF2 jobs into lane-friendly chunks and run them across the pool. */
+static int
+run_multilane_jobs(vba_pool_t *pool,
+                   const nd_link_voucher_option_t *voucher,
+                   pbkdf2_sha256_job_t *jobs,
+                   size_t count)
+{
+    pool_group_t group;
+    multilane_task_t *tasks = NULL;
+    size_t lanes = pbkdf2_sha256_mb__lanes();
+    size_t threads = MAX((size_t)1, pool__thread_count(pool));
+    size_t chunk = 0;
+    size_t task_count = 0;
+
+    if (0 == count) return 0;
+
+    /*
+     * Chunks are never narrower than the kernel, and are kept small enough that every worker
+     *   gets a share and retiring lanes have something to refill from.
+     */
+    chunk = MAX(lanes, MIN(lanes * 8, (count + threads - 1) / threads));
+    task_count = (count + chunk - 1) / chunk;
+
+    tasks = (multilane_task_t *)calloc(task_count, sizeof(multilane_task_t));
+    if (NULL == tasks) return -3;
+
+    pool__group_init(&group);
+
+    for (size_t i = 0; i < task_count; ++i) {
+        tasks[i].midstate = &(voucher->pbkdf2_midstate);
+        tasks[i].iterations_factor = voucher->kdf.pbkdf2_iterations_factor;
+        tasks[i].jobs = &(jobs[i * chunk]);
+        tasks[i].count = MIN(chunk, count - (i * chunk));
+
+        if (NULL == pool || 0 != pool__submit(pool, &group, multilane_task, &(tasks[i]))) {
+            multilane_task(&(tasks[i]));
+        }
+    }
+
+    pool__group_wait(pool, &group);
+
+    free(tasks);
     return 0;
 }
+
+
+static int
+generate_batch_multilane(pseudo_net_dev_t *net_device,
+                         nd_link_voucher_option_t *voucher,
+                         vba_pool_t *pool,
+                         const vba_generate_request_t *requests,
+                         size_t count,
+                         vba_t *addresses,
+                         int *results)
+{
+    llid_t link_layer_id = net_device->link_layer_id;   /* An aligned copy; the device is packed. */
+    multilane_item_t *items = NULL;
+    pbkdf2_sha256_job_t *jobs = NULL;
+    size_t job_count = 0;
+    int status = 0;
+
+    items = (multilane_item_t *)calloc(count, sizeof(multilane_item_t));
+    jobs = (pbkdf2_sha256_job_t *)calloc(count, sizeof(pbkdf2_sha256_job_t));
+    if (NULL == items || NULL == jobs) {
+        status = -3;
+        goto Label__generate_batch_multilane_Exit;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        memset(&(addresses[i]), 0x00, sizeof(vba_t));
+
+        if (requests[i].subnet_index + 1 > net_device->subnet_prefixes_count) {
+            results[i] = -7;
+            continue;
+        }
+
+        prepare_address_prefix(&(addresses[i]), net_device, requests[i].subnet_index);
+
+        /* Same rejections as `calculate_address_suffix`; the salt buffer only fits a full LLID. */
+        if (
+            0 == requests[i].work_factor
+            || link_layer_id.length > sizeof(link_layer_id.id)
+        ) {
+            results[i] = -2;
+            continue;
+        }
+
+        items[i].Z = ~(requests[i].work_factor ^ *((uint16_t *)(voucher->seed)));
+        items[i].needs_kdf = true;
+        items[i].job_index = job_count;
+
+        jobs[job_count].salt = items[i].salt;
+        jobs[job_count].salt_length = build_kdf_salt(&(addresses[i]), &link_layer_id, items[i].salt);
+        jobs[job_count].iterations = (uint32_t)requests[i].work_factor
+                                     * voucher->kdf.pbkdf2_iterations_factor;
+        jobs[job_count].output = items[i].hash_result;
+        job_count++;
+    }
+
+    status = run_multilane_jobs(pool, voucher, jobs, job_count);
+    if (0 != status) goto Label__generate_batch_multilane_Exit;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (false == items[i].needs_kdf) continue;
+
+        if (0 != jobs[items[i].job_index].status) {
+            results[i] = -2;
+            continue;
+        }
+
+        finish_address_suffix(&(addresses[i]), items[i].hash_result, items[i].Z);
+        results[i] = 0;
+    }
+
+Label__generate_batch_multilane_Exit:
+    free(jobs);
+    free(items);
+    return status;
+}
+
+
+static int
+verify_batch_multilane(pseudo_net_dev_t *verifier_device,
+                       nd_link_voucher_option_t *voucher,
+                       vba_pool_t *pool,
+                       const vba_neighbor_t *neighbors,
+                       size_t count,
+                       int *results)
+{
+    multilane_item_t *items = NULL;
+    pbkdf2_sha256_job_t *jobs = NULL;
+    size_t job_count = 0;
+    ipv6_addr_t expected;
+    int status = 0;
+
+    items = (multilane_item_t *)calloc(count, sizeof(multilane_item_t));
+    jobs = (pbkdf2_sha256_job_t *)calloc(count, sizeof(pbkdf2_sha256_job_t));
+    if (NULL == items || NULL == jobs) {
+        status = -3;
+        goto Label__verify_batch_multilane_Exit;
+    }
+
+    /* Same decisions, in the same order, as `verify_address`, but all the KDF work is collected up front. */
+    for (size_t i = 0; i < count; ++i) {
+        const ipv6_addr_t *ndar_ip = &(neighbors[i].address);
+        uint8_t cached_tag = 0;
+
+        items[i].work_factor = vba__extract_work_factor(voucher, ndar_ip);
+        trace__emit(VBA_TRACE_VERIFY_BEGIN, 0, VBA_PBKDF2_TYPE, items[i].work_factor, 0, 0);
+
+        items[i].needs_decision = true;
+
+        if ((ndar_ip->prefix_length * 8) > 64) {
+            record_outcome(voucher, ndar_ip, VBA_OUTCOME_REJECTED);
+            continue;
+        }
+
+        if (
+            0 == ncache__lookup(verifier_device->neighbor_cache,
+                                ndar_ip,
+                                &(neighbors[i].link_layer_id),
+                                voucher->voucher_id,
+                                &cached_tag)
+        ) {
+            items[i].is_cached = true;
+            items[i].is_verified = (VBA_TAG_SECURED == cached_tag);
+            record_outcome(voucher, ndar_ip, VBA_OUTCOME_CACHED);
+            continue;
+        }
+
+        if (negfilter__is_rejected(verifier_device->negative_filter, voucher, ndar_ip, &(neighbors[i].link_layer_id))) {
+            record_outcome(voucher, ndar_ip, VBA_OUTCOME_REJECTED);
+            continue;
+        }
+
+        items[i].needs_decision = false;
+
+        if (!admit_verification(verifier_device, voucher, ndar_ip, &(neighbors[i].link_layer_id))) {
+            record_outcome(voucher, ndar_ip, VBA_OUTCOME_REJECTED);
+            results[i] = render_rate_limited(verifier_device);
+            trace__emit(VBA_TRACE_VERIFY_END, 0, VBA_PBKDF2_TYPE, items[i].work_factor, 0, results[i]);
+            continue;
+        }
+
+        /* `calculate_address_suffix` refuses these, and the salt buffer only fits a full LLID. */
+        if (
+            0 == items[i].work_factor
+            || neighbors[i].link_layer_id.length > sizeof(neighbors[i].link_layer_id.id)
+        ) {
+            results[i] = -2;
+            record_outcome(voucher, ndar_ip, VBA_OUTCOME_ERROR);
+            trace__emit(VBA_TRACE_VERIFY_END, 0, VBA_PBKDF2_TYPE, items[i].work_factor, 0, results[i]);
+            continue;
+        }
+
+        items[i].needs_kdf = true;
+        items[i].job_index = job_count;
+
+        jobs[job_count].salt = items[i].salt;
+        jobs[job_count].salt_length = build_kdf_salt(ndar_ip, &(neighbors[i].link_layer_id), items[i].salt);
+        jobs[job_count].iterations = (uint32_t)items[i].work_factor
+                                     * voucher->kdf.pbkdf2_iterations_factor;
+        jobs[job_count].output = items[i].hash_result;
+        job_count++;
+    }
+
+    status = run_multilane_jobs(pool, voucher, jobs, job_count);
+    if (0 != status) goto Label__verify_batch_multilane_Exit;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (true == items[i].needs_kdf) {
+            if (0 != jobs[items[i].job_index].status) {
+                results[i] = -2;
+                record_outcome(voucher, &(neighbors[i].address), VBA_OUTCOME_ERROR);
+                trace__emit(VBA_TRACE_VERIFY_END, 0, VBA_PBKDF2_TYPE, items[i].work_factor, 0, results[i]);
+                continue;
+            }
+
+            /* Z round-trips through L unchanged, so the neighbor's own Z is the expected one. */
+            memcpy(&expected, &(neighbors[i].address), sizeof(ipv6_addr_t));
+            finish_address_suffix(&expected, items[i].hash_result, neighbors[i].address.suffix.Z);
+            items[i].is_verified = (0 == memcmp(&expected, &(neighbors[i].address), sizeof(ipv6_addr_t)));
+            items[i].needs_decision = true;
+            record_outcome(voucher,
+                           &(neighbors[i].address),
+                           (true == items[i].is_verified) ? VBA_OUTCOME_PASS : VBA_OUTCOME_FAIL);
+
+            if (false == items[i].is_verified) {
+                negfilter__record_failure(verifier_device->negative_filter,
+                                          voucher,
+                                          &(neighbors[i].address),
+                                          &(neighbors[i].link_layer_id));
+            }
+        }
+
+        if (true == items[i].needs_decision) {
+            results[i] = render_verification(verifier_device,
+                                             voucher,
+                                             (ipv6_addr_t *)&(neighbors[i].address),
+                                             (llid_t *)&(neighbors[i].link_layer_id),
+                                             items[i].is_cached,
+                                             items[i].is_verified);
+            trace__emit(VBA_TRACE_VERIFY_END,
+                        items[i].is_cached ? VBA_TRACE_FLAG_CACHE_HIT : 0,
+                        VBA_PBKDF2_TYPE,
+                        items[i].work_factor,
+                        0,
+                        results[i]);
+        }
+    }
+
+Label__verify_batch_multilane_Exit:
+    free(jobs);
+    free(items);
+    return status;
+}
+
+
+uint16_t
+vba__extract_work_factor(const nd_link_voucher_option_t *voucher,
+                         const ipv6_addr_t *ndar_ip)
+{
+    /* L = ~(Z ^ Seed[0..1]) */
+    return (uint16_t)~(ndar_ip->suffix.Z ^ *((uint16_t *)&(voucher->seed)));
+}
+
+
+int
+vba__estimate_cost(const nd_link_voucher_option_t *voucher,
+                   uint16_t work_factor,
+                   vba_kdf_cost_t *cost)
+{
+    uint64_t memory_blocks = 0;
+    uint64_t lanes = 0;
+    uint64_t scrypt_n = 0;
+    uint32_t scrypt_r = 0;
+    uint32_t scrypt_p = 0;
+
+    if (NULL == voucher || NULL == voucher->algorithm_spec || NULL == cost) return -1;
+
+    memset(cost, 0x00, sizeof(vba_kdf_cost_t));
+    if (0 == work_factor) return 0;   /* Rejected before any KDF work is done. */
+
+    switch (voucher->algorithm_spec->type) {
+        case VBA_PBKDF2_TYPE:
+            /* Two compressions per iteration. */
+            cost->cpu_units = 2 * COST_UNITS_PER_SHA256_BLOCK
+                              * (uint64_t)work_factor * voucher->kdf.pbkdf2_iterations_factor;
+            cost->memory_bytes = 0;
+            break;
+        case VBA_ARGON2_TYPE:
+            /* Mirror libargon2's rounding of MemorySize to whole segments. */
+            lanes = MAX(1, voucher->kdf.argon2_lanes);
+            memory_blocks = MAX((uint64_t)voucher->kdf.argon2_memory_blocks, 2 * ARGON2_SYNC_POINT_COUNT * lanes);
+            memory_blocks = (memory_blocks / (lanes * ARGON2_SYNC_POINT_COUNT)) * (lanes * ARGON2_SYNC_POINT_COUNT);
+
+            cost->cpu_units = COST_UNITS_PER_ARGON2_BLOCK * memory_blocks * ((work_factor >> 8) + 1);
+            cost->memory_bytes = memory_blocks * 1024;
+            break;
+        case VBA_SCRYPT_TYPE:
+            scrypt_parameters(voucher, work_factor, &scrypt_n, &scrypt_r, &scrypt_p);
+
+            /* ROMix does 2N BlockMix calls per lane, each of which runs 2r Salsa20/8 cores. */
+            cost->cpu_units = COST_UNITS_PER_SALSA_CORE * 4 * scrypt_n * scrypt_r * scrypt_p;
+            cost->memory_bytes = 128 * (uint64_t)scrypt_r * scrypt_n;
+            break;
+        default:
+            return -2;   /* Unknown KDF/algo type. */
+    }
+
+    return 0;
+}
+
+
+uint16_t
+vba__choose_work_factor(pseudo_net_dev_t *net_device,
+                        uint32_t target_ms)
+{
+    double target_ns = (double)target_ms * 1000000.0;
+    double predicted_ns = 0.0;
+    nd_link_voucher_option_t *voucher = NULL;
+    uint16_t chosen = 0;
+
+    if (NULL == net_device || NULL == net_device->kdf_calibration) return 0;
+
+    voucher = vba__pin_voucher(net_device);
+    if (NULL == voucher) goto Label__choose_work_factor_Unpin;
+
+    /*
+     * Scrypt packs N, r and p into separate bit fields of L, so cost is not monotonic in L and
+     *   a binary search would miss. There are only 64K candidates and each one is a few integer
+     *   operations, so just walk down from the top.
+     */
+    for (uint32_t work_factor = 0xFFFF; work_factor > 0; --work_factor) {
+        predicted_ns = calibrate__predict_ns(net_device->kdf_calibration, voucher, (uint16_t)work_factor);
+        if (predicted_ns < 0.0) break;   /* Not calibrated for this KDF. */
+
+        if (predicted_ns <= target_ns) {
+            chosen = (uint16_t)work_factor;
+            break;
+        }
+    }
+
+Label__choose_work_factor_Unpin:
+    vba__unpin_voucher(net_device);
+    return chosen;
+}
+
+
+void
+vba__print(vba_t *vba,
+           nd_link_voucher_option_t *voucher)
+{
+    printf("Prefix (/%u subnet): ", vba->prefix_length * 8);
+    for (int i = 0; i < VBA_PREFIX_LENGTH; ++i) {
+        printf("%02X", vba->prefix[i]);
+        if (i > 0 && i < (VBA_PREFIX_LENGTH - 1) && (i % 2)) printf(":");
+    }
+
+    printf(" //  Suffix: ");
+    for (int i = 0; i < VBA_PREFIX_LENGTH; ++i) {
+        printf("%02X", vba->suffix.raw[i]);
+        if (i > 0 && i < (VBA_PREFIX_LENGTH - 1) && (i % 2)) printf(":");
+    }
+
+    // printf(" //  Z: 0x"); for (int i = 0; i < 2; ++i) printf("%02X", ((uint8_t *)&(vba->suffix.Z))[i]);
+    printf(" //  Z: 0x%04X", vba->suffix.Z);
+    if (NULL != voucher) {
+        printf(" //  L: 0x%04X", (uint16_t)~(vba->suffix.Z ^ *((uint16_t *)(voucher->seed))));
+    }
+
+    printf(" //  H: 0x"); for (int i = 0; i < 6; ++i) printf("%02X", vba->suffix.H[i]);
+}
+
+
+
+/*
+ * Argon2 block memory is served from the calling thread's huge-page arena. The arena is sized by
+ *   the voucher's MemorySize on first use and then reused by every later KDF run on that thread,
+ *   so the pages are faulted in once instead of on every verification. It is never freed here.
+ *   Scratch memory lent through `ctx` is used instead when it is large enough.
+ */
+static argon2d_block_t *
+argon2_arena_allocate(const vba_ctx_t *ctx,
+                      size_t bytes_to_allocate)
+{
+    if (NULL != ctx && NULL != ctx->kdf_scratch && ctx->kdf_scratch_size >= bytes_to_allocate) {
+        return (argon2d_block_t *)ctx->kdf_scratch;
+    }
+
+    return (argon2d_block_t *)arena__acquire(bytes_to_allocate);
+}
+
+
+static
+int
+calculate_address_suffix(vba_t *vba,
+                         nd_link_voucher_option_t *voucher,
+                         subnet_t *subnet,
+                         llid_t *link_layer_id,
+                         uint16_t work_factor,
+                         const vba_ctx_t *ctx)
+{
+    uint8_t hash_result[SHA256_DIGEST_LENGTH_BYTES] = {0};
+    uint8_t salt[KDF_SALT_MAX_LENGTH] = {0};
+    uint16_t Z = 0;
+    int status = 0;
+    uint64_t started_ns = 0;
+
+    /* NOTE: The salt always uses the full 8 bytes of the prefix, even if the actual mask length is less. */
+    /*   This is because generating nodes can pad their prefixes with noise; that can be used no problem. */
+    size_t salt_length = 0;
+
+    if (
+        NULL == vba
+        || NULL == voucher
+        || NULL == subnet
+        || NULL == link_layer_id
+        || link_layer_id->length > sizeof(link_layer_id->id)
+        || 0 == work_factor
+    ) {
+        return -1;   /* Invalid parameter. */
+    }
+
+    if (NULL == voucher->kdf.derive) return -2;   /* The voucher was never accepted by the parser. */
+
+    /* Calculate Z. */
+    Z = ~(work_factor ^ *((uint16_t *)(voucher->seed)));
+
+    /* Construct the KDF salt. It is at most LLID + 11 bytes, so it always fits on the stack. */
+    salt_length = build_kdf_salt(vba, link_layer_id, salt);
+
+    /* The KDF and its parameters were resolved when the voucher was accepted. */
+    trace__emit(VBA_TRACE_KDF_BEGIN, 0, voucher->algorithm_spec->type, work_factor, salt_length, 0);
+    started_ns = metrics__now_ns();
+
+    status = voucher->kdf.derive(voucher, salt, salt_length, work_factor, ctx, hash_result);
+
+    trace__emit(VBA_TRACE_KDF_END, 0, voucher->algorithm_spec->type, work_factor, salt_length, status);
+    if (0 != status) return -3;
+
+    metrics__record_kdf(voucher->algorithm_spec->type, work_factor, metrics__now_ns() - started_ns);
+
+    finish_address_suffix(vba, hash_result, Z);
+
+    /* All done! */
+    return 0;
+}
+
+
+static
+int
+prepare_address_prefix(vba_t *vba,
+                       pseudo_net_dev_t *net_device,
+                       size_t subnet_index)
+{
+    vba->prefix_length = net_device->subnet_prefixes[subnet_index].length;
+    memcpy(vba->prefix, net_device->subnet_prefixes[subnet_index].prefix, sizeof(vba->prefix));
+
+    /* If the prefix length is less than 8 bytes, create some random noise. */
+    if (vba->prefix_length < VBA_PREFIX_LENGTH) {
+        Xoshiro128p__fill(&(vba->prefix[vba->prefix_length]), VBA_PREFIX_LENGTH - vba->prefix_length);
+    }
+
+    return 0;
+}
+
+
+static
+int
+verify_address_binding(nd_link_voucher_option_t *voucher,
+                       ipv6_addr_t *ndar_ip,
+                       llid_t *ndar_link_layer_id,
+                       bool *is_verified,
+                       const vba_ctx_t *ctx)
+{
+    int status = 0;
+    uint16_t extracted_work_factor = 0;
+    subnet_t addr_net = {0};
+    vba_t new_vba;
+
+    *is_verified = false;
+
+    /* Copy all the current VBA info into the new one, then clear the suffix. */
+    memcpy(&new_vba, (vba_t *)ndar_ip, sizeof(vba_t));
+    memset(new_vba.suffix.raw, 0x00, sizeof(new_vba.suffix.raw));
+
+    /* NOTE: Really should have just made VBA prefix info a subnet_t type, but alas. */
+    addr_net.length = new_vba.prefix_length,
+    memcpy(addr_net.prefix, new_vba.prefix, sizeof(new_vba.prefix));
+
+    /* First, extract the work factor component (L) from the NDAR IP address given by the neighbor. */
+    extracted_work_factor = vba__extract_work_factor(voucher, ndar_ip);
+
+    /* Now use these components to regenerate the address suffix. */
+    status = calculate_address_suffix(&new_vba,
+                                      voucher,
+                                      &addr_net,
+                                      ndar_link_layer_id,
+                                      extracted_work_factor,
+                                      ctx);
+    if (0 != status) {
+        return -2;   /* Exception while calculating the address suffix. */
+    }
+
+    /*
+     * If the two VBAs match -- that is, both the one we computed locally AND the one given
+     *   during NDP address resolution -- then the binding of the LLID to the IP address is
+     *   legitimate. When this verification function returns a SUCCESS, the NDP implementation
+     *   should continue caching and processing the communication with the neighbor. Otherwise,
+     *   the neighbor should be denied communications, depending on IEM.
+     */
+    *is_verified = (0 == memcmp(ndar_ip, &new_vba, sizeof(vba_t)));
+
+    return 0;
+}
+
+
+static
+size_t
+build_kdf_salt(const vba_t *vba,
+               const llid_t *link_layer_id,
+               uint8_t *salt)
+{
+    const char *vba_salt_string = VBA_SALT_STRING;
+
+    /* A full-width LLID (an Ethernet MAC) is the common case; give it a layout fixed at compile time. */
+    if (sizeof(link_layer_id->id) == link_layer_id->length) {
+        memcpy(salt, link_layer_id->id, sizeof(link_layer_id->id));
+        memcpy((salt + sizeof(link_layer_id->id)), vba_salt_string, VBA_SALT_STRING_LENGTH);
+        memcpy((salt + sizeof(link_layer_id->id) + VBA_SALT_STRING_LENGTH), vba->prefix, VBA_PREFIX_LENGTH);
+
+        return KDF_SALT_MAX_LENGTH;
+    }
+
+    memcpy(salt, link_layer_id->id, link_layer_id->length);
+    memcpy((salt + link_layer_id->length), vba_salt_string, VBA_SALT_STRING_LENGTH);
+    memcpy((salt + link_layer_id->length + VBA_SALT_STRING_LENGTH), vba->prefix, VBA_PREFIX_LENGTH);
+
+    return link_layer_id->length + VBA_SALT_STRING_LENGTH + VBA_PREFIX_LENGTH;
+}
+
+
+static
+void
+finish_address_suffix(vba_t *vba,
+                      const uint8_t *hash_result,
+                      uint16_t Z)
+{
+    /* Now that the H value is computed and placed, compute Z. */
+    memcpy(vba->suffix.raw, hash_result, VBA_SUFFIX_LENGTH);
+    memcpy(vba->suffix.raw, &Z, sizeof(uint16_t));
+}
+
+
+static
+int
+render_verification(pseudo_net_dev_t *verifier_device,
+                    const nd_link_voucher_option_t *voucher,
+                    ipv6_addr_t *ndar_ip,
+                    llid_t *ndar_link_layer_id,
+                    bool is_cached,
+                    bool is_verified)
+{
+    switch (verifier_device->iem) {
+        /* Neither AAD nor AGO regard verification results. */
+        case VBA_IEM_AAD:
+        case VBA_IEM_AGO:
+            return 0;
+        case VBA_IEM_AGVL:
+            /* Set the cache entry on the net device regardless of `is_verified`. */
+            /* If the verification succeeded, tag the cache entry as SECURED. */
+            /* If not, tag it as UNSECURED. */
+            if (false == is_cached) {
+                ncache__insert(verifier_device->neighbor_cache,
+                               ndar_ip,
+                               ndar_link_layer_id,
+                               voucher->voucher_id,
+                               (true == is_verified) ? VBA_TAG_SECURED : VBA_TAG_UNSECURED);
+            }
+            return 0;   /* AGVL should always succeed here because the entry is cached. */
+        case VBA_IEM_AGV:
+            /* In strict mode, the address either passes or fails verification. */
+            /* If the address is verified, make sure to cache it on the net device here. */
+            if (false == is_cached && true == is_verified) {
+                ncache__insert(verifier_device->neighbor_cache,
+                               ndar_ip,
+                               ndar_link_layer_id,
+                               voucher->voucher_id,
+                               VBA_TAG_SECURED);
+            }
+            return (true == is_verified) ? 0 : -5;   /* Either SUCCESS or a verification failure. */
+        default:
+            return -10;   /* Invalid IEM setting */
+    }
+}
+
+
+static
+uint32_t
+argon2_memory_size(const vba_algorithm_type_t *algo)
+{
+    const uint8_t *memory_size_scroll = algo->data.argon2d_spec.memory_size;
+    uint32_t memory_size = 0;
+
+    /* Really having a big think on this 24-bit big-endian value. */
+    for (int i = 0; i < 3; ++i) {
+        memory_size += (0xFF & *(memory_size_scroll + i)) << ((3-1-i) * 8);
+    }
+
+    return memory_size;
+}
+
+
+static
+void
+scrypt_parameters(const nd_link_voucher_option_t *voucher,
+                  uint16_t work_factor,
+                  uint64_t *N,
+                  uint32_t *r,
+                  uint32_t *p)
+{
+    *N = (uint64_t)MAX(1 << (MIN(SCRYPT_MAX_BASE_N_LOG2, MAX(1, ((work_factor & 0xFF00) >> 8) / 24))), 2) << voucher->kdf.scrypt_scaling_factor;
+    *r = MAX(1, (work_factor & 0x0F));
+    *p = MAX(1, (work_factor & 0xF0));
+}
+
+
+static
+void
+resolve_kdf(nd_link_voucher_option_t *voucher)
+{
+    const vba_algorithm_type_t *algo = voucher->algorithm_spec;
+
+    memset(&(voucher->kdf), 0x00, sizeof(vba_kdf_params_t));
+
+    switch (algo->type) {
+        case VBA_PBKDF2_TYPE:
+            voucher->kdf.derive = derive_pbkdf2;
+            voucher->kdf.pbkdf2_iterations_factor = MAX(1, algo->data.pbkdf2_spec.iterations_factor);
+            break;
+        case VBA_ARGON2_TYPE:
+            voucher->kdf.derive = derive_argon2;
+            voucher->kdf.argon2_memory_blocks = argon2_memory_size(algo);
+            voucher->kdf.argon2_lanes = algo->data.argon2d_spec.parallelism;
+            break;
+        case VBA_SCRYPT_TYPE:
+            voucher->kdf.derive = derive_scrypt;
+            voucher->kdf.scrypt_scaling_factor = MIN(5, algo->data.scrypt_spec.scaling_factor);
+            break;
+        default:
+            break;   /* Leaves `derive` NULL; the parser rejects unknown types anyway. */
+    }
+}
+
+
+static
+int
+derive_pbkdf2(const nd_link_voucher_option_t *voucher,
+              const uint8_t *salt,
+              size_t salt_length,
+              uint16_t work_factor,
+              const vba_ctx_t *ctx,
+              uint8_t *hash_result)
+{
+    if (
+        0 != pbkdf2_sha256__from_midstate(&(voucher->pbkdf2_midstate),
+                                          salt,
+                                          salt_length,
+                                          (uint32_t)work_factor * voucher->kdf.pbkdf2_iterations_factor,
+                                          hash_result,
+                                          SHA256_DIGEST_LENGTH_BYTES)
+    ) {
+        fprintf(stderr, "The PBKDF2 KDF failed!\n");
+        return -3;
+    }
+
+    return 0;
+}
+
+
+/* The blocks an Argon2 derivation under the voucher fills, or 0 if its parameters are refused. */
+static
+size_t
+argon2_block_count(const nd_link_voucher_option_t *voucher)
+{
+    uint32_t lanes = voucher->kdf.argon2_lanes;
+
+    /* libargon2 refused a MemorySize under 8 KiB per lane rather than rounding it up; so do we. */
+    if (voucher->kdf.argon2_memory_blocks < 2 * ARGON2_SYNC_POINT_COUNT * lanes) return 0;
+
+    return argon2d__memory_blocks(voucher->kdf.argon2_memory_blocks, lanes);
+}
+
+
+static
+int
+derive_argon2(const nd_link_voucher_option_t *voucher,
+              const uint8_t *salt,
+              size_t salt_length,
+              uint16_t work_factor,
+              const vba_ctx_t *ctx,
+              uint8_t *hash_result)
+{
+    argon2d_state_t argon2;
+    argon2d_block_t *memory = NULL;
+    uint32_t lanes = voucher->kdf.argon2_lanes;
+    size_t memory_blocks = argon2_block_count(voucher);
+
+    if (0 == memory_blocks) goto Label__derive_argon2_Fail;
+
+    memory = argon2_arena_allocate(ctx, memory_blocks * sizeof(argon2d_block_t));
+    if (NULL == memory) goto Label__derive_argon2_Fail;
+
+    if (
+        0 != argon2d__begin(&argon2,
+                            memory,
+                            voucher->seed,
+                            VBA_SEED_LENGTH,
+                            salt,
+                            salt_length,
+                            (work_factor >> 8) + 1,
+                            voucher->kdf.argon2_memory_blocks,
+                            lanes,
+                            SHA256_DIGEST_LENGTH_BYTES)
+    ) {
+        goto Label__derive_argon2_Fail;
+    }
+
+    /* Lanes above 1 are filled alongside the persistent lane crew, not by per-pass threads. */
+    argon2_lanes__fill(&argon2);
+    argon2d__finish(&argon2, hash_result, SHA256_DIGEST_LENGTH_BYTES);
+
+    return 0;
+
+Label__derive_argon2_Fail:
+    fprintf(stderr, "The Argon2 KDF failed!\n");
+    return -3;
+}
+
+
+static
+int
+derive_scrypt(const nd_link_voucher_option_t *voucher,
+              const uint8_t *salt,
+              size_t salt_length,
+              uint16_t work_factor,
+              const vba_ctx_t *ctx,
+              uint8_t *hash_result)
+{
+    uint64_t scrypt_n = 0;
+    uint32_t scrypt_r = 0;
+    uint32_t scrypt_p = 0;
+
+    scrypt_parameters(voucher, work_factor, &scrypt_n, &scrypt_r, &scrypt_p);
+
+    if (
+        0 != scrypt__derive(&(voucher->pbkdf2_midstate),
+                            salt,
+                            salt_length,
+                            scrypt_n,
+                            scrypt_r,
+                            scrypt_p,
+                            (uint64_t)1 << (SCRYPT_MAX_BASE_N_LOG2 + voucher->kdf.scrypt_scaling_factor),
+                            (NULL == ctx) ? NULL : ctx->net_device->kdf_pool,
+                            hash_result,
+                            SHA256_DIGEST_LENGTH_BYTES)
+    ) {
+        fprintf(stderr, "The Scrypt KDF failed!\n");
+        return -3;
+    }
+
+    return 0;
+}
+
+
+static
+int
+verify_address(pseudo_net_dev_t *verifier_device,
+               nd_link_voucher_option_t *voucher,
+               ipv6_addr_t *ndar_ip,
+               llid_t *ndar_link_layer_id,
+               const vba_ctx_t *ctx)
+{
+    int status = 0;
+    bool is_verified = false;
+    bool is_cached = false;
+    uint8_t cached_tag = 0;
+    vba_outcome_t outcome = VBA_OUTCOME_REJECTED;
+    uint16_t kdf_type = 0;
+    uint16_t claimed_work_factor = 0;
+    vba_ctx_t device_ctx;
+
+    /*
+     * `voucher` is the caller's pinned snapshot of the active voucher. Everything below, the cache
+     *   entry included, goes by it alone, so a voucher published meanwhile never gets a binding
+     *   which was only checked under the previous one.
+     */
+    if (
+        NULL == verifier_device
+        || NULL == voucher
+        || NULL == ndar_ip
+        || NULL == ndar_link_layer_id
+    ) {
+        return -1;   /* Invalid input parameter. */
+    }
+
+    /* Without a caller's context, the KDF still gets the device's pool. */
+    if (NULL == ctx) {
+        vba_ctx__init(&device_ctx, verifier_device, NULL, 0);
+        ctx = &device_ctx;
+    }
+
+    kdf_type = voucher_kdf_type(voucher);
+    if (0 != kdf_type) claimed_work_factor = vba__extract_work_factor(voucher, ndar_ip);
+    trace__emit(VBA_TRACE_VERIFY_BEGIN, 0, kdf_type, claimed_work_factor, 0, 0);
+
+    /*
+     * VBAs cannot use subnets smaller than /64 (8 bytes).
+     *   If the indicated subnet is smaller, it can't be a VBA.
+     */
+    if ((ndar_ip->prefix_length * 8) > 64) goto Label__verify_address_RenderDecision;
+
+    /*
+     * A neighbor which has already been through verification under this voucher does not need
+     *   another trip through the KDF. The cached tag IS the verification result.
+     */
+    if (
+        0 == ncache__lookup(verifier_device->neighbor_cache,
+                            ndar_ip,
+                            ndar_link_layer_id,
+                            voucher->voucher_id,
+                            &cached_tag)
+    ) {
+        is_cached = true;
+        is_verified = (VBA_TAG_SECURED == cached_tag);
+        outcome = VBA_OUTCOME_CACHED;
+        goto Label__verify_address_RenderDecision;
+    }
+
+    /* A binding which already failed under this voucher (or never could pass) costs no KDF run. */
+    if (
+        negfilter__is_rejected(verifier_device->negative_filter,
+                               voucher,
+                               ndar_ip,
+                               ndar_link_layer_id)
+    ) {
+        goto Label__verify_address_RenderDecision;
+    }
+
+    /* Charge the neighbor for the KDF run before it happens. */
+    if (!admit_verification(verifier_device, voucher, ndar_ip, ndar_link_layer_id)) {
+        record_outcome(voucher, ndar_ip, VBA_OUTCOME_REJECTED);
+        status = render_rate_limited(verifier_device);
+        goto Label__verify_address_Trace;
+    }
+
+    status = verify_address_binding(voucher,
+                                    ndar_ip,
+                                    ndar_link_layer_id,
+                                    &is_verified,
+                                    ctx);
+    if (0 != status) {
+        record_outcome(voucher, ndar_ip, VBA_OUTCOME_ERROR);
+        status = -2;   /* Exception while calculating the address suffix. */
+        goto Label__verify_address_Trace;
+    }
+
+    outcome = (true == is_verified) ? VBA_OUTCOME_PASS : VBA_OUTCOME_FAIL;
+
+    if (false == is_verified) {
+        negfilter__record_failure(verifier_device->negative_filter,
+                                  voucher,
+                                  ndar_ip,
+                                  ndar_link_layer_id);
+    }
+
+Label__verify_address_RenderDecision:
+    record_outcome(voucher, ndar_ip, outcome);
+    status = render_verification(verifier_device, voucher, ndar_ip, ndar_link_layer_id, is_cached, is_verified);
+
+Label__verify_address_Trace:
+    trace__emit(VBA_TRACE_VERIFY_END,
+                is_cached ? VBA_TRACE_FLAG_CACHE_HIT : 0,
+                kdf_type,
+                claimed_work_factor,
+                0,
+                status);
+    return status;
+}
+
+
+static
+int
+generate_address(pseudo_net_dev_t *net_device,
+                 nd_link_voucher_option_t *voucher,
+                 size_t subnet_index,
+                 uint16_t work_factor,
+                 vba_t *vba,
+                 const vba_ctx_t *ctx)
+{
+    uint16_t kdf_type = voucher_kdf_type(voucher);
+    llid_t link_layer_id = net_device->link_layer_id;   /* An aligned copy; the device is packed. */
+    vba_ctx_t device_ctx;
+    int status = 0;
+
+    trace__emit(VBA_TRACE_GENERATE_BEGIN, 0, kdf_type, work_factor, 0, 0);
+
+    if (NULL == ctx) {
+        vba_ctx__init(&device_ctx, net_device, NULL, 0);
+        ctx = &device_ctx;
+    }
+
+    if (subnet_index + 1 > net_device->subnet_prefixes_count) {
+        status = -7;
+        goto Label__generate_address_Trace;
+    }
+
+    /* Copy in prefix information to the VBA. */
+    memset(vba, 0x00, sizeof(vba_t));
+    prepare_address_prefix(vba, net_device, subnet_index);
+
+    if (
+        0 != calculate_address_suffix(vba,
+                                      voucher,
+                                      &(net_device->subnet_prefixes[subnet_index]),
+                                      &link_layer_id,
+                                      work_factor,
+                                      ctx)
+    ) {
+        status = -2;   /* Exception while calculating the address suffix. */
+    }
+
+Label__generate_address_Trace:
+    trace__emit(VBA_TRACE_GENERATE_END, 0, kdf_type, work_factor, 0, status);
+    return status;
+}
+
+
+static
+int
+parse_link_voucher(const uint8_t *input,
+                   nd_link_voucher_option_t *voucher,
+                   vba_algorithm_type_t *algo)
+{
+    if (VBA_LINK_VOUCHER_TYPE != input[0]) return -2;
+    if (input[1] < 6) return -3;   /* vouchers should be a minimum of 48 bytes in length */
+
+    /* Options are not aligned in the packet, so multi-byte fields are copied rather than cast. */
+    voucher->type = VBA_LINK_VOUCHER_TYPE;
+    voucher->length = input[1];
+    voucher->expiration = (input[VBA_LINK_VOUCHER_OFFSET_EXPIRATION] << 8) | input[VBA_LINK_VOUCHER_OFFSET_EXPIRATION + 1];
+    memcpy(&(voucher->timestamp), &input[VBA_LINK_VOUCHER_OFFSET_TIMESTAMP], sizeof(uint64_t));
+    memcpy(&(voucher->voucher_id), &input[VBA_LINK_VOUCHER_OFFSET_ID], sizeof(uint32_t));
+    memcpy(&(voucher->seed), &input[VBA_LINK_VOUCHER_OFFSET_SEED], VBA_SEED_LENGTH);
+
+    algo->type   = (input[40] << 8) | input[41];
+    algo->length = (input[42] << 8) | input[43];
+    switch (algo->type) {
+        case VBA_PBKDF2_TYPE:
+            memcpy(&(algo->data), &input[44], sizeof(uint32_t));
+
+            /* The seed is the HMAC key for the voucher's whole lifetime, so key it exactly once. */
+            hmac_sha256__prekey(&(voucher->pbkdf2_midstate), voucher->seed, VBA_SEED_LENGTH);
+            break;
+        case VBA_SCRYPT_TYPE:
+            memcpy(&(algo->data), &input[44], sizeof(uint32_t));
+            ndopt__normalize_algorithm(algo);
+
+            /* Scrypt's two PBKDF2 steps are keyed by the seed as well. */
+            hmac_sha256__prekey(&(voucher->pbkdf2_midstate), voucher->seed, VBA_SEED_LENGTH);
+            break;
+        case VBA_ARGON2_TYPE:
+            memcpy(&(algo->data), &input[44], sizeof(uint32_t));
+            ndopt__normalize_algorithm(algo);
+            break;
+        default: return -3;
+    }
+
+    voucher->algorithm_spec = algo;
+    resolve_kdf(voucher);
+
+    return 0;
+}
+
+
+/* Decide under the job's own voucher, even if the device has rotated to another one since. */
+static
+void
+decide_verify_job(vba_verify_job_t *job,
+                  bool is_cached,
+                  bool is_verified)
+{
+    job->status = render_verification(job->verifier_device,
+                                      job->voucher,
+                                      &(job->address),
+                                      &(job->link_layer_id),
+                                      is_cached,
+                                      is_verified);
+}
+
+
+static
+void
+finish_verify_job(vba_verify_job_t *job,
+                  const uint8_t *hash_result)
+{
+    uint16_t Z = ~(job->work_factor ^ *((uint16_t *)(job->voucher->seed)));
+    bool is_verified = false;
+
+    finish_address_suffix(&(job->expected), hash_result, Z);
+    is_verified = (0 == memcmp(&(job->address), &(job->expected), sizeof(vba_t)));
+
+    if (false == is_verified) {
+        negfilter__record_failure(job->verifier_device->negative_filter,
+                                  job->voucher,
+                                  &(job->address),
+                                  &(job->link_layer_id));
+    }
+
+    record_outcome(job->voucher, &(job->address), (true == is_verified) ? VBA_OUTCOME_PASS : VBA_OUTCOME_FAIL);
+    decide_verify_job(job, false, is_verified);
+}
+
+
+/* The cost is what the neighbor's own Z claims, so a higher L is charged for exactly what it costs. */
+static
+bool
+admit_verification(pseudo_net_dev_t *verifier_device,
+                   const nd_link_voucher_option_t *voucher,
+                   const ipv6_addr_t *ndar_ip,
+                   const llid_t *ndar_link_layer_id)
+{
+    vba_kdf_cost_t cost = {0};
+
+    if (NULL == verifier_device->rate_limiter) return true;
+
+    /* Nothing to charge for what the KDF will refuse anyway. */
+    if (0 != vba__estimate_cost(voucher, vba__extract_work_factor(voucher, ndar_ip), &cost)) return true;
+
+    return ratelimit__admit(verifier_device->rate_limiter, ndar_ip, ndar_link_layer_id, cost.cpu_units);
+}
+
+
+static
+int
+render_rate_limited(pseudo_net_dev_t *verifier_device)
+{
+    switch (verifier_device->iem) {
+        /* Neither AAD nor AGO regard verification results, so there is nothing to lose. */
+        case VBA_IEM_AAD:
+        case VBA_IEM_AGO:
+            return 0;
+        case VBA_IEM_AGVL:
+            /* Deferred: admitted like an UNSECURED neighbor, but not cached, so it is verified later. */
+            return 0;
+        case VBA_IEM_AGV:
+            return -18;   /* Dropped: over its verification budget. */
+        default:
+            return -10;   /* Invalid IEM setting */
+    }
+}
+
+
+static
+uint16_t
+voucher_kdf_type(const nd_link_voucher_option_t *voucher)
+{
+    return (NULL == voucher || NULL == voucher->algorithm_spec) ? 0 : voucher->algorithm_spec->type;
+}
+
+
+static
+void
+record_outcome(const nd_link_voucher_option_t *voucher,
+               const ipv6_addr_t *ndar_ip,
+               vba_outcome_t outcome)
+{
+    if (0 == voucher_kdf_type(voucher)) return;
+
+    metrics__record_outcome(voucher->algorithm_spec->type, vba__extract_work_factor(voucher, ndar_ip), outcome);
+}
@@ -4,6 +4,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "sha256.h"
+
 
 
 #define VBA_LINK_VOUCHER_TYPE       63
@@ -20,6 +22,8 @@
 #define VBA_TAG_SECURED             2
 #define VBA_TAG_UNSECURED           1
 
+#define VBA_VERIFY_PENDING          1   /* Returned by `vba__verify_resume` while KDF work remains. */
+
 
 #define MAX_PSEUDO_ADDRESSES        16
 #define MAX_PSEDUO_SUBNETS          16
@@ -105,22 +109,58 @@ enum {
     VBA_ALGO_SCRYPT
 } vba_kdf_t;
 
+struct nd_link_voucher_option;
+struct vba_ctx;
+
+/**
+ * A voucher's KDF, run with all of its parameters except the work factor already decoded.
+ *   `ctx` lends the caller's KDF scratch memory and its device's `kdf_pool`; with a NULL `ctx`
+ *   the KDF works in the calling thread's arena, on the calling thread alone. Always writes a
+ *   32-byte result. Returns 0 on success.
+ */
+typedef int (*vba_kdf_derive_fn)(
+    const struct nd_link_voucher_option *voucher,
+    const uint8_t                       *salt,
+    size_t                              salt_length,
+    uint16_t                            work_factor,
+    const struct vba_ctx                *ctx,
+    uint8_t                             *hash_result
+);
+
 /**
- * The parsed structure of an NDP LV option.
+ * KDF parameters decoded once, when a voucher is accepted, so that address generation and
+ *   verification never re-parse the algorithm object.
  */
 typedef
 struct {
-    uint8_t                 type;
-    uint8_t                 length;
-    uint16_t                expiration;
-    uint8_t                 __reserved[8];
-    uint64_t                timestamp;
-    uint32_t                voucher_id;
-    uint8_t                 seed[VBA_SEED_LENGTH];
-    vba_algorithm_type_t    *algorithm_spec;
-    void                    *der_structure;   /* This is not used in this sample. */
-    uint8_t                 __padding[8];
-} __attribute__((packed)) nd_link_voucher_option_t;
+    vba_kdf_derive_fn   derive;
+    uint32_t            pbkdf2_iterations_factor;   /* At least 1. */
+    uint32_t            argon2_memory_blocks;   /* The 24-bit MemorySize as a host integer. */
+    uint32_t            argon2_lanes;
+    uint32_t            scrypt_scaling_factor;   /* At most 5. */
+} vba_kdf_params_t;
+
+/**
+ * The parsed structure of an NDP LV option. The option's own fields keep their packed layout;
+ *   the state decoded from them when the voucher is accepted sits after them, naturally aligned.
+ */
+typedef
+struct nd_link_voucher_option {
+    struct {
+        uint8_t                 type;
+        uint8_t                 length;
+        uint16_t                expiration;
+        uint8_t                 __reserved[8];
+        uint64_t                timestamp;
+        uint32_t                voucher_id;
+        uint8_t                 seed[VBA_SEED_LENGTH];
+        vba_algorithm_type_t    *algorithm_spec;
+        void                    *der_structure;   /* This is not used in this sample. */
+        uint8_t                 __padding[8];
+    } __attribute__((packed));
+    hmac_sha256_midstate_t  pbkdf2_midstate;   /* Keyed by the seed when a PBKDF2 or Scrypt voucher is accepted. */
+    vba_kdf_params_t        kdf;   /* Resolved when the voucher is accepted. */
+} nd_link_voucher_option_t;
 
 
 /**
@@ -138,20 +178,123 @@ struct {
     size_t  length;
 } llid_t;
 
+/**
+ * Opaque cache of neighbor bindings which have already been through verification (see ncache.h).
+ */
+typedef struct neighbor_cache neighbor_cache_t;
+
+/**
+ * Opaque filter of recent verification failures (see negfilter.h).
+ */
+typedef struct negative_filter negative_filter_t;
+
+/**
+ * Opaque per-neighbor verification budgets (see ratelimit.h).
+ */
+typedef struct rate_limiter rate_limiter_t;
+
+/**
+ * Opaque persistent work-stealing thread pool used by the batch APIs (see pool.h).
+ */
+typedef struct vba_pool vba_pool_t;
+
+/**
+ * Opaque per-host KDF latency model used to pick work factors (see calibrate.h).
+ */
+typedef struct vba_calibration vba_calibration_t;
+
+/**
+ * Opaque resumable verification (see `vba__verify_begin`).
+ */
+typedef struct vba_verify_job vba_verify_job_t;
+
 /**
  * A pseudo network interface to use for generating VBAs.
+ *
+ * `active_voucher` is the one field which may change while other threads use the device. It is
+ *   kept naturally aligned inside the packed struct so that it can be swapped in one atomic store
+ *   (see `vba__publish_voucher`), and every call pins the voucher it read for as long as it uses it.
  */
 typedef
 struct {
     interface_enforcement_mode_t    iem;
-    nd_link_voucher_option_t        *active_voucher;
+    nd_link_voucher_option_t        *active_voucher __attribute__((aligned(8)));
+    nd_link_voucher_option_t        *pending_voucher;   /* Optional; the next voucher, while it is being rotated in. */
     llid_t                          link_layer_id;
     subnet_t                        *subnet_prefixes;
     size_t                          subnet_prefixes_count;
     vba_t                           *address_pool;
     size_t                          address_count;
+    neighbor_cache_t                *neighbor_cache;   /* Optional; verification results are cached when set. */
+    negative_filter_t               *negative_filter;   /* Optional; repeated forgeries skip the KDF when set. */
+    rate_limiter_t                  *rate_limiter;   /* Optional; KDF runs are charged to the neighbor when set. */
+    const vba_calibration_t         *kdf_calibration;   /* Optional; needed by `vba__choose_work_factor`. */
+    vba_pool_t                      *kdf_pool;   /* Optional; the p lanes of one Scrypt run are spread over it when set. */
+    uint32_t                        voucher_pins __attribute__((aligned(4)));   /* See `vba__pin_voucher`. Keep last. */
 } __attribute__((packed)) pseudo_net_dev_t;
 
+/**
+ * Completion callback for asynchronous verification. `status` is 0 when the binding was
+ *   verified (the cache entry is now SECURED) or negative when it was evicted.
+ */
+typedef void (*vba_verify_callback_t)(
+    pseudo_net_dev_t    *verifier_device,
+    const ipv6_addr_t   *ndar_ip,
+    const llid_t        *ndar_link_layer_id,
+    int                 status,
+    void                *context
+);
+
+/**
+ * Estimated cost of one KDF run, as derived from the voucher and a work factor.
+ *   `cpu_units` is relative work in units of one SHA-256 block compression.
+ */
+typedef
+struct {
+    uint64_t    cpu_units;
+    uint64_t    memory_bytes;
+} vba_kdf_cost_t;
+
+/**
+ * Caller-owned state for the allocation-free generate/verify path. `kdf_scratch` is optional
+ *   memory for the KDF working set (see `vba__kdf_scratch_size`); when it is NULL or too small,
+ *   the calling thread's arena is used instead. A context may only be used by one thread at a time.
+ */
+typedef
+struct vba_ctx {
+    pseudo_net_dev_t    *net_device;
+    void                *kdf_scratch;
+    size_t              kdf_scratch_size;
+} vba_ctx_t;
+
+/**
+ * Caller-owned storage for a parsed voucher. `voucher.algorithm_spec` points into the same object,
+ *   so the storage must not be moved or copied once it has been parsed into.
+ */
+typedef
+struct {
+    nd_link_voucher_option_t    voucher;
+    vba_algorithm_type_t        algorithm;
+} vba_voucher_storage_t;
+
+/**
+ * One neighbor binding to verify as part of a batch.
+ */
+typedef
+struct {
+    ipv6_addr_t address;
+    llid_t      link_layer_id;
+} vba_neighbor_t;
+
+/**
+ * One address to generate as part of a batch.
+ */
+typedef
+struct {
+    size_t      subnet_index;
+    uint16_t    work_factor;
+} vba_generate_request_t;
+
 
 
 /**
@@ -164,6 +307,63 @@ ndopt__process_link_voucher(
     nd_link_voucher_option_t    **new_voucher
 );
 
+/**
+ * Process raw input data into caller-owned voucher storage, without allocating.
+ */
+int
+ndopt__process_link_voucher_into(
+    void                        *input_data,
+    pseudo_net_dev_t            *net_device,
+    vba_voucher_storage_t       *storage
+);
+
+/**
+ * Read the device's active voucher once, atomically. Code which may run while the voucher is
+ *   replaced takes one snapshot through here and uses it throughout.
+ */
+nd_link_voucher_option_t *
+vba__active_voucher(
+    const pseudo_net_dev_t      *net_device
+);
+
+/**
+ * Replace the device's active voucher with one atomic store, while other threads may be using
+ *   the device. Returns the previous voucher, which calls already running may still be using:
+ *   it may only be freed once `vba__voucher_pins` has been seen at 0 after this returns.
+ */
+nd_link_voucher_option_t *
+vba__publish_voucher(
+    pseudo_net_dev_t            *net_device,
+    nd_link_voucher_option_t    *voucher
+);
+
+/**
+ * Take a snapshot of the device's active voucher and pin it: a voucher replaced after this is not
+ *   freed (see `vba__publish_voucher`) until the matching `vba__unpin_voucher`. Every `vba__*`
+ *   call pins the voucher it works under for its whole length; asynchronous and resumable
+ *   verifications hold their pin until they finish.
+ */
+nd_link_voucher_option_t *
+vba__pin_voucher(
+    pseudo_net_dev_t            *net_device
+);
+
+/**
+ * Drop a pin taken with `vba__pin_voucher`.
+ */
+void
+vba__unpin_voucher(
+    pseudo_net_dev_t            *net_device
+);
+
+/**
+ * The amount of pins currently held on the device's vouchers.
+ */
+uint32_t
+vba__voucher_pins(
+    const pseudo_net_dev_t      *net_device
+);
+
 /**
  * Generate a new VBA object and return it.
  */
@@ -177,6 +377,9 @@ vba__generate(
 
 /**
  * Verify an input VBA based on the currently-stored Voucher information.
+ *
+ * With a rate limiter on the device, a neighbor over its budget gets no KDF run. AGV drops it
+ *   with -18; AGVL admits it without caching it, so that it is verified once it has budget again.
  */
 int
 vba__verify(
@@ -185,6 +388,163 @@ vba__verify(
     llid_t                      *ndar_link_layer_id
 );
 
+/**
+ * Prepare a context for `vba__generate_ctx` and `vba__verify_ctx`. Scratch memory is optional.
+ */
+int
+vba_ctx__init(
+    vba_ctx_t                   *ctx,
+    pseudo_net_dev_t            *net_device,
+    void                        *kdf_scratch,
+    size_t                      kdf_scratch_size
+);
+
+/**
+ * The amount of KDF scratch memory a context needs for the voucher to never touch the arena.
+ *   This is 0 for KDFs which cannot use caller scratch.
+ */
+size_t
+vba__kdf_scratch_size(
+    const nd_link_voucher_option_t  *voucher
+);
+
+/**
+ * Generate a VBA into a caller-provided address. Nothing is allocated on the heap.
+ */
+int
+vba__generate_ctx(
+    vba_ctx_t                   *ctx,
+    size_t                      subnet_index,
+    uint16_t                    work_factor,
+    vba_t                       *address
+);
+
+/**
+ * Same as `vba__verify`, using the context's device and scratch memory.
+ */
+int
+vba__verify_ctx(
+    vba_ctx_t                   *ctx,
+    ipv6_addr_t                 *ndar_ip,
+    llid_t                      *ndar_link_layer_id
+);
+
+/**
+ * Asynchronous AGVL verification. The neighbor is admitted to the device's neighbor cache as
+ *   UNSECURED immediately and the KDF is queued on the pool; when it completes the entry is
+ *   upgraded to SECURED or evicted, and `callback` is invoked from the worker thread.
+ *
+ * Neighbors already in the cache are not queued again and get no callback. A neighbor over its
+ *   rate limit is neither admitted nor queued (-18). The device must outlive any verification
+ *   still in flight; each one pins the voucher it was queued under until it completes.
+ */
+int
+vba__verify_async(
+    pseudo_net_dev_t            *verifier_device,
+    vba_pool_t                  *pool,
+    ipv6_addr_t                 *ndar_ip,
+    llid_t                      *ndar_link_layer_id,
+    vba_verify_callback_t       callback,
+    void                        *context
+);
+
+/**
+ * Start a verification which can be run a slice at a time, for callers such as a single-threaded
+ *   event loop which cannot block for a whole KDF run. The cheap checks (prefix length, neighbor
+ *   cache, negative filter) happen right here; the KDF happens in `vba__verify_resume`.
+ *
+ * The job keeps its own copy of the address and LLID and pins the device's current active voucher
+ *   until it is freed, so the device must outlive the job. Argon2 block memory belongs to the job,
+ *   so other KDF runs on the same thread may happen between slices.
+ */
+int
+vba__verify_begin(
+    pseudo_net_dev_t            *verifier_device,
+    const ipv6_addr_t           *ndar_ip,
+    const llid_t                *ndar_link_layer_id,
+    vba_verify_job_t            **job
+);
+
+/**
+ * Run about `budget_units` of KDF work (in the units of `vba__estimate_cost`; at least one
+ *   PBKDF2 iteration or Argon2 segment). Returns VBA_VERIFY_PENDING while work remains, and
+ *   after that the same status `vba__verify` would have returned, on every later call too.
+ *
+ * PBKDF2 stops between iterations and Argon2 between segments. Scrypt cannot be split and runs
+ *   whole in the first slice.
+ */
+int
+vba__verify_resume(
+    vba_verify_job_t            *job,
+    uint64_t                    budget_units
+);
+
+/**
+ * Release a job, finished or not.
+ */
+void
+vba__verify_job_free(
+    vba_verify_job_t            *job
+);
+
+/**
+ * Generate many VBAs at once across the pool. Each request's status is written to `results`
+ *   (with the same meaning as `vba__generate`) and each address to the matching slot in `addresses`.
+ *   A NULL pool runs the whole batch on the calling thread.
+ */
+int
+vba__generate_batch(
+    pseudo_net_dev_t                *net_device,
+    vba_pool_t                      *pool,
+    const vba_generate_request_t    *requests,
+    size_t                          count,
+    vba_t                           *addresses,
+    int                             *results
+);
+
+/**
+ * Verify many neighbor bindings at once across the pool. Each binding's status is written to
+ *   `results` with the same meaning as `vba__verify`. A NULL pool runs the batch on the calling thread.
+ */
+int
+vba__verify_batch(
+    pseudo_net_dev_t            *verifier_device,
+    vba_pool_t                  *pool,
+    const vba_neighbor_t        *neighbors,
+    size_t                      count,
+    int                         *results
+);
+
+/**
+ * Recover the work factor (L) a neighbor's address claims, without doing any KDF work.
+ */
+uint16_t
+vba__extract_work_factor(
+    const nd_link_voucher_option_t  *voucher,
+    const ipv6_addr_t               *ndar_ip
+);
+
+/**
+ * Estimate how much CPU and memory one KDF run would take for the voucher and work factor.
+ */
+int
+vba__estimate_cost(
+    const nd_link_voucher_option_t  *voucher,
+    uint16_t                        work_factor,
+    vba_kdf_cost_t                  *cost
+);
+
+/**
+ * Pick the largest work factor whose predicted generation time under the device's active voucher
+ *   fits within `target_ms`, according to the device's KDF calibration. Returns 0 when the device
+ *   is not calibrated for that KDF or when not even the cheapest work factor fits.
+ */
+uint16_t
+vba__choose_work_factor(
+    pseudo_net_dev_t            *net_device,
+    uint32_t                    target_ms
+);
+
 /**
  * Print the contents of a VBA.
  */
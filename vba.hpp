@@ -0,0 +1,237 @@
+#ifndef LIB_VBA_HPP
+#define LIB_VBA_HPP
+
+/*
+ * Thin C++ wrapper over the allocation-free VBA API. Vouchers and devices are move-only handles
+ *   which own their C objects; each keeps its C object at a fixed address for its whole life,
+ *   because the library holds raw pointers into them (a device's active voucher, pool tasks).
+ */
+
+#include "vba.h"
+#include "ncache.h"
+
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#define VBA_HAVE_COROUTINES 1
+#endif
+
+
+
+namespace vba {
+
+
+class Voucher {
+public:
+    Voucher() = default;
+
+    Voucher(const Voucher &) = delete;
+    Voucher &operator=(const Voucher &) = delete;
+    Voucher(Voucher &&) noexcept = default;
+    Voucher &operator=(Voucher &&) noexcept = default;
+
+    /** Parse a raw LV option. Returns 0 and fills `out` on success, or the parser's status. */
+    static int parse(const void *raw_option, Voucher &out)
+    {
+        std::unique_ptr<vba_voucher_storage_t> storage(new vba_voucher_storage_t());
+        int status = ndopt__process_link_voucher_into(const_cast<void *>(raw_option), nullptr, storage.get());
+
+        if (0 == status) out.storage_ = std::move(storage);
+        return status;
+    }
+
+    bool valid() const { return nullptr != storage_; }
+
+    nd_link_voucher_option_t *get() const { return valid() ? &(storage_->voucher) : nullptr; }
+
+    size_t kdf_scratch_size() const { return vba__kdf_scratch_size(get()); }
+
+private:
+    std::unique_ptr<vba_voucher_storage_t> storage_;
+};
+
+
+class Device {
+public:
+    Device() : state_(new State()) {}
+
+    Device(const Device &) = delete;
+    Device &operator=(const Device &) = delete;
+    Device(Device &&) noexcept = default;
+    Device &operator=(Device &&) noexcept = default;
+
+    /** Set the device's LLID; at most `sizeof(llid_t::id)` bytes are used. */
+    void set_link_layer_id(const uint8_t *id, size_t length)
+    {
+        length = MIN(length, sizeof(state_->device.link_layer_id.id));
+        std::memcpy(state_->device.link_layer_id.id, id, length);
+        state_->device.link_layer_id.length = length;
+    }
+
+    void set_enforcement_mode(interface_enforcement_mode_t iem) { state_->device.iem = iem; }
+
+    /** Add a subnet prefix; `length` is in bytes, as everywhere else in the library. */
+    size_t add_subnet(const uint8_t *prefix, size_t length)
+    {
+        subnet_t subnet = {};
+
+        std::memcpy(subnet.prefix, prefix, MIN(length, sizeof(subnet.prefix)));
+        subnet.length = length;
+
+        state_->subnets.push_back(subnet);
+        state_->device.subnet_prefixes = state_->subnets.data();
+        state_->device.subnet_prefixes_count = state_->subnets.size();
+
+        return state_->subnets.size() - 1;
+    }
+
+    /** The voucher is borrowed, not owned; it must outlive its use by this device. */
+    void set_voucher(const Voucher &voucher)
+    {
+        state_->device.active_voucher = voucher.get();
+
+        /* Size the scratch once so the KDF never needs to touch the arena or the heap. */
+        state_->scratch.resize(voucher.kdf_scratch_size());
+        vba_ctx__init(&(state_->ctx), &(state_->device), state_->scratch.data(), state_->scratch.size());
+    }
+
+    /** Attach a neighbor cache owned by this device. Returns false if it cannot be created. */
+    bool enable_neighbor_cache(size_t capacity = VBA_NCACHE_DEFAULT_CAPACITY)
+    {
+        state_->cache.reset(ncache__create(capacity));
+        state_->device.neighbor_cache = state_->cache.get();
+
+        return nullptr != state_->cache;
+    }
+
+    int generate(size_t subnet_index, uint16_t work_factor, vba_t &address)
+    {
+        return vba__generate_ctx(&(state_->ctx), subnet_index, work_factor, &address);
+    }
+
+    int verify(const ipv6_addr_t &address, const llid_t &link_layer_id)
+    {
+        /* The C API takes mutable pointers for historical reasons; it never writes through them. */
+        return vba__verify_ctx(&(state_->ctx),
+                               const_cast<ipv6_addr_t *>(&address),
+                               const_cast<llid_t *>(&link_layer_id));
+    }
+
+    pseudo_net_dev_t *get() const { return &(state_->device); }
+
+private:
+    struct CacheDeleter {
+        void operator()(neighbor_cache_t *cache) const { ncache__destroy(cache); }
+    };
+
+    struct State {
+        State() : device(), ctx()
+        {
+            vba_ctx__init(&ctx, &device, nullptr, 0);
+        }
+
+        pseudo_net_dev_t device;
+        vba_ctx_t ctx;
+        std::vector<subnet_t> subnets;
+        std::vector<uint8_t> scratch;
+        std::unique_ptr<neighbor_cache_t, CacheDeleter> cache;
+    };
+
+    std::unique_ptr<State> state_;
+};
+
+
+#ifdef VBA_HAVE_COROUTINES
+
+/*
+ * A verification as a C++20 coroutine which suspends after every slice of KDF work. Whoever owns
+ *   the task (typically an event loop, between other events) calls `resume()` until it returns
+ *   false, then reads `status()`. Nothing runs on other threads. Destroying an unfinished task
+ *   abandons its verification.
+ */
+class VerifyTask {
+public:
+    struct promise_type {
+        int status = VBA_VERIFY_PENDING;
+
+        VerifyTask get_return_object() { return VerifyTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(int value) { status = value; }
+        void unhandled_exception() { status = -2; }
+    };
+
+    VerifyTask(const VerifyTask &) = delete;
+    VerifyTask &operator=(const VerifyTask &) = delete;
+
+    VerifyTask(VerifyTask &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+    VerifyTask &operator=(VerifyTask &&other) noexcept
+    {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    ~VerifyTask()
+    {
+        if (handle_) handle_.destroy();
+    }
+
+    bool done() const { return !handle_ || handle_.done(); }
+
+    /** Run the next slice. Returns true while there is more to do. */
+    bool resume()
+    {
+        if (!done()) handle_.resume();
+        return !done();
+    }
+
+    /** The result, as `vba__verify` would return it, once `done()`; VBA_VERIFY_PENDING before. */
+    int status() const { return handle_ ? handle_.promise().status : -1; }
+
+private:
+    explicit VerifyTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+
+/**
+ * Verify a neighbor on `device` in slices of about `slice_units` (see `vba__verify_resume`). The
+ *   cheap checks and the first slice run before this returns; the address and LLID are copied.
+ */
+inline VerifyTask verify_sliced(pseudo_net_dev_t *device, ipv6_addr_t address, llid_t link_layer_id, uint64_t slice_units)
+{
+    struct JobDeleter {
+        void operator()(vba_verify_job_t *job) const { vba__verify_job_free(job); }
+    };
+
+    vba_verify_job_t *raw_job = nullptr;
+    int status = vba__verify_begin(device, &address, &link_layer_id, &raw_job);
+
+    if (0 != status) co_return status;
+
+    std::unique_ptr<vba_verify_job_t, JobDeleter> job(raw_job);
+
+    while (VBA_VERIFY_PENDING == (status = vba__verify_resume(job.get(), slice_units))) {
+        co_await std::suspend_always{};
+    }
+
+    co_return status;
+}
+
+#endif   /* VBA_HAVE_COROUTINES */
+
+
+}   /* namespace vba */
+
+
+
+#endif   /* LIB_VBA_HPP */